@@ -0,0 +1,113 @@
+#ifndef QJS_BENCH_H
+#define QJS_BENCH_H
+
+#include <inttypes.h>
+#include <js.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <uv.h>
+
+/**
+ * Each benchmark reports one JSON object per line on stdout, such that the
+ * output of several runs, or of the same benchmarks built against the V8
+ * backed libjs, can be compared mechanically. The benchmarks only use the
+ * libjs ABI; the engine name is provided by the build, as is the heap
+ * allocation counter if the engine has one. The counter only covers
+ * allocations made by the JavaScript heap of the engine, not native
+ * allocations made by the binding itself, such as those of handle scopes or
+ * callback state. Heap allocations are reported as -1 for env creation and
+ * for engines without a counter.
+ */
+
+#ifndef BENCH_ENGINE
+#define BENCH_ENGINE "unknown"
+#endif
+
+#ifdef BENCH_HAS_HEAP_ALLOCATIONS
+uint64_t
+bench_get_heap_allocations (js_env_t *env);
+#endif
+
+typedef struct {
+  uv_loop_t *loop;
+  js_platform_t *platform;
+  js_env_t *env;
+  js_handle_scope_t *scope;
+
+  const char *name;
+  uint64_t iterations;
+  uint64_t start;
+  uint64_t heap_allocations;
+} bench_t;
+
+static const uint64_t bench_batch_len = 1024;
+
+static inline void
+bench_setup (bench_t *bench) {
+  int e;
+
+  bench->loop = uv_default_loop();
+
+  e = js_create_platform(bench->loop, NULL, &bench->platform);
+  if (e != 0) abort();
+
+  e = js_create_env(bench->loop, bench->platform, NULL, &bench->env);
+  if (e != 0) abort();
+
+  e = js_open_handle_scope(bench->env, &bench->scope);
+  if (e != 0) abort();
+}
+
+static inline void
+bench_teardown (bench_t *bench) {
+  int e;
+
+  e = js_close_handle_scope(bench->env, bench->scope);
+  if (e != 0) abort();
+
+  e = js_destroy_env(bench->env);
+  if (e != 0) abort();
+
+  e = js_destroy_platform(bench->platform);
+  if (e != 0) abort();
+
+  e = uv_run(bench->loop, UV_RUN_DEFAULT);
+  if (e != 0) abort();
+}
+
+static inline void
+bench_start (bench_t *bench, const char *name, uint64_t iterations) {
+  bench->name = name;
+  bench->iterations = iterations;
+#ifdef BENCH_HAS_HEAP_ALLOCATIONS
+  bench->heap_allocations = bench->env ? bench_get_heap_allocations(bench->env) : 0;
+#else
+  bench->heap_allocations = 0;
+#endif
+  bench->start = uv_hrtime();
+}
+
+static inline void
+bench_end (bench_t *bench) {
+  uint64_t elapsed = uv_hrtime() - bench->start;
+
+  double heap_allocations = -1;
+
+#ifdef BENCH_HAS_HEAP_ALLOCATIONS
+  if (bench->env) {
+    heap_allocations = (double) (bench_get_heap_allocations(bench->env) - bench->heap_allocations) / bench->iterations;
+  }
+#endif
+
+  printf(
+    "{\"benchmark\":\"%s\",\"engine\":\"%s\",\"iterations\":%" PRIu64 ",\"ns_per_op\":%.2f,\"heap_allocations_per_op\":%.2f}\n",
+    bench->name,
+    BENCH_ENGINE,
+    bench->iterations,
+    (double) elapsed / bench->iterations,
+    heap_allocations
+  );
+}
+
+#endif // QJS_BENCH_H
@@ -0,0 +1,54 @@
+#include <js.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+int
+main () {
+  int e;
+
+  bench_t bench;
+  bench_setup(&bench);
+
+  js_env_t *env = bench.env;
+
+  const char *code = "(a) => a";
+
+  js_value_t *script;
+  e = js_create_string_utf8(env, (utf8_t *) code, strlen(code), &script);
+  if (e != 0) abort();
+
+  js_value_t *fn;
+  e = js_run_script(env, NULL, 0, 0, script, &fn);
+  if (e != 0) abort();
+
+  js_value_t *global;
+  e = js_get_global(env, &global);
+  if (e != 0) abort();
+
+  js_value_t *argv[1];
+  e = js_create_uint32(env, 42, &argv[0]);
+  if (e != 0) abort();
+
+  bench_start(&bench, "call-function", 1 << 20);
+
+  for (uint64_t i = 0; i < bench.iterations; i += bench_batch_len) {
+    js_handle_scope_t *scope;
+    e = js_open_handle_scope(env, &scope);
+    if (e != 0) abort();
+
+    for (uint64_t j = 0; j < bench_batch_len; j++) {
+      js_value_t *result;
+      e = js_call_function(env, global, fn, 1, argv, &result);
+      if (e != 0) abort();
+    }
+
+    e = js_close_handle_scope(env, scope);
+    if (e != 0) abort();
+  }
+
+  bench_end(&bench);
+
+  bench_teardown(&bench);
+}
@@ -0,0 +1,36 @@
+#include <js.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+int
+main () {
+  int e;
+
+  bench_t bench;
+
+  bench.loop = uv_default_loop();
+  bench.env = NULL;
+
+  e = js_create_platform(bench.loop, NULL, &bench.platform);
+  if (e != 0) abort();
+
+  bench_start(&bench, "env-creation", 1000);
+
+  for (uint64_t i = 0; i < bench.iterations; i++) {
+    js_env_t *env;
+    e = js_create_env(bench.loop, bench.platform, NULL, &env);
+    if (e != 0) abort();
+
+    e = js_destroy_env(env);
+    if (e != 0) abort();
+  }
+
+  bench_end(&bench);
+
+  e = js_destroy_platform(bench.platform);
+  if (e != 0) abort();
+
+  e = uv_run(bench.loop, UV_RUN_DEFAULT);
+  if (e != 0) abort();
+}
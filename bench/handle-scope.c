@@ -0,0 +1,33 @@
+#include <js.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+int
+main () {
+  int e;
+
+  bench_t bench;
+  bench_setup(&bench);
+
+  js_env_t *env = bench.env;
+
+  bench_start(&bench, "handle-scope", 1000000);
+
+  for (uint64_t i = 0; i < bench.iterations; i++) {
+    js_handle_scope_t *scope;
+    e = js_open_handle_scope(env, &scope);
+    if (e != 0) abort();
+
+    js_value_t *value;
+    e = js_create_uint32(env, (uint32_t) i, &value);
+    if (e != 0) abort();
+
+    e = js_close_handle_scope(env, scope);
+    if (e != 0) abort();
+  }
+
+  bench_end(&bench);
+
+  bench_teardown(&bench);
+}
@@ -0,0 +1,15 @@
+#include <js.h>
+#include <qjs.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+uint64_t
+bench_get_heap_allocations (js_env_t *env) {
+  int e;
+
+  js_runtime_statistics_t statistics = {.version = 0};
+  e = js_get_runtime_statistics(env, &statistics);
+  if (e != 0) abort();
+
+  return statistics.allocations;
+}
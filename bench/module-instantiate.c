@@ -0,0 +1,46 @@
+#include <js.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+static js_module_t *
+on_resolve (js_env_t *env, js_value_t *specifier, js_value_t *assertions, js_module_t *referrer, void *data) {
+  abort();
+
+  return NULL;
+}
+
+int
+main () {
+  int e;
+
+  bench_t bench;
+  bench_setup(&bench);
+
+  js_env_t *env = bench.env;
+
+  const char *code = "export default function foo () { return 42 }";
+
+  js_value_t *source;
+  e = js_create_string_utf8(env, (utf8_t *) code, strlen(code), &source);
+  if (e != 0) abort();
+
+  bench_start(&bench, "module-instantiate", 10000);
+
+  for (uint64_t i = 0; i < bench.iterations; i++) {
+    js_module_t *module;
+    e = js_create_module(env, "test.js", -1, 0, source, NULL, NULL, &module);
+    if (e != 0) abort();
+
+    e = js_instantiate_module(env, module, on_resolve, NULL);
+    if (e != 0) abort();
+
+    e = js_delete_module(env, module);
+    if (e != 0) abort();
+  }
+
+  bench_end(&bench);
+
+  bench_teardown(&bench);
+}
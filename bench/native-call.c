@@ -0,0 +1,55 @@
+#include <js.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+static js_value_t *
+on_call (js_env_t *env, js_callback_info_t *info) {
+  int e;
+
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  e = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (e != 0) abort();
+
+  return argv[0];
+}
+
+int
+main () {
+  int e;
+
+  bench_t bench;
+  bench_setup(&bench);
+
+  js_env_t *env = bench.env;
+
+  js_value_t *fn;
+  e = js_create_function(env, "fn", -1, on_call, NULL, &fn);
+  if (e != 0) abort();
+
+  js_value_t *global;
+  e = js_get_global(env, &global);
+  if (e != 0) abort();
+
+  e = js_set_named_property(env, global, "fn", fn);
+  if (e != 0) abort();
+
+  const char *code = "for (let i = 0; i < 1000000; i++) fn(i)";
+
+  js_value_t *script;
+  e = js_create_string_utf8(env, (utf8_t *) code, strlen(code), &script);
+  if (e != 0) abort();
+
+  bench_start(&bench, "native-call", 1000000);
+
+  js_value_t *result;
+  e = js_run_script(env, NULL, 0, 0, script, &result);
+  if (e != 0) abort();
+
+  bench_end(&bench);
+
+  bench_teardown(&bench);
+}
@@ -0,0 +1,52 @@
+#include <js.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+int
+main () {
+  int e;
+
+  bench_t bench;
+  bench_setup(&bench);
+
+  js_env_t *env = bench.env;
+
+  js_value_t *object;
+  e = js_create_object(env, &object);
+  if (e != 0) abort();
+
+  js_value_t *value;
+  e = js_create_uint32(env, 42, &value);
+  if (e != 0) abort();
+
+  bench_start(&bench, "property-set", 1 << 20);
+
+  for (uint64_t i = 0; i < bench.iterations; i++) {
+    e = js_set_named_property(env, object, "foo", value);
+    if (e != 0) abort();
+  }
+
+  bench_end(&bench);
+
+  bench_start(&bench, "property-get", 1 << 20);
+
+  for (uint64_t i = 0; i < bench.iterations; i += bench_batch_len) {
+    js_handle_scope_t *scope;
+    e = js_open_handle_scope(env, &scope);
+    if (e != 0) abort();
+
+    for (uint64_t j = 0; j < bench_batch_len; j++) {
+      js_value_t *result;
+      e = js_get_named_property(env, object, "foo", &result);
+      if (e != 0) abort();
+    }
+
+    e = js_close_handle_scope(env, scope);
+    if (e != 0) abort();
+  }
+
+  bench_end(&bench);
+
+  bench_teardown(&bench);
+}
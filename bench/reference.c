@@ -0,0 +1,53 @@
+#include <js.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+int
+main () {
+  int e;
+
+  bench_t bench;
+  bench_setup(&bench);
+
+  js_env_t *env = bench.env;
+
+  js_value_t *object;
+  e = js_create_object(env, &object);
+  if (e != 0) abort();
+
+  bench_start(&bench, "reference-create-delete", 1000000);
+
+  for (uint64_t i = 0; i < bench.iterations; i++) {
+    js_ref_t *reference;
+    e = js_create_reference(env, object, 1, &reference);
+    if (e != 0) abort();
+
+    e = js_delete_reference(env, reference);
+    if (e != 0) abort();
+  }
+
+  bench_end(&bench);
+
+  js_ref_t *reference;
+  e = js_create_reference(env, object, 1, &reference);
+  if (e != 0) abort();
+
+  bench_start(&bench, "reference-ref-unref", 1000000);
+
+  for (uint64_t i = 0; i < bench.iterations; i++) {
+    uint32_t count;
+    e = js_reference_unref(env, reference, &count);
+    if (e != 0) abort();
+
+    e = js_reference_ref(env, reference, &count);
+    if (e != 0) abort();
+  }
+
+  bench_end(&bench);
+
+  e = js_delete_reference(env, reference);
+  if (e != 0) abort();
+
+  bench_teardown(&bench);
+}
@@ -0,0 +1,56 @@
+#include <js.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+int
+main () {
+  int e;
+
+  bench_t bench;
+  bench_setup(&bench);
+
+  js_env_t *env = bench.env;
+
+  const char *str = "The quick brown fox jumps over the lazy dog";
+
+  size_t len = strlen(str);
+
+  bench_start(&bench, "string-create", 1 << 20);
+
+  for (uint64_t i = 0; i < bench.iterations; i += bench_batch_len) {
+    js_handle_scope_t *scope;
+    e = js_open_handle_scope(env, &scope);
+    if (e != 0) abort();
+
+    for (uint64_t j = 0; j < bench_batch_len; j++) {
+      js_value_t *value;
+      e = js_create_string_utf8(env, (utf8_t *) str, len, &value);
+      if (e != 0) abort();
+    }
+
+    e = js_close_handle_scope(env, scope);
+    if (e != 0) abort();
+  }
+
+  bench_end(&bench);
+
+  js_value_t *value;
+  e = js_create_string_utf8(env, (utf8_t *) str, len, &value);
+  if (e != 0) abort();
+
+  utf8_t buf[64];
+
+  bench_start(&bench, "string-get", 1 << 20);
+
+  for (uint64_t i = 0; i < bench.iterations; i++) {
+    size_t written;
+    e = js_get_value_string_utf8(env, value, buf, sizeof(buf), &written);
+    if (e != 0) abort();
+  }
+
+  bench_end(&bench);
+
+  bench_teardown(&bench);
+}
@@ -0,0 +1,35 @@
+#include <js.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+int
+main () {
+  int e;
+
+  bench_t bench;
+  bench_setup(&bench);
+
+  js_env_t *env = bench.env;
+
+  js_value_t *arraybuffer;
+  e = js_create_arraybuffer(env, 1024, NULL, &arraybuffer);
+  if (e != 0) abort();
+
+  js_value_t *typedarray;
+  e = js_create_typedarray(env, js_uint8array, 512, arraybuffer, 256, &typedarray);
+  if (e != 0) abort();
+
+  bench_start(&bench, "typedarray-info", 1000000);
+
+  for (uint64_t i = 0; i < bench.iterations; i++) {
+    void *data;
+    size_t len;
+    e = js_get_typedarray_info(env, typedarray, NULL, &data, &len, NULL, NULL);
+    if (e != 0) abort();
+  }
+
+  bench_end(&bench);
+
+  bench_teardown(&bench);
+}
@@ -0,0 +1,57 @@
+#include <js.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+int
+main () {
+  int e;
+
+  bench_t bench;
+  bench_setup(&bench);
+
+  js_env_t *env = bench.env;
+
+  int data = 42;
+
+  bench_start(&bench, "wrap", 1 << 17);
+
+  for (uint64_t i = 0; i < bench.iterations; i += bench_batch_len) {
+    js_handle_scope_t *scope;
+    e = js_open_handle_scope(env, &scope);
+    if (e != 0) abort();
+
+    for (uint64_t j = 0; j < bench_batch_len; j++) {
+      js_value_t *object;
+      e = js_create_object(env, &object);
+      if (e != 0) abort();
+
+      e = js_wrap(env, object, &data, NULL, NULL, NULL);
+      if (e != 0) abort();
+    }
+
+    e = js_close_handle_scope(env, scope);
+    if (e != 0) abort();
+  }
+
+  bench_end(&bench);
+
+  js_value_t *object;
+  e = js_create_object(env, &object);
+  if (e != 0) abort();
+
+  e = js_wrap(env, object, &data, NULL, NULL, NULL);
+  if (e != 0) abort();
+
+  bench_start(&bench, "unwrap", 1000000);
+
+  for (uint64_t i = 0; i < bench.iterations; i++) {
+    void *result;
+    e = js_unwrap(env, object, &result);
+    if (e != 0) abort();
+  }
+
+  bench_end(&bench);
+
+  bench_teardown(&bench);
+}
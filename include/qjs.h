@@ -0,0 +1,482 @@
+#ifndef QJS_H
+#define QJS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <js.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Extensions to the libjs ABI that are specific to the QuickJS backend.
+ */
+
+typedef struct js_script_s js_script_t;
+typedef struct js_allocator_s js_allocator_t;
+typedef struct js_key_s js_key_t;
+typedef struct js_property_iterator_s js_property_iterator_t;
+typedef struct js_runtime_statistics_s js_runtime_statistics_t;
+
+typedef enum {
+  js_microtask_policy_auto = 0,
+  js_microtask_policy_explicit = 1,
+  js_microtask_policy_deferred = 2,
+} js_microtask_policy_t;
+
+typedef enum {
+  js_string_encoding_latin1 = 1,
+  js_string_encoding_utf16le = 2,
+} js_string_encoding_t;
+
+typedef enum {
+  js_mapping_readonly = 1,
+  js_mapping_private = 1 << 1,
+} js_mapping_flags_t;
+
+typedef enum {
+  js_mapping_advice_normal = 0,
+  js_mapping_advice_sequential = 1,
+  js_mapping_advice_random = 2,
+  js_mapping_advice_willneed = 3,
+} js_mapping_advice_t;
+
+typedef enum {
+  js_trace_function_call = 1,
+  js_trace_module_instantiation = 2,
+  js_trace_microtask_drain = 3,
+} js_trace_event_t;
+
+typedef enum {
+  js_trace_begin = 0,
+  js_trace_end = 1,
+} js_trace_phase_t;
+
+typedef void (*js_trace_cb)(js_env_t *env, js_trace_event_t event, js_trace_phase_t phase, void *data);
+
+typedef void *(*js_allocate_cb)(size_t size, void *data);
+typedef void *(*js_reallocate_cb)(void *ptr, size_t size, void *data);
+typedef void (*js_deallocate_cb)(void *ptr, void *data);
+
+struct js_allocator_s {
+  js_allocate_cb allocate;
+  js_reallocate_cb reallocate;
+  js_deallocate_cb deallocate;
+  void *data;
+};
+
+struct js_runtime_statistics_s {
+  int version;
+
+  // QuickJS heap, as reported by `JS_ComputeMemoryUsage()`
+  int64_t malloc_size;
+  int64_t malloc_limit;
+  int64_t malloc_count;
+  int64_t memory_used_size;
+  int64_t memory_used_count;
+  int64_t atom_count;
+  int64_t atom_size;
+  int64_t string_count;
+  int64_t string_size;
+  int64_t object_count;
+  int64_t object_size;
+  int64_t property_count;
+  int64_t property_size;
+  int64_t shape_count;
+  int64_t shape_size;
+  int64_t function_count;
+  int64_t function_size;
+  int64_t bytecode_size;
+  int64_t native_function_count;
+  int64_t array_count;
+  int64_t fast_array_count;
+  int64_t fast_array_elements;
+  int64_t binary_object_count;
+  int64_t binary_object_size;
+
+  // Cumulative number of allocations made by the heap since its creation
+  uint64_t allocations;
+
+  // Memory held outside of the heap
+  int64_t external_memory;
+  int64_t mapped_memory;
+
+  // Handle scopes and the handles open in them
+  size_t handle_scope_depth;
+  size_t peak_handle_scope_depth;
+  size_t handles;
+  size_t peak_handles;
+
+  // Garbage collection, with the time given in nanoseconds
+  uint64_t gc_count;
+  uint64_t gc_time;
+
+  // Microtask queue drains and the jobs run by them
+  uint64_t microtask_drains;
+  uint64_t microtasks;
+
+  // The script cache shared by the envs of the platform, with its size given
+  // in bytes
+  size_t script_cache_size;
+  uint64_t script_cache_hits;
+};
+
+/**
+ * Serialize the bytecode of a module that has been instantiated, but not yet
+ * run, into a code cache. The cache is tagged with a hash of the module name
+ * and source as well as the engine version and is allocated with `malloc()`.
+ * The caller must release it with `free()`.
+ */
+int
+js_create_module_cache (js_env_t *env, js_module_t *module, uint8_t **result, size_t *len);
+
+/**
+ * Create a module from a code cache previously produced by
+ * `js_create_module_cache()`. If the cache was produced for a different name,
+ * source, or engine version, it is rejected and the module is instead compiled
+ * from source when instantiated. If `rejected` is not `NULL` it is set to
+ * indicate whether the cache was rejected.
+ */
+int
+js_create_module_with_cache (js_env_t *env, const char *name, size_t len, int offset, js_value_t *source, const uint8_t *cache, size_t cache_len, js_module_meta_cb cb, void *data, bool *rejected, js_module_t **result);
+
+/**
+ * Compile a script without running it. The compiled script may be run any
+ * number of times with `js_run_compiled_script()` and must be released with
+ * `js_delete_script()`.
+ */
+int
+js_create_script (js_env_t *env, const char *file, size_t len, int offset, js_value_t *source, js_script_t **result);
+
+/**
+ * Compile a script from a code cache previously produced by
+ * `js_create_script_cache()`, falling back to compiling the source if the
+ * cache is rejected. If `rejected` is not `NULL` it is set to indicate whether
+ * the cache was rejected.
+ */
+int
+js_create_script_with_cache (js_env_t *env, const char *file, size_t len, int offset, js_value_t *source, const uint8_t *cache, size_t cache_len, bool *rejected, js_script_t **result);
+
+/**
+ * Serialize the bytecode of a compiled script into a code cache allocated
+ * with `malloc()`. The caller must release it with `free()`.
+ */
+int
+js_create_script_cache (js_env_t *env, js_script_t *script, uint8_t **result, size_t *len);
+
+int
+js_delete_script (js_env_t *env, js_script_t *script);
+
+int
+js_run_compiled_script (js_env_t *env, js_script_t *script, js_value_t **result);
+
+/**
+ * Set the size limit, in bytes, of the in-process cache of compiled scripts
+ * shared by all envs created from the platform. The cache is keyed by file
+ * name and source hash and consulted by both `js_run_script()` and
+ * `js_create_script()`. A limit of 0, the default, disables the cache.
+ */
+int
+js_set_platform_script_cache_limit (js_platform_t *platform, size_t limit);
+
+/**
+ * Set the allocator backing the heaps of runtimes subsequently created by the
+ * platform, which may be called from any thread that runs an env. Each runtime
+ * serves small allocations from size-classed slabs obtained from the
+ * allocator and passes larger allocations straight through. Passing `NULL`
+ * restores the default allocator, which uses `malloc()` and friends.
+ */
+int
+js_set_platform_allocator (js_platform_t *platform, const js_allocator_t *allocator);
+
+/**
+ * Set the maximum number of runtimes that the platform keeps around for reuse
+ * once their envs are destroyed. Reusing a runtime skips its setup and the
+ * registration of the native classes, but a runtime is only ever handed back
+ * to envs created on the thread that created it and only pooled if nothing
+ * allocated by its previous env outlived it. A limit of 0, the default,
+ * disables the pool.
+ */
+int
+js_set_platform_runtime_pool_limit (js_platform_t *platform, size_t limit);
+
+/**
+ * Capture the state of a bootstrapped env as a snapshot allocated with
+ * `malloc()`, which the caller must release with `free()`. The snapshot holds
+ * the bindings object, which must only contain data that survives structured
+ * serialization, and the bytecode of the given bootstrap scripts. QuickJS has
+ * no heap snapshots, so rather than the heap itself, the snapshot records how
+ * to rebuild it without parsing any source.
+ */
+int
+js_create_snapshot (js_env_t *env, js_script_t *const scripts[], size_t scripts_len, uint8_t **result, size_t *len);
+
+/**
+ * Create an env from a snapshot previously produced by `js_create_snapshot()`
+ * by restoring its bindings object and running its bootstrap scripts in
+ * order. If the snapshot was produced by a different engine version or any of
+ * its scripts throw, no env is created and an error is returned.
+ */
+int
+js_create_env_with_snapshot (uv_loop_t *loop, js_platform_t *platform, const uint8_t *snapshot, size_t len, const js_env_options_t *options, js_env_t **result);
+
+/**
+ * Set the watermarks, in bytes, that govern garbage collection driven by
+ * external memory, which includes that reported by
+ * `js_adjust_external_memory()` and the memory backing ArrayBuffers. Once the
+ * external memory of the env exceeds the high watermark a collection is
+ * scheduled for the next turn of the loop. If the external memory is still
+ * above the low watermark after collecting, the next collection is deferred
+ * until another `high - low` bytes have been allocated. The defaults are
+ * 32 MiB and 64 MiB, respectively.
+ */
+int
+js_set_external_memory_watermarks (js_env_t *env, int64_t low, int64_t high);
+
+/**
+ * Opt in to running cycle collection when the loop of the env goes idle. A
+ * collection runs, at most once every `interval` milliseconds, when the loop
+ * is about to block and does not expect to wake for at least `budget`
+ * milliseconds. QuickJS collects in a single pass, so the budget bounds the
+ * idle period required rather than the collection itself. A budget of 0, the
+ * default, disables idle collection.
+ */
+int
+js_set_idle_garbage_collection (js_env_t *env, uint64_t budget, uint64_t interval);
+
+/**
+ * Create an ArrayBuffer backed by a mapping of `len` bytes of the file at
+ * `path`, starting at `offset`. A `len` of 0 maps the remainder of the file.
+ * By default the mapping is shared and writes are carried through to the
+ * file; with `js_mapping_private` writes are instead copied on write, and with
+ * `js_mapping_readonly` the mapping can't be written at all, in which case
+ * writing to the ArrayBuffer crashes the process. The advice is passed on to
+ * `madvise()` where supported. The file is unmapped once the ArrayBuffer is
+ * collected. The mapping is not counted as external memory, so mapping large
+ * files does not by itself cause garbage collection.
+ */
+int
+js_create_mapped_arraybuffer (js_env_t *env, const char *path, size_t offset, size_t len, int flags, js_mapping_advice_t advice, js_value_t **result);
+
+/**
+ * Borrow the characters of a string without copying or transcoding them. The
+ * characters are either Latin-1, one byte each, or UTF-16LE, two bytes each,
+ * as indicated by `encoding`, and `len` is given in characters. The view is
+ * not NUL-terminated and remains valid for as long as the handle `value` does,
+ * which is until its handle scope is closed. Views are unavailable, and an
+ * error is thrown, when QuickJS was built with a string layout that differs
+ * from the one this library was checked against.
+ */
+int
+js_get_value_string_view (js_env_t *env, js_value_t *value, js_string_encoding_t *encoding, const void **str, size_t *len);
+
+/**
+ * Create a string from caller owned memory. QuickJS stores the characters of
+ * a string inline, so the characters are always copied, `finalize_cb` is
+ * called before returning, and `copied` is set to `true`. The memory may be
+ * released as soon as the call returns. The string is interned in the runtime
+ * of the env, so creating strings with the same contents, from any context of
+ * the env, shares a single copy while any of them is alive.
+ */
+int
+js_create_external_string_utf8 (js_env_t *env, utf8_t *str, size_t len, js_finalize_cb finalize_cb, void *finalize_hint, js_value_t **result, bool *copied);
+
+int
+js_create_external_string_utf16le (js_env_t *env, utf16_t *str, size_t len, js_finalize_cb finalize_cb, void *finalize_hint, js_value_t **result, bool *copied);
+
+int
+js_create_external_string_latin1 (js_env_t *env, latin1_t *str, size_t len, js_finalize_cb finalize_cb, void *finalize_hint, js_value_t **result, bool *copied);
+
+/**
+ * Intern a property key for use with `js_get_properties()` and
+ * `js_set_properties()`. Keys are reference counted and cached by name, so
+ * interning a name that is already interned returns the same key. Each call
+ * must be balanced by a call to `js_delete_key()`.
+ */
+int
+js_create_key (js_env_t *env, const char *name, size_t len, js_key_t **result);
+
+int
+js_delete_key (js_env_t *env, js_key_t *key);
+
+/**
+ * Get several properties of an object at once, storing a handle for each of
+ * them in `result`. Microtasks are only run once all properties have been
+ * read. Reading stops at the first property that throws.
+ */
+int
+js_get_properties (js_env_t *env, js_value_t *object, js_key_t *const keys[], size_t len, js_value_t *result[]);
+
+/**
+ * Set several properties of an object at once. Microtasks are only run once
+ * all properties have been written. Writing stops at the first property that
+ * throws.
+ */
+int
+js_set_properties (js_env_t *env, js_value_t *object, js_key_t *const keys[], js_value_t *const values[], size_t len);
+
+/**
+ * Iterate the enumerable own string keys of an object without collecting them
+ * in an array. The keys are captured when the iterator is created and each
+ * call to `js_get_next_property()` opens a handle for the next of them, or
+ * sets `result` to `NULL` once all keys have been visited. The iterator must
+ * be released with `js_destroy_property_iterator()`.
+ */
+int
+js_create_property_iterator (js_env_t *env, js_value_t *object, js_property_iterator_t **result);
+
+int
+js_get_next_property (js_env_t *env, js_property_iterator_t *iterator, js_value_t **result);
+
+int
+js_destroy_property_iterator (js_env_t *env, js_property_iterator_t *iterator);
+
+/**
+ * Create a dense array from a list of values in a single call.
+ */
+int
+js_create_array_with_elements (js_env_t *env, js_value_t *const elements[], size_t len, js_value_t **result);
+
+int
+js_create_array_with_doubles (js_env_t *env, const double *elements, size_t len, js_value_t **result);
+
+int
+js_create_array_with_int32s (js_env_t *env, const int32_t *elements, size_t len, js_value_t **result);
+
+/**
+ * Copy up to `len` elements of an array, starting at `offset`, into a caller
+ * provided buffer, opening a handle for each of them. The number of elements
+ * copied is stored in `result`. Microtasks are only run once all elements have
+ * been read.
+ */
+int
+js_copy_array_elements (js_env_t *env, js_value_t *array, js_value_t **elements, size_t len, size_t offset, uint32_t *result);
+
+/**
+ * Like `js_copy_array_elements()`, but converts each element to a number
+ * instead of opening a handle for it.
+ */
+int
+js_copy_array_doubles (js_env_t *env, js_value_t *array, double *elements, size_t len, size_t offset, uint32_t *result);
+
+/**
+ * Call a function with a contiguous vector of `argc` values rather than a
+ * vector of handles, which skips unwrapping the arguments. The values of the
+ * arguments passed to a callback, as handed out by `js_get_callback_info()`,
+ * form such a vector, so a callback may forward its arguments by passing a
+ * pointer to the first of them. Only the arguments actually passed may be
+ * forwarded this way; entries that `js_get_callback_info()` pads with
+ * `undefined` don't belong to the vector, so `argc` must not exceed the
+ * number of arguments the callback was called with.
+ */
+int
+js_call_function_with_values (js_env_t *env, js_value_t *recv, js_value_t *function, size_t argc, js_value_t *argv, js_value_t **result);
+
+/**
+ * Set when the microtask queue of the env is drained. With
+ * `js_microtask_policy_auto`, the default, it is drained whenever a call into
+ * JavaScript made from outside of any other such call returns. With
+ * `js_microtask_policy_explicit` it is only drained by
+ * `js_call_function_with_checkpoint()` and
+ * `js_perform_microtask_checkpoint()`. With `js_microtask_policy_deferred` it
+ * is drained on the next turn of the loop of the env.
+ */
+int
+js_set_microtask_policy (js_env_t *env, js_microtask_policy_t policy);
+
+/**
+ * Set the maximum number of jobs run per drain of the microtask queue. If jobs
+ * remain once the budget runs out, draining continues on the next turn of the
+ * loop. A budget of 0, the default, drains the queue entirely.
+ */
+int
+js_set_microtask_budget (js_env_t *env, size_t budget);
+
+/**
+ * Drain the microtask queue of the env, subject to its budget, unless called
+ * from within a call into JavaScript in which case this is a no-op.
+ */
+int
+js_perform_microtask_checkpoint (js_env_t *env);
+
+/**
+ * Collect statistics about the runtime of the env, including a breakdown of
+ * its heap by kind of allocation. The breakdown is computed by walking the
+ * entire heap, so this is meant for periodic sampling rather than hot paths.
+ * The GC and microtask counters cover the lifetime of the env and the peaks
+ * are the highest values seen since it was created. The `version` field is
+ * reserved and should be set to 0.
+ */
+int
+js_get_runtime_statistics (js_env_t *env, js_runtime_statistics_t *result);
+
+/**
+ * Start sampling the JavaScript running in the env every `interval`
+ * microseconds, or every millisecond if `interval` is 0. A timer thread marks
+ * when a sample is due and the stack is captured at the next interrupt check
+ * of QuickJS, so samples are only taken while JavaScript is running and may
+ * be delayed by up to 10000 operations or so.
+ */
+int
+js_start_profile (js_env_t *env, uint64_t interval);
+
+/**
+ * Stop the profiler started by `js_start_profile()` and serialize the samples
+ * as a CPU profile in the JSON format of `.cpuprofile` files, allocated with
+ * `malloc()`. The caller must release it with `free()`.
+ */
+int
+js_stop_profile (js_env_t *env, char **result, size_t *len);
+
+/**
+ * Set a callback to be called at the beginning and end of native function
+ * calls, module instantiation, and microtask queue drains, such that time
+ * spent in native code may be told apart from time spent in JavaScript.
+ * Passing `NULL` removes the callback.
+ */
+int
+js_set_trace_callback (js_env_t *env, js_trace_cb cb, void *data);
+
+/**
+ * Request that the JavaScript currently running in the env, or the next to
+ * run if none is, be terminated with an uncatchable error. Unlike
+ * `js_terminate_execution()`, this may be called from any thread, as well as
+ * from a signal handler, and also preempts code stuck in a loop. The request
+ * is honoured at the next interrupt check and only terminates once, after
+ * which the env can run code again. Unlike the timeout and budget, the request
+ * is sticky: if no JavaScript is running, it terminates whatever runs next.
+ */
+int
+js_request_termination (js_env_t *env);
+
+/**
+ * Terminate the JavaScript running in the env, like
+ * `js_request_termination()`, once it has run for `timeout` milliseconds. The
+ * timeout applies to each outermost entry into JavaScript, such as running a
+ * script or calling a function from native code, and is measured from the
+ * start of that entry. When set from within JavaScript it also applies to the
+ * rest of the current entry, measured from the time of the call. The deadline
+ * is checked at each interrupt check, which QuickJS performs every 10000
+ * operations or so. A timeout of 0 disables the timeout.
+ */
+int
+js_set_execution_timeout (js_env_t *env, uint64_t timeout);
+
+/**
+ * Terminate the JavaScript running in the env, like
+ * `js_request_termination()`, once it has performed roughly `budget`
+ * operations. Like the timeout, the budget applies afresh to each outermost
+ * entry into JavaScript and, when set from within JavaScript, to the rest of
+ * the current entry. It is consumed in steps of the interrupt check interval
+ * of QuickJS. A budget of 0 disables the budget.
+ */
+int
+js_set_execution_budget (js_env_t *env, uint64_t budget);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // QJS_H
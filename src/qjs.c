@@ -1,7 +1,10 @@
 #include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
 #include <js.h>
 #include <js/ffi.h>
 #include <math.h>
+#include <qjs.h>
 #include <quickjs.h>
 #include <stdarg.h>
 #include <stdatomic.h>
@@ -15,19 +18,161 @@
 #include <uv.h>
 #include <wchar.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+typedef struct js_value_chunk_s js_value_chunk_t;
 typedef struct js_callback_s js_callback_t;
 typedef struct js_finalizer_s js_finalizer_t;
 typedef struct js_finalizer_list_s js_finalizer_list_t;
+typedef struct js_slots_s js_slots_t;
 typedef struct js_delegate_s js_delegate_t;
 typedef struct js_module_resolver_s js_module_resolver_t;
 typedef struct js_module_evaluator_s js_module_evaluator_t;
 typedef struct js_arraybuffer_header_s js_arraybuffer_header_t;
 typedef struct js_promise_rejection_s js_promise_rejection_t;
 typedef struct js_threadsafe_queue_s js_threadsafe_queue_t;
+typedef struct js_threadsafe_queue_slot_s js_threadsafe_queue_slot_t;
+typedef struct js_threadsafe_queue_node_s js_threadsafe_queue_node_t;
+typedef struct js_intrinsic_class_s js_intrinsic_class_t;
+typedef struct js_code_cache_header_s js_code_cache_header_t;
+typedef struct js_teardown_task_s js_teardown_task_t;
+typedef struct js_arraybuffer_slab_s js_arraybuffer_slab_t;
+typedef struct js_script_cache_entry_s js_script_cache_entry_t;
+typedef struct js_pooled_runtime_s js_pooled_runtime_t;
+typedef struct js_snapshot_header_s js_snapshot_header_t;
+typedef struct js_heap_s js_heap_t;
+typedef struct js_heap_slab_s js_heap_slab_t;
+typedef struct js_mapped_arraybuffer_s js_mapped_arraybuffer_t;
+typedef struct js_profiler_s js_profiler_t;
+typedef struct js_profile_node_s js_profile_node_t;
+typedef struct js_profile_buffer_s js_profile_buffer_t;
+typedef struct js_heap_block_s js_heap_block_t;
+typedef struct js_heap_free_s js_heap_free_t;
+typedef struct js_external_arraybuffer_s js_external_arraybuffer_t;
+typedef struct js_string_header_s js_string_header_t;
+
+struct js_intrinsic_class_s {
+  JSValue constructor;
+  JSClassID id;
+};
+
+struct js_profile_node_s {
+  char *function_name;
+  char *url;
+  int line;
+  uint32_t hits;
+  uint32_t child;
+  uint32_t sibling;
+};
+
+struct js_profiler_s {
+  uv_thread_t thread;
+  uv_mutex_t lock;
+  uv_cond_t wake;
+  bool stopping;
+
+  atomic_bool pending;
+
+  uint64_t interval;
+  uint64_t start;
+
+  js_profile_node_t *nodes;
+  size_t nodes_len;
+  size_t nodes_capacity;
+
+  uint32_t *samples;
+  uint64_t *timestamps;
+  size_t samples_len;
+  size_t samples_capacity;
+};
+
+struct js_profile_buffer_s {
+  char *data;
+  size_t len;
+  size_t capacity;
+};
+
+struct js_script_cache_entry_s {
+  char *file;
+  uint64_t hash;
+  uint8_t *data;
+  size_t len;
+  int references;
+  bool evicted;
+  js_script_cache_entry_t *prev;
+  js_script_cache_entry_t *next;
+  js_script_cache_entry_t *chain;
+};
+
+struct js_heap_block_s {
+  // The size class of a small block or the length of a large one, which is
+  // always larger than the number of size classes.
+  size_t size;
+};
+
+struct js_heap_free_s {
+  js_heap_free_t *next;
+};
+
+struct js_heap_slab_s {
+  js_heap_slab_t *next;
+
+  // The number of bytes carved from the slab so far.
+  size_t len;
+};
+
+struct js_heap_s {
+  js_allocator_t allocator;
+  size_t external;
+  uint64_t allocations;
+  js_heap_slab_t *slabs;
+  uint8_t *cursor;
+  uint8_t *end;
+  js_heap_free_t *free[15];
+};
+
+struct js_pooled_runtime_s {
+  JSRuntime *runtime;
+  js_heap_t *heap;
+  uv_thread_t thread;
+  js_pooled_runtime_t *next;
+};
 
 struct js_platform_s {
   js_platform_options_t options;
   uv_loop_t *loop;
+
+  js_allocator_t allocator;
+
+  struct {
+    uv_mutex_t lock;
+
+    // Written under the lock, but read without it to tell whether the pool
+    // is enabled at all.
+    atomic_size_t limit;
+
+    size_t len;
+    js_pooled_runtime_t *head;
+  } runtimes;
+
+  struct {
+    uv_mutex_t lock;
+
+    // Written under the lock, but read without it to tell whether the cache
+    // is enabled at all.
+    atomic_size_t limit;
+
+    size_t len;
+    uint64_t hits;
+    js_script_cache_entry_t *head;
+    js_script_cache_entry_t *tail;
+    js_script_cache_entry_t *buckets[256];
+  } scripts;
 };
 
 struct js_env_s {
@@ -38,6 +183,9 @@ struct js_env_s {
 
   js_platform_t *platform;
   js_handle_scope_t *scope;
+  js_handle_scope_t *unused_scopes;
+
+  JSValue undefined;
 
   uint32_t depth;
 
@@ -45,12 +193,107 @@ struct js_env_s {
   JSContext *context;
   JSValue bindings;
 
+  js_heap_t *heap;
+
+  js_intrinsic_class_t typedarrays[11];
+  js_intrinsic_class_t dataview;
+  js_intrinsic_class_t arraybuffer;
+  JSValue error;
+
+  // The word offset of the opaque pointer, followed by the free function,
+  // that an ArrayBuffer was created with within its QuickJS representation,
+  // or -1 if they couldn't be located.
+  int arraybuffer_opaque;
+
+  // Whether the string header layout mirrored from quickjs.c matches the
+  // QuickJS being run against, in which case strings are read in place.
+  bool string_headers;
+
+  struct {
+    JSValue map;
+    JSValue get;
+    JSValue set;
+  } slots;
+
   int64_t external_memory;
+  int64_t mapped_memory;
+
+  struct {
+    int64_t low;
+    int64_t high;
+    int64_t trigger;
+    bool scheduled;
+
+    uint64_t idle_budget;
+    uint64_t idle_interval;
+    uint64_t last;
+    uint64_t allocations;
+
+    uint64_t count;
+    uint64_t time;
+  } gc;
+
+  struct {
+    size_t depth;
+    size_t peak_depth;
+    size_t len;
+    size_t peak_len;
+  } handles;
 
   js_module_resolver_t *resolvers;
   js_module_evaluator_t *evaluators;
 
-  js_promise_rejection_t *promise_rejections;
+  struct {
+    js_promise_rejection_t *head;
+    js_promise_rejection_t *tail;
+    js_promise_rejection_t **buckets;
+    size_t capacity;
+    size_t len;
+    js_promise_rejection_t *unused;
+    size_t unused_len;
+  } promise_rejections;
+
+  js_arraybuffer_slab_t *arraybuffer_slab;
+  js_arraybuffer_slab_t *arraybuffer_slabs;
+
+  js_threadsafe_function_t *threadsafe_functions;
+
+  struct {
+    js_teardown_task_t *tasks;
+    uint32_t pending;
+    bool destroying;
+    bool running;
+  } teardown;
+
+  struct {
+    js_microtask_policy_t policy;
+    size_t budget;
+    bool scheduled;
+
+    uint64_t drains;
+    uint64_t jobs;
+  } microtasks;
+
+  struct {
+    atomic_bool terminate;
+
+    // The configured limits, in nanoseconds and operations.
+    uint64_t timeout;
+    uint64_t budget;
+
+    // The limits of the current outermost entry into JavaScript.
+    uint64_t deadline;
+    uint64_t remaining;
+  } execution;
+
+  js_profiler_t *profiler;
+
+  struct {
+    js_trace_cb cb;
+    void *data;
+  } trace;
+
+  js_key_t *keys[64];
 
   struct {
     js_uncaught_exception_cb uncaught_exception;
@@ -68,11 +311,39 @@ struct js_value_s {
   JSValue value;
 };
 
-struct js_handle_scope_s {
-  js_handle_scope_t *parent;
-  js_value_t **values;
+struct js_deferred_teardown_s {
+  js_env_t *env;
+  js_teardown_task_t *task;
+};
+
+struct js_teardown_task_s {
+  bool deferred;
+  js_teardown_cb callback;
+  js_deferred_teardown_cb deferred_callback;
+  void *data;
+  js_deferred_teardown_t handle;
+  js_teardown_task_t *next;
+};
+
+struct js_context_s {
+  JSContext *context;
+  js_intrinsic_class_t typedarrays[11];
+  js_intrinsic_class_t dataview;
+  js_intrinsic_class_t arraybuffer;
+  JSValue error;
+  bool entered;
+};
+
+struct js_value_chunk_s {
+  js_value_chunk_t *next;
   size_t len;
   size_t capacity;
+  js_value_t values[];
+};
+
+struct js_handle_scope_s {
+  js_handle_scope_t *parent;
+  js_value_chunk_t *values;
 };
 
 struct js_escapable_handle_scope_s {
@@ -105,9 +376,16 @@ struct js_module_evaluator_s {
 
 struct js_ref_s {
   JSValue value;
-  JSValue symbol;
   uint32_t count;
   bool finalized;
+  js_slots_t *slots;
+  js_ref_t *prev;
+  js_ref_t *next;
+};
+
+struct js_script_s {
+  JSValue bytecode;
+  uint64_t hash;
 };
 
 struct js_deferred_s {
@@ -121,11 +399,70 @@ struct js_finalizer_s {
   void *finalize_hint;
 };
 
+// Mirrors the header of `JSString` in quickjs.c, which the public API does not
+// expose, and must be kept in sync with the QuickJS revision pinned in
+// CMakeLists.txt. The characters follow the header and are either Latin-1 or,
+// if `is_wide_char` is set, UTF-16. The layout is verified at env creation.
+struct js_string_header_s {
+  int ref_count;
+  uint32_t len : 31;
+  uint8_t is_wide_char : 1;
+  uint32_t hash : 30;
+  uint8_t atom_type : 2;
+  uint32_t hash_next;
+};
+
+struct js_property_iterator_s {
+  JSPropertyEnum *properties;
+  uint32_t len;
+  uint32_t index;
+};
+
+struct js_key_s {
+  JSAtom atom;
+  char *name;
+  size_t len;
+  uint32_t references;
+  js_key_t *next;
+};
+
+struct js_arraybuffer_slab_s {
+  // References held by the env while it's allocating from the slab and by the
+  // pooled ArrayBuffers carved from it, which are only ever touched on the
+  // thread of the env. The slab is counted as external memory of the env for
+  // as long as these remain.
+  uint32_t buffers;
+
+  // References held by backing stores and ArrayBuffers created from them,
+  // which may be released on any thread, plus a single reference on behalf of
+  // the env for as long as it holds any buffers.
+  atomic_uint references;
+
+  size_t len;
+  js_arraybuffer_slab_t *prev;
+  js_arraybuffer_slab_t *next;
+  uint8_t data[];
+};
+
+struct js_external_arraybuffer_s {
+  js_finalizer_t finalizer;
+  size_t len;
+};
+
 struct js_finalizer_list_s {
   js_finalizer_t finalizer;
   js_finalizer_list_t *next;
 };
 
+struct js_slots_s {
+  js_finalizer_t wrap;
+  js_type_tag_t type_tag;
+  js_finalizer_list_t *finalizers;
+  js_ref_t *references;
+  bool wrapped;
+  bool type_tagged;
+};
+
 struct js_delegate_s {
   js_delegate_callbacks_t callbacks;
   void *data;
@@ -136,6 +473,38 @@ struct js_delegate_s {
 struct js_callback_s {
   js_function_cb cb;
   void *data;
+  js_ffi_function_t *ffi;
+};
+
+struct js_ffi_type_info_s {
+  js_ffi_type_t type;
+};
+
+struct js_ffi_function_info_s {
+  js_ffi_type_t result;
+  unsigned int argc;
+  js_ffi_type_t argv[];
+};
+
+struct js_ffi_function_s {
+  const void *function;
+  js_ffi_function_info_t *type_info;
+  bool fast;
+};
+
+// The receiver is passed to the C function as a pointer to its value.
+struct js_ffi_receiver_s {
+  JSValue value;
+};
+
+struct js_ffi_arraybuffer_s {
+  void *data;
+  size_t len;
+};
+
+struct js_ffi_typedarray_s {
+  void *data;
+  size_t len;
 };
 
 struct js_callback_info_s {
@@ -152,29 +521,74 @@ struct js_arraybuffer_header_s {
   uint8_t data[];
 };
 
+struct js_mapped_arraybuffer_s {
+  void *base;
+  size_t size;
+};
+
 struct js_arraybuffer_backing_store_s {
   atomic_int references;
   size_t len;
   uint8_t *data;
+  js_arraybuffer_header_t *header;
+  js_arraybuffer_slab_t *slab;
+  JSRuntime *runtime;
   JSValue owner;
 };
 
 struct js_promise_rejection_s {
   JSValue promise;
   JSValue reason;
+  js_promise_rejection_t *prev;
   js_promise_rejection_t *next;
+  js_promise_rejection_t *chain;
 };
 
 static const uint8_t js_threadsafe_function_idle = 0x0;
 static const uint8_t js_threadsafe_function_running = 0x1;
 static const uint8_t js_threadsafe_function_pending = 0x2;
 
+struct js_threadsafe_queue_slot_s {
+  atomic_size_t sequence;
+  void *data;
+};
+
+struct js_threadsafe_queue_node_s {
+  void *data;
+  js_threadsafe_queue_node_t *next;
+};
+
 struct js_threadsafe_queue_s {
-  void **queue;
-  size_t len;
-  size_t capacity;
-  bool closed;
+  // Bounded ring of slots shared between producers, see
+  // https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+  js_threadsafe_queue_slot_t *slots;
+  size_t mask;
+  atomic_size_t head;
+  size_t tail;
+
+  // The number of queued calls, only tracked when the queue is limited.
+  size_t limit;
+  atomic_size_t len;
+
+  // Calls that didn't fit in the ring of an unlimited queue. Producers only
+  // append to the overflow while it's non-empty to preserve ordering.
+  js_threadsafe_queue_node_t *overflow;
+  js_threadsafe_queue_node_t **overflow_tail;
+  atomic_bool overflowing;
+
+  // Calls moved out of the overflow by the consumer, but not yet dispatched.
+  js_threadsafe_queue_node_t *pending;
+
+  atomic_bool closed;
+  atomic_bool aborted;
+
+  // The lock is only taken by producers that overflow or block and by the
+  // consumer when it needs to wake them up. The last blocked producer to
+  // leave signals `drained` so that the queue can be torn down.
+  atomic_int waiting;
   uv_mutex_t lock;
+  uv_cond_t available;
+  uv_cond_t drained;
 };
 
 struct js_threadsafe_function_s {
@@ -188,12 +602,74 @@ struct js_threadsafe_function_s {
   js_finalize_cb finalize_cb;
   void *finalize_hint;
   js_threadsafe_function_cb cb;
+  bool finalized;
+  js_threadsafe_function_t *prev;
+  js_threadsafe_function_t *next;
+};
+
+struct js_code_cache_header_s {
+  char magic[4];
+  char version[12];
+  uint64_t hash;
+};
+
+struct js_snapshot_header_s {
+  char magic[4];
+  char version[12];
+  uint64_t len;
 };
 
 static const char *js_platform_identifier = "quickjs";
 
 static const char *js_platform_version = "2021-03-27";
 
+static const size_t js_value_chunk_capacity = 32;
+
+static const size_t js_heap_slab_size = 64 * 1024;
+
+static const size_t js_heap_max_small_size = 512;
+
+static const size_t js_promise_rejection_capacity = 16;
+
+static const size_t js_arraybuffer_slab_size = 64 * 1024;
+
+static const size_t js_arraybuffer_max_pooled_len = 4 * 1024;
+
+static atomic_bool js_arraybuffer_zero_fill = true;
+
+static const size_t js_promise_rejection_pool_len = 64;
+
+static const int64_t js_external_memory_low_watermark = 32 * 1024 * 1024;
+
+static const int64_t js_external_memory_high_watermark = 64 * 1024 * 1024;
+
+static const size_t js_threadsafe_queue_capacity = 1024;
+
+static const size_t js_threadsafe_function_batch_len = 1024;
+
+// The number of operations QuickJS performs between calls to the interrupt
+// handler, which is `JS_INTERRUPT_COUNTER_INIT` in quickjs.c.
+static const uint64_t js_interrupt_interval = 10000;
+
+static const struct {
+  const char *name;
+  js_typedarray_type_t type;
+} js_typedarray_classes[] = {
+  {"Int8Array", js_int8array},
+  {"Uint8Array", js_uint8array},
+  {"Uint8ClampedArray", js_uint8clampedarray},
+  {"Int16Array", js_int16_array},
+  {"Uint16Array", js_uint16array},
+  {"Int32Array", js_int32array},
+  {"Uint32Array", js_uint32array},
+  {"Float32Array", js_float32array},
+  {"Float64Array", js_float64array},
+  {"BigInt64Array", js_bigint64array},
+  {"BigUint64Array", js_biguint64array},
+};
+
+static const size_t js_typedarray_classes_len = sizeof(js_typedarray_classes) / sizeof(js_typedarray_classes[0]);
+
 static void
 js__on_external_finalize (JSRuntime *runtime, JSValue value);
 
@@ -205,23 +681,13 @@ static JSClassDef js_external_class = {
 };
 
 static void
-js__on_finalizer_finalize (JSRuntime *runtime, JSValue value);
-
-static JSClassID js_finalizer_class_id;
-
-static JSClassDef js_finalizer_class = {
-  .class_name = "Finalizer",
-  .finalizer = js__on_finalizer_finalize,
-};
-
-static void
-js__on_type_tag_finalize (JSRuntime *runtime, JSValue value);
+js__on_slots_finalize (JSRuntime *runtime, JSValue value);
 
-static JSClassID js_type_tag_class_id;
+static JSClassID js_slots_class_id;
 
-static JSClassDef js_type_tag_class = {
-  .class_name = "TypeTag",
-  .finalizer = js__on_type_tag_finalize,
+static JSClassDef js_slots_class = {
+  .class_name = "Slots",
+  .finalizer = js__on_slots_finalize,
 };
 
 static void
@@ -272,6 +738,70 @@ static JSClassDef js_delegate_class = {
   },
 };
 
+static void *
+js__on_default_allocate (size_t size, void *data) {
+  return malloc(size);
+}
+
+static void *
+js__on_default_reallocate (void *ptr, size_t size, void *data) {
+  return realloc(ptr, size);
+}
+
+static void
+js__on_default_deallocate (void *ptr, void *data) {
+  free(ptr);
+}
+
+static const js_allocator_t js_default_allocator = {
+  .allocate = js__on_default_allocate,
+  .reallocate = js__on_default_reallocate,
+  .deallocate = js__on_default_deallocate,
+  .data = NULL,
+};
+
+static js_heap_t *
+js__create_heap (const js_allocator_t *allocator) {
+  js_heap_t *heap = allocator->allocate(sizeof(js_heap_t), allocator->data);
+
+  heap->allocator = *allocator;
+  heap->external = 0;
+  heap->allocations = 0;
+  heap->slabs = NULL;
+  heap->cursor = NULL;
+  heap->end = NULL;
+
+  memset(heap->free, 0, sizeof(heap->free));
+
+  return heap;
+}
+
+static void
+js__destroy_heap (js_heap_t *heap) {
+  js_allocator_t allocator = heap->allocator;
+
+  js_heap_slab_t *next = heap->slabs;
+  js_heap_slab_t *prev = NULL;
+
+  while (next) {
+    prev = next;
+    next = next->next;
+
+    allocator.deallocate(prev, allocator.data);
+  }
+
+  allocator.deallocate(heap, allocator.data);
+}
+
+static void
+js__free_runtime (JSRuntime *runtime, js_heap_t *heap) {
+  JS_FreeRuntime(runtime);
+
+  // Anything still allocated from the heap at this point was leaked by the
+  // runtime, so the slabs are released wholesale.
+  js__destroy_heap(heap);
+}
+
 static uv_once_t js_platform_init = UV_ONCE_INIT;
 
 static void
@@ -280,8 +810,7 @@ js__on_platform_init () {
   // `uv_once_t`.
 
   JS_NewClassID(&js_external_class_id);
-  JS_NewClassID(&js_finalizer_class_id);
-  JS_NewClassID(&js_type_tag_class_id);
+  JS_NewClassID(&js_slots_class_id);
   JS_NewClassID(&js_function_class_id);
   JS_NewClassID(&js_constructor_class_id);
   JS_NewClassID(&js_delegate_class_id);
@@ -295,6 +824,28 @@ js_create_platform (uv_loop_t *loop, const js_platform_options_t *options, js_pl
 
   platform->loop = loop;
   platform->options = options ? *options : (js_platform_options_t) {};
+  platform->allocator = js_default_allocator;
+
+  // The script cache is shared by all envs created from the platform, which
+  // may live on different threads, and is disabled until given a limit.
+  int err = uv_mutex_init(&platform->scripts.lock);
+  assert(err == 0);
+
+  atomic_init(&platform->scripts.limit, 0);
+  platform->scripts.len = 0;
+  platform->scripts.hits = 0;
+  platform->scripts.head = NULL;
+  platform->scripts.tail = NULL;
+
+  memset(platform->scripts.buckets, 0, sizeof(platform->scripts.buckets));
+
+  // Likewise, the runtime pool is disabled until given a limit.
+  err = uv_mutex_init(&platform->runtimes.lock);
+  assert(err == 0);
+
+  atomic_init(&platform->runtimes.limit, 0);
+  platform->runtimes.len = 0;
+  platform->runtimes.head = NULL;
 
   *result = platform;
 
@@ -303,6 +854,32 @@ js_create_platform (uv_loop_t *loop, const js_platform_options_t *options, js_pl
 
 int
 js_destroy_platform (js_platform_t *platform) {
+  js_script_cache_entry_t *next = platform->scripts.head;
+  js_script_cache_entry_t *prev = NULL;
+
+  while (next) {
+    prev = next;
+    next = next->next;
+
+    free(prev->file);
+    free(prev->data);
+    free(prev);
+  }
+
+  uv_mutex_destroy(&platform->scripts.lock);
+
+  while (platform->runtimes.head) {
+    js_pooled_runtime_t *pooled = platform->runtimes.head;
+
+    platform->runtimes.head = pooled->next;
+
+    js__free_runtime(pooled->runtime, pooled->heap);
+
+    free(pooled);
+  }
+
+  uv_mutex_destroy(&platform->runtimes.lock);
+
   free(platform);
 
   return 0;
@@ -461,89 +1038,233 @@ js__on_unhandled_rejection (JSContext *context, JSValue promise, JSValue reason)
   JS_FreeValue(context, reason);
 }
 
+static inline js_promise_rejection_t **
+js__get_promise_rejection_bucket (js_env_t *env, JSValueConst promise) {
+  uintptr_t hash = (uintptr_t) JS_VALUE_GET_OBJ(promise);
+
+  hash ^= hash >> 4;
+  hash ^= hash >> 12;
+
+  return &env->promise_rejections.buckets[hash & (env->promise_rejections.capacity - 1)];
+}
+
 static void
-js__on_promise_rejection (JSContext *context, JSValueConst promise, JSValueConst reason, JS_BOOL is_handled, void *opaque) {
-  js_env_t *env = (js_env_t *) JS_GetContextOpaque(context);
+js__grow_promise_rejections (js_env_t *env) {
+  size_t capacity = env->promise_rejections.capacity * 2;
 
-  if (env->callbacks.unhandled_rejection == NULL) return;
+  js_promise_rejection_t **buckets = calloc(capacity, sizeof(js_promise_rejection_t *));
 
-  if (is_handled) {
-    js_promise_rejection_t *next = env->promise_rejections;
-    js_promise_rejection_t *prev = NULL;
+  free(env->promise_rejections.buckets);
 
-    while (next) {
-      if (JS_VALUE_GET_OBJ(next->promise) == JS_VALUE_GET_OBJ(promise)) {
-        JS_FreeValue(context, next->promise);
-        JS_FreeValue(context, next->reason);
+  env->promise_rejections.buckets = buckets;
+  env->promise_rejections.capacity = capacity;
 
-        if (prev) prev->next = next->next;
-        else env->promise_rejections = next->next;
+  js_promise_rejection_t *next = env->promise_rejections.head;
 
-        return free(next);
-      }
+  while (next) {
+    js_promise_rejection_t **bucket = js__get_promise_rejection_bucket(env, next->promise);
 
-      prev = next;
-      next = next->next;
-    }
-  } else {
-    js_promise_rejection_t *node = malloc(sizeof(js_promise_rejection_t));
+    next->chain = *bucket;
 
-    node->promise = JS_DupValue(context, promise);
-    node->reason = JS_DupValue(context, reason);
-    node->next = env->promise_rejections;
+    *bucket = next;
 
-    env->promise_rejections = node;
+    next = next->next;
   }
 }
 
 static inline void
-js__on_run_microtasks (js_env_t *env) {
-  int err;
+js__release_promise_rejection (js_env_t *env, js_promise_rejection_t *node) {
+  if (env->promise_rejections.unused_len < js_promise_rejection_pool_len) {
+    node->next = env->promise_rejections.unused;
 
-  js_handle_scope_t *scope;
-  err = js_open_handle_scope(env, &scope);
-  assert(err == 0);
+    env->promise_rejections.unused = node;
+    env->promise_rejections.unused_len++;
+  } else {
+    free(node);
+  }
+}
 
-  JSContext *context;
+static void
+js__on_promise_rejection (JSContext *context, JSValueConst promise, JSValueConst reason, JS_BOOL is_handled, void *opaque) {
+  js_env_t *env = (js_env_t *) JS_GetContextOpaque(context);
 
-  for (;;) {
-    err = JS_ExecutePendingJob(env->runtime, &context);
+  if (env->callbacks.unhandled_rejection == NULL) return;
 
-    if (err == 0) break;
+  if (is_handled) {
+    js_promise_rejection_t **next = js__get_promise_rejection_bucket(env, promise);
 
-    if (err < 0) {
-      JSValue error = JS_GetException(context);
+    while (*next && JS_VALUE_GET_OBJ((*next)->promise) != JS_VALUE_GET_OBJ(promise)) {
+      next = &(*next)->chain;
+    }
+
+    js_promise_rejection_t *node = *next;
+
+    if (node == NULL) return;
+
+    *next = node->chain;
+
+    if (node->prev) node->prev->next = node->next;
+    else env->promise_rejections.head = node->next;
+
+    if (node->next) node->next->prev = node->prev;
+    else env->promise_rejections.tail = node->prev;
+
+    env->promise_rejections.len--;
+
+    JS_FreeValue(context, node->promise);
+    JS_FreeValue(context, node->reason);
+
+    js__release_promise_rejection(env, node);
+  } else {
+    js_promise_rejection_t *node = env->promise_rejections.unused;
+
+    if (node) {
+      env->promise_rejections.unused = node->next;
+      env->promise_rejections.unused_len--;
+    } else {
+      node = malloc(sizeof(js_promise_rejection_t));
+    }
+
+    if (env->promise_rejections.len >= env->promise_rejections.capacity) {
+      js__grow_promise_rejections(env);
+    }
+
+    js_promise_rejection_t **bucket = js__get_promise_rejection_bucket(env, promise);
+
+    node->promise = JS_DupValue(context, promise);
+    node->reason = JS_DupValue(context, reason);
+    node->prev = env->promise_rejections.tail;
+    node->next = NULL;
+    node->chain = *bucket;
+
+    *bucket = node;
+
+    // Rejections are kept in the order they happened so that they're also
+    // reported in that order.
+    if (node->prev) node->prev->next = node;
+    else env->promise_rejections.head = node;
+
+    env->promise_rejections.tail = node;
+    env->promise_rejections.len++;
+  }
+}
+
+static void
+js__on_prepare (uv_prepare_t *handle);
+
+static void
+js__close_threadsafe_functions (js_env_t *env);
+
+static bool
+js__verify_string_header (JSContext *context);
+
+static inline void
+js__trace (js_env_t *env, js_trace_event_t event, js_trace_phase_t phase) {
+  if (env->trace.cb) env->trace.cb(env, event, phase, env->trace.data);
+}
+
+static void
+js__run_microtasks (js_env_t *env) {
+  int err;
+
+  js_handle_scope_t *scope;
+  err = js_open_handle_scope(env, &scope);
+  assert(err == 0);
+
+  JSContext *context;
+
+  env->microtasks.scheduled = false;
+  env->microtasks.drains++;
+
+  js__trace(env, js_trace_microtask_drain, js_trace_begin);
+
+  size_t budget = env->microtasks.budget;
+
+  for (size_t i = 0; budget == 0 || i < budget; i++) {
+    err = JS_ExecutePendingJob(env->runtime, &context);
+
+    if (err == 0) break;
+
+    env->microtasks.jobs++;
+
+    if (err < 0) {
+      JSValue error = JS_GetException(context);
 
       js__on_uncaught_exception(context, error);
     }
   }
 
-  js_promise_rejection_t *next = env->promise_rejections;
+  js__trace(env, js_trace_microtask_drain, js_trace_end);
+
+  // If the budget ran out before the queue did, continue draining on the next
+  // turn of the loop to let I/O through. Rejections are only reported once
+  // the queue has been drained as a pending job may still handle them.
+  if (JS_IsJobPending(env->runtime)) {
+    env->microtasks.scheduled = true;
+
+    err = uv_prepare_start(&env->prepare, js__on_prepare);
+    assert(err == 0);
+
+    err = js_close_handle_scope(env, scope);
+    assert(err == 0);
+
+    return;
+  }
+
+  js_promise_rejection_t *next = env->promise_rejections.head;
   js_promise_rejection_t *prev = NULL;
 
-  env->promise_rejections = NULL;
+  // Detach the rejections before reporting them as the callback may cause
+  // additional rejections.
+  env->promise_rejections.head = NULL;
+  env->promise_rejections.tail = NULL;
+  env->promise_rejections.len = 0;
 
-  while (next) {
-    js__on_unhandled_rejection(env->context, next->promise, next->reason);
+  if (next) {
+    memset(env->promise_rejections.buckets, 0, env->promise_rejections.capacity * sizeof(js_promise_rejection_t *));
+  }
 
+  while (next) {
     prev = next;
     next = next->next;
 
-    free(prev);
+    js__on_unhandled_rejection(env->context, prev->promise, prev->reason);
+
+    js__release_promise_rejection(env, prev);
   }
 
   err = js_close_handle_scope(env, scope);
   assert(err == 0);
 }
 
-static void
-js__on_prepare (uv_prepare_t *handle);
+static inline void
+js__on_run_microtasks (js_env_t *env) {
+  int err;
+
+  switch (env->microtasks.policy) {
+  case js_microtask_policy_auto:
+    js__run_microtasks(env);
+    break;
+
+  case js_microtask_policy_explicit:
+    break;
+
+  case js_microtask_policy_deferred:
+    if (env->microtasks.scheduled) break;
+
+    env->microtasks.scheduled = true;
+
+    err = uv_prepare_start(&env->prepare, js__on_prepare);
+    assert(err == 0);
+    break;
+  }
+}
 
 static inline void
 js__on_check_liveness (js_env_t *env) {
   int err;
 
-  if (true /* macrotask queue empty */) {
+  if (true /* macrotask queue empty */ && !env->microtasks.scheduled) {
     err = uv_prepare_stop(&env->prepare);
   } else {
     err = uv_prepare_start(&env->prepare, js__on_prepare);
@@ -553,3404 +1274,6459 @@ js__on_check_liveness (js_env_t *env) {
 }
 
 static void
-js__on_prepare (uv_prepare_t *handle) {
-  js_env_t *env = (js_env_t *) handle->data;
+js__run_gc (js_env_t *env) {
+  uint64_t start = uv_hrtime();
 
-  js__on_check_liveness(env);
+  JS_RunGC(env->runtime);
+
+  env->gc.count++;
+  env->gc.time += uv_hrtime() - start;
+
+  env->gc.last = uv_now(env->loop);
+  env->gc.allocations = env->heap->allocations;
 }
 
 static void
-js__on_check (uv_check_t *handle) {
-  js_env_t *env = (js_env_t *) handle->data;
+js__on_run_idle_gc (js_env_t *env) {
+  if (env->gc.idle_budget == 0 || env->depth > 0) return;
 
-  if (uv_loop_alive(env->loop)) return;
+  // Nothing can have become garbage if nothing was allocated.
+  if (env->gc.allocations == env->heap->allocations) return;
 
-  js__on_check_liveness(env);
-}
+  if (uv_now(env->loop) - env->gc.last < env->gc.idle_interval) return;
 
-static void *
-js__on_malloc (JSMallocState *s, size_t size) {
-  return malloc(size);
+  // The check phase is the last thing the loop does before it blocks for I/O,
+  // so the backend timeout tells how long the loop expects to stay idle. A
+  // timeout of -1 means it will block until woken by I/O.
+  int timeout = uv_backend_timeout(env->loop);
+
+  if (timeout >= 0 && (uint64_t) timeout < env->gc.idle_budget) return;
+
+  js__run_gc(env);
 }
 
 static void
-js__on_free (JSMallocState *s, void *ptr) {
-  free(ptr);
-}
+js__on_run_scheduled_gc (js_env_t *env) {
+  if (!env->gc.scheduled || env->depth > 0) return;
 
-static void *
-js__on_realloc (JSMallocState *s, void *ptr, size_t size) {
-  return realloc(ptr, size);
-}
+  env->gc.scheduled = false;
 
-static size_t
-js__on_usable_size (const void *ptr) {
-  return 0;
-}
+  js__run_gc(env);
 
-static void *
-js__on_shared_malloc (void *opaque, size_t size) {
-  js_arraybuffer_header_t *header = malloc(sizeof(js_arraybuffer_header_t) + size);
+  // If the external memory is still above the low watermark after collecting
+  // then it's being held on to, so back off rather than collecting again on
+  // every subsequent adjustment.
+  if (env->external_memory > env->gc.low) {
+    env->gc.trigger = env->external_memory + (env->gc.high - env->gc.low);
+  } else {
+    env->gc.trigger = env->gc.high;
+  }
+}
 
-  header->references = 1;
-  header->len = size;
+static inline void
+js__enter (js_env_t *env) {
+  // The deadline and budget are armed afresh whenever the outermost native
+  // entry into JavaScript begins and disarmed when it ends, such that they
+  // never carry over to unrelated calls.
+  if (env->depth++ == 0) {
+    env->execution.deadline = env->execution.timeout ? uv_hrtime() + env->execution.timeout : 0;
+    env->execution.remaining = env->execution.budget;
+  }
+}
 
-  return header->data;
+static inline void
+js__exit (js_env_t *env) {
+  if (--env->depth == 0) {
+    env->execution.deadline = 0;
+    env->execution.remaining = 0;
+  }
 }
 
 static void
-js__on_shared_free (void *opaque, void *ptr) {
-  js_arraybuffer_header_t *header = (js_arraybuffer_header_t *) ((char *) ptr - sizeof(js_arraybuffer_header_t));
+js__on_prepare (uv_prepare_t *handle) {
+  js_env_t *env = (js_env_t *) handle->data;
 
-  if (--header->references == 0) {
-    free(header);
+  if (env->microtasks.scheduled && env->depth == 0) {
+    js__enter(env);
+
+    js__run_microtasks(env);
+
+    js__exit(env);
   }
+
+  js__on_run_scheduled_gc(env);
+
+  js__on_check_liveness(env);
 }
 
 static void
-js__on_shared_dup (void *opaque, void *ptr) {
-  js_arraybuffer_header_t *header = (js_arraybuffer_header_t *) ((char *) ptr - sizeof(js_arraybuffer_header_t));
+js__on_check (uv_check_t *handle) {
+  js_env_t *env = (js_env_t *) handle->data;
+
+  js__on_run_scheduled_gc(env);
+  js__on_run_idle_gc(env);
 
-  header->references++;
+  if (uv_loop_alive(env->loop)) return;
+
+  js__on_check_liveness(env);
 }
 
-int
-js_create_env (uv_loop_t *loop, js_platform_t *platform, const js_env_options_t *options, js_env_t **result) {
+static void
+js__adjust_external_memory (js_env_t *env, int64_t change_in_bytes) {
   int err;
 
-  JSRuntime *runtime = JS_NewRuntime2(
-    &(JSMallocFunctions) {
-      .js_malloc = js__on_malloc,
-      .js_free = js__on_free,
-      .js_realloc = js__on_realloc,
-      .js_malloc_usable_size = js__on_usable_size,
-    },
-    NULL
-  );
+  env->external_memory += change_in_bytes;
 
-  JS_SetSharedArrayBufferFunctions(
-    runtime,
-    &(JSSharedArrayBufferFunctions) {
-      .sab_alloc = js__on_shared_malloc,
-      .sab_free = js__on_shared_free,
-      .sab_dup = js__on_shared_dup,
-      .sab_opaque = NULL,
-    }
-  );
+  // External memory counts toward the memory limit of the runtime, which is
+  // enforced by the heap.
+  env->heap->external = env->external_memory > 0 ? (size_t) env->external_memory : 0;
 
-  JS_SetMaxStackSize(runtime, 864 * 1024);
-  JS_SetCanBlock(runtime, false);
-  JS_SetModuleLoaderFunc(runtime, NULL, js__on_resolve_module, NULL);
-  JS_SetHostPromiseRejectionTracker(runtime, js__on_promise_rejection, NULL);
+  if (env->external_memory < env->gc.low) env->gc.trigger = env->gc.high;
 
-  if (options && options->memory_limit) {
-    JS_SetMemoryLimit(runtime, options->memory_limit);
-  } else {
-    uint64_t constrained_memory = uv_get_constrained_memory();
-    uint64_t total_memory = uv_get_total_memory();
+  if (env->gc.scheduled || env->external_memory <= env->gc.trigger) return;
 
-    if (constrained_memory > 0 && constrained_memory < total_memory) {
-      total_memory = constrained_memory;
-    }
+  // Collecting right away could run finalizers in the middle of a native
+  // call, so defer the collection to the next safe point of the loop.
+  env->gc.scheduled = true;
 
-    if (total_memory > 0) {
-      JS_SetMemoryLimit(runtime, total_memory);
-    }
-  }
+  err = uv_prepare_start(&env->prepare, js__on_prepare);
+  assert(err == 0);
+}
 
-  JS_NewClass(runtime, js_external_class_id, &js_external_class);
-  JS_NewClass(runtime, js_finalizer_class_id, &js_finalizer_class);
-  JS_NewClass(runtime, js_type_tag_class_id, &js_type_tag_class);
-  JS_NewClass(runtime, js_function_class_id, &js_function_class);
-  JS_NewClass(runtime, js_constructor_class_id, &js_constructor_class);
-  JS_NewClass(runtime, js_delegate_class_id, &js_delegate_class);
+static inline size_t
+js__get_heap_size_class (size_t size) {
+  if (size <= 128) return size == 0 ? 1 : (size + 15) / 16;
 
-  js_env_t *env = malloc(sizeof(js_env_t));
+  if (size <= js_heap_max_small_size) return 8 + (size - 128 + 63) / 64;
 
-  env->loop = loop;
-  env->active_handles = 2;
+  return 0;
+}
 
-  env->platform = platform;
+static inline size_t
+js__get_heap_class_size (size_t size_class) {
+  return size_class <= 8 ? size_class * 16 : 128 + (size_class - 8) * 64;
+}
 
-  env->depth = 0;
+static inline size_t
+js__get_heap_block_class (const js_heap_block_t *block) {
+  return block->size < sizeof(((js_heap_t *) NULL)->free) / sizeof(js_heap_free_t *) ? block->size : 0;
+}
 
-  env->runtime = runtime;
-  env->context = JS_NewContext(runtime);
-  env->bindings = JS_NewObject(env->context);
+static inline size_t
+js__get_heap_block_len (const js_heap_block_t *block) {
+  size_t size_class = js__get_heap_block_class(block);
 
-  env->external_memory = 0;
+  return size_class ? js__get_heap_class_size(size_class) : block->size;
+}
 
-  env->resolvers = NULL;
-  env->evaluators = NULL;
+static inline js_heap_block_t *
+js__allocate_small_block (js_heap_t *heap, size_t size_class) {
+  js_heap_free_t *free = heap->free[size_class];
 
-  env->promise_rejections = NULL;
+  if (free) {
+    heap->free[size_class] = free->next;
 
-  env->callbacks.uncaught_exception = NULL;
-  env->callbacks.uncaught_exception_data = NULL;
+    return (js_heap_block_t *) free;
+  }
 
-  env->callbacks.unhandled_rejection = NULL;
-  env->callbacks.unhandled_rejection_data = NULL;
+  size_t len = sizeof(js_heap_block_t) + js__get_heap_class_size(size_class);
 
-  env->callbacks.dynamic_import = NULL;
-  env->callbacks.dynamic_import_data = NULL;
+  // Blocks are carved from the current slab in allocation order. Whatever is
+  // left of a slab that cannot fit the next block is simply abandoned, which
+  // is bounded by the largest block size.
+  if (heap->cursor == NULL || (size_t) (heap->end - heap->cursor) < len) {
+    js_heap_slab_t *slab = heap->allocator.allocate(js_heap_slab_size, heap->allocator.data);
 
-  JS_SetRuntimeOpaque(env->runtime, env);
-  JS_SetContextOpaque(env->context, env);
+    if (slab == NULL) return NULL;
 
-  err = uv_prepare_init(loop, &env->prepare);
-  assert(err == 0);
+    slab->next = heap->slabs;
+    slab->len = 0;
 
-  err = uv_prepare_start(&env->prepare, js__on_prepare);
-  assert(err == 0);
+    heap->slabs = slab;
+    heap->cursor = (uint8_t *) slab + sizeof(js_heap_slab_t);
+    heap->end = (uint8_t *) slab + js_heap_slab_size;
+  }
 
-  env->prepare.data = (void *) env;
+  js_heap_block_t *block = (js_heap_block_t *) heap->cursor;
 
-  err = uv_check_init(loop, &env->check);
-  assert(err == 0);
+  heap->cursor += len;
+  heap->slabs->len += len;
 
-  err = uv_check_start(&env->check, js__on_check);
-  assert(err == 0);
+  return block;
+}
 
-  env->check.data = (void *) env;
+static void *
+js__on_malloc (JSMallocState *s, size_t size) {
+  js_heap_t *heap = (js_heap_t *) s->opaque;
 
-  // The check handle should not on its own keep the loop alive; it's simply
-  // used for running any outstanding tasks that might cause additional work
-  // to be queued.
-  uv_unref((uv_handle_t *) &env->check);
+  size_t size_class = js__get_heap_size_class(size);
 
-  *result = env;
+  size_t len = size_class ? js__get_heap_class_size(size_class) : size;
 
-  return 0;
-}
+  if (s->malloc_size + heap->external + sizeof(js_heap_block_t) + len > s->malloc_limit) return NULL;
 
-static void
-js__on_handle_close (uv_handle_t *handle) {
-  js_env_t *env = (js_env_t *) handle->data;
+  js_heap_block_t *block;
 
-  if (--env->active_handles == 0) {
-    free(env);
+  if (size_class) {
+    block = js__allocate_small_block(heap, size_class);
+  } else {
+    block = heap->allocator.allocate(sizeof(js_heap_block_t) + len, heap->allocator.data);
   }
-}
 
-int
-js_destroy_env (js_env_t *env) {
-  int err;
+  if (block == NULL) return NULL;
 
-  JS_FreeValue(env->context, env->bindings);
-  JS_FreeContext(env->context);
-  JS_FreeRuntime(env->runtime);
+  block->size = size_class ? size_class : len;
 
-  uv_ref((uv_handle_t *) &env->check);
+  s->malloc_count++;
+  s->malloc_size += sizeof(js_heap_block_t) + len;
 
-  uv_close((uv_handle_t *) &env->prepare, js__on_handle_close);
-  uv_close((uv_handle_t *) &env->check, js__on_handle_close);
+  heap->allocations++;
 
-  return 0;
+  return &block[1];
 }
 
-int
-js_on_uncaught_exception (js_env_t *env, js_uncaught_exception_cb cb, void *data) {
-  env->callbacks.uncaught_exception = cb;
-  env->callbacks.uncaught_exception_data = data;
+static void
+js__on_free (JSMallocState *s, void *ptr) {
+  if (ptr == NULL) return;
 
-  return 0;
-}
+  js_heap_t *heap = (js_heap_t *) s->opaque;
 
-int
-js_on_unhandled_rejection (js_env_t *env, js_unhandled_rejection_cb cb, void *data) {
-  env->callbacks.unhandled_rejection = cb;
-  env->callbacks.unhandled_rejection_data = data;
+  js_heap_block_t *block = &((js_heap_block_t *) ptr)[-1];
 
-  return 0;
-}
+  size_t size_class = js__get_heap_block_class(block);
 
-int
-js_on_dynamic_import (js_env_t *env, js_dynamic_import_cb cb, void *data) {
-  env->callbacks.dynamic_import = cb;
-  env->callbacks.dynamic_import_data = data;
+  s->malloc_count--;
+  s->malloc_size -= sizeof(js_heap_block_t) + js__get_heap_block_len(block);
 
-  return 0;
-}
+  if (size_class) {
+    js_heap_free_t *free = (js_heap_free_t *) block;
 
-int
-js_get_env_loop (js_env_t *env, uv_loop_t **result) {
-  *result = env->loop;
+    free->next = heap->free[size_class];
 
-  return 0;
+    heap->free[size_class] = free;
+  } else {
+    heap->allocator.deallocate(block, heap->allocator.data);
+  }
 }
 
-int
-js_get_env_platform (js_env_t *env, js_platform_t **result) {
-  *result = env->platform;
+static void *
+js__on_realloc (JSMallocState *s, void *ptr, size_t size) {
+  if (ptr == NULL) return js__on_malloc(s, size);
 
-  return 0;
-}
+  if (size == 0) {
+    js__on_free(s, ptr);
 
-static inline int
-js__error (js_env_t *env) {
-  return JS_HasException(env->context) ? js_pending_exception : js_uncaught_exception;
-}
+    return NULL;
+  }
 
-int
-js_open_handle_scope (js_env_t *env, js_handle_scope_t **result) {
-  // Allow continuing even with a pending exception
+  js_heap_t *heap = (js_heap_t *) s->opaque;
 
-  js_handle_scope_t *scope = malloc(sizeof(js_handle_scope_t));
+  js_heap_block_t *block = &((js_heap_block_t *) ptr)[-1];
 
-  scope->parent = env->scope;
-  scope->values = NULL;
-  scope->len = 0;
-  scope->capacity = 0;
+  size_t size_class = js__get_heap_size_class(size);
 
-  env->scope = scope;
+  size_t block_class = js__get_heap_block_class(block);
+  size_t block_len = js__get_heap_block_len(block);
 
-  *result = scope;
+  if (size_class && size_class == block_class) return ptr;
 
-  return 0;
-}
+  if (size_class == 0 && block_class == 0) {
+    if (s->malloc_size + heap->external - block_len + size > s->malloc_limit) return NULL;
 
-int
-js_close_handle_scope (js_env_t *env, js_handle_scope_t *scope) {
-  // Allow continuing even with a pending exception
+    js_heap_block_t *resized = heap->allocator.reallocate(block, sizeof(js_heap_block_t) + size, heap->allocator.data);
 
-  for (size_t i = 0; i < scope->len; i++) {
-    js_value_t *value = scope->values[i];
+    if (resized == NULL) return NULL;
 
-    JS_FreeValue(env->context, value->value);
+    s->malloc_size -= block_len;
+    s->malloc_size += size;
 
-    free(value);
+    resized->size = size;
+
+    return &resized[1];
   }
 
-  env->scope = scope->parent;
+  void *resized = js__on_malloc(s, size);
 
-  if (scope->values) free(scope->values);
+  if (resized == NULL) return NULL;
 
-  free(scope);
+  memcpy(resized, ptr, block_len < size ? block_len : size);
 
-  return 0;
+  js__on_free(s, ptr);
+
+  return resized;
 }
 
-int
-js_open_escapable_handle_scope (js_env_t *env, js_escapable_handle_scope_t **result) {
-  return js_open_handle_scope(env, (js_handle_scope_t **) result);
+static size_t
+js__on_usable_size (const void *ptr) {
+  if (ptr == NULL) return 0;
+
+  return js__get_heap_block_len(&((const js_heap_block_t *) ptr)[-1]);
 }
 
-int
-js_close_escapable_handle_scope (js_env_t *env, js_escapable_handle_scope_t *scope) {
-  return js_close_handle_scope(env, (js_handle_scope_t *) scope);
+static int
+js__compare_heap_slabs (const void *a, const void *b) {
+  uintptr_t x = (uintptr_t) *(js_heap_slab_t *const *) a;
+  uintptr_t y = (uintptr_t) *(js_heap_slab_t *const *) b;
+
+  return x < y ? -1 : x > y;
 }
 
-static inline void
-js__attach_to_handle_scope (js_env_t *env, js_handle_scope_t *scope, js_value_t *value) {
-  assert(scope);
+static inline size_t
+js__find_heap_slab (js_heap_slab_t **slabs, size_t len, const void *ptr) {
+  uintptr_t address = (uintptr_t) ptr;
 
-  if (scope->len >= scope->capacity) {
-    if (scope->capacity) scope->capacity *= 2;
-    else scope->capacity = 4;
+  size_t low = 0, high = len;
 
-    scope->values = realloc(scope->values, scope->capacity * sizeof(js_value_t *));
+  while (high - low > 1) {
+    size_t mid = low + (high - low) / 2;
+
+    if ((uintptr_t) slabs[mid] <= address) low = mid;
+    else high = mid;
   }
 
-  scope->values[scope->len++] = value;
+  return low;
 }
 
-int
-js_escape_handle (js_env_t *env, js_escapable_handle_scope_t *scope, js_value_t *escapee, js_value_t **result) {
-  // Allow continuing even with a pending exception
-
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
-
-  wrapper->value = JS_DupValue(env->context, escapee->value);
+static void
+js__trim_heap (js_heap_t *heap) {
+  size_t len = 0;
 
-  *result = wrapper;
+  for (js_heap_slab_t *slab = heap->slabs; slab; slab = slab->next) len++;
 
-  js__attach_to_handle_scope(env, scope->parent, wrapper);
+  if (len == 0) return;
 
-  return 0;
-}
+  // Sort the slabs by address such that the slab of a free block can be
+  // found by bisection, and tally the free bytes of each slab.
+  js_heap_slab_t **slabs = heap->allocator.allocate(len * (sizeof(js_heap_slab_t *) + sizeof(size_t)), heap->allocator.data);
 
-int
-js_create_context (js_env_t *env, js_context_t **result) {
-  js_throw_error(env, NULL, "Unsupported operation");
+  if (slabs == NULL) return;
 
-  return js__error(env);
-}
+  size_t *unused = (size_t *) &slabs[len];
 
-int
-js_destroy_context (js_env_t *env, js_context_t *context) {
-  js_throw_error(env, NULL, "Unsupported operation");
+  size_t i = 0;
 
-  return js__error(env);
-}
+  for (js_heap_slab_t *slab = heap->slabs; slab; slab = slab->next) slabs[i++] = slab;
 
-int
-js_enter_context (js_env_t *env, js_context_t *context) {
-  js_throw_error(env, NULL, "Unsupported operation");
+  qsort(slabs, len, sizeof(js_heap_slab_t *), js__compare_heap_slabs);
 
-  return js__error(env);
-}
+  memset(unused, 0, len * sizeof(size_t));
 
-int
-js_exit_context (js_env_t *env, js_context_t *context) {
-  js_throw_error(env, NULL, "Unsupported operation");
+  size_t classes = sizeof(heap->free) / sizeof(heap->free[0]);
 
-  return js__error(env);
-}
+  for (size_t size_class = 1; size_class < classes; size_class++) {
+    for (js_heap_free_t *free = heap->free[size_class]; free; free = free->next) {
+      unused[js__find_heap_slab(slabs, len, free)] += sizeof(js_heap_block_t) + js__get_heap_class_size(size_class);
+    }
+  }
 
-int
-js_get_bindings (js_env_t *env, js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
+  // A slab all of whose blocks are free is released, which first means
+  // taking its blocks off the free lists.
+  for (size_t size_class = 1; size_class < classes; size_class++) {
+    js_heap_free_t **next = &heap->free[size_class];
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+    while (*next) {
+      size_t j = js__find_heap_slab(slabs, len, *next);
 
-  wrapper->value = JS_DupValue(env->context, env->bindings);
+      if (unused[j] == slabs[j]->len) *next = (*next)->next;
+      else next = &(*next)->next;
+    }
+  }
 
-  *result = wrapper;
+  js_heap_slab_t **next = &heap->slabs;
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  while (*next) {
+    js_heap_slab_t *slab = *next;
 
-  return 0;
-}
+    size_t j = js__find_heap_slab(slabs, len, slab);
 
-int
-js_run_script (js_env_t *env, const char *file, size_t len, int offset, js_value_t *source, js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
+    if (unused[j] == slab->len) {
+      *next = slab->next;
 
-  size_t str_len;
-  const char *str = JS_ToCStringLen(env->context, &str_len, source->value);
+      if (heap->cursor >= (uint8_t *) slab && heap->cursor <= (uint8_t *) slab + js_heap_slab_size) {
+        heap->cursor = NULL;
+        heap->end = NULL;
+      }
 
-  env->depth++;
+      heap->allocator.deallocate(slab, heap->allocator.data);
+    } else {
+      next = &slab->next;
+    }
+  }
 
-  if (file == NULL) file = "";
+  heap->allocator.deallocate(slabs, heap->allocator.data);
+}
 
-  JSValue value = JS_Eval(
-    env->context,
-    str,
-    str_len,
-    file,
-    JS_EVAL_TYPE_GLOBAL
-  );
+static inline js_arraybuffer_header_t *
+js__create_arraybuffer_header (size_t len, bool zero_fill) {
+  js_arraybuffer_header_t *header = zero_fill
+                                      ? calloc(1, sizeof(js_arraybuffer_header_t) + len)
+                                      : malloc(sizeof(js_arraybuffer_header_t) + len);
 
-  JS_FreeCString(env->context, str);
+  if (header == NULL) return NULL;
 
-  if (env->depth == 1) js__on_run_microtasks(env);
+  header->references = 1;
+  header->len = len;
 
-  env->depth--;
+  return header;
+}
 
-  if (JS_IsException(value)) {
-    if (env->depth == 0) {
-      JSValue error = JS_GetException(env->context);
+static inline js_arraybuffer_header_t *
+js__get_arraybuffer_header (void *data) {
+  return (js_arraybuffer_header_t *) ((char *) data - sizeof(js_arraybuffer_header_t));
+}
 
-      js__on_uncaught_exception(env->context, error);
-    }
+static inline void
+js__ref_arraybuffer_header (js_arraybuffer_header_t *header) {
+  atomic_fetch_add_explicit(&header->references, 1, memory_order_relaxed);
+}
 
-    return js__error(env);
+static inline void
+js__unref_arraybuffer_header (js_arraybuffer_header_t *header) {
+  if (atomic_fetch_sub_explicit(&header->references, 1, memory_order_acq_rel) == 1) {
+    free(header);
   }
+}
 
-  if (result == NULL) JS_FreeValue(env->context, value);
-  else {
-    js_value_t *wrapper = malloc(sizeof(js_value_t));
+static void *
+js__on_shared_malloc (void *opaque, size_t size) {
+  js_arraybuffer_header_t *header = js__create_arraybuffer_header(size, false);
 
-    wrapper->value = value;
+  if (header == NULL) return NULL;
 
-    *result = wrapper;
+  return header->data;
+}
 
-    js__attach_to_handle_scope(env, env->scope, wrapper);
-  }
+static void
+js__on_shared_free (void *opaque, void *ptr) {
+  js__unref_arraybuffer_header(js__get_arraybuffer_header(ptr));
+}
 
-  return 0;
+static void
+js__on_shared_dup (void *opaque, void *ptr) {
+  js__ref_arraybuffer_header(js__get_arraybuffer_header(ptr));
 }
 
-int
-js_create_module (js_env_t *env, const char *name, size_t len, int offset, js_value_t *source, js_module_meta_cb cb, void *data, js_module_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
+static inline void
+js__init_intrinsic_class (js_env_t *env, js_intrinsic_class_t *class, JSValue global, const char *name, int argc, JSValue *argv) {
+  class->constructor = JS_GetPropertyStr(env->context, global, name);
 
-  js_module_t *module = malloc(sizeof(js_module_t));
+  JSValue sample = JS_CallConstructor(env->context, class->constructor, argc, argv);
 
-  module->context = env->context;
-  module->source = JS_DupValue(env->context, source->value);
-  module->bytecode = JS_NULL;
-  module->definition = NULL;
-  module->name = strndup(name, len);
-  module->meta = cb;
-  module->meta_data = data;
+  // QuickJS doesn't expose the class ID of an object, but every typed array,
+  // DataView, and ArrayBuffer carries a non-NULL opaque pointer to its backing
+  // view or buffer that JS_GetOpaque() only hands out when given the matching
+  // class ID.
+  for (class->id = 1; class->id < UINT16_MAX; class->id++) {
+    if (JS_GetOpaque(sample, class->id)) break;
+  }
 
-  *result = module;
+  assert(class->id < UINT16_MAX);
 
-  return 0;
+  JS_FreeValue(env->context, sample);
 }
 
-static int
-js__on_evaluate_module (JSContext *context, JSModuleDef *definition) {
-  int err;
-
-  js_env_t *env = (js_env_t *) JS_GetContextOpaque(context);
-
-  js_module_evaluator_t *evaluator = env->evaluators;
+static void
+js__init_intrinsic_classes (js_env_t *env) {
+  JSValue global = JS_GetGlobalObject(env->context);
 
-  while (evaluator && evaluator->module->definition != definition) {
-    evaluator = evaluator->next;
+  for (size_t i = 0; i < js_typedarray_classes_len; i++) {
+    js__init_intrinsic_class(env, &env->typedarrays[i], global, js_typedarray_classes[i].name, 0, NULL);
   }
 
-  js_handle_scope_t *scope;
-  err = js_open_handle_scope(env, &scope);
-  assert(err == 0);
+  JSValue arraybuffer = JS_NewArrayBufferCopy(env->context, NULL, 0);
 
-  evaluator->cb(env, evaluator->module, evaluator->data);
+  js__init_intrinsic_class(env, &env->dataview, global, "DataView", 1, &arraybuffer);
 
-  err = js_close_handle_scope(env, scope);
-  assert(err == 0);
+  js__init_intrinsic_class(env, &env->arraybuffer, global, "ArrayBuffer", 0, NULL);
 
-  return 0;
-}
+  env->error = JS_GetPropertyStr(env->context, global, "Error");
 
-int
-js_create_synthetic_module (js_env_t *env, const char *name, size_t len, js_value_t *const export_names[], size_t names_len, js_module_evaluate_cb cb, void *data, js_module_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
+  JS_FreeValue(env->context, arraybuffer);
+  JS_FreeValue(env->context, global);
+}
 
-  js_module_t *module = malloc(sizeof(js_module_t));
+static void
+js__on_sample_arraybuffer_finalize (JSRuntime *runtime, void *opaque, void *ptr) {}
 
-  module->context = env->context;
-  module->source = JS_NULL;
-  module->bytecode = JS_NULL;
-  module->definition = JS_NewCModule(env->context, name, js__on_evaluate_module);
-  module->name = strndup(name, len);
-  module->meta = NULL;
-  module->meta_data = NULL;
+static void
+js__init_arraybuffer_opaque (js_env_t *env) {
+  static uint8_t data;
+  static uint8_t opaque;
 
-  for (size_t i = 0; i < names_len; i++) {
-    const char *str = JS_ToCString(env->context, export_names[i]->value);
+  JSFreeArrayBufferDataFunc *free_func = js__on_sample_arraybuffer_finalize;
 
-    JS_AddModuleExport(env->context, module->definition, str);
+  JSValue sample = JS_NewArrayBuffer(env->context, &data, 1, free_func, &opaque, false);
 
-    JS_FreeCString(env->context, str);
-  }
+  // Much like the class IDs, QuickJS doesn't expose the opaque pointer and
+  // free function of an ArrayBuffer, so look for them among the words of its
+  // backing buffer, as allocated from our heap. Should they not be found,
+  // backing stores fall back to pinning their ArrayBuffer.
+  void **words = (void **) JS_GetOpaque(sample, env->arraybuffer.id);
 
-  js_module_evaluator_t *evaluator = malloc(sizeof(js_module_evaluator_t));
+  size_t len = js__on_usable_size(words) / sizeof(void *);
 
-  evaluator->module = module;
-  evaluator->cb = cb;
-  evaluator->data = data;
-  evaluator->next = env->evaluators;
+  env->arraybuffer_opaque = -1;
 
-  env->evaluators = evaluator;
+  for (size_t i = 0; i + 1 < len; i++) {
+    if (words[i] == (void *) &opaque && memcmp(&words[i + 1], &free_func, sizeof(free_func)) == 0) {
+      env->arraybuffer_opaque = (int) i;
 
-  *result = module;
+      break;
+    }
+  }
 
-  return 0;
+  JS_FreeValue(env->context, sample);
 }
 
-int
-js_delete_module (js_env_t *env, js_module_t *module) {
-  // Allow continuing even with a pending exception
+static inline void *
+js__get_arraybuffer_opaque (js_env_t *env, JSValue arraybuffer, JSFreeArrayBufferDataFunc *free_func) {
+  if (env->arraybuffer_opaque < 0) return NULL;
 
-  JS_FreeValue(env->context, module->source);
-  JS_FreeValue(env->context, module->bytecode);
+  void **words = (void **) JS_GetOpaque(arraybuffer, env->arraybuffer.id);
 
-  free(module->name);
-  free(module);
+  if (words == NULL) return NULL;
 
-  return 0;
+  JSFreeArrayBufferDataFunc *actual;
+  memcpy(&actual, &words[env->arraybuffer_opaque + 1], sizeof(actual));
+
+  return actual == free_func ? words[env->arraybuffer_opaque] : NULL;
 }
 
-int
-js_get_module_name (js_env_t *env, js_module_t *module, const char **result) {
-  // Allow continuing even with a pending exception
+static void
+js__init_slots (js_env_t *env) {
+  // Objects that aren't instances of native classes have their slots
+  // attached through a WeakMap private to the env. Unlike a property, the
+  // entry can't be observed or retained from JavaScript, looking it up never
+  // runs Proxy traps, and it's released as soon as the object is freed. This
+  // isn't free, however: for such objects every lookup is a call into the
+  // WeakMap and a hash lookup, so only instances of native classes, which
+  // carry their slots inline, avoid calling into JavaScript altogether.
+  JSValue global = JS_GetGlobalObject(env->context);
+  JSValue constructor = JS_GetPropertyStr(env->context, global, "WeakMap");
+  JSValue prototype = JS_GetPropertyStr(env->context, constructor, "prototype");
 
-  *result = module->name;
+  env->slots.map = JS_CallConstructor(env->context, constructor, 0, NULL);
+  env->slots.get = JS_GetPropertyStr(env->context, prototype, "get");
+  env->slots.set = JS_GetPropertyStr(env->context, prototype, "set");
 
-  return 0;
+  JS_FreeValue(env->context, prototype);
+  JS_FreeValue(env->context, constructor);
+  JS_FreeValue(env->context, global);
 }
 
-int
-js_get_module_namespace (js_env_t *env, js_module_t *module, js_value_t **result) {
-  // Allow continuing even with a pending exception
-
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+static void
+js__free_slots (js_env_t *env) {
+  JS_FreeValue(env->context, env->slots.set);
+  JS_FreeValue(env->context, env->slots.get);
+  JS_FreeValue(env->context, env->slots.map);
+}
 
-  wrapper->value = JS_GetModuleNamespace(env->context, module->definition);
+static void
+js__free_intrinsic_classes (js_env_t *env) {
+  for (size_t i = 0; i < js_typedarray_classes_len; i++) {
+    JS_FreeValue(env->context, env->typedarrays[i].constructor);
+  }
 
-  *result = wrapper;
+  JS_FreeValue(env->context, env->dataview.constructor);
+  JS_FreeValue(env->context, env->arraybuffer.constructor);
+  JS_FreeValue(env->context, env->error);
+}
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+static inline js_intrinsic_class_t *
+js__get_typedarray_class (js_env_t *env, js_typedarray_type_t type) {
+  for (size_t i = 0; i < js_typedarray_classes_len; i++) {
+    if (js_typedarray_classes[i].type == type) return &env->typedarrays[i];
+  }
 
-  return 0;
+  return NULL;
 }
 
-int
-js_set_module_export (js_env_t *env, js_module_t *module, js_value_t *name, js_value_t *value) {
-  if (JS_HasException(env->context)) return js__error(env);
+static inline bool
+js__is_intrinsic_class (js_intrinsic_class_t *class, JSValue value) {
+  return JS_GetOpaque(value, class->id) != NULL;
+}
 
-  const char *str = JS_ToCString(env->context, name->value);
+static uint32_t
+js__get_profile_node (js_profiler_t *profiler, uint32_t parent, const char *function_name, size_t function_name_len, const char *url, size_t url_len, int line) {
+  uint32_t index = profiler->nodes[parent].child;
 
-  int success = JS_SetModuleExport(env->context, module->definition, str, JS_DupValue(env->context, value->value));
+  while (index) {
+    js_profile_node_t *node = &profiler->nodes[index];
 
-  JS_FreeCString(env->context, str);
+    if (
+      node->line == line &&
+      strlen(node->function_name) == function_name_len && memcmp(node->function_name, function_name, function_name_len) == 0 &&
+      strlen(node->url) == url_len && memcmp(node->url, url, url_len) == 0
+    ) {
+      return index;
+    }
 
-  if (success < 0) {
-    js_throw_error(env, NULL, "Could not set module export");
+    index = node->sibling;
+  }
 
-    return js__error(env);
+  if (profiler->nodes_len == profiler->nodes_capacity) {
+    profiler->nodes_capacity *= 2;
+    profiler->nodes = realloc(profiler->nodes, profiler->nodes_capacity * sizeof(js_profile_node_t));
   }
 
-  return 0;
-}
+  index = (uint32_t) profiler->nodes_len++;
 
-int
-js_instantiate_module (js_env_t *env, js_module_t *module, js_module_resolve_cb cb, void *data) {
-  if (JS_HasException(env->context)) return js__error(env);
+  js_profile_node_t *node = &profiler->nodes[index];
 
-  if (JS_IsNull(module->source)) return 0;
+  node->function_name = strndup(function_name, function_name_len);
+  node->url = strndup(url, url_len);
+  node->line = line;
+  node->hits = 0;
+  node->child = 0;
 
-  js_module_resolver_t resolver = {
-    .module = module,
-    .cb = cb,
-    .data = data,
-    .next = env->resolvers,
-  };
+  // Prepend the node to the children of its parent.
+  node->sibling = profiler->nodes[parent].child;
+  profiler->nodes[parent].child = index;
 
-  env->resolvers = &resolver;
+  return index;
+}
 
-  size_t str_len;
-  const char *str = JS_ToCStringLen(env->context, &str_len, module->source);
+static void
+js__sample_profile (js_env_t *env) {
+  js_profiler_t *profiler = env->profiler;
 
-  env->depth++;
+  // QuickJS has no public API for walking the stack, so capture a backtrace
+  // by constructing an Error and parse its stack, which has one line of the
+  // form `    at <name> (<file>:<line>)` per frame, innermost first. The
+  // intrinsic constructor is used as the global may have been replaced by
+  // code that mustn't run at arbitrary interrupt points.
+  JSValue error = JS_CallConstructor(env->context, env->error, 0, NULL);
 
-  JSValue bytecode = JS_Eval(
-    env->context,
-    str,
-    str_len,
-    module->name,
-    JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY
-  );
+  JSValue stack = JS_IsException(error) ? JS_EXCEPTION : JS_GetPropertyStr(env->context, error, "stack");
 
-  JS_FreeCString(env->context, str);
+  const char *str = JS_IsException(stack) ? NULL : JS_ToCString(env->context, stack);
 
-  if (env->depth == 1) js__on_run_microtasks(env);
+  JS_FreeValue(env->context, stack);
+  JS_FreeValue(env->context, error);
+
+  if (str == NULL) {
+    JS_FreeValue(env->context, JS_GetException(env->context));
 
-  env->depth--;
+    return;
+  }
 
-  if (JS_IsException(bytecode)) {
-    if (env->depth == 0) {
-      JSValue error = JS_GetException(env->context);
+  // Deep stacks are cut short at the innermost frames, keeping the path from
+  // the root intact.
+  size_t lines = 0;
 
-      js__on_uncaught_exception(env->context, error);
-    }
+  for (const char *line = str; line && *line; lines++) {
+    line = strchr(line, '\n');
 
-    return js__error(env);
+    if (line) line++;
   }
 
-  module->bytecode = bytecode;
-
-  module->definition = (JSModuleDef *) JS_VALUE_GET_PTR(bytecode);
+  size_t skip = lines > 128 ? lines - 128 : 0;
 
-  env->resolvers = resolver.next;
+  const char *frames[128];
+  size_t frames_len = 0;
 
-  return 0;
-}
+  for (const char *line = str; line && *line;) {
+    if (skip) skip--;
+    else frames[frames_len++] = line;
 
-int
-js_run_module (js_env_t *env, js_module_t *module, js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
+    line = strchr(line, '\n');
 
-  int err;
+    if (line) line++;
+  }
 
-  if (module->meta) {
-    JSValue meta = JS_GetImportMeta(env->context, module->definition);
+  uint32_t node = 0;
 
-    module->meta(env, module, &(js_value_t) {meta}, module->meta_data);
+  // Walk the frames from the outermost inwards to descend from the root.
+  for (size_t i = frames_len; i-- > 0;) {
+    const char *frame = frames[i];
+    const char *end = strchr(frame, '\n');
 
-    JS_FreeValue(env->context, meta);
+    if (end == NULL) end = frame + strlen(frame);
 
-    if (JS_HasException(env->context)) {
-      JSValue error = JS_GetException(env->context);
+    while (frame < end && *frame == ' ') frame++;
 
-      js_deferred_t *deferred;
-      err = js_create_promise(env, &deferred, result);
-      if (err < 0) return err;
+    if (end - frame < 3 || strncmp(frame, "at ", 3) != 0) continue;
 
-      js_reject_deferred(env, deferred, &(js_value_t) {error});
+    frame += 3;
 
-      JS_FreeValue(env->context, error);
+    const char *location = NULL;
 
-      return 0;
+    for (const char *p = end - 1; p > frame; p--) {
+      if (p[0] == '(' && p[-1] == ' ') {
+        location = p;
+        break;
+      }
     }
-  }
 
-  env->depth++;
+    const char *name_end = location ? location - 1 : end;
+    const char *url = "";
+    size_t url_len = 0;
+    int line = -1;
 
-  JSValue value = JS_EvalFunction(env->context, module->bytecode);
+    if (location && end[-1] == ')' && strncmp(location, "(native)", 8) != 0) {
+      url = location + 1;
 
-  if (env->depth == 1) js__on_run_microtasks(env);
+      const char *url_end = end - 1;
+      const char *colon = url_end;
 
-  env->depth--;
+      while (colon > url && colon[-1] >= '0' && colon[-1] <= '9') colon--;
 
-  module->bytecode = JS_NULL;
+      if (colon > url && colon < url_end && colon[-1] == ':') {
+        // Lines are 1-based in QuickJS but 0-based in CPU profiles.
+        line = atoi(colon) - 1;
 
-  if (JS_IsException(value)) {
-    JSValue error = JS_GetException(env->context);
+        url_end = colon - 1;
+      }
 
-    js_deferred_t *deferred;
-    err = js_create_promise(env, &deferred, result);
-    if (err < 0) return err;
+      url_len = url_end - url;
+    }
 
-    js_reject_deferred(env, deferred, &(js_value_t) {error});
+    node = js__get_profile_node(profiler, node, frame, name_end - frame, url, url_len, line);
+  }
 
-    JS_FreeValue(env->context, error);
+  JS_FreeCString(env->context, str);
 
-    return 0;
+  profiler->nodes[node].hits++;
+
+  if (profiler->samples_len == profiler->samples_capacity) {
+    profiler->samples_capacity *= 2;
+    profiler->samples = realloc(profiler->samples, profiler->samples_capacity * sizeof(uint32_t));
+    profiler->timestamps = realloc(profiler->timestamps, profiler->samples_capacity * sizeof(uint64_t));
   }
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  profiler->samples[profiler->samples_len] = node;
+  profiler->timestamps[profiler->samples_len] = uv_hrtime();
+  profiler->samples_len++;
+}
 
-  wrapper->value = value;
+static void
+js__on_profiler_thread (void *data) {
+  js_profiler_t *profiler = (js_profiler_t *) data;
 
-  *result = wrapper;
+  uv_mutex_lock(&profiler->lock);
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  // The thread merely marks that a sample is due, which the interrupt handler
+  // picks up on the thread of the env the next time it runs.
+  while (!profiler->stopping) {
+    if (uv_cond_timedwait(&profiler->wake, &profiler->lock, profiler->interval) == UV_ETIMEDOUT) {
+      atomic_store_explicit(&profiler->pending, true, memory_order_release);
+    }
+  }
 
-  return 0;
+  uv_mutex_unlock(&profiler->lock);
 }
 
 static void
-js__on_reference_finalize (js_env_t *env, void *data, void *finalize_hint) {
-  js_ref_t *reference = (js_ref_t *) data;
+js__free_profiler (js_profiler_t *profiler) {
+  int err;
 
-  reference->value = JS_NULL;
-  reference->finalized = true;
-}
+  uv_mutex_lock(&profiler->lock);
 
-static inline void
-js__set_weak_reference (js_env_t *env, js_ref_t *reference) {
-  if (reference->finalized) return;
+  profiler->stopping = true;
 
-  int err;
+  uv_cond_signal(&profiler->wake);
 
-  js_finalizer_t *finalizer = malloc(sizeof(js_finalizer_t));
+  uv_mutex_unlock(&profiler->lock);
 
-  finalizer->data = reference;
-  finalizer->finalize_cb = js__on_reference_finalize;
-  finalizer->finalize_hint = NULL;
+  err = uv_thread_join(&profiler->thread);
+  assert(err == 0);
 
-  JSValue external = JS_NewObjectClass(env->context, js_external_class_id);
+  uv_cond_destroy(&profiler->wake);
+  uv_mutex_destroy(&profiler->lock);
 
-  JS_SetOpaque(external, finalizer);
+  for (size_t i = 0; i < profiler->nodes_len; i++) {
+    free(profiler->nodes[i].function_name);
+    free(profiler->nodes[i].url);
+  }
 
-  JSAtom atom = JS_ValueToAtom(env->context, reference->symbol);
+  free(profiler->nodes);
+  free(profiler->samples);
+  free(profiler->timestamps);
+  free(profiler);
+}
 
-  err = JS_DefinePropertyValue(env->context, reference->value, atom, external, 0);
-  assert(err >= 0);
+static int
+js__on_interrupt (JSRuntime *runtime, void *opaque) {
+  js_env_t *env = (js_env_t *) JS_GetRuntimeOpaque(runtime);
 
-  JS_FreeAtom(env->context, atom);
+  // Pooled runtimes aren't bound to any env.
+  if (env == NULL) return 0;
 
-  JS_FreeValue(env->context, reference->value);
-}
+  if (env->profiler && atomic_exchange_explicit(&env->profiler->pending, false, memory_order_acquire)) {
+    js__sample_profile(env);
+  }
 
-static inline void
-js__clear_weak_reference (js_env_t *env, js_ref_t *reference) {
-  if (reference->finalized) return;
+  // A termination request only applies once, after which the env can run
+  // code again, while the budget and deadline only apply to the current entry
+  // into JavaScript. Returning non-zero makes QuickJS throw an uncatchable
+  // error that unwinds all the way to the native caller.
+  if (atomic_exchange_explicit(&env->execution.terminate, false, memory_order_acquire)) return 1;
 
-  int err;
+  if (env->execution.remaining) {
+    if (env->execution.remaining <= js_interrupt_interval) {
+      env->execution.remaining = 0;
 
-  JS_DupValue(env->context, reference->value);
+      return 1;
+    }
+
+    env->execution.remaining -= js_interrupt_interval;
+  }
+
+  if (env->execution.deadline && uv_hrtime() >= env->execution.deadline) {
+    env->execution.deadline = 0;
 
-  JSAtom atom = JS_ValueToAtom(env->context, reference->symbol);
+    return 1;
+  }
 
-  JSValue external = JS_GetProperty(env->context, reference->value, atom);
+  return 0;
+}
 
-  js_finalizer_t *finalizer = (js_finalizer_t *) JS_GetOpaque(external, js_external_class_id);
+static JSRuntime *
+js__create_runtime (js_heap_t *heap) {
+  JSRuntime *runtime = JS_NewRuntime2(
+    &(JSMallocFunctions) {
+      .js_malloc = js__on_malloc,
+      .js_free = js__on_free,
+      .js_realloc = js__on_realloc,
+      .js_malloc_usable_size = js__on_usable_size,
+    },
+    heap
+  );
 
-  JS_FreeValue(env->context, external);
+  JS_SetSharedArrayBufferFunctions(
+    runtime,
+    &(JSSharedArrayBufferFunctions) {
+      .sab_alloc = js__on_shared_malloc,
+      .sab_free = js__on_shared_free,
+      .sab_dup = js__on_shared_dup,
+      .sab_opaque = NULL,
+    }
+  );
 
-  finalizer->finalize_cb = NULL;
+  JS_SetMaxStackSize(runtime, 864 * 1024);
+  JS_SetCanBlock(runtime, false);
+  JS_SetModuleLoaderFunc(runtime, NULL, js__on_resolve_module, NULL);
+  JS_SetHostPromiseRejectionTracker(runtime, js__on_promise_rejection, NULL);
+  JS_SetInterruptHandler(runtime, js__on_interrupt, NULL);
 
-  err = JS_DeleteProperty(env->context, reference->value, atom, 0);
-  assert(err >= 0);
+  JS_NewClass(runtime, js_external_class_id, &js_external_class);
+  JS_NewClass(runtime, js_slots_class_id, &js_slots_class);
+  JS_NewClass(runtime, js_function_class_id, &js_function_class);
+  JS_NewClass(runtime, js_constructor_class_id, &js_constructor_class);
+  JS_NewClass(runtime, js_delegate_class_id, &js_delegate_class);
 
-  JS_FreeAtom(env->context, atom);
+  return runtime;
 }
 
-int
-js_create_reference (js_env_t *env, js_value_t *value, uint32_t count, js_ref_t **result) {
-  // Allow continuing even with a pending exception
+static JSRuntime *
+js__acquire_runtime (js_platform_t *platform, js_heap_t **heap) {
+  uv_thread_t thread = uv_thread_self();
 
-  js_ref_t *reference = malloc(sizeof(js_ref_t));
+  JSRuntime *runtime = NULL;
 
-  reference->value = JS_DupValue(env->context, value->value);
-  reference->count = count;
-  reference->finalized = false;
+  uv_mutex_lock(&platform->runtimes.lock);
 
-  if (JS_IsObject(reference->value) || JS_IsFunction(env->context, reference->value)) {
-    JSValue global = JS_GetGlobalObject(env->context);
-    JSValue constructor = JS_GetPropertyStr(env->context, global, "Symbol");
+  js_pooled_runtime_t **next = &platform->runtimes.head;
 
-    JSValue description = JS_NewString(env->context, "__native_reference");
+  // The stack limit of a runtime is derived from the stack of the thread that
+  // created it, so only runtimes created on the calling thread may be reused.
+  while (*next) {
+    js_pooled_runtime_t *pooled = *next;
 
-    reference->symbol = JS_Call(env->context, constructor, global, 1, &description);
+    if (uv_thread_equal(&pooled->thread, &thread)) {
+      *next = pooled->next;
 
-    JS_FreeValue(env->context, description);
-    JS_FreeValue(env->context, constructor);
-    JS_FreeValue(env->context, global);
+      platform->runtimes.len--;
 
-    if (reference->count == 0) js__set_weak_reference(env, reference);
-  } else {
-    reference->symbol = JS_NULL;
-  }
+      runtime = pooled->runtime;
 
-  *result = reference;
+      *heap = pooled->heap;
 
-  return 0;
-}
+      free(pooled);
 
-int
-js_delete_reference (js_env_t *env, js_ref_t *reference) {
-  // Allow continuing even with a pending exception
+      break;
+    }
 
-  if (JS_IsObject(reference->value) || JS_IsFunction(env->context, reference->value)) {
-    if (reference->count == 0) js__clear_weak_reference(env, reference);
+    next = &pooled->next;
   }
 
-  JS_FreeValue(env->context, reference->value);
+  uv_mutex_unlock(&platform->runtimes.lock);
 
-  JS_FreeValue(env->context, reference->symbol);
+  if (runtime == NULL) {
+    *heap = js__create_heap(&platform->allocator);
 
-  free(reference);
+    runtime = js__create_runtime(*heap);
+  }
 
-  return 0;
+  return runtime;
 }
 
-int
-js_reference_ref (js_env_t *env, js_ref_t *reference, uint32_t *result) {
-  // Allow continuing even with a pending exception
+static void
+js__release_runtime (js_platform_t *platform, JSRuntime *runtime, js_heap_t *heap) {
+  bool reusable = atomic_load_explicit(&platform->runtimes.limit, memory_order_relaxed) > 0;
 
-  reference->count++;
+  if (reusable) {
+    JS_RunGC(runtime);
 
-  if (JS_IsObject(reference->value) || JS_IsFunction(env->context, reference->value)) {
-    if (reference->count == 1) js__clear_weak_reference(env, reference);
+    JSMemoryUsage usage;
+    JS_ComputeMemoryUsage(runtime, &usage);
+
+    // A runtime can only be reused once every object allocated by its
+    // previous env has been collected as the finalizers of any lingering
+    // objects would otherwise run against the next env.
+    reusable = usage.obj_count == 0;
   }
 
-  if (result) *result = reference->count;
+  if (reusable) {
+    uv_mutex_lock(&platform->runtimes.lock);
 
-  return 0;
-}
+    reusable = platform->runtimes.len < atomic_load_explicit(&platform->runtimes.limit, memory_order_relaxed);
 
-int
-js_reference_unref (js_env_t *env, js_ref_t *reference, uint32_t *result) {
-  // Allow continuing even with a pending exception
+    if (reusable) {
+      js_pooled_runtime_t *pooled = malloc(sizeof(js_pooled_runtime_t));
 
-  if (reference->count > 0) {
-    reference->count--;
+      // Any external memory still accounted belongs to an env that is gone.
+      heap->external = 0;
 
-    if (reference->count == 1) {
-      if (JS_IsObject(reference->value) || JS_IsFunction(env->context, reference->value)) {
-        js__set_weak_reference(env, reference);
-      }
+      // Don't hold on to the peak heap of the previous env for as long as the
+      // runtime is pooled, only to what the runtime itself still uses.
+      js__trim_heap(heap);
+
+      JS_SetRuntimeOpaque(runtime, NULL);
+
+      pooled->runtime = runtime;
+      pooled->heap = heap;
+      pooled->thread = uv_thread_self();
+      pooled->next = platform->runtimes.head;
+
+      platform->runtimes.head = pooled;
+      platform->runtimes.len++;
     }
+
+    uv_mutex_unlock(&platform->runtimes.lock);
   }
 
-  if (result) *result = reference->count;
+  if (!reusable) js__free_runtime(runtime, heap);
+}
+
+int
+js_set_platform_allocator (js_platform_t *platform, const js_allocator_t *allocator) {
+  platform->allocator = allocator ? *allocator : js_default_allocator;
 
   return 0;
 }
 
 int
-js_get_reference_value (js_env_t *env, js_ref_t *reference, js_value_t **result) {
-  // Allow continuing even with a pending exception
+js_set_platform_runtime_pool_limit (js_platform_t *platform, size_t limit) {
+  uv_mutex_lock(&platform->runtimes.lock);
 
-  if (reference->finalized) *result = NULL;
-  else {
-    js_value_t *wrapper = malloc(sizeof(js_value_t));
+  atomic_store_explicit(&platform->runtimes.limit, limit, memory_order_relaxed);
+
+  js_pooled_runtime_t **next = &platform->runtimes.head;
+
+  size_t len = 0;
 
-    wrapper->value = JS_DupValue(env->context, reference->value);
+  while (*next) {
+    js_pooled_runtime_t *pooled = *next;
 
-    *result = wrapper;
+    if (len < limit) {
+      next = &pooled->next;
 
-    js__attach_to_handle_scope(env, env->scope, wrapper);
+      len++;
+    } else {
+      *next = pooled->next;
+
+      js__free_runtime(pooled->runtime, pooled->heap);
+
+      free(pooled);
+    }
   }
 
-  return 0;
-}
+  platform->runtimes.len = len;
 
-static void
-js__on_constructor_finalize (JSRuntime *runtime, JSValue value) {
-  js_callback_t *callback = (js_callback_t *) JS_GetOpaque(value, js_constructor_class_id);
+  uv_mutex_unlock(&platform->runtimes.lock);
 
-  free(callback);
+  return 0;
 }
 
-static JSValue
-js__on_constructor_call (JSContext *context, JSValueConst new_target, int argc, JSValueConst *argv, int magic, JSValue *data) {
+int
+js_create_env (uv_loop_t *loop, js_platform_t *platform, const js_env_options_t *options, js_env_t **result) {
   int err;
 
-  JSValue prototype = JS_GetPropertyStr(context, new_target, "prototype");
+  js_heap_t *heap;
+  JSRuntime *runtime = js__acquire_runtime(platform, &heap);
 
-  JSValue receiver = JS_NewObjectProto(context, prototype);
+  if (options && options->memory_limit) {
+    JS_SetMemoryLimit(runtime, options->memory_limit);
+  } else {
+    uint64_t constrained_memory = uv_get_constrained_memory();
+    uint64_t total_memory = uv_get_total_memory();
 
-  JS_FreeValue(context, prototype);
+    if (constrained_memory > 0 && constrained_memory < total_memory) {
+      total_memory = constrained_memory;
+    }
 
-  js_env_t *env = (js_env_t *) JS_GetContextOpaque(context);
+    if (total_memory > 0) {
+      JS_SetMemoryLimit(runtime, total_memory);
+    }
+  }
 
-  js_callback_t *callback = (js_callback_t *) JS_GetOpaque(*data, js_constructor_class_id);
+  js_env_t *env = malloc(sizeof(js_env_t));
 
-  js_callback_info_t callback_info = {
-    .callback = callback,
-    .argc = argc,
-    .argv = argv,
-    .receiver = receiver,
-    .new_target = new_target,
-  };
+  env->loop = loop;
+  env->active_handles = 2;
 
-  js_handle_scope_t *scope;
-  err = js_open_handle_scope(env, &scope);
-  assert(err == 0);
+  env->platform = platform;
 
-  js_value_t *result = callback->cb(env, &callback_info);
+  env->scope = NULL;
+  env->unused_scopes = NULL;
 
-  JSValue value, error;
+  env->undefined = JS_UNDEFINED;
 
-  if (result == NULL) value = JS_UNDEFINED;
-  else value = JS_DupValue(env->context, result->value);
+  env->depth = 0;
 
-  if (JS_HasException(env->context)) {
-    JS_FreeValue(env->context, value);
+  env->runtime = runtime;
+  env->heap = heap;
+  env->context = JS_NewContext(runtime);
+  env->bindings = JS_NewObject(env->context);
 
-    value = JS_EXCEPTION;
-  }
+  js__init_intrinsic_classes(env);
+  js__init_arraybuffer_opaque(env);
+  js__init_slots(env);
 
-  err = js_close_handle_scope(env, scope);
-  assert(err == 0);
+  env->external_memory = 0;
+  env->mapped_memory = 0;
 
-  return receiver;
-}
+  env->gc.low = js_external_memory_low_watermark;
+  env->gc.high = js_external_memory_high_watermark;
+  env->gc.trigger = env->gc.high;
+  env->gc.scheduled = false;
 
-int
-js_define_class (js_env_t *env, const char *name, size_t len, js_function_cb constructor, void *data, js_property_descriptor_t const properties[], size_t properties_len, js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
+  env->gc.idle_budget = 0;
+  env->gc.idle_interval = 0;
+  env->gc.last = uv_now(loop);
+  env->gc.allocations = 0;
+  env->gc.count = 0;
+  env->gc.time = 0;
 
-  int err;
+  env->handles.depth = 0;
+  env->handles.peak_depth = 0;
+  env->handles.len = 0;
+  env->handles.peak_len = 0;
 
-  js_callback_t *callback = malloc(sizeof(js_callback_t));
+  env->resolvers = NULL;
+  env->evaluators = NULL;
 
-  callback->cb = constructor;
-  callback->data = data;
+  env->promise_rejections.head = NULL;
+  env->promise_rejections.tail = NULL;
+  env->promise_rejections.buckets = calloc(js_promise_rejection_capacity, sizeof(js_promise_rejection_t *));
+  env->promise_rejections.capacity = js_promise_rejection_capacity;
+  env->promise_rejections.len = 0;
+  env->promise_rejections.unused = NULL;
+  env->promise_rejections.unused_len = 0;
 
-  JSValue external = JS_NewObjectClass(env->context, js_constructor_class_id);
+  env->arraybuffer_slab = NULL;
+  env->arraybuffer_slabs = NULL;
 
-  JS_SetOpaque(external, callback);
+  env->threadsafe_functions = NULL;
 
-  JSValue class = JS_NewCFunctionData(env->context, js__on_constructor_call, 0, 0, 1, &external);
+  env->teardown.tasks = NULL;
+  env->teardown.pending = 0;
+  env->teardown.destroying = false;
+  env->teardown.running = false;
 
-  JS_SetConstructorBit(env->context, class, true);
+  env->microtasks.policy = js_microtask_policy_auto;
+  env->microtasks.budget = 0;
+  env->microtasks.scheduled = false;
+  env->microtasks.drains = 0;
+  env->microtasks.jobs = 0;
 
-  JSValue prototype = JS_NewObject(env->context);
-
-  JS_SetConstructor(env->context, class, prototype);
+  atomic_init(&env->execution.terminate, false);
+  env->execution.timeout = 0;
+  env->execution.budget = 0;
+  env->execution.deadline = 0;
+  env->execution.remaining = 0;
 
-  size_t instance_properties_len = 0;
-  size_t static_properties_len = 0;
+  env->profiler = NULL;
 
-  for (size_t i = 0; i < properties_len; i++) {
-    const js_property_descriptor_t *property = &properties[i];
+  env->trace.cb = NULL;
+  env->trace.data = NULL;
 
-    if ((property->attributes & js_static) == 0) {
-      instance_properties_len++;
-    } else {
-      static_properties_len++;
-    }
-  }
+  memset(env->keys, 0, sizeof(env->keys));
 
-  if (instance_properties_len) {
-    js_property_descriptor_t *instance_properties = malloc(sizeof(js_property_descriptor_t) * instance_properties_len);
+  env->callbacks.uncaught_exception = NULL;
+  env->callbacks.uncaught_exception_data = NULL;
 
-    for (size_t i = 0, j = 0; i < properties_len; i++) {
-      const js_property_descriptor_t *property = &properties[i];
+  env->callbacks.unhandled_rejection = NULL;
+  env->callbacks.unhandled_rejection_data = NULL;
 
-      if ((property->attributes & js_static) == 0) {
-        instance_properties[j++] = *property;
-      }
-    }
+  env->callbacks.dynamic_import = NULL;
+  env->callbacks.dynamic_import_data = NULL;
 
-    err = js_define_properties(env, &(js_value_t) {prototype}, instance_properties, instance_properties_len);
-    assert(err == 0);
+  JS_SetRuntimeOpaque(env->runtime, env);
+  JS_SetContextOpaque(env->context, env);
 
-    free(instance_properties);
-  }
+  err = uv_prepare_init(loop, &env->prepare);
+  assert(err == 0);
 
-  if (static_properties_len) {
-    js_property_descriptor_t *static_properties = malloc(sizeof(js_property_descriptor_t) * static_properties_len);
+  err = uv_prepare_start(&env->prepare, js__on_prepare);
+  assert(err == 0);
 
-    for (size_t i = 0, j = 0; i < properties_len; i++) {
-      const js_property_descriptor_t *property = &properties[i];
+  env->prepare.data = (void *) env;
 
-      if ((property->attributes & js_static) != 0) {
-        static_properties[j++] = *property;
-      }
-    }
+  err = uv_check_init(loop, &env->check);
+  assert(err == 0);
 
-    err = js_define_properties(env, &(js_value_t) {class}, static_properties, static_properties_len);
-    assert(err == 0);
+  err = uv_check_start(&env->check, js__on_check);
+  assert(err == 0);
 
-    free(static_properties);
-  }
+  env->check.data = (void *) env;
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  // The check handle should not on its own keep the loop alive; it's simply
+  // used for running any outstanding tasks that might cause additional work
+  // to be queued.
+  uv_unref((uv_handle_t *) &env->check);
 
-  wrapper->value = class;
+  // The string accessors read characters straight out of the string header,
+  // whose layout is mirrored from quickjs.c. Against a build of QuickJS where
+  // the layout no longer matches, fall back to going through the public API
+  // rather than reading garbage.
+  env->string_headers = js__verify_string_header(env->context);
 
-  JS_FreeValue(env->context, external);
-  JS_FreeValue(env->context, prototype);
+  *result = env;
 
-  *result = wrapper;
+  return 0;
+}
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+static void
+js__on_handle_close (uv_handle_t *handle) {
+  js_env_t *env = (js_env_t *) handle->data;
 
-  return 0;
+  if (--env->active_handles == 0) {
+    free(env);
+  }
 }
 
-int
-js_define_properties (js_env_t *env, js_value_t *object, js_property_descriptor_t const properties[], size_t properties_len) {
-  if (JS_HasException(env->context)) return js__error(env);
+static void
+js__free_handle_scope (js_handle_scope_t *scope) {
+  js_value_chunk_t *chunk = scope->values;
 
-  int err;
+  while (chunk) {
+    js_value_chunk_t *next = chunk->next;
 
-  for (size_t i = 0; i < properties_len; i++) {
-    const js_property_descriptor_t *property = &properties[i];
+    free(chunk);
 
-    int flags = JS_PROP_HAS_WRITABLE | JS_PROP_HAS_ENUMERABLE | JS_PROP_HAS_CONFIGURABLE;
+    chunk = next;
+  }
 
-    if ((property->attributes & js_writable) != 0 || property->getter || property->setter) {
-      flags |= JS_PROP_WRITABLE;
-    }
+  free(scope);
+}
 
-    if ((property->attributes & js_enumerable) != 0) {
-      flags |= JS_PROP_ENUMERABLE;
-    }
+static void
+js__free_promise_rejections (js_env_t *env) {
+  js_promise_rejection_t *next = env->promise_rejections.head;
+  js_promise_rejection_t *prev = NULL;
 
-    if ((property->attributes & js_configurable) != 0) {
-      flags |= JS_PROP_CONFIGURABLE;
-    }
+  while (next) {
+    prev = next;
+    next = next->next;
 
-    JSValue value = JS_UNDEFINED, getter = JS_UNDEFINED, setter = JS_UNDEFINED;
+    JS_FreeValue(env->context, prev->promise);
+    JS_FreeValue(env->context, prev->reason);
 
-    if (property->getter || property->setter) {
-      if (property->getter) {
-        flags |= JS_PROP_HAS_GET;
+    free(prev);
+  }
 
-        js_value_t *fn;
-        err = js_create_function(env, "fn", -1, property->getter, property->data, &fn);
-        assert(err == 0);
+  next = env->promise_rejections.unused;
 
-        getter = fn->value;
-      }
+  while (next) {
+    prev = next;
+    next = next->next;
 
-      if (property->setter) {
-        flags |= JS_PROP_HAS_SET;
+    free(prev);
+  }
 
-        js_value_t *fn;
-        err = js_create_function(env, "fn", -1, property->setter, property->data, &fn);
-        assert(err == 0);
+  free(env->promise_rejections.buckets);
+}
 
-        setter = fn->value;
-      }
-    } else if (property->method) {
-      flags |= JS_PROP_HAS_VALUE;
+static void
+js__free_keys (js_env_t *env) {
+  for (size_t i = 0; i < 64; i++) {
+    js_key_t *next = env->keys[i];
+    js_key_t *prev = NULL;
 
-      js_value_t *fn;
-      err = js_create_function(env, "fn", -1, property->method, property->data, &fn);
-      assert(err == 0);
+    while (next) {
+      prev = next;
+      next = next->next;
 
-      value = fn->value;
-    } else {
-      flags |= JS_PROP_HAS_VALUE;
+      JS_FreeAtom(env->context, prev->atom);
 
-      value = property->value->value;
+      free(prev->name);
+      free(prev);
     }
 
-    JSAtom atom = JS_ValueToAtom(env->context, property->name->value);
-
-    err = JS_DefineProperty(env->context, object->value, atom, value, getter, setter, flags);
+    env->keys[i] = NULL;
+  }
+}
 
-    JS_FreeAtom(env->context, atom);
+static inline void
+js__ref_arraybuffer_slab (js_arraybuffer_slab_t *slab) {
+  atomic_fetch_add_explicit(&slab->references, 1, memory_order_relaxed);
+}
 
-    if (err < 0) return js__error(env);
+static inline void
+js__unref_arraybuffer_slab (js_arraybuffer_slab_t *slab) {
+  if (atomic_fetch_sub_explicit(&slab->references, 1, memory_order_acq_rel) == 1) {
+    free(slab);
   }
+}
 
-  return 0;
+static void
+js__release_pooled_arraybuffer_slab (js_env_t *env, js_arraybuffer_slab_t *slab) {
+  if (--slab->buffers > 0) return;
+
+  if (slab->prev) slab->prev->next = slab->next;
+  else env->arraybuffer_slabs = slab->next;
+
+  if (slab->next) slab->next->prev = slab->prev;
+
+  js__adjust_external_memory(env, -(int64_t) js_arraybuffer_slab_size);
+
+  // Backing stores may still be holding on to the slab, possibly from other
+  // threads, in which case the last of them frees it.
+  js__unref_arraybuffer_slab(slab);
 }
 
-int
-js_wrap (js_env_t *env, js_value_t *object, void *data, js_finalize_cb finalize_cb, void *finalize_hint, js_ref_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
+static void
+js__destroy_env (js_env_t *env) {
+  if (env->profiler) js__free_profiler(env->profiler);
 
-  int err;
+  js__close_threadsafe_functions(env);
 
-  js_finalizer_t *finalizer = malloc(sizeof(js_finalizer_t));
+  JS_FreeValue(env->context, env->bindings);
 
-  finalizer->data = data;
-  finalizer->finalize_cb = finalize_cb;
-  finalizer->finalize_hint = finalize_hint;
+  js__free_intrinsic_classes(env);
+  js__free_slots(env);
+  js__free_keys(env);
+  js__free_promise_rejections(env);
 
-  JSValue external = JS_NewObjectClass(env->context, js_external_class_id);
+  if (env->arraybuffer_slab) js__release_pooled_arraybuffer_slab(env, env->arraybuffer_slab);
 
-  JS_SetOpaque(external, finalizer);
+  JS_FreeContext(env->context);
 
-  JSAtom atom = JS_NewAtom(env->context, "__native_external");
+  js__release_runtime(env->platform, env->runtime, env->heap);
 
-  err = JS_DefinePropertyValue(env->context, object->value, atom, external, 0);
+  while (env->unused_scopes) {
+    js_handle_scope_t *scope = env->unused_scopes;
 
-  if (err < 0) {
-    JS_FreeValue(env->context, external);
+    env->unused_scopes = scope->parent;
 
-    JS_FreeAtom(env->context, atom);
+    js__free_handle_scope(scope);
+  }
 
-    return js__error(env);
+  uv_ref((uv_handle_t *) &env->check);
+
+  uv_close((uv_handle_t *) &env->prepare, js__on_handle_close);
+  uv_close((uv_handle_t *) &env->check, js__on_handle_close);
+}
+
+int
+js_destroy_env (js_env_t *env) {
+  env->teardown.destroying = true;
+  env->teardown.running = true;
+
+  // Teardown callbacks run in the reverse order of their registration. A
+  // deferred callback holds off the destruction of the env until it's
+  // finished, which lets it wait for asynchronous work without blocking the
+  // loop.
+  while (env->teardown.tasks) {
+    js_teardown_task_t *task = env->teardown.tasks;
+
+    env->teardown.tasks = task->next;
+
+    if (task->deferred) {
+      env->teardown.pending++;
+
+      task->deferred_callback(&task->handle, task->data);
+    } else {
+      task->callback(task->data);
+
+      free(task);
+    }
   }
 
-  JS_FreeAtom(env->context, atom);
+  env->teardown.running = false;
 
-  if (result) return js_create_reference(env, object, 0, result);
+  if (env->teardown.pending == 0) js__destroy_env(env);
 
   return 0;
 }
 
 int
-js_unwrap (js_env_t *env, js_value_t *object, void **result) {
-  if (JS_HasException(env->context)) return js__error(env);
+js_on_uncaught_exception (js_env_t *env, js_uncaught_exception_cb cb, void *data) {
+  env->callbacks.uncaught_exception = cb;
+  env->callbacks.uncaught_exception_data = data;
 
-  JSAtom atom = JS_NewAtom(env->context, "__native_external");
+  return 0;
+}
 
-  JSValue external = JS_GetProperty(env->context, object->value, atom);
+int
+js_on_unhandled_rejection (js_env_t *env, js_unhandled_rejection_cb cb, void *data) {
+  env->callbacks.unhandled_rejection = cb;
+  env->callbacks.unhandled_rejection_data = data;
 
-  JS_FreeAtom(env->context, atom);
+  return 0;
+}
 
-  js_finalizer_t *finalizer = (js_finalizer_t *) JS_GetOpaque(external, js_external_class_id);
+int
+js_on_dynamic_import (js_env_t *env, js_dynamic_import_cb cb, void *data) {
+  env->callbacks.dynamic_import = cb;
+  env->callbacks.dynamic_import_data = data;
 
-  JS_FreeValue(env->context, external);
+  return 0;
+}
 
-  *result = finalizer->data;
+int
+js_get_env_loop (js_env_t *env, uv_loop_t **result) {
+  *result = env->loop;
 
   return 0;
 }
 
 int
-js_remove_wrap (js_env_t *env, js_value_t *object, void **result) {
-  if (JS_HasException(env->context)) return js__error(env);
-
-  int err;
+js_get_env_platform (js_env_t *env, js_platform_t **result) {
+  *result = env->platform;
 
-  JSAtom atom = JS_NewAtom(env->context, "__native_external");
+  return 0;
+}
 
-  JSValue external = JS_GetProperty(env->context, object->value, atom);
+static inline int
+js__error (js_env_t *env) {
+  return JS_HasException(env->context) ? js_pending_exception : js_uncaught_exception;
+}
 
-  js_finalizer_t *finalizer = (js_finalizer_t *) JS_GetOpaque(external, js_external_class_id);
+int
+js_open_handle_scope (js_env_t *env, js_handle_scope_t **result) {
+  // Allow continuing even with a pending exception
 
-  JS_FreeValue(env->context, external);
+  js_handle_scope_t *scope = env->unused_scopes;
 
-  finalizer->finalize_cb = NULL;
+  if (scope) {
+    env->unused_scopes = scope->parent;
+  } else {
+    scope = malloc(sizeof(js_handle_scope_t));
 
-  if (result) *result = finalizer->data;
+    scope->values = NULL;
+  }
 
-  err = JS_DeleteProperty(env->context, object->value, atom, 0);
+  scope->parent = env->scope;
 
-  if (err < 0) {
-    JS_FreeAtom(env->context, atom);
+  env->scope = scope;
 
-    return js__error(env);
-  }
+  if (++env->handles.depth > env->handles.peak_depth) env->handles.peak_depth = env->handles.depth;
 
-  JS_FreeAtom(env->context, atom);
+  *result = scope;
 
   return 0;
 }
 
-static int
-js__on_delegate_get_own_property (JSContext *context, JSPropertyDescriptor *descriptor, JSValueConst object, JSAtom name) {
-  js_env_t *env = (js_env_t *) JS_GetContextOpaque(context);
+int
+js_close_handle_scope (js_env_t *env, js_handle_scope_t *scope) {
+  // Allow continuing even with a pending exception
 
-  js_delegate_t *delegate = (js_delegate_t *) JS_GetOpaque(object, js_delegate_class_id);
+  js_value_chunk_t *chunk = scope->values;
 
-  if (delegate->callbacks.has) {
-    JSValue property = JS_AtomToValue(env->context, name);
+  while (chunk) {
+    for (size_t i = 0; i < chunk->len; i++) {
+      JS_FreeValue(env->context, chunk->values[i].value);
+    }
 
-    bool exists = delegate->callbacks.has(env, &(js_value_t) {property}, delegate->data);
+    env->handles.len -= chunk->len;
 
-    JS_FreeValue(env->context, property);
+    chunk->len = 0;
 
-    if (JS_HasException(env->context)) return js__error(env);
+    // Keep the first chunk around for the next time the scope is reused and
+    // release any chunks that were added to accommodate overflow.
+    if (chunk->next == NULL) break;
 
-    if (!exists) return 0;
+    js_value_chunk_t *next = chunk->next;
+
+    free(chunk);
+
+    chunk = next;
   }
 
-  if (delegate->callbacks.get) {
-    JSValue property = JS_AtomToValue(env->context, name);
+  scope->values = chunk;
 
-    js_value_t *result = delegate->callbacks.get(env, &(js_value_t) {property}, delegate->data);
+  env->scope = scope->parent;
 
-    JS_FreeValue(env->context, property);
+  env->handles.depth--;
+
+  scope->parent = env->unused_scopes;
+
+  env->unused_scopes = scope;
+
+  return 0;
+}
+
+int
+js_open_escapable_handle_scope (js_env_t *env, js_escapable_handle_scope_t **result) {
+  return js_open_handle_scope(env, (js_handle_scope_t **) result);
+}
+
+int
+js_close_escapable_handle_scope (js_env_t *env, js_escapable_handle_scope_t *scope) {
+  return js_close_handle_scope(env, (js_handle_scope_t *) scope);
+}
+
+static inline js_value_t *
+js__attach_to_handle_scope (js_env_t *env, js_handle_scope_t *scope, JSValue value) {
+  assert(scope);
+
+  js_value_chunk_t *chunk = scope->values;
+
+  if (chunk == NULL || chunk->len == chunk->capacity) {
+    size_t capacity = chunk ? chunk->capacity * 2 : js_value_chunk_capacity;
+
+    js_value_chunk_t *next = malloc(sizeof(js_value_chunk_t) + capacity * sizeof(js_value_t));
+
+    next->next = chunk;
+    next->len = 0;
+    next->capacity = capacity;
+
+    scope->values = chunk = next;
+  }
+
+  js_value_t *wrapper = &chunk->values[chunk->len++];
+
+  wrapper->value = value;
+
+  if (++env->handles.len > env->handles.peak_len) env->handles.peak_len = env->handles.len;
+
+  return wrapper;
+}
+
+int
+js_escape_handle (js_env_t *env, js_escapable_handle_scope_t *scope, js_value_t *escapee, js_value_t **result) {
+  // Allow continuing even with a pending exception
+
+  *result = js__attach_to_handle_scope(env, scope->parent, JS_DupValue(env->context, escapee->value));
+
+  return 0;
+}
+
+static inline void
+js__swap_context (js_env_t *env, js_context_t *context) {
+  // The state of the current context lives on the env itself, so entering a
+  // context swaps its state with that of the env. The context then holds the
+  // state of the context that was entered from until it is exited again.
+  JSContext *current = env->context;
+
+  env->context = context->context;
+
+  context->context = current;
+
+  for (size_t i = 0; i < js_typedarray_classes_len; i++) {
+    js_intrinsic_class_t typedarray = env->typedarrays[i];
+
+    env->typedarrays[i] = context->typedarrays[i];
+
+    context->typedarrays[i] = typedarray;
+  }
+
+  js_intrinsic_class_t dataview = env->dataview;
+
+  env->dataview = context->dataview;
+
+  context->dataview = dataview;
+
+  js_intrinsic_class_t arraybuffer = env->arraybuffer;
+
+  env->arraybuffer = context->arraybuffer;
+
+  context->arraybuffer = arraybuffer;
+
+  JSValue error = env->error;
+
+  env->error = context->error;
+
+  context->error = error;
+}
+
+int
+js_create_context (js_env_t *env, js_context_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  // The context shares the runtime of the env, and with it the atoms, shapes,
+  // and class registrations, and only brings its own intrinsics.
+  JSContext *value = JS_NewContext(env->runtime);
+
+  if (value == NULL) {
+    js_throw_error(env, NULL, "Could not create context");
+
+    return js__error(env);
+  }
+
+  JS_SetContextOpaque(value, env);
+
+  js_context_t *context = malloc(sizeof(js_context_t));
+
+  context->context = value;
+  context->entered = false;
+
+  js__swap_context(env, context);
+
+  js__init_intrinsic_classes(env);
+
+  js__swap_context(env, context);
+
+  *result = context;
+
+  return 0;
+}
+
+int
+js_destroy_context (js_env_t *env, js_context_t *context) {
+  // Allow continuing even with a pending exception
+
+  // While entered, the context holds the state of the context it was entered
+  // from, which would be lost.
+  if (context->entered) {
+    if (!JS_HasException(env->context)) js_throw_error(env, NULL, "Context is entered");
+
+    return js__error(env);
+  }
+
+  js__swap_context(env, context);
+
+  js__free_intrinsic_classes(env);
+
+  js__swap_context(env, context);
+
+  JS_FreeContext(context->context);
+
+  free(context);
+
+  return 0;
+}
+
+int
+js_enter_context (js_env_t *env, js_context_t *context) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  // Entering again would overwrite the state of the context that it was first
+  // entered from.
+  if (context->entered) {
+    js_throw_error(env, NULL, "Context is already entered");
+
+    return js__error(env);
+  }
+
+  js__swap_context(env, context);
+
+  context->entered = true;
+
+  return 0;
+}
+
+int
+js_exit_context (js_env_t *env, js_context_t *context) {
+  // Allow continuing even with a pending exception, which is tracked by the
+  // runtime and so carries over to the context being returned to.
+
+  if (!context->entered) {
+    if (!JS_HasException(env->context)) js_throw_error(env, NULL, "Context is not entered");
+
+    return js__error(env);
+  }
+
+  js__swap_context(env, context);
+
+  context->entered = false;
+
+  return 0;
+}
+
+int
+js_get_bindings (js_env_t *env, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  *result = js__attach_to_handle_scope(env, env->scope, JS_DupValue(env->context, env->bindings));
+
+  return 0;
+}
+
+static inline uint64_t
+js__hash (uint64_t hash, const void *data, size_t len) {
+  // 64-bit FNV-1a, see http://www.isthe.com/chongo/tech/comp/fnv/
+  const uint8_t *bytes = (const uint8_t *) data;
+
+  for (size_t i = 0; i < len; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3;
+  }
+
+  return hash;
+}
+
+static inline uint64_t
+js__hash_string (const char *name, size_t name_len, const char *str, size_t str_len) {
+  uint64_t hash = 0xcbf29ce484222325;
+
+  hash = js__hash(hash, name, name_len);
+  hash = js__hash(hash, str, str_len);
+
+  return hash;
+}
+
+static uint64_t
+js__hash_source (js_env_t *env, const char *name, size_t name_len, JSValue source) {
+  size_t str_len;
+  const char *str = JS_ToCStringLen(env->context, &str_len, source);
+
+  uint64_t hash = js__hash_string(name, name_len, str, str_len);
+
+  JS_FreeCString(env->context, str);
+
+  return hash;
+}
+
+static inline void
+js__init_code_cache_header (js_code_cache_header_t *header, uint64_t hash) {
+  memset(header, 0, sizeof(js_code_cache_header_t));
+
+  memcpy(header->magic, "QJSC", 4);
+
+  strncpy(header->version, js_platform_version, sizeof(header->version) - 1);
+
+  header->hash = hash;
+}
+
+static int
+js__write_code_cache (js_env_t *env, JSValue bytecode, uint64_t hash, uint8_t **result, size_t *len) {
+  size_t bytecode_len;
+  uint8_t *bytecode_data = JS_WriteObject(env->context, &bytecode_len, bytecode, JS_WRITE_OBJ_BYTECODE);
+
+  if (bytecode_data == NULL) return js__error(env);
+
+  uint8_t *cache = malloc(sizeof(js_code_cache_header_t) + bytecode_len);
+
+  js__init_code_cache_header((js_code_cache_header_t *) cache, hash);
+
+  memcpy(cache + sizeof(js_code_cache_header_t), bytecode_data, bytecode_len);
+
+  js_free(env->context, bytecode_data);
+
+  *result = cache;
+  *len = sizeof(js_code_cache_header_t) + bytecode_len;
+
+  return 0;
+}
+
+static JSValue
+js__read_code_cache (js_env_t *env, const uint8_t *cache, size_t len, uint64_t hash, int tag) {
+  if (cache == NULL || len <= sizeof(js_code_cache_header_t)) return JS_NULL;
+
+  js_code_cache_header_t expected;
+  js__init_code_cache_header(&expected, hash);
+
+  if (memcmp(cache, &expected, sizeof(js_code_cache_header_t)) != 0) return JS_NULL;
+
+  JSValue bytecode = JS_ReadObject(env->context, cache + sizeof(js_code_cache_header_t), len - sizeof(js_code_cache_header_t), JS_READ_OBJ_BYTECODE);
+
+  // A cache that passes validation but still fails to load, such as one
+  // produced by a differently configured build of the engine, is treated the
+  // same as a stale cache.
+  if (JS_IsException(bytecode)) {
+    JS_FreeValue(env->context, JS_GetException(env->context));
+
+    return JS_NULL;
+  }
+
+  if (JS_VALUE_GET_TAG(bytecode) != tag) {
+    JS_FreeValue(env->context, bytecode);
+
+    return JS_NULL;
+  }
+
+  return bytecode;
+}
+
+static inline js_script_cache_entry_t **
+js__get_script_cache_bucket (js_platform_t *platform, uint64_t hash) {
+  size_t len = sizeof(platform->scripts.buckets) / sizeof(platform->scripts.buckets[0]);
+
+  return &platform->scripts.buckets[hash & (len - 1)];
+}
+
+static inline void
+js__release_script_cache_entry (js_script_cache_entry_t *entry) {
+  if (--entry->references > 0 || !entry->evicted) return;
+
+  free(entry->file);
+  free(entry->data);
+  free(entry);
+}
+
+static void
+js__evict_script_cache_entry (js_platform_t *platform, js_script_cache_entry_t *entry) {
+  js_script_cache_entry_t **bucket = js__get_script_cache_bucket(platform, entry->hash);
+
+  while (*bucket != entry) bucket = &(*bucket)->chain;
+
+  *bucket = entry->chain;
+
+  if (entry->prev) entry->prev->next = entry->next;
+  else platform->scripts.head = entry->next;
+
+  if (entry->next) entry->next->prev = entry->prev;
+  else platform->scripts.tail = entry->prev;
+
+  platform->scripts.len -= entry->len;
+
+  entry->evicted = true;
+
+  js__release_script_cache_entry(entry);
+}
+
+static void
+js__trim_script_cache (js_platform_t *platform) {
+  size_t limit = atomic_load_explicit(&platform->scripts.limit, memory_order_relaxed);
+
+  while (platform->scripts.tail && platform->scripts.len > limit) {
+    js__evict_script_cache_entry(platform, platform->scripts.tail);
+  }
+}
+
+static js_script_cache_entry_t *
+js__lookup_script_cache (js_platform_t *platform, const char *file, uint64_t hash) {
+  uv_mutex_lock(&platform->scripts.lock);
+
+  js_script_cache_entry_t *entry = *js__get_script_cache_bucket(platform, hash);
+
+  while (entry && (entry->hash != hash || strcmp(entry->file, file) != 0)) {
+    entry = entry->chain;
+  }
+
+  if (entry) {
+    entry->references++;
+
+    platform->scripts.hits++;
+
+    // Move the entry to the front of the list of recently used entries.
+    if (entry->prev) {
+      entry->prev->next = entry->next;
+
+      if (entry->next) entry->next->prev = entry->prev;
+      else platform->scripts.tail = entry->prev;
+
+      entry->prev = NULL;
+      entry->next = platform->scripts.head;
+
+      platform->scripts.head->prev = entry;
+      platform->scripts.head = entry;
+    }
+  }
+
+  uv_mutex_unlock(&platform->scripts.lock);
+
+  return entry;
+}
+
+static void
+js__unref_script_cache_entry (js_platform_t *platform, js_script_cache_entry_t *entry) {
+  uv_mutex_lock(&platform->scripts.lock);
+
+  js__release_script_cache_entry(entry);
+
+  uv_mutex_unlock(&platform->scripts.lock);
+}
+
+static void
+js__insert_script_cache (js_platform_t *platform, const char *file, uint64_t hash, uint8_t *data, size_t len) {
+  uv_mutex_lock(&platform->scripts.lock);
+
+  js_script_cache_entry_t **bucket = js__get_script_cache_bucket(platform, hash);
+
+  js_script_cache_entry_t *entry = *bucket;
+
+  while (entry && (entry->hash != hash || strcmp(entry->file, file) != 0)) {
+    entry = entry->chain;
+  }
+
+  if (entry || len > atomic_load_explicit(&platform->scripts.limit, memory_order_relaxed)) {
+    free(data);
+  } else {
+    entry = malloc(sizeof(js_script_cache_entry_t));
+
+    entry->file = strdup(file);
+    entry->hash = hash;
+    entry->data = data;
+    entry->len = len;
+    entry->references = 1;
+    entry->evicted = false;
+    entry->prev = NULL;
+    entry->next = platform->scripts.head;
+    entry->chain = *bucket;
+
+    if (platform->scripts.head) platform->scripts.head->prev = entry;
+    else platform->scripts.tail = entry;
+
+    platform->scripts.head = entry;
+
+    *bucket = entry;
+
+    platform->scripts.len += len;
+
+    js__trim_script_cache(platform);
+  }
+
+  uv_mutex_unlock(&platform->scripts.lock);
+}
+
+int
+js_set_platform_script_cache_limit (js_platform_t *platform, size_t limit) {
+  uv_mutex_lock(&platform->scripts.lock);
+
+  atomic_store_explicit(&platform->scripts.limit, limit, memory_order_relaxed);
+
+  js__trim_script_cache(platform);
+
+  uv_mutex_unlock(&platform->scripts.lock);
+
+  return 0;
+}
+
+static JSValue
+js__compile_script (js_env_t *env, const char *file, const char *str, size_t str_len, uint64_t hash, const uint8_t *cache, size_t cache_len, bool *rejected) {
+  js_platform_t *platform = env->platform;
+
+  bool cached = atomic_load_explicit(&platform->scripts.limit, memory_order_relaxed) > 0;
+
+  JSValue bytecode = js__read_code_cache(env, cache, cache_len, hash, JS_TAG_FUNCTION_BYTECODE);
+
+  if (rejected) *rejected = JS_IsNull(bytecode);
+
+  if (JS_IsNull(bytecode) && cached) {
+    js_script_cache_entry_t *entry = js__lookup_script_cache(platform, file, hash);
+
+    if (entry) {
+      bytecode = js__read_code_cache(env, entry->data, entry->len, hash, JS_TAG_FUNCTION_BYTECODE);
+
+      js__unref_script_cache_entry(platform, entry);
+    }
+  }
+
+  if (!JS_IsNull(bytecode)) return bytecode;
+
+  bytecode = JS_Eval(
+    env->context,
+    str,
+    str_len,
+    file,
+    JS_EVAL_TYPE_GLOBAL | JS_EVAL_FLAG_COMPILE_ONLY
+  );
+
+  if (JS_IsException(bytecode) || !cached) return bytecode;
+
+  uint8_t *data;
+  size_t len;
+
+  if (js__write_code_cache(env, bytecode, hash, &data, &len) == 0) {
+    js__insert_script_cache(platform, file, hash, data, len);
+  } else {
+    JS_FreeValue(env->context, JS_GetException(env->context));
+  }
+
+  return bytecode;
+}
+
+int
+js_create_script (js_env_t *env, const char *file, size_t len, int offset, js_value_t *source, js_script_t **result) {
+  return js_create_script_with_cache(env, file, len, offset, source, NULL, 0, NULL, result);
+}
+
+int
+js_create_script_with_cache (js_env_t *env, const char *file, size_t len, int offset, js_value_t *source, const uint8_t *cache, size_t cache_len, bool *rejected, js_script_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  size_t str_len;
+  const char *str = JS_ToCStringLen(env->context, &str_len, source->value);
+
+  if (file == NULL) file = "";
+
+  uint64_t hash = js__hash_string(file, strlen(file), str, str_len);
+
+  JSValue bytecode = js__compile_script(env, file, str, str_len, hash, cache, cache_len, rejected);
+
+  JS_FreeCString(env->context, str);
+
+  if (JS_IsException(bytecode)) {
+    if (env->depth == 0) {
+      JSValue error = JS_GetException(env->context);
+
+      js__on_uncaught_exception(env->context, error);
+    }
+
+    return js__error(env);
+  }
+
+  js_script_t *script = malloc(sizeof(js_script_t));
+
+  script->bytecode = bytecode;
+  script->hash = hash;
+
+  *result = script;
+
+  return 0;
+}
+
+int
+js_create_script_cache (js_env_t *env, js_script_t *script, uint8_t **result, size_t *len) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  return js__write_code_cache(env, script->bytecode, script->hash, result, len);
+}
+
+int
+js_delete_script (js_env_t *env, js_script_t *script) {
+  // Allow continuing even with a pending exception
+
+  JS_FreeValue(env->context, script->bytecode);
+
+  free(script);
+
+  return 0;
+}
+
+static inline JSValue
+js__run_script (js_env_t *env, const char *file, const char *str, size_t str_len) {
+  if (atomic_load_explicit(&env->platform->scripts.limit, memory_order_relaxed) == 0) {
+    return JS_Eval(
+      env->context,
+      str,
+      str_len,
+      file,
+      JS_EVAL_TYPE_GLOBAL
+    );
+  }
+
+  uint64_t hash = js__hash_string(file, strlen(file), str, str_len);
+
+  JSValue bytecode = js__compile_script(env, file, str, str_len, hash, NULL, 0, NULL);
+
+  if (JS_IsException(bytecode)) return bytecode;
+
+  return JS_EvalFunction(env->context, bytecode);
+}
+
+int
+js_run_script (js_env_t *env, const char *file, size_t len, int offset, js_value_t *source, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  size_t str_len;
+  const char *str = JS_ToCStringLen(env->context, &str_len, source->value);
+
+  js__enter(env);
+
+  if (file == NULL) file = "";
+
+  JSValue value = js__run_script(env, file, str, str_len);
+
+  JS_FreeCString(env->context, str);
+
+  if (env->depth == 1) js__on_run_microtasks(env);
+
+  js__exit(env);
+
+  if (JS_IsException(value)) {
+    if (env->depth == 0) {
+      JSValue error = JS_GetException(env->context);
+
+      js__on_uncaught_exception(env->context, error);
+    }
+
+    return js__error(env);
+  }
+
+  if (result == NULL) JS_FreeValue(env->context, value);
+  else {
+    *result = js__attach_to_handle_scope(env, env->scope, value);
+  }
+
+  return 0;
+}
+
+int
+js_run_compiled_script (js_env_t *env, js_script_t *script, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  js__enter(env);
+
+  JSValue value = JS_EvalFunction(env->context, JS_DupValue(env->context, script->bytecode));
+
+  if (env->depth == 1) js__on_run_microtasks(env);
+
+  js__exit(env);
+
+  if (JS_IsException(value)) {
+    if (env->depth == 0) {
+      JSValue error = JS_GetException(env->context);
+
+      js__on_uncaught_exception(env->context, error);
+    }
+
+    return js__error(env);
+  }
+
+  if (result == NULL) JS_FreeValue(env->context, value);
+  else {
+    *result = js__attach_to_handle_scope(env, env->scope, value);
+  }
+
+  return 0;
+}
+
+static inline void
+js__init_snapshot_header (js_snapshot_header_t *header, uint64_t len) {
+  memset(header, 0, sizeof(js_snapshot_header_t));
+
+  memcpy(header->magic, "QJSS", 4);
+
+  strncpy(header->version, js_platform_version, sizeof(header->version) - 1);
+
+  header->len = len;
+}
+
+static inline void
+js__write_snapshot_entry (uint8_t **cursor, const uint8_t *data, size_t len) {
+  uint64_t entry_len = len;
+
+  memcpy(*cursor, &entry_len, sizeof(uint64_t));
+  memcpy(*cursor + sizeof(uint64_t), data, len);
+
+  *cursor += sizeof(uint64_t) + len;
+}
+
+static inline bool
+js__read_snapshot_entry (const uint8_t **cursor, const uint8_t *end, const uint8_t **data, size_t *len) {
+  uint64_t entry_len;
+
+  if ((size_t) (end - *cursor) < sizeof(uint64_t)) return false;
+
+  memcpy(&entry_len, *cursor, sizeof(uint64_t));
+
+  if ((size_t) (end - *cursor) - sizeof(uint64_t) < entry_len) return false;
+
+  *data = *cursor + sizeof(uint64_t);
+  *len = (size_t) entry_len;
+
+  *cursor += sizeof(uint64_t) + entry_len;
+
+  return true;
+}
+
+int
+js_create_snapshot (js_env_t *env, js_script_t *const scripts[], size_t scripts_len, uint8_t **result, size_t *len) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  int err = 0;
+
+  size_t entries_len = scripts_len + 1;
+
+  uint8_t **entries = malloc(entries_len * sizeof(uint8_t *));
+  size_t *entry_lens = malloc(entries_len * sizeof(size_t));
+
+  size_t total = sizeof(js_snapshot_header_t);
+
+  size_t i = 0;
+
+  for (; i < entries_len; i++) {
+    // The bindings object is written first, as plain data, followed by the
+    // bytecode of each of the bootstrap scripts in the order they are to run.
+    if (i == 0) {
+      entries[i] = JS_WriteObject(env->context, &entry_lens[i], env->bindings, 0);
+    } else {
+      entries[i] = JS_WriteObject(env->context, &entry_lens[i], scripts[i - 1]->bytecode, JS_WRITE_OBJ_BYTECODE);
+    }
+
+    if (entries[i] == NULL) {
+      err = js__error(env);
+
+      break;
+    }
+
+    total += sizeof(uint64_t) + entry_lens[i];
+  }
+
+  if (err == 0) {
+    uint8_t *snapshot = malloc(total);
+
+    js__init_snapshot_header((js_snapshot_header_t *) snapshot, scripts_len);
+
+    uint8_t *cursor = snapshot + sizeof(js_snapshot_header_t);
+
+    for (size_t j = 0; j < entries_len; j++) {
+      js__write_snapshot_entry(&cursor, entries[j], entry_lens[j]);
+    }
+
+    *result = snapshot;
+    *len = total;
+  }
+
+  while (i > 0) js_free(env->context, entries[--i]);
+
+  free(entries);
+  free(entry_lens);
+
+  return err;
+}
+
+static int
+js__restore_snapshot (js_env_t *env, const uint8_t *snapshot, size_t len) {
+  js_snapshot_header_t expected;
+
+  if (len < sizeof(js_snapshot_header_t)) return -1;
+
+  memcpy(&expected, snapshot, sizeof(js_snapshot_header_t));
+
+  uint64_t scripts_len = expected.len;
+
+  js__init_snapshot_header(&expected, scripts_len);
+
+  if (memcmp(snapshot, &expected, sizeof(js_snapshot_header_t)) != 0) return -1;
+
+  const uint8_t *cursor = snapshot + sizeof(js_snapshot_header_t);
+  const uint8_t *end = snapshot + len;
+
+  const uint8_t *data;
+  size_t data_len;
+
+  if (!js__read_snapshot_entry(&cursor, end, &data, &data_len)) return -1;
+
+  JSValue bindings = JS_ReadObject(env->context, data, data_len, 0);
+
+  if (JS_IsException(bindings)) return -1;
+
+  JS_FreeValue(env->context, env->bindings);
+
+  env->bindings = bindings;
+
+  for (uint64_t i = 0; i < scripts_len; i++) {
+    if (!js__read_snapshot_entry(&cursor, end, &data, &data_len)) return -1;
+
+    JSValue bytecode = JS_ReadObject(env->context, data, data_len, JS_READ_OBJ_BYTECODE);
+
+    if (JS_IsException(bytecode)) return -1;
+
+    if (JS_VALUE_GET_TAG(bytecode) != JS_TAG_FUNCTION_BYTECODE) {
+      JS_FreeValue(env->context, bytecode);
+
+      return -1;
+    }
+
+    js__enter(env);
+
+    JSValue value = JS_EvalFunction(env->context, bytecode);
+
+    if (env->depth == 1) js__on_run_microtasks(env);
+
+    js__exit(env);
+
+    if (JS_IsException(value)) return -1;
+
+    JS_FreeValue(env->context, value);
+  }
+
+  return 0;
+}
+
+int
+js_create_env_with_snapshot (uv_loop_t *loop, js_platform_t *platform, const uint8_t *snapshot, size_t len, const js_env_options_t *options, js_env_t **result) {
+  int err;
+
+  js_env_t *env;
+  err = js_create_env(loop, platform, options, &env);
+  if (err < 0) return err;
+
+  err = js__restore_snapshot(env, snapshot, len);
+
+  if (err < 0) {
+    if (JS_HasException(env->context)) {
+      JS_FreeValue(env->context, JS_GetException(env->context));
+    }
+
+    js_destroy_env(env);
+
+    return err;
+  }
+
+  *result = env;
+
+  return 0;
+}
+
+int
+js_create_module (js_env_t *env, const char *name, size_t len, int offset, js_value_t *source, js_module_meta_cb cb, void *data, js_module_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  js_module_t *module = malloc(sizeof(js_module_t));
+
+  module->context = env->context;
+  module->source = JS_DupValue(env->context, source->value);
+  module->bytecode = JS_NULL;
+  module->definition = NULL;
+  module->name = strndup(name, len);
+  module->meta = cb;
+  module->meta_data = data;
+
+  *result = module;
+
+  return 0;
+}
+
+static int
+js__on_evaluate_module (JSContext *context, JSModuleDef *definition) {
+  int err;
+
+  js_env_t *env = (js_env_t *) JS_GetContextOpaque(context);
+
+  js_module_evaluator_t *evaluator = env->evaluators;
+
+  while (evaluator && evaluator->module->definition != definition) {
+    evaluator = evaluator->next;
+  }
+
+  js_handle_scope_t *scope;
+  err = js_open_handle_scope(env, &scope);
+  assert(err == 0);
+
+  evaluator->cb(env, evaluator->module, evaluator->data);
+
+  err = js_close_handle_scope(env, scope);
+  assert(err == 0);
+
+  return 0;
+}
+
+int
+js_create_module_with_cache (js_env_t *env, const char *name, size_t len, int offset, js_value_t *source, const uint8_t *cache, size_t cache_len, js_module_meta_cb cb, void *data, bool *rejected, js_module_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  int err;
+
+  js_module_t *module;
+  err = js_create_module(env, name, len, offset, source, cb, data, &module);
+  if (err < 0) return err;
+
+  uint64_t hash = js__hash_source(env, module->name, strlen(module->name), module->source);
+
+  JSValue bytecode = js__read_code_cache(env, cache, cache_len, hash, JS_TAG_MODULE);
+
+  // The definition is only exposed once the module has been instantiated and
+  // its imports resolved, same as for modules compiled from source.
+  module->bytecode = bytecode;
+
+  if (rejected) *rejected = JS_IsNull(bytecode);
+
+  *result = module;
+
+  return 0;
+}
+
+int
+js_create_module_cache (js_env_t *env, js_module_t *module, uint8_t **result, size_t *len) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  if (JS_IsNull(module->source) || JS_IsNull(module->bytecode)) {
+    js_throw_error(env, NULL, "Module must be instantiated and not yet run");
+
+    return js__error(env);
+  }
+
+  uint64_t hash = js__hash_source(env, module->name, strlen(module->name), module->source);
+
+  return js__write_code_cache(env, module->bytecode, hash, result, len);
+}
+
+int
+js_create_synthetic_module (js_env_t *env, const char *name, size_t len, js_value_t *const export_names[], size_t names_len, js_module_evaluate_cb cb, void *data, js_module_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  js_module_t *module = malloc(sizeof(js_module_t));
+
+  module->context = env->context;
+  module->source = JS_NULL;
+  module->bytecode = JS_NULL;
+  module->definition = JS_NewCModule(env->context, name, js__on_evaluate_module);
+  module->name = strndup(name, len);
+  module->meta = NULL;
+  module->meta_data = NULL;
+
+  for (size_t i = 0; i < names_len; i++) {
+    const char *str = JS_ToCString(env->context, export_names[i]->value);
+
+    JS_AddModuleExport(env->context, module->definition, str);
+
+    JS_FreeCString(env->context, str);
+  }
+
+  js_module_evaluator_t *evaluator = malloc(sizeof(js_module_evaluator_t));
+
+  evaluator->module = module;
+  evaluator->cb = cb;
+  evaluator->data = data;
+  evaluator->next = env->evaluators;
+
+  env->evaluators = evaluator;
+
+  *result = module;
+
+  return 0;
+}
+
+int
+js_delete_module (js_env_t *env, js_module_t *module) {
+  // Allow continuing even with a pending exception
+
+  JS_FreeValue(env->context, module->source);
+  JS_FreeValue(env->context, module->bytecode);
+
+  free(module->name);
+  free(module);
+
+  return 0;
+}
+
+int
+js_get_module_name (js_env_t *env, js_module_t *module, const char **result) {
+  // Allow continuing even with a pending exception
+
+  *result = module->name;
+
+  return 0;
+}
+
+int
+js_get_module_namespace (js_env_t *env, js_module_t *module, js_value_t **result) {
+  // Allow continuing even with a pending exception
+
+  *result = js__attach_to_handle_scope(env, env->scope, JS_GetModuleNamespace(env->context, module->definition));
+
+  return 0;
+}
+
+int
+js_set_module_export (js_env_t *env, js_module_t *module, js_value_t *name, js_value_t *value) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  const char *str = JS_ToCString(env->context, name->value);
+
+  int success = JS_SetModuleExport(env->context, module->definition, str, JS_DupValue(env->context, value->value));
+
+  JS_FreeCString(env->context, str);
+
+  if (success < 0) {
+    js_throw_error(env, NULL, "Could not set module export");
+
+    return js__error(env);
+  }
+
+  return 0;
+}
+
+int
+js_instantiate_module (js_env_t *env, js_module_t *module, js_module_resolve_cb cb, void *data) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  if (JS_IsNull(module->source)) return 0;
+
+  js_module_resolver_t resolver = {
+    .module = module,
+    .cb = cb,
+    .data = data,
+    .next = env->resolvers,
+  };
+
+  env->resolvers = &resolver;
+
+  js__enter(env);
+
+  js__trace(env, js_trace_module_instantiation, js_trace_begin);
+
+  JSValue bytecode;
+
+  if (JS_IsNull(module->bytecode)) {
+    size_t str_len;
+    const char *str = JS_ToCStringLen(env->context, &str_len, module->source);
+
+    bytecode = JS_Eval(
+      env->context,
+      str,
+      str_len,
+      module->name,
+      JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY
+    );
+
+    JS_FreeCString(env->context, str);
+  } else {
+    // The module was loaded from a code cache, which only leaves its imports
+    // to be resolved.
+    bytecode = module->bytecode;
+
+    module->bytecode = JS_NULL;
+
+    if (JS_ResolveModule(env->context, bytecode) < 0) {
+      JS_FreeValue(env->context, bytecode);
+
+      bytecode = JS_EXCEPTION;
+    }
+  }
+
+  js__trace(env, js_trace_module_instantiation, js_trace_end);
+
+  if (env->depth == 1) js__on_run_microtasks(env);
+
+  js__exit(env);
+
+  env->resolvers = resolver.next;
+
+  if (JS_IsException(bytecode)) {
+    module->definition = NULL;
+
+    if (env->depth == 0) {
+      JSValue error = JS_GetException(env->context);
+
+      js__on_uncaught_exception(env->context, error);
+    }
+
+    return js__error(env);
+  }
+
+  module->bytecode = bytecode;
+
+  module->definition = (JSModuleDef *) JS_VALUE_GET_PTR(bytecode);
+
+  return 0;
+}
+
+int
+js_run_module (js_env_t *env, js_module_t *module, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  int err;
+
+  if (module->meta) {
+    JSValue meta = JS_GetImportMeta(env->context, module->definition);
+
+    module->meta(env, module, &(js_value_t) {meta}, module->meta_data);
+
+    JS_FreeValue(env->context, meta);
+
+    if (JS_HasException(env->context)) {
+      JSValue error = JS_GetException(env->context);
+
+      js_deferred_t *deferred;
+      err = js_create_promise(env, &deferred, result);
+      if (err < 0) return err;
+
+      js_reject_deferred(env, deferred, &(js_value_t) {error});
+
+      JS_FreeValue(env->context, error);
+
+      return 0;
+    }
+  }
+
+  js__enter(env);
+
+  JSValue value = JS_EvalFunction(env->context, module->bytecode);
+
+  if (env->depth == 1) js__on_run_microtasks(env);
+
+  js__exit(env);
+
+  module->bytecode = JS_NULL;
+
+  if (JS_IsException(value)) {
+    JSValue error = JS_GetException(env->context);
+
+    js_deferred_t *deferred;
+    err = js_create_promise(env, &deferred, result);
+    if (err < 0) return err;
+
+    js_reject_deferred(env, deferred, &(js_value_t) {error});
+
+    JS_FreeValue(env->context, error);
+
+    return 0;
+  }
+
+  *result = js__attach_to_handle_scope(env, env->scope, value);
+
+  return 0;
+}
+
+static void
+js__on_slots_finalize (JSRuntime *runtime, JSValue value) {
+  js_env_t *env = (js_env_t *) JS_GetRuntimeOpaque(runtime);
+
+  js_slots_t *slots = (js_slots_t *) JS_GetOpaque(value, js_slots_class_id);
+
+  if (slots == NULL) return;
+
+  // Clear any weak references first so that finalizers observe them as
+  // finalized, as they may delete them.
+  js_ref_t *reference = slots->references;
+
+  while (reference) {
+    js_ref_t *next = reference->next;
+
+    reference->value = JS_NULL;
+    reference->finalized = true;
+    reference->slots = NULL;
+    reference->prev = NULL;
+    reference->next = NULL;
+
+    reference = next;
+  }
+
+  if (slots->wrapped && slots->wrap.finalize_cb) {
+    slots->wrap.finalize_cb(env, slots->wrap.data, slots->wrap.finalize_hint);
+  }
+
+  js_finalizer_list_t *next = slots->finalizers;
+  js_finalizer_list_t *prev = NULL;
+
+  while (next) {
+    js_finalizer_t *finalizer = &next->finalizer;
+
+    if (finalizer->finalize_cb) {
+      finalizer->finalize_cb(env, finalizer->data, finalizer->finalize_hint);
+    }
+
+    prev = next;
+    next = next->next;
+
+    free(prev);
+  }
+
+  free(slots);
+}
+
+static JSValue
+js__call_slots_method (js_env_t *env, JSValue method, int argc, JSValue *argv) {
+  if (!JS_HasException(env->context)) {
+    return JS_Call(env->context, method, env->slots.map, argc, argv);
+  }
+
+  // Slots may be looked up or attached with an exception pending, which must
+  // survive the call into the WeakMap. A failure of the call itself is then
+  // dropped in favour of the pending exception.
+  JSValue exception = JS_GetException(env->context);
+
+  JSValue result = JS_Call(env->context, method, env->slots.map, argc, argv);
+
+  if (JS_IsException(result)) JS_FreeValue(env->context, JS_GetException(env->context));
+
+  JS_Throw(env->context, exception);
+
+  return result;
+}
+
+static js_slots_t *
+js__get_slots (js_env_t *env, JSValue object) {
+  if (!JS_IsObject(object)) return NULL;
+
+  js_slots_t *slots = (js_slots_t *) JS_GetOpaque(object, js_slots_class_id);
+
+  if (slots) return slots;
+
+  JSValue external = js__call_slots_method(env, env->slots.get, 1, &object);
+
+  if (JS_IsException(external)) return NULL;
+
+  slots = (js_slots_t *) JS_GetOpaque(external, js_slots_class_id);
+
+  JS_FreeValue(env->context, external);
+
+  return slots;
+}
+
+static js_slots_t *
+js__ensure_slots (js_env_t *env, JSValue object) {
+  js_slots_t *slots = js__get_slots(env, object);
+
+  if (slots) return slots;
+
+  slots = calloc(1, sizeof(js_slots_t));
+
+  if (slots == NULL) {
+    if (!JS_HasException(env->context)) JS_ThrowOutOfMemory(env->context);
+
+    return NULL;
+  }
+
+  JSValue external = JS_NewObjectClass(env->context, js_slots_class_id);
+
+  if (JS_IsException(external)) {
+    free(slots);
+
+    return NULL;
+  }
+
+  JS_SetOpaque(external, slots);
+
+  JSValue argv[2] = {object, external};
+
+  JSValue map = js__call_slots_method(env, env->slots.set, 2, argv);
+
+  // The map now holds the only reference to the slots, which are freed with
+  // them on failure.
+  JS_FreeValue(env->context, external);
+
+  if (JS_IsException(map)) return NULL;
+
+  JS_FreeValue(env->context, map);
+
+  return slots;
+}
+
+static js_slots_t *
+js__try_ensure_slots (js_env_t *env, JSValue object) {
+  // For callers that can do without the slots should they fail to allocate.
+  // Only the error of the allocation is dropped, never an exception that was
+  // already pending.
+  bool pending = JS_HasException(env->context);
+
+  js_slots_t *slots = js__ensure_slots(env, object);
+
+  if (slots == NULL && !pending) JS_FreeValue(env->context, JS_GetException(env->context));
+
+  return slots;
+}
+
+static inline void
+js__set_weak_reference (js_env_t *env, js_ref_t *reference) {
+  if (reference->finalized || reference->slots == NULL) return;
+
+  js_slots_t *slots = reference->slots;
+
+  reference->prev = NULL;
+  reference->next = slots->references;
+
+  if (slots->references) slots->references->prev = reference;
+
+  slots->references = reference;
+
+  JS_FreeValue(env->context, reference->value);
+}
+
+static inline void
+js__clear_weak_reference (js_env_t *env, js_ref_t *reference) {
+  if (reference->finalized || reference->slots == NULL) return;
+
+  js_slots_t *slots = reference->slots;
+
+  JS_DupValue(env->context, reference->value);
+
+  if (reference->prev) reference->prev->next = reference->next;
+  else slots->references = reference->next;
+
+  if (reference->next) reference->next->prev = reference->prev;
+
+  reference->prev = NULL;
+  reference->next = NULL;
+}
+
+int
+js_create_reference (js_env_t *env, js_value_t *value, uint32_t count, js_ref_t **result) {
+  // Allow continuing even with a pending exception
+
+  js_ref_t *reference = malloc(sizeof(js_ref_t));
+
+  reference->value = JS_DupValue(env->context, value->value);
+  reference->count = count;
+  reference->finalized = false;
+  reference->slots = NULL;
+  reference->prev = NULL;
+  reference->next = NULL;
+
+  if (JS_IsObject(reference->value) || JS_IsFunction(env->context, reference->value)) {
+    // Weak references are tracked by the slots of the referenced object, which
+    // clears them when the object is finalized. Should the slots fail to
+    // allocate, the object is instead always held strongly.
+    reference->slots = js__try_ensure_slots(env, reference->value);
+
+    if (reference->count == 0) js__set_weak_reference(env, reference);
+  }
+
+  *result = reference;
+
+  return 0;
+}
+
+int
+js_delete_reference (js_env_t *env, js_ref_t *reference) {
+  // Allow continuing even with a pending exception
+
+  if (JS_IsObject(reference->value) || JS_IsFunction(env->context, reference->value)) {
+    if (reference->count == 0) js__clear_weak_reference(env, reference);
+  }
+
+  JS_FreeValue(env->context, reference->value);
+
+  free(reference);
+
+  return 0;
+}
+
+int
+js_reference_ref (js_env_t *env, js_ref_t *reference, uint32_t *result) {
+  // Allow continuing even with a pending exception
+
+  reference->count++;
+
+  if (JS_IsObject(reference->value) || JS_IsFunction(env->context, reference->value)) {
+    if (reference->count == 1) js__clear_weak_reference(env, reference);
+  }
+
+  if (result) *result = reference->count;
+
+  return 0;
+}
+
+int
+js_reference_unref (js_env_t *env, js_ref_t *reference, uint32_t *result) {
+  // Allow continuing even with a pending exception
+
+  if (reference->count > 0) {
+    reference->count--;
+
+    if (reference->count == 0) {
+      if (JS_IsObject(reference->value) || JS_IsFunction(env->context, reference->value)) {
+        js__set_weak_reference(env, reference);
+      }
+    }
+  }
+
+  if (result) *result = reference->count;
+
+  return 0;
+}
+
+int
+js_get_reference_value (js_env_t *env, js_ref_t *reference, js_value_t **result) {
+  // Allow continuing even with a pending exception
+
+  if (reference->finalized) *result = NULL;
+  else {
+    *result = js__attach_to_handle_scope(env, env->scope, JS_DupValue(env->context, reference->value));
+  }
+
+  return 0;
+}
+
+static void
+js__on_constructor_finalize (JSRuntime *runtime, JSValue value) {
+  js_callback_t *callback = (js_callback_t *) JS_GetOpaque(value, js_constructor_class_id);
+
+  free(callback);
+}
+
+static JSValue
+js__on_constructor_call (JSContext *context, JSValueConst new_target, int argc, JSValueConst *argv, int magic, JSValue *data) {
+  int err;
+
+  JSValue prototype = JS_GetPropertyStr(context, new_target, "prototype");
+
+  if (JS_IsException(prototype)) return prototype;
+
+  // Instances of native classes carry their slots directly rather than
+  // through the WeakMap of the env, which makes wrapping and unwrapping them a
+  // matter of reading the object opaque.
+  JSValue receiver = JS_NewObjectProtoClass(context, prototype, js_slots_class_id);
+
+  JS_FreeValue(context, prototype);
+
+  if (JS_IsException(receiver)) return receiver;
+
+  js_slots_t *slots = calloc(1, sizeof(js_slots_t));
+
+  if (slots == NULL) {
+    JS_FreeValue(context, receiver);
+
+    return JS_ThrowOutOfMemory(context);
+  }
+
+  JS_SetOpaque(receiver, slots);
+
+  js_env_t *env = (js_env_t *) JS_GetContextOpaque(context);
+
+  js_callback_t *callback = (js_callback_t *) JS_GetOpaque(*data, js_constructor_class_id);
+
+  js_callback_info_t callback_info = {
+    .callback = callback,
+    .argc = argc,
+    .argv = argv,
+    .receiver = receiver,
+    .new_target = new_target,
+  };
+
+  js_handle_scope_t *scope;
+  err = js_open_handle_scope(env, &scope);
+  assert(err == 0);
+
+  callback->cb(env, &callback_info);
+
+  err = js_close_handle_scope(env, scope);
+  assert(err == 0);
+
+  // The receiver is always the result of the construction, whatever the
+  // constructor returned, unless it threw.
+  if (JS_HasException(env->context)) {
+    JS_FreeValue(env->context, receiver);
+
+    return JS_EXCEPTION;
+  }
+
+  return receiver;
+}
+
+int
+js_define_class (js_env_t *env, const char *name, size_t len, js_function_cb constructor, void *data, js_property_descriptor_t const properties[], size_t properties_len, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  int err;
+
+  js_callback_t *callback = malloc(sizeof(js_callback_t));
+
+  callback->cb = constructor;
+  callback->data = data;
+
+  JSValue external = JS_NewObjectClass(env->context, js_constructor_class_id);
+
+  JS_SetOpaque(external, callback);
+
+  JSValue class = JS_NewCFunctionData(env->context, js__on_constructor_call, 0, 0, 1, &external);
+
+  JS_SetConstructorBit(env->context, class, true);
+
+  JSValue prototype = JS_NewObject(env->context);
+
+  JS_SetConstructor(env->context, class, prototype);
+
+  size_t instance_properties_len = 0;
+  size_t static_properties_len = 0;
+
+  for (size_t i = 0; i < properties_len; i++) {
+    const js_property_descriptor_t *property = &properties[i];
+
+    if ((property->attributes & js_static) == 0) {
+      instance_properties_len++;
+    } else {
+      static_properties_len++;
+    }
+  }
+
+  if (instance_properties_len) {
+    js_property_descriptor_t *instance_properties = malloc(sizeof(js_property_descriptor_t) * instance_properties_len);
+
+    for (size_t i = 0, j = 0; i < properties_len; i++) {
+      const js_property_descriptor_t *property = &properties[i];
+
+      if ((property->attributes & js_static) == 0) {
+        instance_properties[j++] = *property;
+      }
+    }
+
+    err = js_define_properties(env, &(js_value_t) {prototype}, instance_properties, instance_properties_len);
+    assert(err == 0);
+
+    free(instance_properties);
+  }
+
+  if (static_properties_len) {
+    js_property_descriptor_t *static_properties = malloc(sizeof(js_property_descriptor_t) * static_properties_len);
+
+    for (size_t i = 0, j = 0; i < properties_len; i++) {
+      const js_property_descriptor_t *property = &properties[i];
+
+      if ((property->attributes & js_static) != 0) {
+        static_properties[j++] = *property;
+      }
+    }
+
+    err = js_define_properties(env, &(js_value_t) {class}, static_properties, static_properties_len);
+    assert(err == 0);
+
+    free(static_properties);
+  }
+
+  JS_FreeValue(env->context, external);
+  JS_FreeValue(env->context, prototype);
+
+  *result = js__attach_to_handle_scope(env, env->scope, class);
+
+  return 0;
+}
+
+int
+js_define_properties (js_env_t *env, js_value_t *object, js_property_descriptor_t const properties[], size_t properties_len) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  int err;
+
+  for (size_t i = 0; i < properties_len; i++) {
+    const js_property_descriptor_t *property = &properties[i];
+
+    int flags = JS_PROP_HAS_WRITABLE | JS_PROP_HAS_ENUMERABLE | JS_PROP_HAS_CONFIGURABLE;
+
+    if ((property->attributes & js_writable) != 0 || property->getter || property->setter) {
+      flags |= JS_PROP_WRITABLE;
+    }
+
+    if ((property->attributes & js_enumerable) != 0) {
+      flags |= JS_PROP_ENUMERABLE;
+    }
+
+    if ((property->attributes & js_configurable) != 0) {
+      flags |= JS_PROP_CONFIGURABLE;
+    }
+
+    JSValue value = JS_UNDEFINED, getter = JS_UNDEFINED, setter = JS_UNDEFINED;
+
+    if (property->getter || property->setter) {
+      if (property->getter) {
+        flags |= JS_PROP_HAS_GET;
+
+        js_value_t *fn;
+        err = js_create_function(env, "fn", -1, property->getter, property->data, &fn);
+        assert(err == 0);
+
+        getter = fn->value;
+      }
+
+      if (property->setter) {
+        flags |= JS_PROP_HAS_SET;
+
+        js_value_t *fn;
+        err = js_create_function(env, "fn", -1, property->setter, property->data, &fn);
+        assert(err == 0);
+
+        setter = fn->value;
+      }
+    } else if (property->method) {
+      flags |= JS_PROP_HAS_VALUE;
+
+      js_value_t *fn;
+      err = js_create_function(env, "fn", -1, property->method, property->data, &fn);
+      assert(err == 0);
+
+      value = fn->value;
+    } else {
+      flags |= JS_PROP_HAS_VALUE;
+
+      value = property->value->value;
+    }
+
+    JSAtom atom = JS_ValueToAtom(env->context, property->name->value);
+
+    err = JS_DefineProperty(env->context, object->value, atom, value, getter, setter, flags);
+
+    JS_FreeAtom(env->context, atom);
+
+    if (err < 0) return js__error(env);
+  }
+
+  return 0;
+}
+
+int
+js_wrap (js_env_t *env, js_value_t *object, void *data, js_finalize_cb finalize_cb, void *finalize_hint, js_ref_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  js_slots_t *slots = js__ensure_slots(env, object->value);
+
+  if (slots == NULL) return js__error(env);
+
+  if (slots->wrapped) {
+    js_throw_error(env, NULL, "Object is already wrapped");
+
+    return js__error(env);
+  }
+
+  slots->wrap.data = data;
+  slots->wrap.finalize_cb = finalize_cb;
+  slots->wrap.finalize_hint = finalize_hint;
+  slots->wrapped = true;
+
+  if (result) return js_create_reference(env, object, 0, result);
+
+  return 0;
+}
+
+int
+js_unwrap (js_env_t *env, js_value_t *object, void **result) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  js_slots_t *slots = js__get_slots(env, object->value);
+
+  if (slots == NULL || !slots->wrapped) {
+    js_throw_error(env, NULL, "Object is not wrapped");
+
+    return js__error(env);
+  }
+
+  *result = slots->wrap.data;
+
+  return 0;
+}
+
+int
+js_remove_wrap (js_env_t *env, js_value_t *object, void **result) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  js_slots_t *slots = js__get_slots(env, object->value);
+
+  if (slots == NULL || !slots->wrapped) {
+    js_throw_error(env, NULL, "Object is not wrapped");
+
+    return js__error(env);
+  }
+
+  if (result) *result = slots->wrap.data;
+
+  slots->wrap.finalize_cb = NULL;
+  slots->wrapped = false;
+
+  return 0;
+}
+
+static int
+js__on_delegate_get_own_property (JSContext *context, JSPropertyDescriptor *descriptor, JSValueConst object, JSAtom name) {
+  js_env_t *env = (js_env_t *) JS_GetContextOpaque(context);
+
+  js_delegate_t *delegate = (js_delegate_t *) JS_GetOpaque(object, js_delegate_class_id);
+
+  if (delegate->callbacks.has) {
+    JSValue property = JS_AtomToValue(env->context, name);
+
+    bool exists = delegate->callbacks.has(env, &(js_value_t) {property}, delegate->data);
+
+    JS_FreeValue(env->context, property);
+
+    if (JS_HasException(env->context)) return js__error(env);
+
+    if (!exists) return 0;
+  }
+
+  if (delegate->callbacks.get) {
+    JSValue property = JS_AtomToValue(env->context, name);
+
+    js_value_t *result = delegate->callbacks.get(env, &(js_value_t) {property}, delegate->data);
+
+    JS_FreeValue(env->context, property);
+
+    if (JS_HasException(env->context)) return js__error(env);
+
+    if (result == NULL) return 0;
+
+    if (descriptor) {
+      descriptor->flags = JS_PROP_ENUMERABLE;
+      descriptor->value = result->value;
+      descriptor->getter = JS_UNDEFINED;
+      descriptor->setter = JS_UNDEFINED;
+    }
+
+    return 1;
+  }
+
+  return 0;
+}
+
+static int
+js__on_delegate_get_own_property_names (JSContext *context, JSPropertyEnum **pproperties, uint32_t *plen, JSValueConst object) {
+  int err;
+
+  js_env_t *env = (js_env_t *) JS_GetContextOpaque(context);
+
+  js_delegate_t *delegate = (js_delegate_t *) JS_GetOpaque(object, js_delegate_class_id);
+
+  if (delegate->callbacks.own_keys) {
+    js_value_t *result = delegate->callbacks.own_keys(env, delegate->data);
+
+    if (JS_HasException(env->context)) return js__error(env);
+
+    uint32_t len;
+    err = js_get_array_length(env, result, &len);
+    assert(err == 0);
+
+    JSPropertyEnum *properties = js_mallocz(env->context, sizeof(JSPropertyEnum) * len);
+
+    for (uint32_t i = 0; i < len; i++) {
+      js_value_t *value;
+      err = js_get_element(env, result, i, &value);
+      assert(err == 0);
+
+      properties[i].atom = JS_ValueToAtom(env->context, value->value);
+    }
+
+    *pproperties = properties;
+    *plen = len;
+
+    return 0;
+  }
+
+  *pproperties = NULL;
+  *plen = 0;
+
+  return 0;
+}
+
+static int
+js__on_delegate_delete_property (JSContext *context, JSValueConst object, JSAtom name) {
+  js_env_t *env = (js_env_t *) JS_GetContextOpaque(context);
+
+  js_delegate_t *delegate = (js_delegate_t *) JS_GetOpaque(object, js_delegate_class_id);
+
+  if (delegate->callbacks.delete_property) {
+    JSValue property = JS_AtomToValue(env->context, name);
+
+    bool success = delegate->callbacks.delete_property(env, &(js_value_t) {property}, delegate->data);
+
+    JS_FreeValue(env->context, property);
+
+    if (JS_HasException(env->context)) return js__error(env);
+
+    return success;
+  }
+
+  return 0;
+}
+
+static int
+js__on_delegate_set_property (JSContext *context, JSValueConst object, JSAtom name, JSValueConst value, JSValueConst receiver, int flags) {
+  js_env_t *env = (js_env_t *) JS_GetContextOpaque(context);
+
+  js_delegate_t *delegate = (js_delegate_t *) JS_GetOpaque(object, js_delegate_class_id);
+
+  if (delegate->callbacks.set) {
+    JSValue property = JS_AtomToValue(env->context, name);
+
+    bool success = delegate->callbacks.set(env, &(js_value_t) {property}, &(js_value_t) {value}, delegate->data);
+
+    JS_FreeValue(env->context, property);
 
     if (JS_HasException(env->context)) return js__error(env);
 
-    if (result == NULL) return 0;
+    return success;
+  }
+
+  return 0;
+}
+
+static void
+js__on_delegate_finalize (JSRuntime *runtime, JSValue value) {
+  js_env_t *env = (js_env_t *) JS_GetRuntimeOpaque(runtime);
+
+  js_delegate_t *delegate = (js_delegate_t *) JS_GetOpaque(value, js_delegate_class_id);
+
+  if (delegate->finalize_cb) {
+    delegate->finalize_cb(env, delegate->data, delegate->finalize_hint);
+  }
+
+  free(delegate);
+}
+
+int
+js_create_delegate (js_env_t *env, const js_delegate_callbacks_t *callbacks, void *data, js_finalize_cb finalize_cb, void *finalize_hint, js_value_t **result) {
+  // Allow continuing even with a pending exception
+
+  js_delegate_t *delegate = malloc(sizeof(js_delegate_t));
+
+  delegate->data = data;
+  delegate->finalize_cb = finalize_cb;
+  delegate->finalize_hint = finalize_hint;
+
+  memcpy(&delegate->callbacks, callbacks, sizeof(js_delegate_callbacks_t));
+
+  JSValue object = JS_NewObjectClass(env->context, js_delegate_class_id);
+
+  JS_SetOpaque(object, delegate);
+
+  *result = js__attach_to_handle_scope(env, env->scope, object);
+
+  return 0;
+}
+
+int
+js_add_finalizer (js_env_t *env, js_value_t *object, void *data, js_finalize_cb finalize_cb, void *finalize_hint, js_ref_t **result) {
+  // Allow continuing even with a pending exception
+
+  js_slots_t *slots = js__ensure_slots(env, object->value);
+
+  if (slots == NULL) return js__error(env);
+
+  js_finalizer_list_t *prev = malloc(sizeof(js_finalizer_list_t));
+
+  js_finalizer_t *finalizer = &prev->finalizer;
+
+  finalizer->data = data;
+  finalizer->finalize_cb = finalize_cb;
+  finalizer->finalize_hint = finalize_hint;
+
+  prev->next = slots->finalizers;
+
+  slots->finalizers = prev;
+
+  if (result) return js_create_reference(env, object, 0, result);
+
+  return 0;
+}
+
+int
+js_add_type_tag (js_env_t *env, js_value_t *object, const js_type_tag_t *tag) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  js_slots_t *slots = js__ensure_slots(env, object->value);
+
+  if (slots == NULL) return js__error(env);
+
+  if (slots->type_tagged) {
+    js_throw_errorf(env, NULL, "Object is already type tagged");
+
+    return js__error(env);
+  }
+
+  slots->type_tag.lower = tag->lower;
+  slots->type_tag.upper = tag->upper;
+  slots->type_tagged = true;
+
+  return 0;
+}
+
+int
+js_check_type_tag (js_env_t *env, js_value_t *object, const js_type_tag_t *tag, bool *result) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  js_slots_t *slots = js__get_slots(env, object->value);
+
+  *result = slots && slots->type_tagged && slots->type_tag.lower == tag->lower && slots->type_tag.upper == tag->upper;
+
+  return 0;
+}
+
+int
+js_create_int32 (js_env_t *env, int32_t value, js_value_t **result) {
+  // Allow continuing even with a pending exception
+
+  *result = js__attach_to_handle_scope(env, env->scope, JS_NewInt32(env->context, value));
+
+  return 0;
+}
+
+int
+js_create_uint32 (js_env_t *env, uint32_t value, js_value_t **result) {
+  // Allow continuing even with a pending exception
+
+  *result = js__attach_to_handle_scope(env, env->scope, JS_NewUint32(env->context, value));
+
+  return 0;
+}
+
+int
+js_create_int64 (js_env_t *env, int64_t value, js_value_t **result) {
+  // Allow continuing even with a pending exception
+
+  *result = js__attach_to_handle_scope(env, env->scope, JS_NewInt64(env->context, value));
+
+  return 0;
+}
+
+int
+js_create_double (js_env_t *env, double value, js_value_t **result) {
+  // Allow continuing even with a pending exception
+
+  *result = js__attach_to_handle_scope(env, env->scope, JS_NewFloat64(env->context, value));
+
+  return 0;
+}
+
+int
+js_create_bigint_int64 (js_env_t *env, int64_t value, js_value_t **result) {
+  // Allow continuing even with a pending exception
+
+  *result = js__attach_to_handle_scope(env, env->scope, JS_NewBigInt64(env->context, value));
+
+  return 0;
+}
+
+int
+js_create_bigint_uint64 (js_env_t *env, uint64_t value, js_value_t **result) {
+  // Allow continuing even with a pending exception
+
+  *result = js__attach_to_handle_scope(env, env->scope, JS_NewBigUint64(env->context, value));
+
+  return 0;
+}
+
+int
+js_create_string_utf8 (js_env_t *env, const utf8_t *str, size_t len, js_value_t **result) {
+  // Allow continuing even with a pending exception
+
+  JSValue value;
+
+  if (len == (size_t) -1) {
+    value = JS_NewString(env->context, (char *) str);
+  } else {
+    value = JS_NewStringLen(env->context, (char *) str, len);
+  }
+
+  *result = js__attach_to_handle_scope(env, env->scope, value);
+
+  return 0;
+}
+
+static JSValue
+js__new_string_utf8 (js_env_t *env, const void *str, size_t len) {
+  return JS_NewStringLen(env->context, (const char *) str, len);
+}
+
+static JSValue
+js__new_string_utf16le (js_env_t *env, const void *str, size_t len) {
+  size_t utf8_len = utf8_length_from_utf16le((const utf16_t *) str, len);
+
+  utf8_t *utf8 = malloc(utf8_len);
+
+  utf16le_convert_to_utf8((const utf16_t *) str, len, utf8);
+
+  JSValue value = JS_NewStringLen(env->context, (char *) utf8, utf8_len);
+
+  free(utf8);
+
+  return value;
+}
+
+static JSValue
+js__new_string_latin1 (js_env_t *env, const void *str, size_t len) {
+  size_t utf8_len = utf8_length_from_latin1((const latin1_t *) str, len);
+
+  utf8_t *utf8 = malloc(utf8_len);
+
+  latin1_convert_to_utf8((const latin1_t *) str, len, utf8);
+
+  JSValue value = JS_NewStringLen(env->context, (char *) utf8, utf8_len);
+
+  free(utf8);
+
+  return value;
+}
+
+int
+js_create_string_utf16le (js_env_t *env, const utf16_t *str, size_t len, js_value_t **result) {
+  // Allow continuing even with a pending exception
+
+  if (len == (size_t) -1) len = wcslen((wchar_t *) str);
+
+  *result = js__attach_to_handle_scope(env, env->scope, js__new_string_utf16le(env, str, len));
+
+  return 0;
+}
+
+static int
+js__create_external_string (js_env_t *env, const void *str, size_t len, JSValue (*create)(js_env_t *, const void *, size_t), js_finalize_cb finalize_cb, void *finalize_hint, js_value_t **result, bool *copied) {
+  // QuickJS keeps the characters of a string inline with its header, so
+  // strings can't reference external memory. The characters are instead
+  // copied and interned in the atom table of the runtime, such that strings
+  // with the same contents share a single copy for as long as any of them is
+  // alive, and the memory handed back to the caller right away.
+  JSValue value = create(env, str, len);
+
+  if (JS_IsException(value)) return js__error(env);
+
+  JSAtom atom = JS_ValueToAtom(env->context, value);
+
+  JS_FreeValue(env->context, value);
+
+  if (atom == JS_ATOM_NULL) return js__error(env);
+
+  value = JS_AtomToString(env->context, atom);
+
+  // The atom is kept alive by the string itself and removed from the table
+  // once the last string referencing it is collected.
+  JS_FreeAtom(env->context, atom);
+
+  if (JS_IsException(value)) return js__error(env);
+
+  if (finalize_cb) finalize_cb(env, (void *) str, finalize_hint);
+
+  if (copied) *copied = true;
+
+  *result = js__attach_to_handle_scope(env, env->scope, value);
+
+  return 0;
+}
+
+int
+js_create_external_string_utf8 (js_env_t *env, utf8_t *str, size_t len, js_finalize_cb finalize_cb, void *finalize_hint, js_value_t **result, bool *copied) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  if (len == (size_t) -1) len = strlen((char *) str);
+
+  return js__create_external_string(env, str, len, js__new_string_utf8, finalize_cb, finalize_hint, result, copied);
+}
+
+int
+js_create_external_string_utf16le (js_env_t *env, utf16_t *str, size_t len, js_finalize_cb finalize_cb, void *finalize_hint, js_value_t **result, bool *copied) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  if (len == (size_t) -1) len = wcslen((wchar_t *) str);
+
+  return js__create_external_string(env, str, len, js__new_string_utf16le, finalize_cb, finalize_hint, result, copied);
+}
+
+int
+js_create_external_string_latin1 (js_env_t *env, latin1_t *str, size_t len, js_finalize_cb finalize_cb, void *finalize_hint, js_value_t **result, bool *copied) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  if (len == (size_t) -1) len = strlen((char *) str);
+
+  return js__create_external_string(env, str, len, js__new_string_latin1, finalize_cb, finalize_hint, result, copied);
+}
+
+int
+js_create_symbol (js_env_t *env, js_value_t *description, js_value_t **result) {
+  // Allow continuing even with a pending exception
+
+  JSValue global = JS_GetGlobalObject(env->context);
+  JSValue constructor = JS_GetPropertyStr(env->context, global, "Symbol");
+
+  JSValue arg = description == NULL ? JS_NULL : description->value;
+
+  *result = js__attach_to_handle_scope(env, env->scope, JS_Call(env->context, constructor, global, 1, &arg));
+
+  JS_FreeValue(env->context, constructor);
+  JS_FreeValue(env->context, global);
+
+  return 0;
+}
+
+int
+js_create_object (js_env_t *env, js_value_t **result) {
+  // Allow continuing even with a pending exception
+
+  *result = js__attach_to_handle_scope(env, env->scope, JS_NewObject(env->context));
+
+  return 0;
+}
+
+static void
+js__on_function_finalize (JSRuntime *runtime, JSValue value) {
+  js_callback_t *callback = (js_callback_t *) JS_GetOpaque(value, js_function_class_id);
+
+  if (callback->ffi) {
+    free(callback->ffi->type_info);
+    free(callback->ffi);
+  }
+
+  free(callback);
+}
+
+// The trampoline relies on integer and floating point arguments being assigned
+// to separate register files in order, which lets a single function type call
+// any C function whose arguments all fit in registers; excess arguments are
+// simply ignored by the callee. This holds for the System V x86-64 and AAPCS64
+// calling conventions, but not for Windows x64 or any 32-bit convention.
+#if (defined(__x86_64__) && !defined(_WIN32)) || defined(__aarch64__)
+#define JS_FFI_TRAMPOLINE 1
+#endif
+
+typedef uint64_t (*js_ffi_word_function_t)(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, double, double, double, double, double, double, double, double);
+
+typedef double (*js_ffi_double_function_t)(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, double, double, double, double, double, double, double, double);
+
+static bool
+js__is_ffi_function_fast (const js_ffi_function_info_t *type_info) {
+#ifdef JS_FFI_TRAMPOLINE
+  switch (type_info->result) {
+  case js_ffi_void:
+  case js_ffi_bool:
+  case js_ffi_uint8:
+  case js_ffi_uint16:
+  case js_ffi_uint32:
+  case js_ffi_uint64:
+  case js_ffi_int8:
+  case js_ffi_int16:
+  case js_ffi_int32:
+  case js_ffi_int64:
+  case js_ffi_float64:
+    break;
+  default:
+    return false;
+  }
+
+  unsigned int words = 0, doubles = 0;
+
+  for (unsigned int i = 0; i < type_info->argc; i++) {
+    switch (type_info->argv[i]) {
+    case js_ffi_receiver:
+    case js_ffi_bool:
+    case js_ffi_uint8:
+    case js_ffi_uint16:
+    case js_ffi_uint32:
+    case js_ffi_uint64:
+    case js_ffi_int8:
+    case js_ffi_int16:
+    case js_ffi_int32:
+    case js_ffi_int64:
+    case js_ffi_pointer:
+    case js_ffi_arraybuffer:
+    case js_ffi_uint8array:
+      words += 1;
+      break;
+
+    case js_ffi_float64:
+      doubles += 1;
+      break;
+
+    default:
+      return false;
+    }
+  }
+
+  return words <= 6 && doubles <= 8;
+#else
+  return false;
+#endif
+}
+
+static inline bool
+js__unbox_ffi_integer (JSValue value, double min, double max, uint64_t *result) {
+  double number;
+
+  switch (JS_VALUE_GET_TAG(value)) {
+  case JS_TAG_INT:
+    number = JS_VALUE_GET_INT(value);
+    break;
+  case JS_TAG_FLOAT64:
+    number = JS_VALUE_GET_FLOAT64(value);
+    break;
+  default:
+    return false;
+  }
+
+  if (number < min || number > max || number != trunc(number)) return false;
+
+  *result = (uint64_t) (int64_t) number;
+
+  return true;
+}
+
+static inline void
+js__get_ffi_arraybuffer_data (js_env_t *env, JSValue arraybuffer, size_t offset, size_t len, void **result, size_t *result_len) {
+  size_t size;
 
-    if (descriptor) {
-      descriptor->flags = JS_PROP_ENUMERABLE;
-      descriptor->value = result->value;
-      descriptor->getter = JS_UNDEFINED;
-      descriptor->setter = JS_UNDEFINED;
+  uint8_t *data = JS_GetArrayBuffer(env->context, &size, arraybuffer);
+
+  // Detached buffers are passed as empty rather than bailing out.
+  if (data == NULL) {
+    JS_FreeValue(env->context, JS_GetException(env->context));
+
+    *result = NULL;
+    *result_len = 0;
+  } else {
+    *result = data + offset;
+    *result_len = len == (size_t) -1 ? size : len;
+  }
+}
+
+// Call the C function of an FFI function directly with the unboxed arguments,
+// bypassing the callback info, handle scope, and value wrappers of a regular
+// call. If any argument can't be unboxed to its declared type without
+// coercion, `false` is returned and the caller takes the regular path instead.
+static bool
+js__call_ffi_function (js_env_t *env, js_ffi_function_t *ffi, JSValue receiver, int argc, JSValue *argv, JSValue *result) {
+#ifdef JS_FFI_TRAMPOLINE
+  js_ffi_function_info_t *type_info = ffi->type_info;
+
+  uint64_t words[6] = {0};
+  double doubles[8] = {0};
+
+  size_t w = 0, d = 0;
+
+  // ArrayBuffers and typed arrays are passed by pointer to a descriptor of
+  // their data, which lives for the duration of the call.
+  js_ffi_arraybuffer_t arraybuffers[6];
+  js_ffi_typedarray_t typedarrays[6];
+
+  size_t a = 0, t = 0;
+
+  int j = 0;
+
+  for (unsigned int i = 0; i < type_info->argc; i++) {
+    js_ffi_type_t type = type_info->argv[i];
+
+    if (type == js_ffi_receiver) {
+      words[w++] = (uintptr_t) (js_ffi_receiver_t *) &receiver;
+
+      continue;
     }
 
-    return 1;
+    if (j >= argc) return false;
+
+    JSValue value = argv[j++];
+
+    switch (type) {
+    case js_ffi_bool:
+      if (JS_VALUE_GET_TAG(value) != JS_TAG_BOOL) return false;
+      words[w++] = JS_VALUE_GET_BOOL(value) != 0;
+      break;
+
+    case js_ffi_uint8:
+      if (!js__unbox_ffi_integer(value, 0, UINT8_MAX, &words[w++])) return false;
+      break;
+    case js_ffi_uint16:
+      if (!js__unbox_ffi_integer(value, 0, UINT16_MAX, &words[w++])) return false;
+      break;
+    case js_ffi_uint32:
+      if (!js__unbox_ffi_integer(value, 0, UINT32_MAX, &words[w++])) return false;
+      break;
+    case js_ffi_uint64:
+      if (!js__unbox_ffi_integer(value, 0, 9007199254740991.0, &words[w++])) return false;
+      break;
+    case js_ffi_int8:
+      if (!js__unbox_ffi_integer(value, INT8_MIN, INT8_MAX, &words[w++])) return false;
+      break;
+    case js_ffi_int16:
+      if (!js__unbox_ffi_integer(value, INT16_MIN, INT16_MAX, &words[w++])) return false;
+      break;
+    case js_ffi_int32:
+      if (!js__unbox_ffi_integer(value, INT32_MIN, INT32_MAX, &words[w++])) return false;
+      break;
+    case js_ffi_int64:
+      if (!js__unbox_ffi_integer(value, -9007199254740991.0, 9007199254740991.0, &words[w++])) return false;
+      break;
+
+    case js_ffi_float64:
+      if (JS_VALUE_GET_TAG(value) == JS_TAG_INT) doubles[d++] = JS_VALUE_GET_INT(value);
+      else if (JS_VALUE_GET_TAG(value) == JS_TAG_FLOAT64) doubles[d++] = JS_VALUE_GET_FLOAT64(value);
+      else return false;
+      break;
+
+    case js_ffi_pointer: {
+      js_finalizer_t *finalizer = (js_finalizer_t *) JS_GetOpaque(value, js_external_class_id);
+
+      if (finalizer == NULL) return false;
+
+      words[w++] = (uintptr_t) finalizer->data;
+      break;
+    }
+
+    case js_ffi_arraybuffer: {
+      if (!js__is_intrinsic_class(&env->arraybuffer, value)) return false;
+
+      js_ffi_arraybuffer_t *arraybuffer = &arraybuffers[a++];
+
+      js__get_ffi_arraybuffer_data(env, value, 0, (size_t) -1, &arraybuffer->data, &arraybuffer->len);
+
+      words[w++] = (uintptr_t) arraybuffer;
+      break;
+    }
+
+    case js_ffi_uint8array: {
+      if (!js__is_intrinsic_class(js__get_typedarray_class(env, js_uint8array), value)) return false;
+
+      size_t offset, len, bytes_per_element;
+
+      JSValue arraybuffer = JS_GetTypedArrayBuffer(env->context, value, &offset, &len, &bytes_per_element);
+
+      js_ffi_typedarray_t *typedarray = &typedarrays[t++];
+
+      js__get_ffi_arraybuffer_data(env, arraybuffer, offset, len, &typedarray->data, &typedarray->len);
+
+      JS_FreeValue(env->context, arraybuffer);
+
+      words[w++] = (uintptr_t) typedarray;
+      break;
+    }
+
+    default:
+      return false;
+    }
   }
 
-  return 0;
+  if (type_info->result == js_ffi_float64) {
+    js_ffi_double_function_t function = (js_ffi_double_function_t) ffi->function;
+
+    double value = function(words[0], words[1], words[2], words[3], words[4], words[5], doubles[0], doubles[1], doubles[2], doubles[3], doubles[4], doubles[5], doubles[6], doubles[7]);
+
+    *result = JS_NewFloat64(env->context, value);
+
+    return true;
+  }
+
+  js_ffi_word_function_t function = (js_ffi_word_function_t) ffi->function;
+
+  uint64_t value = function(words[0], words[1], words[2], words[3], words[4], words[5], doubles[0], doubles[1], doubles[2], doubles[3], doubles[4], doubles[5], doubles[6], doubles[7]);
+
+  // Only the low bits of the return register are defined for narrow return
+  // types, so truncate before boxing.
+  switch (type_info->result) {
+  case js_ffi_void:
+    *result = JS_UNDEFINED;
+    break;
+  case js_ffi_bool:
+    *result = JS_NewBool(env->context, (uint8_t) value != 0);
+    break;
+  case js_ffi_uint8:
+    *result = JS_NewInt32(env->context, (uint8_t) value);
+    break;
+  case js_ffi_uint16:
+    *result = JS_NewInt32(env->context, (uint16_t) value);
+    break;
+  case js_ffi_uint32:
+    *result = JS_NewUint32(env->context, (uint32_t) value);
+    break;
+  case js_ffi_uint64:
+    *result = value <= INT64_MAX ? JS_NewInt64(env->context, (int64_t) value) : JS_NewFloat64(env->context, (double) value);
+    break;
+  case js_ffi_int8:
+    *result = JS_NewInt32(env->context, (int8_t) value);
+    break;
+  case js_ffi_int16:
+    *result = JS_NewInt32(env->context, (int16_t) value);
+    break;
+  case js_ffi_int32:
+    *result = JS_NewInt32(env->context, (int32_t) value);
+    break;
+  case js_ffi_int64:
+    *result = JS_NewInt64(env->context, (int64_t) value);
+    break;
+  default:
+    return false;
+  }
+
+  return true;
+#else
+  return false;
+#endif
 }
 
-static int
-js__on_delegate_get_own_property_names (JSContext *context, JSPropertyEnum **pproperties, uint32_t *plen, JSValueConst object) {
+static JSValue
+js__on_function_call (JSContext *context, JSValueConst receiver, int argc, JSValueConst *argv, int magic, JSValue *data) {
   int err;
 
   js_env_t *env = (js_env_t *) JS_GetContextOpaque(context);
 
-  js_delegate_t *delegate = (js_delegate_t *) JS_GetOpaque(object, js_delegate_class_id);
+  js_callback_t *callback = (js_callback_t *) JS_GetOpaque(*data, js_function_class_id);
 
-  if (delegate->callbacks.own_keys) {
-    js_value_t *result = delegate->callbacks.own_keys(env, delegate->data);
+  JSValue value;
 
-    if (JS_HasException(env->context)) return js__error(env);
+  js__trace(env, js_trace_function_call, js_trace_begin);
 
-    uint32_t len;
-    err = js_get_array_length(env, result, &len);
-    assert(err == 0);
+  // The C function of an FFI function can neither throw nor call back into
+  // JavaScript, so there's no need for a handle scope, or checking for a
+  // pending exception, if it's called directly.
+  if (callback->ffi && callback->ffi->fast && js__call_ffi_function(env, callback->ffi, receiver, argc, argv, &value)) {
+    js__trace(env, js_trace_function_call, js_trace_end);
 
-    JSPropertyEnum *properties = js_mallocz(env->context, sizeof(JSPropertyEnum) * len);
+    return value;
+  }
 
-    for (uint32_t i = 0; i < len; i++) {
-      js_value_t *value;
-      err = js_get_element(env, result, i, &value);
-      assert(err == 0);
+  js_callback_info_t callback_info = {
+    .callback = callback,
+    .argc = argc,
+    .argv = argv,
+    .receiver = receiver,
+    .new_target = JS_NULL,
+  };
 
-      properties[i].atom = JS_ValueToAtom(env->context, value->value);
-    }
+  js_handle_scope_t *scope;
+  err = js_open_handle_scope(env, &scope);
+  assert(err == 0);
 
-    *pproperties = properties;
-    *plen = len;
+  js_value_t *result = callback->cb(env, &callback_info);
 
-    return 0;
+  if (JS_HasException(env->context)) {
+    value = JS_EXCEPTION;
+  } else {
+    if (result) value = JS_DupValue(env->context, result->value);
+    else value = JS_UNDEFINED;
   }
 
-  *pproperties = NULL;
-  *plen = 0;
+  err = js_close_handle_scope(env, scope);
+  assert(err == 0);
+
+  js__trace(env, js_trace_function_call, js_trace_end);
+
+  return value;
+}
+
+static int
+js__create_function (js_env_t *env, js_function_cb cb, void *data, js_ffi_function_t *ffi, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  js_callback_t *callback = malloc(sizeof(js_callback_t));
+
+  callback->cb = cb;
+  callback->data = data;
+  callback->ffi = ffi;
+
+  JSValue external = JS_NewObjectClass(env->context, js_function_class_id);
+
+  JS_SetOpaque(external, callback);
+
+  JSValue function = JS_NewCFunctionData(env->context, js__on_function_call, 0, 0, 1, &external);
+
+  JS_FreeValue(env->context, external);
+
+  *result = js__attach_to_handle_scope(env, env->scope, function);
+
+  return 0;
+}
+
+int
+js_create_function (js_env_t *env, const char *name, size_t len, js_function_cb cb, void *data, js_value_t **result) {
+  return js__create_function(env, cb, data, NULL, result);
+}
+
+int
+js_create_function_with_source (js_env_t *env, const char *name, size_t name_len, const char *file, size_t file_len, js_value_t *const args[], size_t args_len, int offset, js_value_t *source, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  const char *str;
+
+  size_t buf_len = 0;
+
+  if (name) {
+    buf_len += strlen("const ");
+
+    if (name_len == (size_t) -1) buf_len += strlen(name);
+    else buf_len += name_len;
+
+    buf_len += strlen(" = ");
+  }
+
+  buf_len += strlen("(");
+
+  for (int i = 0; i < args_len; i++) {
+    if (i != 0) buf_len += strlen(", ");
+
+    str = JS_ToCString(env->context, args[i]->value);
+    buf_len += strlen(str);
+    JS_FreeCString(env->context, str);
+  }
+
+  buf_len += strlen(") => {\n");
+
+  str = JS_ToCString(env->context, source->value);
+  buf_len += strlen(str);
+  JS_FreeCString(env->context, str);
+
+  buf_len += strlen("}\n");
+
+  if (name) {
+    if (name_len == (size_t) -1) buf_len += strlen(name);
+    else buf_len += name_len;
+
+    buf_len += strlen("\n");
+  }
+
+  char *buf = malloc(buf_len + 1 /* NULL */);
+
+  buf[0] = '\0';
+
+  if (name) {
+    strcat(buf, "const ");
+
+    if (name_len == (size_t) -1) strcat(buf, name);
+    else strncat(buf, name, name_len);
+
+    strcat(buf, " = ");
+  }
+
+  strcat(buf, "(");
+
+  for (int i = 0; i < args_len; i++) {
+    if (i != 0) strcat(buf, ", ");
+
+    str = JS_ToCString(env->context, args[i]->value);
+    strcat(buf, str);
+    JS_FreeCString(env->context, str);
+  }
+
+  strcat(buf, ") => {\n");
+
+  str = JS_ToCString(env->context, source->value);
+  strcat(buf, str);
+  JS_FreeCString(env->context, str);
+
+  strcat(buf, "}\n");
+
+  if (name) {
+    if (name_len == (size_t) -1) strcat(buf, name);
+    else strncat(buf, name, name_len);
+
+    strcat(buf, "\n");
+  }
+
+  if (file == NULL) file = "";
+
+  JSValue function = JS_Eval(
+    env->context,
+    buf,
+    buf_len,
+    file,
+    JS_EVAL_TYPE_GLOBAL
+  );
+
+  free(buf);
+
+  if (JS_IsException(function)) {
+    if (env->depth == 0) {
+      JSValue error = JS_GetException(env->context);
+
+      js__on_uncaught_exception(env->context, error);
+    }
+
+    return js__error(env);
+  }
+
+  *result = js__attach_to_handle_scope(env, env->scope, function);
+
+  return 0;
+}
+
+int
+js_get_ffi_arraybuffer_info (js_ffi_arraybuffer_t *arraybuffer, void **data, size_t *len) {
+  if (data) *data = arraybuffer->data;
+
+  if (len) *len = arraybuffer->len;
+
+  return 0;
+}
+
+int
+js_get_ffi_typedarray_info (js_ffi_typedarray_t *typedarray, void **data, size_t *len) {
+  if (data) *data = typedarray->data;
+
+  if (len) *len = typedarray->len;
+
+  return 0;
+}
+
+int
+js_create_function_with_ffi (js_env_t *env, const char *name, size_t len, js_function_cb cb, void *data, js_ffi_function_t *ffi, js_value_t **result) {
+  return js__create_function(env, cb, data, ffi, result);
+}
+
+int
+js_create_array (js_env_t *env, js_value_t **result) {
+  // Allow continuing even with a pending exception
+
+  *result = js__attach_to_handle_scope(env, env->scope, JS_NewArray(env->context));
 
   return 0;
 }
 
-static int
-js__on_delegate_delete_property (JSContext *context, JSValueConst object, JSAtom name) {
-  js_env_t *env = (js_env_t *) JS_GetContextOpaque(context);
-
-  js_delegate_t *delegate = (js_delegate_t *) JS_GetOpaque(object, js_delegate_class_id);
-
-  if (delegate->callbacks.delete_property) {
-    JSValue property = JS_AtomToValue(env->context, name);
+int
+js_create_array_with_length (js_env_t *env, size_t len, js_value_t **result) {
+  // Allow continuing even with a pending exception
 
-    bool success = delegate->callbacks.delete_property(env, &(js_value_t) {property}, delegate->data);
+  JSValue global = JS_GetGlobalObject(env->context);
+  JSValue constructor = JS_GetPropertyStr(env->context, global, "Array");
 
-    JS_FreeValue(env->context, property);
+  JSValue arg = JS_NewUint32(env->context, len);
 
-    if (JS_HasException(env->context)) return js__error(env);
+  *result = js__attach_to_handle_scope(env, env->scope, JS_CallConstructor(env->context, constructor, 1, &arg));
 
-    return success;
-  }
+  JS_FreeValue(env->context, arg);
+  JS_FreeValue(env->context, constructor);
+  JS_FreeValue(env->context, global);
 
   return 0;
 }
 
-static int
-js__on_delegate_set_property (JSContext *context, JSValueConst object, JSAtom name, JSValueConst value, JSValueConst receiver, int flags) {
-  js_env_t *env = (js_env_t *) JS_GetContextOpaque(context);
+static inline JSValue
+js__create_array_with_length (js_env_t *env, size_t len) {
+  if (len > UINT32_MAX) {
+    js_throw_range_error(env, NULL, "Array length must be at most 2^32 - 1");
 
-  js_delegate_t *delegate = (js_delegate_t *) JS_GetOpaque(object, js_delegate_class_id);
+    return JS_EXCEPTION;
+  }
 
-  if (delegate->callbacks.set) {
-    JSValue property = JS_AtomToValue(env->context, name);
+  JSValue array = JS_NewArray(env->context);
 
-    bool success = delegate->callbacks.set(env, &(js_value_t) {property}, &(js_value_t) {value}, delegate->data);
+  if (JS_IsException(array)) return array;
 
-    JS_FreeValue(env->context, property);
+  // Set the final length up front so that it's not bumped once per element.
+  // The array stays fast as the elements are then appended in order.
+  if (JS_SetPropertyStr(env->context, array, "length", JS_NewInt64(env->context, len)) < 0) {
+    JS_FreeValue(env->context, array);
 
-    if (JS_HasException(env->context)) return js__error(env);
+    return JS_EXCEPTION;
+  }
 
-    return success;
+  return array;
+}
+
+static inline int
+js__append_array_element (js_env_t *env, JSValue array, uint32_t index, JSValue value) {
+  // Defining the element at the current count of a fast array appends it in
+  // place, so the array stays dense and no setters need to be consulted.
+  if (JS_DefinePropertyValueUint32(env->context, array, index, value, JS_PROP_C_W_E) < 0) {
+    JS_FreeValue(env->context, array);
+
+    return -1;
   }
 
   return 0;
 }
 
-static void
-js__on_delegate_finalize (JSRuntime *runtime, JSValue value) {
-  js_env_t *env = (js_env_t *) JS_GetRuntimeOpaque(runtime);
+int
+js_create_array_with_elements (js_env_t *env, js_value_t *const elements[], size_t len, js_value_t **result) {
+  // Allow continuing even with a pending exception
 
-  js_delegate_t *delegate = (js_delegate_t *) JS_GetOpaque(value, js_delegate_class_id);
+  JSValue array = js__create_array_with_length(env, len);
 
-  if (delegate->finalize_cb) {
-    delegate->finalize_cb(env, delegate->data, delegate->finalize_hint);
+  if (JS_IsException(array)) return js__error(env);
+
+  for (uint32_t i = 0; i < len; i++) {
+    if (js__append_array_element(env, array, i, JS_DupValue(env->context, elements[i]->value)) < 0) {
+      return js__error(env);
+    }
   }
 
-  free(delegate);
+  *result = js__attach_to_handle_scope(env, env->scope, array);
+
+  return 0;
 }
 
 int
-js_create_delegate (js_env_t *env, const js_delegate_callbacks_t *callbacks, void *data, js_finalize_cb finalize_cb, void *finalize_hint, js_value_t **result) {
+js_create_array_with_doubles (js_env_t *env, const double *elements, size_t len, js_value_t **result) {
   // Allow continuing even with a pending exception
 
-  js_delegate_t *delegate = malloc(sizeof(js_delegate_t));
+  JSValue array = js__create_array_with_length(env, len);
 
-  delegate->data = data;
-  delegate->finalize_cb = finalize_cb;
-  delegate->finalize_hint = finalize_hint;
+  if (JS_IsException(array)) return js__error(env);
 
-  memcpy(&delegate->callbacks, callbacks, sizeof(js_delegate_callbacks_t));
+  for (uint32_t i = 0; i < len; i++) {
+    if (js__append_array_element(env, array, i, JS_NewFloat64(env->context, elements[i])) < 0) {
+      return js__error(env);
+    }
+  }
 
-  JSValue object = JS_NewObjectClass(env->context, js_delegate_class_id);
+  *result = js__attach_to_handle_scope(env, env->scope, array);
 
-  JS_SetOpaque(object, delegate);
+  return 0;
+}
+
+int
+js_create_array_with_int32s (js_env_t *env, const int32_t *elements, size_t len, js_value_t **result) {
+  // Allow continuing even with a pending exception
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  JSValue array = js__create_array_with_length(env, len);
 
-  wrapper->value = object;
+  if (JS_IsException(array)) return js__error(env);
 
-  *result = wrapper;
+  for (uint32_t i = 0; i < len; i++) {
+    if (js__append_array_element(env, array, i, JS_NewInt32(env->context, elements[i])) < 0) {
+      return js__error(env);
+    }
+  }
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  *result = js__attach_to_handle_scope(env, env->scope, array);
 
   return 0;
 }
 
 static void
-js__on_finalizer_finalize (JSRuntime *runtime, JSValue value) {
+js__on_external_finalize (JSRuntime *runtime, JSValue value) {
   js_env_t *env = (js_env_t *) JS_GetRuntimeOpaque(runtime);
 
-  js_finalizer_list_t *next = (js_finalizer_list_t *) JS_GetOpaque(value, js_finalizer_class_id);
-  js_finalizer_list_t *prev = NULL;
-
-  while (next) {
-    js_finalizer_t *finalizer = &next->finalizer;
-
-    if (finalizer->finalize_cb) {
-      finalizer->finalize_cb(env, finalizer->data, finalizer->finalize_hint);
-    }
-
-    prev = next;
-    next = next->next;
+  js_finalizer_t *finalizer = (js_finalizer_t *) JS_GetOpaque(value, js_external_class_id);
 
-    free(prev);
+  if (finalizer->finalize_cb) {
+    finalizer->finalize_cb(env, finalizer->data, finalizer->finalize_hint);
   }
+
+  free(finalizer);
 }
 
 int
-js_add_finalizer (js_env_t *env, js_value_t *object, void *data, js_finalize_cb finalize_cb, void *finalize_hint, js_ref_t **result) {
+js_create_external (js_env_t *env, void *data, js_finalize_cb finalize_cb, void *finalize_hint, js_value_t **result) {
   // Allow continuing even with a pending exception
 
-  int err;
-
-  js_finalizer_list_t *prev = malloc(sizeof(js_finalizer_list_t));
-
-  js_finalizer_t *finalizer = &prev->finalizer;
+  js_finalizer_t *finalizer = malloc(sizeof(js_finalizer_t));
 
   finalizer->data = data;
   finalizer->finalize_cb = finalize_cb;
   finalizer->finalize_hint = finalize_hint;
 
-  JSAtom atom = JS_NewAtom(env->context, "__native_finalizer");
+  JSValue external = JS_NewObjectClass(env->context, js_external_class_id);
+
+  JS_SetOpaque(external, finalizer);
 
-  JSValue external;
+  *result = js__attach_to_handle_scope(env, env->scope, external);
 
-  if (JS_HasProperty(env->context, object->value, atom) == 1) {
-    external = JS_GetProperty(env->context, object->value, atom);
-  } else {
-    external = JS_NewObjectClass(env->context, js_finalizer_class_id);
+  return 0;
+}
 
-    JS_SetOpaque(external, NULL);
+int
+js_create_date (js_env_t *env, double time, js_value_t **result) {
+  // Allow continuing even with a pending exception
 
-    err = JS_DefinePropertyValue(env->context, object->value, atom, external, 0);
-    assert(err >= 0);
+  *result = js__attach_to_handle_scope(env, env->scope, JS_NewDate(env->context, time));
 
-    JS_DupValue(env->context, external);
-  }
+  return 0;
+}
 
-  JS_FreeAtom(env->context, atom);
+int
+js_create_error (js_env_t *env, js_value_t *code, js_value_t *message, js_value_t **result) {
+  // Allow continuing even with a pending exception
 
-  prev->next = (js_finalizer_list_t *) JS_GetOpaque(external, js_finalizer_class_id);
+  JSValue global = JS_GetGlobalObject(env->context);
+  JSValue constructor = JS_GetPropertyStr(env->context, global, "Error");
 
-  JS_SetOpaque(external, prev);
+  JSValue arg = message->value;
 
-  JS_FreeValue(env->context, external);
+  JSValue error = JS_CallConstructor(env->context, constructor, 1, &arg);
 
-  if (result) return js_create_reference(env, object, 0, result);
+  if (code) {
+    JS_SetPropertyStr(env->context, error, "code", JS_DupValue(env->context, code->value));
+  }
 
-  return 0;
-}
+  *result = js__attach_to_handle_scope(env, env->scope, error);
 
-static void
-js__on_type_tag_finalize (JSRuntime *runtime, JSValue value) {
-  js_type_tag_t *tag = (js_type_tag_t *) JS_GetOpaque(value, js_type_tag_class_id);
+  JS_FreeValue(env->context, constructor);
+  JS_FreeValue(env->context, global);
 
-  free(tag);
+  return 0;
 }
 
 int
-js_add_type_tag (js_env_t *env, js_value_t *object, const js_type_tag_t *tag) {
-  if (JS_HasException(env->context)) return js__error(env);
-
-  int err;
+js_create_type_error (js_env_t *env, js_value_t *code, js_value_t *message, js_value_t **result) {
+  // Allow continuing even with a pending exception
 
-  JSAtom atom = JS_NewAtom(env->context, "__native_type_tag");
+  JSValue global = JS_GetGlobalObject(env->context);
+  JSValue constructor = JS_GetPropertyStr(env->context, global, "TypeError");
 
-  if (JS_HasProperty(env->context, object->value, atom) == 1) {
-    JS_FreeAtom(env->context, atom);
+  JSValue arg = message->value;
 
-    js_throw_errorf(env, NULL, "Object is already type tagged");
+  JSValue error = JS_CallConstructor(env->context, constructor, 1, &arg);
 
-    return js__error(env);
+  if (code) {
+    JS_SetPropertyStr(env->context, error, "code", JS_DupValue(env->context, code->value));
   }
 
-  js_type_tag_t *existing = malloc(sizeof(js_type_tag_t));
+  *result = js__attach_to_handle_scope(env, env->scope, error);
 
-  existing->lower = tag->lower;
-  existing->upper = tag->upper;
+  JS_FreeValue(env->context, constructor);
+  JS_FreeValue(env->context, global);
+
+  return 0;
+}
+
+int
+js_create_range_error (js_env_t *env, js_value_t *code, js_value_t *message, js_value_t **result) {
+  // Allow continuing even with a pending exception
 
-  JSValue external = JS_NewObjectClass(env->context, js_type_tag_class_id);
+  JSValue global = JS_GetGlobalObject(env->context);
+  JSValue constructor = JS_GetPropertyStr(env->context, global, "RangeError");
 
-  JS_SetOpaque(external, existing);
+  JSValue arg = message->value;
 
-  err = JS_DefinePropertyValue(env->context, object->value, atom, external, 0);
-  assert(err >= 0);
+  JSValue error = JS_CallConstructor(env->context, constructor, 1, &arg);
 
-  JS_FreeAtom(env->context, atom);
+  if (code) {
+    JS_SetPropertyStr(env->context, error, "code", JS_DupValue(env->context, code->value));
+  }
+
+  *result = js__attach_to_handle_scope(env, env->scope, error);
+
+  JS_FreeValue(env->context, constructor);
+  JS_FreeValue(env->context, global);
 
   return 0;
 }
 
 int
-js_check_type_tag (js_env_t *env, js_value_t *object, const js_type_tag_t *tag, bool *result) {
-  if (JS_HasException(env->context)) return js__error(env);
-
-  JSAtom atom = JS_NewAtom(env->context, "__native_type_tag");
-
-  *result = false;
+js_create_syntax_error (js_env_t *env, js_value_t *code, js_value_t *message, js_value_t **result) {
+  // Allow continuing even with a pending exception
 
-  if (JS_HasProperty(env->context, object->value, atom) == 1) {
-    JSValue external = JS_GetProperty(env->context, object->value, atom);
+  JSValue global = JS_GetGlobalObject(env->context);
+  JSValue constructor = JS_GetPropertyStr(env->context, global, "SyntaxError");
 
-    js_type_tag_t *existing = (js_type_tag_t *) JS_GetOpaque(external, js_type_tag_class_id);
+  JSValue arg = message->value;
 
-    JS_FreeValue(env->context, external);
+  JSValue error = JS_CallConstructor(env->context, constructor, 1, &arg);
 
-    *result = existing->lower == tag->lower && existing->upper == tag->upper;
+  if (code) {
+    JS_SetPropertyStr(env->context, error, "code", JS_DupValue(env->context, code->value));
   }
 
-  JS_FreeAtom(env->context, atom);
+  *result = js__attach_to_handle_scope(env, env->scope, error);
+
+  JS_FreeValue(env->context, constructor);
+  JS_FreeValue(env->context, global);
 
   return 0;
 }
 
 int
-js_create_int32 (js_env_t *env, int32_t value, js_value_t **result) {
+js_create_promise (js_env_t *env, js_deferred_t **deferred, js_value_t **promise) {
   // Allow continuing even with a pending exception
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  *deferred = malloc(sizeof(js_deferred_t));
+
+  JSValue functions[2];
 
-  wrapper->value = JS_NewInt32(env->context, value);
+  JSValue value = JS_NewPromiseCapability(env->context, functions);
 
-  *result = wrapper;
+  (*deferred)->resolve = functions[0];
+  (*deferred)->reject = functions[1];
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  *promise = js__attach_to_handle_scope(env, env->scope, value);
 
   return 0;
 }
 
-int
-js_create_uint32 (js_env_t *env, uint32_t value, js_value_t **result) {
+static inline int
+js__conclude_deferred (js_env_t *env, js_deferred_t *deferred, js_value_t *resolution, bool resolved) {
   // Allow continuing even with a pending exception
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  JSValue global = JS_GetGlobalObject(env->context);
+
+  JSValue result = JS_Call(env->context, resolved ? deferred->resolve : deferred->reject, global, 1, &resolution->value);
 
-  wrapper->value = JS_NewUint32(env->context, value);
+  if (env->depth == 0) js__on_run_microtasks(env);
 
-  *result = wrapper;
+  JS_FreeValue(env->context, global);
+  JS_FreeValue(env->context, result);
+  JS_FreeValue(env->context, deferred->resolve);
+  JS_FreeValue(env->context, deferred->reject);
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  free(deferred);
 
   return 0;
 }
 
 int
-js_create_int64 (js_env_t *env, int64_t value, js_value_t **result) {
-  // Allow continuing even with a pending exception
-
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+js_resolve_deferred (js_env_t *env, js_deferred_t *deferred, js_value_t *resolution) {
+  return js__conclude_deferred(env, deferred, resolution, true);
+}
 
-  wrapper->value = JS_NewInt64(env->context, value);
+int
+js_reject_deferred (js_env_t *env, js_deferred_t *deferred, js_value_t *resolution) {
+  return js__conclude_deferred(env, deferred, resolution, false);
+}
 
-  *result = wrapper;
+int
+js_get_promise_state (js_env_t *env, js_value_t *promise, js_promise_state_t *result) {
+  // Allow continuing even with a pending exception
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  switch (JS_PromiseState(env->context, promise->value)) {
+  case JS_PROMISE_PENDING:
+    *result = js_promise_pending;
+    break;
+  case JS_PROMISE_FULFILLED:
+    *result = js_promise_fulfilled;
+    break;
+  case JS_PROMISE_REJECTED:
+    *result = js_promise_rejected;
+    break;
+  }
 
   return 0;
 }
 
 int
-js_create_double (js_env_t *env, double value, js_value_t **result) {
+js_get_promise_result (js_env_t *env, js_value_t *promise, js_value_t **result) {
   // Allow continuing even with a pending exception
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  assert(JS_PromiseState(env->context, promise->value) != JS_PROMISE_PENDING);
+
+  *result = js__attach_to_handle_scope(env, env->scope, JS_PromiseResult(env->context, promise->value));
+
+  return 0;
+}
+
+static void
+js__on_arraybuffer_finalize (JSRuntime *runtime, void *opaque, void *ptr) {
+  // A detached ArrayBuffer has already been finalized once, but QuickJS will
+  // call the finalizer again with a `NULL` pointer when collecting it.
+  if (ptr == NULL) return;
 
-  wrapper->value = JS_NewFloat64(env->context, value);
+  js_env_t *env = (js_env_t *) JS_GetRuntimeOpaque(runtime);
 
-  *result = wrapper;
+  js_arraybuffer_header_t *header = (js_arraybuffer_header_t *) opaque;
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  js__adjust_external_memory(env, -(int64_t) header->len);
 
-  return 0;
+  js__unref_arraybuffer_header(header);
 }
 
-int
-js_create_bigint_int64 (js_env_t *env, int64_t value, js_value_t **result) {
-  // Allow continuing even with a pending exception
+static JSValue
+js__create_arraybuffer_from_header (js_env_t *env, js_arraybuffer_header_t *header) {
+  JSValue arraybuffer = JS_NewArrayBuffer(env->context, header->data, header->len, js__on_arraybuffer_finalize, (void *) header, false);
+
+  if (JS_IsException(arraybuffer)) {
+    js__unref_arraybuffer_header(header);
+
+    return arraybuffer;
+  }
+
+  js__adjust_external_memory(env, header->len);
+
+  return arraybuffer;
+}
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+static void
+js__on_pooled_arraybuffer_finalize (JSRuntime *runtime, void *opaque, void *ptr) {
+  if (ptr == NULL) return;
+
+  js_env_t *env = (js_env_t *) JS_GetRuntimeOpaque(runtime);
+
+  js__release_pooled_arraybuffer_slab(env, (js_arraybuffer_slab_t *) opaque);
+}
+
+static void
+js__on_slab_arraybuffer_finalize (JSRuntime *runtime, void *opaque, void *ptr) {
+  if (ptr == NULL) return;
 
-  wrapper->value = JS_NewBigInt64(env->context, value);
+  js__unref_arraybuffer_slab((js_arraybuffer_slab_t *) opaque);
+}
 
-  *result = wrapper;
+static js_arraybuffer_slab_t *
+js__find_arraybuffer_slab (js_env_t *env, JSValue arraybuffer, uint8_t *data) {
+  js_arraybuffer_slab_t *slab;
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  // Pooled buffers, and those created from a backing store of one, carry
+  // their slab as their opaque pointer.
+  slab = js__get_arraybuffer_opaque(env, arraybuffer, js__on_pooled_arraybuffer_finalize);
 
-  return 0;
-}
+  if (slab) return slab;
 
-int
-js_create_bigint_uint64 (js_env_t *env, uint64_t value, js_value_t **result) {
-  // Allow continuing even with a pending exception
+  slab = js__get_arraybuffer_opaque(env, arraybuffer, js__on_slab_arraybuffer_finalize);
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  if (slab || env->arraybuffer_opaque >= 0) return slab;
 
-  wrapper->value = JS_NewBigUint64(env->context, value);
+  // Without access to the opaque pointer, only buffers allocated by the env
+  // itself are found among the slabs it's holding buffers of, newest first.
+  slab = env->arraybuffer_slabs;
 
-  *result = wrapper;
+  while (slab) {
+    if (data >= slab->data && data < slab->data + slab->len) return slab;
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+    slab = slab->next;
+  }
 
-  return 0;
+  return NULL;
 }
 
-int
-js_create_string_utf8 (js_env_t *env, const utf8_t *str, size_t len, js_value_t **result) {
-  // Allow continuing even with a pending exception
+static inline uint8_t *
+js__allocate_pooled_arraybuffer (js_env_t *env, size_t len, js_arraybuffer_slab_t **result) {
+  js_arraybuffer_slab_t *slab = env->arraybuffer_slab;
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  // Keep the buffers aligned such that they may be viewed by any kind of
+  // typed array.
+  size_t aligned_len = (len + 15) & ~((size_t) 15);
 
-  if (len == (size_t) -1) {
-    wrapper->value = JS_NewString(env->context, (char *) str);
-  } else {
-    wrapper->value = JS_NewStringLen(env->context, (char *) str, len);
-  }
+  if (slab == NULL || js_arraybuffer_slab_size - sizeof(js_arraybuffer_slab_t) - slab->len < aligned_len) {
+    if (slab) js__release_pooled_arraybuffer_slab(env, slab);
 
-  *result = wrapper;
+    env->arraybuffer_slab = NULL;
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+    slab = malloc(js_arraybuffer_slab_size);
 
-  return 0;
-}
+    if (slab == NULL) return NULL;
 
-int
-js_create_string_utf16le (js_env_t *env, const utf16_t *str, size_t len, js_value_t **result) {
-  // Allow continuing even with a pending exception
+    // The env holds a reference to the slab it's currently allocating from.
+    slab->buffers = 1;
+    slab->len = 0;
+    slab->prev = NULL;
+    slab->next = env->arraybuffer_slabs;
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+    atomic_init(&slab->references, 1);
 
-  if (len == (size_t) -1) len = wcslen((wchar_t *) str);
+    if (env->arraybuffer_slabs) env->arraybuffer_slabs->prev = slab;
 
-  size_t utf8_len = utf8_length_from_utf16le(str, len);
+    env->arraybuffer_slabs = slab;
 
-  utf8_t *utf8 = malloc(len);
+    js__adjust_external_memory(env, js_arraybuffer_slab_size);
 
-  utf16le_convert_to_utf8(str, len, utf8);
+    env->arraybuffer_slab = slab;
+  }
 
-  wrapper->value = JS_NewStringLen(env->context, (char *) utf8, utf8_len);
+  uint8_t *bytes = &slab->data[slab->len];
 
-  *result = wrapper;
+  slab->len += aligned_len;
+  slab->buffers++;
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  *result = slab;
 
-  return 0;
+  return bytes;
 }
 
-int
-js_create_symbol (js_env_t *env, js_value_t *description, js_value_t **result) {
-  // Allow continuing even with a pending exception
+static int
+js__create_arraybuffer (js_env_t *env, size_t len, bool zero_fill, void **data, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "Symbol");
+  JSValue arraybuffer;
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  uint8_t *bytes;
 
-  JSValue arg = description == NULL ? JS_NULL : description->value;
+  // Small buffers are carved from a shared slab that is freed once all buffers
+  // allocated from it have been collected, similar to the Buffer pool of
+  // Node.js. Larger buffers are allocated individually behind a reference
+  // counted header, relying on `calloc()` to obtain pages that are already
+  // zeroed.
+  if (len < js_arraybuffer_max_pooled_len) {
+    js_arraybuffer_slab_t *slab;
+    bytes = js__allocate_pooled_arraybuffer(env, len, &slab);
 
-  wrapper->value = JS_Call(env->context, constructor, global, 1, &arg);
+    if (bytes == NULL) {
+      js_throw_range_error(env, NULL, "Array buffer allocation failed");
 
-  *result = wrapper;
+      return js__error(env);
+    }
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+    if (zero_fill) memset(bytes, 0, len);
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+    arraybuffer = JS_NewArrayBuffer(env->context, bytes, len, js__on_pooled_arraybuffer_finalize, (void *) slab, false);
 
-  return 0;
-}
+    if (JS_IsException(arraybuffer)) js__release_pooled_arraybuffer_slab(env, slab);
+  } else {
+    js_arraybuffer_header_t *header = js__create_arraybuffer_header(len, zero_fill);
 
-int
-js_create_object (js_env_t *env, js_value_t **result) {
-  // Allow continuing even with a pending exception
+    if (header == NULL) {
+      js_throw_range_error(env, NULL, "Array buffer allocation failed");
+
+      return js__error(env);
+    }
+
+    bytes = header->data;
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+    arraybuffer = js__create_arraybuffer_from_header(env, header);
+  }
 
-  wrapper->value = JS_NewObject(env->context);
+  if (JS_IsException(arraybuffer)) return js__error(env);
 
-  *result = wrapper;
+  if (data) {
+    *data = bytes;
+  }
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  *result = js__attach_to_handle_scope(env, env->scope, arraybuffer);
 
   return 0;
 }
 
-static void
-js__on_function_finalize (JSRuntime *runtime, JSValue value) {
-  js_callback_t *callback = (js_callback_t *) JS_GetOpaque(value, js_function_class_id);
+int
+js_create_arraybuffer (js_env_t *env, size_t len, void **data, js_value_t **result) {
+  return js__create_arraybuffer(env, len, atomic_load_explicit(&js_arraybuffer_zero_fill, memory_order_relaxed), data, result);
+}
 
-  free(callback);
+static inline void
+js__release_arraybuffer_backing_store (js_arraybuffer_backing_store_t *backing_store) {
+  if (atomic_fetch_sub_explicit(&backing_store->references, 1, memory_order_acq_rel) == 1) {
+    if (backing_store->header) js__unref_arraybuffer_header(backing_store->header);
+    else if (backing_store->slab) js__unref_arraybuffer_slab(backing_store->slab);
+    else JS_FreeValueRT(backing_store->runtime, backing_store->owner);
+
+    free(backing_store);
+  }
 }
 
-static JSValue
-js__on_function_call (JSContext *context, JSValueConst receiver, int argc, JSValueConst *argv, int magic, JSValue *data) {
-  int err;
+static void
+js__on_backed_arraybuffer_finalize (JSRuntime *runtime, void *opaque, void *ptr) {
+  if (ptr == NULL) return;
 
-  js_env_t *env = (js_env_t *) JS_GetContextOpaque(context);
+  js__release_arraybuffer_backing_store((js_arraybuffer_backing_store_t *) opaque);
+}
 
-  js_callback_t *callback = (js_callback_t *) JS_GetOpaque(*data, js_function_class_id);
+int
+js_create_arraybuffer_with_backing_store (js_env_t *env, js_arraybuffer_backing_store_t *backing_store, void **data, size_t *len, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  js_callback_info_t callback_info = {
-    .callback = callback,
-    .argc = argc,
-    .argv = argv,
-    .receiver = receiver,
-    .new_target = JS_NULL,
-  };
+  JSValue arraybuffer;
 
-  js_handle_scope_t *scope;
-  err = js_open_handle_scope(env, &scope);
-  assert(err == 0);
+  if (backing_store->header) {
+    // The new ArrayBuffer references the header directly and so outlives the
+    // backing store, which may also have come from a different env.
+    js__ref_arraybuffer_header(backing_store->header);
 
-  js_value_t *result = callback->cb(env, &callback_info);
+    arraybuffer = js__create_arraybuffer_from_header(env, backing_store->header);
+  } else if (backing_store->slab) {
+    // Likewise, the new ArrayBuffer references the slab of a pooled buffer
+    // directly.
+    js__ref_arraybuffer_slab(backing_store->slab);
 
-  JSValue value;
+    arraybuffer = JS_NewArrayBuffer(env->context, backing_store->data, backing_store->len, js__on_slab_arraybuffer_finalize, backing_store->slab, false);
 
-  if (JS_HasException(env->context)) {
-    if (result) JS_FreeValue(env->context, result->value);
-    value = JS_EXCEPTION;
+    if (JS_IsException(arraybuffer)) js__unref_arraybuffer_slab(backing_store->slab);
   } else {
-    if (result) value = JS_DupValue(env->context, result->value);
-    else value = JS_UNDEFINED;
+    atomic_fetch_add_explicit(&backing_store->references, 1, memory_order_relaxed);
+
+    arraybuffer = JS_NewArrayBuffer(env->context, backing_store->data, backing_store->len, js__on_backed_arraybuffer_finalize, backing_store, false);
+
+    if (JS_IsException(arraybuffer)) {
+      atomic_fetch_sub_explicit(&backing_store->references, 1, memory_order_relaxed);
+    }
   }
 
-  err = js_close_handle_scope(env, scope);
-  assert(err == 0);
+  if (JS_IsException(arraybuffer)) return js__error(env);
 
-  return value;
-}
+  if (data) {
+    *data = backing_store->data;
+  }
 
-int
-js_create_function (js_env_t *env, const char *name, size_t len, js_function_cb cb, void *data, js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
+  if (len) {
+    *len = backing_store->len;
+  }
 
-  js_callback_t *callback = malloc(sizeof(js_callback_t));
+  *result = js__attach_to_handle_scope(env, env->scope, arraybuffer);
 
-  callback->cb = cb;
-  callback->data = data;
+  return 0;
+}
 
-  JSValue external = JS_NewObjectClass(env->context, js_function_class_id);
+int
+js_create_unsafe_arraybuffer (js_env_t *env, size_t len, void **data, js_value_t **result) {
+  return js__create_arraybuffer(env, len, false, data, result);
+}
 
-  JS_SetOpaque(external, callback);
+static void
+js__on_external_arraybuffer_finalize (JSRuntime *runtime, void *opaque, void *ptr) {
+  if (ptr == NULL) return;
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  js_env_t *env = (js_env_t *) JS_GetRuntimeOpaque(runtime);
 
-  wrapper->value = JS_NewCFunctionData(env->context, js__on_function_call, 0, 0, 1, &external);
+  js_external_arraybuffer_t *external = (js_external_arraybuffer_t *) opaque;
 
-  JS_FreeValue(env->context, external);
+  js__adjust_external_memory(env, -(int64_t) external->len);
 
-  *result = wrapper;
+  js_finalizer_t *finalizer = &external->finalizer;
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  if (finalizer->finalize_cb) {
+    finalizer->finalize_cb(env, finalizer->data, finalizer->finalize_hint);
+  }
 
-  return 0;
+  free(external);
 }
 
 int
-js_create_function_with_source (js_env_t *env, const char *name, size_t name_len, const char *file, size_t file_len, js_value_t *const args[], size_t args_len, int offset, js_value_t *source, js_value_t **result) {
+js_create_external_arraybuffer (js_env_t *env, void *data, size_t len, js_finalize_cb finalize_cb, void *finalize_hint, js_value_t **result) {
   if (JS_HasException(env->context)) return js__error(env);
 
-  const char *str;
+  js_external_arraybuffer_t *external = malloc(sizeof(js_external_arraybuffer_t));
 
-  size_t buf_len = 0;
+  external->finalizer.data = data;
+  external->finalizer.finalize_cb = finalize_cb;
+  external->finalizer.finalize_hint = finalize_hint;
+  external->len = len;
 
-  if (name) {
-    buf_len += strlen("const ");
+  JSValue arraybuffer = JS_NewArrayBuffer(env->context, (uint8_t *) data, len, js__on_external_arraybuffer_finalize, (void *) external, false);
 
-    if (name_len == (size_t) -1) buf_len += strlen(name);
-    else buf_len += name_len;
+  js__adjust_external_memory(env, len);
 
-    buf_len += strlen(" = ");
-  }
+  *result = js__attach_to_handle_scope(env, env->scope, arraybuffer);
 
-  buf_len += strlen("(");
+  return 0;
+}
 
-  for (int i = 0; i < args_len; i++) {
-    if (i != 0) buf_len += strlen(", ");
+static inline size_t
+js__get_mapping_granularity (void) {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
 
-    str = JS_ToCString(env->context, args[i]->value);
-    buf_len += strlen(str);
-    JS_FreeCString(env->context, str);
-  }
+  return info.dwAllocationGranularity;
+#else
+  return (size_t) sysconf(_SC_PAGESIZE);
+#endif
+}
 
-  buf_len += strlen(") => {\n");
+static inline void
+js__unmap (void *base, size_t size) {
+#ifdef _WIN32
+  UnmapViewOfFile(base);
+#else
+  munmap(base, size);
+#endif
+}
 
-  str = JS_ToCString(env->context, source->value);
-  buf_len += strlen(str);
-  JS_FreeCString(env->context, str);
+static void
+js__on_mapped_arraybuffer_finalize (JSRuntime *runtime, void *opaque, void *ptr) {
+  if (ptr == NULL) return;
 
-  buf_len += strlen("}\n");
+  js_env_t *env = (js_env_t *) JS_GetRuntimeOpaque(runtime);
 
-  if (name) {
-    if (name_len == (size_t) -1) buf_len += strlen(name);
-    else buf_len += name_len;
+  js_mapped_arraybuffer_t *mapping = (js_mapped_arraybuffer_t *) opaque;
 
-    buf_len += strlen("\n");
-  }
+  env->mapped_memory -= mapping->size;
 
-  char *buf = malloc(buf_len + 1 /* NULL */);
+  js__unmap(mapping->base, mapping->size);
 
-  buf[0] = '\0';
+  free(mapping);
+}
 
-  if (name) {
-    strcat(buf, "const ");
+static int
+js__map_file (uv_file file, size_t offset, size_t size, int flags, js_mapping_advice_t advice, void **result) {
+  bool writable = (flags & js_mapping_readonly) == 0;
+  bool private = (flags & js_mapping_private) != 0;
 
-    if (name_len == (size_t) -1) strcat(buf, name);
-    else strncat(buf, name, name_len);
+#ifdef _WIN32
+  HANDLE handle = (HANDLE) uv_get_osfhandle(file);
 
-    strcat(buf, " = ");
-  }
+  DWORD protection = writable ? (private ? PAGE_WRITECOPY : PAGE_READWRITE) : PAGE_READONLY;
 
-  strcat(buf, "(");
+  HANDLE mapping = CreateFileMapping(handle, NULL, protection, 0, 0, NULL);
 
-  for (int i = 0; i < args_len; i++) {
-    if (i != 0) strcat(buf, ", ");
+  if (mapping == NULL) return uv_translate_sys_error(GetLastError());
 
-    str = JS_ToCString(env->context, args[i]->value);
-    strcat(buf, str);
-    JS_FreeCString(env->context, str);
-  }
+  DWORD access = writable ? (private ? FILE_MAP_COPY : FILE_MAP_WRITE) : FILE_MAP_READ;
 
-  strcat(buf, ") => {\n");
+  void *base = MapViewOfFile(mapping, access, (DWORD) ((uint64_t) offset >> 32), (DWORD) offset, size);
 
-  str = JS_ToCString(env->context, source->value);
-  strcat(buf, str);
-  JS_FreeCString(env->context, str);
+  int err = base == NULL ? uv_translate_sys_error(GetLastError()) : 0;
 
-  strcat(buf, "}\n");
+  // The view keeps the mapping alive on its own.
+  CloseHandle(mapping);
 
-  if (name) {
-    if (name_len == (size_t) -1) strcat(buf, name);
-    else strncat(buf, name, name_len);
+  if (err < 0) return err;
 
-    strcat(buf, "\n");
-  }
+  // Windows has no equivalent of `madvise()` for views of a file beyond
+  // prefetching, which the first access takes care of anyway.
+  (void) advice;
+#else
+  int protection = PROT_READ | (writable ? PROT_WRITE : 0);
 
-  if (file == NULL) file = "";
+  void *base = mmap(NULL, size, protection, private ? MAP_PRIVATE : MAP_SHARED, file, (off_t) offset);
 
-  JSValue function = JS_Eval(
-    env->context,
-    buf,
-    buf_len,
-    file,
-    JS_EVAL_TYPE_GLOBAL
-  );
+  if (base == MAP_FAILED) return uv_translate_sys_error(errno);
 
-  free(buf);
+  static const int js_mapping_advice[] = {
+    [js_mapping_advice_normal] = MADV_NORMAL,
+    [js_mapping_advice_sequential] = MADV_SEQUENTIAL,
+    [js_mapping_advice_random] = MADV_RANDOM,
+    [js_mapping_advice_willneed] = MADV_WILLNEED,
+  };
 
-  if (JS_IsException(function)) {
-    if (env->depth == 0) {
-      JSValue error = JS_GetException(env->context);
+  // The advice is merely a hint, so failing to apply it isn't an error.
+  if (advice != js_mapping_advice_normal) madvise(base, size, js_mapping_advice[advice]);
+#endif
 
-      js__on_uncaught_exception(env->context, error);
-    }
+  *result = base;
 
-    return js__error(env);
-  }
+  return 0;
+}
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+int
+js_create_mapped_arraybuffer (js_env_t *env, const char *path, size_t offset, size_t len, int flags, js_mapping_advice_t advice, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  wrapper->value = function;
+  int err;
 
-  *result = wrapper;
+  uv_fs_t req;
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  bool writable = (flags & js_mapping_readonly) == 0 && (flags & js_mapping_private) == 0;
 
-  return 0;
-}
+  uv_file file = uv_fs_open(env->loop, &req, path, writable ? UV_FS_O_RDWR : UV_FS_O_RDONLY, 0, NULL);
 
-int
-js_create_function_with_ffi (js_env_t *env, const char *name, size_t len, js_function_cb cb, void *data, js_ffi_function_t *ffi, js_value_t **result) {
-  return js_create_function(env, name, len, cb, data, result);
-}
+  uv_fs_req_cleanup(&req);
 
-int
-js_create_array (js_env_t *env, js_value_t **result) {
-  // Allow continuing even with a pending exception
+  if (file < 0) {
+    err = file;
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+    goto err;
+  }
 
-  wrapper->value = JS_NewArray(env->context);
+  err = uv_fs_fstat(env->loop, &req, file, NULL);
 
-  *result = wrapper;
+  uint64_t file_len = req.statbuf.st_size;
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  uv_fs_req_cleanup(&req);
 
-  return 0;
-}
+  if (err < 0) goto close;
 
-int
-js_create_array_with_length (js_env_t *env, size_t len, js_value_t **result) {
-  // Allow continuing even with a pending exception
+  if (offset > file_len || (len != 0 && len > file_len - offset)) {
+    uv_fs_close(env->loop, &req, file, NULL);
+    uv_fs_req_cleanup(&req);
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "Array");
+    js_throw_range_error(env, NULL, "Mapping out of range");
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+    return js__error(env);
+  }
 
-  JSValue arg = JS_NewUint32(env->context, len);
+  if (len == 0) len = (size_t) (file_len - offset);
 
-  wrapper->value = JS_CallConstructor(env->context, constructor, 1, &arg);
+  // Nothing to map, so hand out an empty ArrayBuffer instead.
+  if (len == 0) {
+    uv_fs_close(env->loop, &req, file, NULL);
+    uv_fs_req_cleanup(&req);
 
-  *result = wrapper;
+    return js_create_arraybuffer(env, 0, NULL, result);
+  }
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  // Mappings must start on a boundary of the mapping granularity, so map from
+  // the preceding boundary and offset the ArrayBuffer into the mapping.
+  size_t granularity = js__get_mapping_granularity();
 
-  JS_FreeValue(env->context, arg);
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+  size_t start = offset - offset % granularity;
 
-  return 0;
-}
+  size_t size = len + (offset - start);
 
-static void
-js__on_external_finalize (JSRuntime *runtime, JSValue value) {
-  js_env_t *env = (js_env_t *) JS_GetRuntimeOpaque(runtime);
+  void *base;
+  err = js__map_file(file, start, size, flags, advice, &base);
 
-  js_finalizer_t *finalizer = (js_finalizer_t *) JS_GetOpaque(value, js_external_class_id);
+  if (err < 0) goto close;
 
-  if (finalizer->finalize_cb) {
-    finalizer->finalize_cb(env, finalizer->data, finalizer->finalize_hint);
-  }
+  uv_fs_close(env->loop, &req, file, NULL);
+  uv_fs_req_cleanup(&req);
 
-  free(finalizer);
-}
+  js_mapped_arraybuffer_t *mapping = malloc(sizeof(js_mapped_arraybuffer_t));
 
-int
-js_create_external (js_env_t *env, void *data, js_finalize_cb finalize_cb, void *finalize_hint, js_value_t **result) {
-  // Allow continuing even with a pending exception
+  mapping->base = base;
+  mapping->size = size;
 
-  js_finalizer_t *finalizer = malloc(sizeof(js_finalizer_t));
+  JSValue arraybuffer = JS_NewArrayBuffer(env->context, (uint8_t *) base + (offset - start), len, js__on_mapped_arraybuffer_finalize, (void *) mapping, false);
 
-  finalizer->data = data;
-  finalizer->finalize_cb = finalize_cb;
-  finalizer->finalize_hint = finalize_hint;
+  if (JS_IsException(arraybuffer)) {
+    js__unmap(base, size);
 
-  JSValue external = JS_NewObjectClass(env->context, js_external_class_id);
+    free(mapping);
 
-  JS_SetOpaque(external, finalizer);
+    return js__error(env);
+  }
+
+  // File backed pages can be reclaimed by the system at any time and so are
+  // tracked separately from external memory, which would otherwise have large
+  // mappings trigger garbage collection continuously.
+  env->mapped_memory += size;
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  *result = js__attach_to_handle_scope(env, env->scope, arraybuffer);
 
-  wrapper->value = external;
+  return 0;
+
+close:
+  uv_fs_close(env->loop, &req, file, NULL);
+  uv_fs_req_cleanup(&req);
+
+err:
+  js_throw_error(env, uv_err_name(err), uv_strerror(err));
 
-  *result = wrapper;
+  return js__error(env);
+}
+
+int
+js_detach_arraybuffer (js_env_t *env, js_value_t *arraybuffer) {
+  // Allow continuing even with a pending exception
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  JS_DetachArrayBuffer(env->context, arraybuffer->value);
 
   return 0;
 }
 
 int
-js_create_date (js_env_t *env, double time, js_value_t **result) {
+js_get_arraybuffer_backing_store (js_env_t *env, js_value_t *arraybuffer, js_arraybuffer_backing_store_t **result) {
   // Allow continuing even with a pending exception
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  js_arraybuffer_backing_store_t *backing_store = malloc(sizeof(js_arraybuffer_backing_store_t));
+
+  backing_store->references = 1;
+  backing_store->header = NULL;
+  backing_store->slab = NULL;
+  backing_store->runtime = env->runtime;
+  backing_store->owner = JS_NULL;
+
+  backing_store->data = JS_GetArrayBuffer(env->context, &backing_store->len, arraybuffer->value);
+
+  // Only an attached ArrayBuffer is guaranteed to still hold a reference to
+  // its header; a detached one will have released it already. The header of
+  // a buffer allocated by us is both its opaque pointer and found right in
+  // front of its data, so there's no need to remember it anywhere.
+  js_arraybuffer_slab_t *slab;
 
-  wrapper->value = JS_NewDate(env->context, time);
+  if (backing_store->data && js__get_arraybuffer_opaque(env, arraybuffer->value, js__on_arraybuffer_finalize)) {
+    backing_store->header = js__get_arraybuffer_header(backing_store->data);
 
-  *result = wrapper;
+    js__ref_arraybuffer_header(backing_store->header);
+  } else if (backing_store->data && (slab = js__find_arraybuffer_slab(env, arraybuffer->value, backing_store->data))) {
+    // Pooled buffers are kept alive by referencing their slab, which may then
+    // outlive both the ArrayBuffer and the env.
+    backing_store->slab = slab;
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+    js__ref_arraybuffer_slab(slab);
+  } else {
+    // Other buffers, such as external ones or those allocated by QuickJS on
+    // behalf of JavaScript, can only be kept alive by their owner and so must
+    // not outlive the runtime of the env.
+    backing_store->owner = JS_DupValue(env->context, arraybuffer->value);
+  }
+
+  *result = backing_store;
 
   return 0;
 }
 
-int
-js_create_error (js_env_t *env, js_value_t *code, js_value_t *message, js_value_t **result) {
-  // Allow continuing even with a pending exception
+static int
+js__create_sharedarraybuffer (js_env_t *env, size_t len, bool zero_fill, void **data, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "Error");
+  js_arraybuffer_header_t *header = js__create_arraybuffer_header(len, zero_fill);
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  if (header == NULL) {
+    js_throw_range_error(env, NULL, "Array buffer allocation failed");
 
-  JSValue arg = message->value;
+    return js__error(env);
+  }
 
-  JSValue error = JS_CallConstructor(env->context, constructor, 1, &arg);
+  // QuickJS takes its own reference to the header through `sab_dup()`, after
+  // which the reference held since creation can be dropped.
+  JSValue sharedarraybuffer = JS_NewArrayBuffer(env->context, header->data, header->len, NULL, NULL, true);
 
-  if (code) {
-    JS_SetPropertyStr(env->context, error, "code", JS_DupValue(env->context, code->value));
-  }
+  if (JS_IsException(sharedarraybuffer)) {
+    js__unref_arraybuffer_header(header);
 
-  wrapper->value = error;
+    return js__error(env);
+  }
 
-  *result = wrapper;
+  if (data) {
+    *data = header->data;
+  }
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  js__unref_arraybuffer_header(header);
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+  *result = js__attach_to_handle_scope(env, env->scope, sharedarraybuffer);
 
   return 0;
 }
 
 int
-js_create_type_error (js_env_t *env, js_value_t *code, js_value_t *message, js_value_t **result) {
-  // Allow continuing even with a pending exception
-
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "TypeError");
-
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+js_create_sharedarraybuffer (js_env_t *env, size_t len, void **data, js_value_t **result) {
+  return js__create_sharedarraybuffer(env, len, true, data, result);
+}
 
-  JSValue arg = message->value;
+int
+js_create_sharedarraybuffer_with_backing_store (js_env_t *env, js_arraybuffer_backing_store_t *backing_store, void **data, size_t *len, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  JSValue error = JS_CallConstructor(env->context, constructor, 1, &arg);
+  // QuickJS assumes that the memory of a SharedArrayBuffer is preceded by a
+  // header, which only holds for backing stores that reference one.
+  if (backing_store->header == NULL) {
+    js_throw_type_error(env, NULL, "Backing store cannot be shared");
 
-  if (code) {
-    JS_SetPropertyStr(env->context, error, "code", JS_DupValue(env->context, code->value));
+    return js__error(env);
   }
 
-  wrapper->value = error;
+  JSValue sharedarraybuffer = JS_NewArrayBuffer(env->context, backing_store->data, backing_store->len, NULL, NULL, true);
+
+  if (JS_IsException(sharedarraybuffer)) return js__error(env);
 
-  *result = wrapper;
+  if (data) {
+    *data = backing_store->data;
+  }
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  if (len) {
+    *len = backing_store->len;
+  }
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+  *result = js__attach_to_handle_scope(env, env->scope, sharedarraybuffer);
 
   return 0;
 }
 
 int
-js_create_range_error (js_env_t *env, js_value_t *code, js_value_t *message, js_value_t **result) {
-  // Allow continuing even with a pending exception
+js_create_unsafe_sharedarraybuffer (js_env_t *env, size_t len, void **data, js_value_t **result) {
+  return js__create_sharedarraybuffer(env, len, false, data, result);
+}
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "RangeError");
+int
+js_get_sharedarraybuffer_backing_store (js_env_t *env, js_value_t *sharedarraybuffer, js_arraybuffer_backing_store_t **result) {
+  // Allow continuing even with a pending exception
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  bool is_sharedarraybuffer;
+  js_is_sharedarraybuffer(env, sharedarraybuffer, &is_sharedarraybuffer);
 
-  JSValue arg = message->value;
+  size_t len;
+  uint8_t *data = is_sharedarraybuffer ? JS_GetArrayBuffer(env->context, &len, sharedarraybuffer->value) : NULL;
 
-  JSValue error = JS_CallConstructor(env->context, constructor, 1, &arg);
+  if (data == NULL) {
+    if (!JS_HasException(env->context)) js_throw_type_error(env, NULL, "Value is not a SharedArrayBuffer");
 
-  if (code) {
-    JS_SetPropertyStr(env->context, error, "code", JS_DupValue(env->context, code->value));
+    return js__error(env);
   }
 
-  wrapper->value = error;
+  js_arraybuffer_backing_store_t *backing_store = malloc(sizeof(js_arraybuffer_backing_store_t));
+
+  backing_store->references = 1;
+  backing_store->len = len;
+  backing_store->data = data;
+  backing_store->slab = NULL;
+  backing_store->runtime = env->runtime;
+  backing_store->owner = JS_NULL;
 
-  *result = wrapper;
+  // The memory of every SharedArrayBuffer is preceded by a header, whether
+  // allocated by us or by QuickJS through `sab_alloc()`.
+  backing_store->header = js__get_arraybuffer_header(backing_store->data);
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  js__ref_arraybuffer_header(backing_store->header);
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+  *result = backing_store;
 
   return 0;
 }
 
 int
-js_create_syntax_error (js_env_t *env, js_value_t *code, js_value_t *message, js_value_t **result) {
+js_release_arraybuffer_backing_store (js_env_t *env, js_arraybuffer_backing_store_t *backing_store) {
   // Allow continuing even with a pending exception
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "SyntaxError");
+  js__release_arraybuffer_backing_store(backing_store);
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  return 0;
+}
 
-  JSValue arg = message->value;
+int
+js_set_arraybuffer_zero_fill_enabled (bool enabled) {
+  atomic_store_explicit(&js_arraybuffer_zero_fill, enabled, memory_order_relaxed);
 
-  JSValue error = JS_CallConstructor(env->context, constructor, 1, &arg);
+  return 0;
+}
 
-  if (code) {
-    JS_SetPropertyStr(env->context, error, "code", JS_DupValue(env->context, code->value));
-  }
+int
+js_create_typedarray (js_env_t *env, js_typedarray_type_t type, size_t len, js_value_t *arraybuffer, size_t offset, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  wrapper->value = error;
+  js_intrinsic_class_t *class = js__get_typedarray_class(env, type);
 
-  *result = wrapper;
+  JSValue argv[3] = {arraybuffer->value, JS_NewInt64(env->context, offset), JS_NewInt64(env->context, len)};
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  JSValue typedarray = JS_CallConstructor(env->context, class->constructor, 3, argv);
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+  if (JS_IsException(typedarray)) return js__error(env);
+
+  *result = js__attach_to_handle_scope(env, env->scope, typedarray);
 
   return 0;
 }
 
 int
-js_create_promise (js_env_t *env, js_deferred_t **deferred, js_value_t **promise) {
-  // Allow continuing even with a pending exception
-
-  *deferred = malloc(sizeof(js_deferred_t));
-
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
-
-  JSValue functions[2];
+js_create_dataview (js_env_t *env, size_t len, js_value_t *arraybuffer, size_t offset, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  wrapper->value = JS_NewPromiseCapability(env->context, functions);
+  JSValue argv[3] = {arraybuffer->value, JS_NewInt64(env->context, offset), JS_NewInt64(env->context, len)};
 
-  (*deferred)->resolve = functions[0];
-  (*deferred)->reject = functions[1];
+  JSValue typedarray = JS_CallConstructor(env->context, env->dataview.constructor, 3, argv);
 
-  *promise = wrapper;
+  if (JS_IsException(typedarray)) return js__error(env);
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  *result = js__attach_to_handle_scope(env, env->scope, typedarray);
 
   return 0;
 }
 
-static inline int
-js__conclude_deferred (js_env_t *env, js_deferred_t *deferred, js_value_t *resolution, bool resolved) {
+int
+js_coerce_to_boolean (js_env_t *env, js_value_t *value, js_value_t **result) {
   // Allow continuing even with a pending exception
 
-  JSValue global = JS_GetGlobalObject(env->context);
+  JSValue boolean = JS_ToBoolean(env->context, value->value);
 
-  JSValue result = JS_Call(env->context, resolved ? deferred->resolve : deferred->reject, global, 1, &resolution->value);
+  *result = js__attach_to_handle_scope(env, env->scope, boolean);
 
-  if (env->depth == 0) js__on_run_microtasks(env);
+  return 0;
+}
 
-  JS_FreeValue(env->context, global);
-  JS_FreeValue(env->context, result);
-  JS_FreeValue(env->context, deferred->resolve);
-  JS_FreeValue(env->context, deferred->reject);
+int
+js_coerce_to_number (js_env_t *env, js_value_t *value, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  free(deferred);
+  JSValue number = JS_ToNumber(env->context, value->value);
+
+  if (JS_IsException(number)) return js__error(env);
+
+  *result = js__attach_to_handle_scope(env, env->scope, number);
 
   return 0;
 }
 
 int
-js_resolve_deferred (js_env_t *env, js_deferred_t *deferred, js_value_t *resolution) {
-  return js__conclude_deferred(env, deferred, resolution, true);
+js_coerce_to_string (js_env_t *env, js_value_t *value, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  JSValue string = JS_ToString(env->context, value->value);
+
+  if (JS_IsException(string)) return js__error(env);
+
+  *result = js__attach_to_handle_scope(env, env->scope, string);
+
+  return 0;
 }
 
 int
-js_reject_deferred (js_env_t *env, js_deferred_t *deferred, js_value_t *resolution) {
-  return js__conclude_deferred(env, deferred, resolution, false);
+js_coerce_to_object (js_env_t *env, js_value_t *value, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  JSValue object = JS_ToObject(env->context, value->value);
+
+  if (JS_IsException(object)) return js__error(env);
+
+  *result = js__attach_to_handle_scope(env, env->scope, object);
+
+  return 0;
 }
 
 int
-js_get_promise_state (js_env_t *env, js_value_t *promise, js_promise_state_t *result) {
+js_typeof (js_env_t *env, js_value_t *value, js_value_type_t *result) {
   // Allow continuing even with a pending exception
 
-  switch (JS_PromiseState(env->context, promise->value)) {
-  case JS_PROMISE_PENDING:
-    *result = js_promise_pending;
-    break;
-  case JS_PROMISE_FULFILLED:
-    *result = js_promise_fulfilled;
-    break;
-  case JS_PROMISE_REJECTED:
-    *result = js_promise_rejected;
-    break;
+  if (JS_IsNumber(value->value)) {
+    *result = js_number;
+  } else if (JS_IsBigInt(env->context, value->value)) {
+    *result = js_bigint;
+  } else if (JS_IsString(value->value)) {
+    *result = js_string;
+  } else if (JS_IsFunction(env->context, value->value)) {
+    *result = js_function;
+  } else if (JS_IsObject(value->value)) {
+    *result = JS_GetOpaque(value->value, js_external_class_id) != NULL
+                ? js_external
+                : js_object;
+  } else if (JS_IsBool(value->value)) {
+    *result = js_boolean;
+  } else if (JS_IsUndefined(value->value)) {
+    *result = js_undefined;
+  } else if (JS_IsSymbol(value->value)) {
+    *result = js_symbol;
+  } else if (JS_IsNull(value->value)) {
+    *result = js_null;
   }
 
   return 0;
 }
 
 int
-js_get_promise_result (js_env_t *env, js_value_t *promise, js_value_t **result) {
-  // Allow continuing even with a pending exception
-
-  assert(JS_PromiseState(env->context, promise->value) != JS_PROMISE_PENDING);
-
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+js_instanceof (js_env_t *env, js_value_t *object, js_value_t *constructor, bool *result) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  wrapper->value = JS_PromiseResult(env->context, promise->value);
+  int success = JS_IsInstanceOf(env->context, object->value, constructor->value);
 
-  *result = wrapper;
+  if (success < 0) return js__error(env);
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  *result = success;
 
   return 0;
 }
 
-static void
-js__on_arraybuffer_finalize (JSRuntime *runtime, void *opaque, void *ptr) {
-  free(ptr);
-}
-
 int
-js_create_arraybuffer (js_env_t *env, size_t len, void **data, js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
-
-  uint8_t *bytes = malloc(len);
+js_is_undefined (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  memset(bytes, 0, len);
+  *result = JS_IsUndefined(value->value);
 
-  if (data) {
-    *data = bytes;
-  }
+  return 0;
+}
 
-  JSValue arraybuffer = JS_NewArrayBuffer(env->context, bytes, len, js__on_arraybuffer_finalize, NULL, false);
+int
+js_is_null (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  *result = JS_IsNull(value->value);
 
-  wrapper->value = arraybuffer;
+  return 0;
+}
 
-  *result = wrapper;
+int
+js_is_boolean (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  *result = JS_IsBool(value->value);
 
   return 0;
 }
 
-static void
-js__on_backed_arraybuffer_finalize (JSRuntime *runtime, void *opaque, void *ptr) {
-  js_arraybuffer_backing_store_t *backing_store = (js_arraybuffer_backing_store_t *) opaque;
+int
+js_is_number (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  if (--backing_store->references == 0) {
-    JS_FreeValueRT(runtime, backing_store->owner);
+  *result = JS_IsNumber(value->value);
 
-    free(backing_store);
-  }
+  return 0;
 }
 
 int
-js_create_arraybuffer_with_backing_store (js_env_t *env, js_arraybuffer_backing_store_t *backing_store, void **data, size_t *len, js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
+js_is_int32 (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
+
+  if (JS_IsNumber(value->value)) {
+    double number;
 
-  backing_store->references++;
+    JS_ToFloat64(env->context, &number, value->value);
 
-  if (data) {
-    *data = backing_store->data;
+    double integral;
+
+    *result = modf(number, &integral) == 0.0 && integral >= INT32_MIN && integral <= INT32_MAX;
+  } else {
+    *result = false;
   }
 
-  if (len) {
-    *len = backing_store->len;
-  }
+  return 0;
+}
 
-  JSValue arraybuffer = JS_NewArrayBuffer(env->context, backing_store->data, backing_store->len, js__on_backed_arraybuffer_finalize, backing_store, false);
+int
+js_is_uint32 (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  if (JS_IsNumber(value->value)) {
+    double number;
 
-  wrapper->value = arraybuffer;
+    JS_ToFloat64(env->context, &number, value->value);
 
-  *result = wrapper;
+    double integral;
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+    *result = modf(number, &integral) == 0.0 && integral >= 0.0 && integral <= UINT32_MAX;
+  } else {
+    *result = false;
+  }
 
   return 0;
 }
 
-static void
-js__on_unsafe_arraybuffer_finalize (JSRuntime *runtime, void *opaque, void *ptr) {
-  free(ptr);
-}
-
 int
-js_create_unsafe_arraybuffer (js_env_t *env, size_t len, void **data, js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
+js_is_string (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  uint8_t *bytes = malloc(len);
+  *result = JS_IsString(value->value);
 
-  if (data) {
-    *data = bytes;
-  }
+  return 0;
+}
 
-  JSValue arraybuffer = JS_NewArrayBuffer(env->context, bytes, len, js__on_unsafe_arraybuffer_finalize, NULL, false);
+int
+js_is_symbol (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  *result = JS_IsSymbol(value->value);
 
-  wrapper->value = arraybuffer;
+  return 0;
+}
 
-  *result = wrapper;
+int
+js_is_object (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  *result = JS_IsObject(value->value);
 
   return 0;
 }
 
-static void
-js__on_external_arraybuffer_finalize (JSRuntime *runtime, void *opaque, void *ptr) {
-  js_env_t *env = (js_env_t *) JS_GetRuntimeOpaque(runtime);
-
-  js_finalizer_t *finalizer = (js_finalizer_t *) opaque;
+int
+js_is_function (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  if (finalizer->finalize_cb) {
-    finalizer->finalize_cb(env, finalizer->data, finalizer->finalize_hint);
-  }
+  *result = JS_IsFunction(env->context, value->value);
 
-  free(finalizer);
+  return 0;
 }
 
 int
-js_create_external_arraybuffer (js_env_t *env, void *data, size_t len, js_finalize_cb finalize_cb, void *finalize_hint, js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
+js_is_async_function (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  js_finalizer_t *finalizer = malloc(sizeof(js_finalizer_t));
+  *result = false;
 
-  finalizer->data = data;
-  finalizer->finalize_cb = finalize_cb;
-  finalizer->finalize_hint = finalize_hint;
+  return 0;
+}
 
-  JSValue arraybuffer = JS_NewArrayBuffer(env->context, (uint8_t *) data, len, js__on_external_arraybuffer_finalize, (void *) finalizer, false);
+int
+js_is_generator_function (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  *result = false;
 
-  wrapper->value = arraybuffer;
+  return 0;
+}
 
-  *result = wrapper;
+int
+js_is_generator (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  *result = false;
 
   return 0;
 }
 
 int
-js_detach_arraybuffer (js_env_t *env, js_value_t *arraybuffer) {
+js_is_arguments (js_env_t *env, js_value_t *value, bool *result) {
   // Allow continuing even with a pending exception
 
-  JS_DetachArrayBuffer(env->context, arraybuffer->value);
+  *result = false;
 
   return 0;
 }
 
 int
-js_get_arraybuffer_backing_store (js_env_t *env, js_value_t *arraybuffer, js_arraybuffer_backing_store_t **result) {
+js_is_array (js_env_t *env, js_value_t *value, bool *result) {
   // Allow continuing even with a pending exception
 
-  js_arraybuffer_backing_store_t *backing_store = malloc(sizeof(js_arraybuffer_backing_store_t));
-
-  backing_store->references = 1;
+  *result = JS_IsArray(env->context, value->value);
 
-  backing_store->data = JS_GetArrayBuffer(env->context, &backing_store->len, arraybuffer->value);
+  return 0;
+}
 
-  backing_store->owner = JS_DupValue(env->context, arraybuffer->value);
+int
+js_is_external (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  *result = backing_store;
+  *result = JS_IsObject(value->value) && JS_GetOpaque(value->value, js_external_class_id) != NULL;
 
   return 0;
 }
 
 int
-js_create_sharedarraybuffer (js_env_t *env, size_t len, void **data, js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
-
-  js_arraybuffer_header_t *header = malloc(sizeof(js_arraybuffer_header_t) + len);
+js_is_wrapped (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  memset(header->data, 0, len);
+  js_slots_t *slots = js__get_slots(env, value->value);
 
-  header->references = 0;
-  header->len = len;
+  *result = slots && slots->wrapped;
 
-  if (data) {
-    *data = header->data;
-  }
+  return 0;
+}
 
-  JSValue sharedarraybuffer = JS_NewArrayBuffer(env->context, header->data, header->len, NULL, NULL, true);
+int
+js_is_delegate (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  *result = JS_IsObject(value->value) && JS_GetOpaque(value->value, js_delegate_class_id) != NULL;
 
-  wrapper->value = sharedarraybuffer;
+  return 0;
+}
 
-  *result = wrapper;
+int
+js_is_bigint (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  *result = JS_IsBigInt(env->context, value->value);
 
   return 0;
 }
 
 int
-js_create_sharedarraybuffer_with_backing_store (js_env_t *env, js_arraybuffer_backing_store_t *backing_store, void **data, size_t *len, js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
+js_is_date (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  if (data) {
-    *data = backing_store->data;
-  }
+  JSValue global = JS_GetGlobalObject(env->context);
+  JSValue constructor = JS_GetPropertyStr(env->context, global, "Date");
 
-  if (len) {
-    *len = backing_store->len;
-  }
+  *result = JS_IsInstanceOf(env->context, value->value, constructor);
 
-  JSValue sharedarraybuffer = JS_NewArrayBuffer(env->context, backing_store->data, backing_store->len, NULL, NULL, true);
+  JS_FreeValue(env->context, constructor);
+  JS_FreeValue(env->context, global);
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  return 0;
+}
+
+int
+js_is_regexp (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  wrapper->value = sharedarraybuffer;
+  JSValue global = JS_GetGlobalObject(env->context);
+  JSValue constructor = JS_GetPropertyStr(env->context, global, "RegExp");
 
-  *result = wrapper;
+  *result = JS_IsInstanceOf(env->context, value->value, constructor);
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  JS_FreeValue(env->context, constructor);
+  JS_FreeValue(env->context, global);
 
   return 0;
 }
 
 int
-js_create_unsafe_sharedarraybuffer (js_env_t *env, size_t len, void **data, js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
-
-  js_arraybuffer_header_t *header = malloc(sizeof(js_arraybuffer_header_t) + len);
-
-  header->references = 0;
-  header->len = len;
+js_is_error (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  if (data) {
-    *data = header->data;
-  }
+  *result = JS_IsError(env->context, value->value);
 
-  JSValue sharedarraybuffer = JS_NewArrayBuffer(env->context, header->data, header->len, NULL, NULL, true);
+  return 0;
+}
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+int
+js_is_promise (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  wrapper->value = sharedarraybuffer;
+  JSValue global = JS_GetGlobalObject(env->context);
+  JSValue constructor = JS_GetPropertyStr(env->context, global, "Promise");
 
-  *result = wrapper;
+  *result = JS_IsInstanceOf(env->context, value->value, constructor);
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  JS_FreeValue(env->context, constructor);
+  JS_FreeValue(env->context, global);
 
   return 0;
 }
 
 int
-js_get_sharedarraybuffer_backing_store (js_env_t *env, js_value_t *sharedarraybuffer, js_arraybuffer_backing_store_t **result) {
+js_is_proxy (js_env_t *env, js_value_t *value, bool *result) {
   // Allow continuing even with a pending exception
 
-  js_arraybuffer_backing_store_t *backing_store = malloc(sizeof(js_arraybuffer_backing_store_t));
-
-  backing_store->references = 1;
-
-  backing_store->data = JS_GetArrayBuffer(env->context, &backing_store->len, sharedarraybuffer->value);
+  JSValue global = JS_GetGlobalObject(env->context);
+  JSValue constructor = JS_GetPropertyStr(env->context, global, "Proxy");
 
-  backing_store->owner = JS_NULL;
+  *result = JS_IsInstanceOf(env->context, value->value, constructor);
 
-  *result = backing_store;
+  JS_FreeValue(env->context, constructor);
+  JS_FreeValue(env->context, global);
 
   return 0;
 }
 
 int
-js_release_arraybuffer_backing_store (js_env_t *env, js_arraybuffer_backing_store_t *backing_store) {
+js_is_map (js_env_t *env, js_value_t *value, bool *result) {
   // Allow continuing even with a pending exception
 
-  if (--backing_store->references == 0) {
-    JS_FreeValue(env->context, backing_store->owner);
+  JSValue global = JS_GetGlobalObject(env->context);
+  JSValue constructor = JS_GetPropertyStr(env->context, global, "Map");
 
-    free(backing_store);
-  }
+  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+
+  JS_FreeValue(env->context, constructor);
+  JS_FreeValue(env->context, global);
 
   return 0;
 }
 
 int
-js_set_arraybuffer_zero_fill_enabled (bool enabled) {
+js_is_map_iterator (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
+
+  *result = false;
+
   return 0;
 }
 
 int
-js_create_typedarray (js_env_t *env, js_typedarray_type_t type, size_t len, js_value_t *arraybuffer, size_t offset, js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
+js_is_set (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
   JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor;
-
-  switch (type) {
-#define V(class, type) \
-  case type: \
-    constructor = JS_GetPropertyStr(env->context, global, class); \
-    break;
-
-    V("Int8Array", js_int8array);
-    V("Uint8Array", js_uint8array);
-    V("Uint8ClampedArray", js_uint8clampedarray);
-    V("Int16Array", js_int16_array);
-    V("Uint16Array", js_uint16array);
-    V("Int32Array", js_int32array);
-    V("Uint32Array", js_uint32array);
-    V("Float32Array", js_float32array);
-    V("Float64Array", js_float64array);
-    V("BigInt64Array", js_bigint64array);
-    V("BigUint64Array", js_biguint64array);
-#undef V
-  }
-
-  JSValue argv[3] = {arraybuffer->value, JS_NewInt64(env->context, offset), JS_NewInt64(env->context, len)};
+  JSValue constructor = JS_GetPropertyStr(env->context, global, "Set");
 
-  JSValue typedarray = JS_CallConstructor(env->context, constructor, 3, argv);
+  *result = JS_IsInstanceOf(env->context, value->value, constructor);
 
   JS_FreeValue(env->context, constructor);
   JS_FreeValue(env->context, global);
 
-  if (JS_IsException(typedarray)) return js__error(env);
-
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
-
-  wrapper->value = typedarray;
+  return 0;
+}
 
-  *result = wrapper;
+int
+js_is_set_iterator (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  *result = false;
 
   return 0;
 }
 
 int
-js_create_dataview (js_env_t *env, size_t len, js_value_t *arraybuffer, size_t offset, js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
+js_is_weak_map (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
   JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "DataView");
-
-  JSValue argv[3] = {arraybuffer->value, JS_NewInt64(env->context, offset), JS_NewInt64(env->context, len)};
+  JSValue constructor = JS_GetPropertyStr(env->context, global, "WeakMap");
 
-  JSValue typedarray = JS_CallConstructor(env->context, constructor, 3, argv);
+  *result = JS_IsInstanceOf(env->context, value->value, constructor);
 
   JS_FreeValue(env->context, constructor);
   JS_FreeValue(env->context, global);
 
-  if (JS_IsException(typedarray)) return js__error(env);
+  return 0;
+}
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+int
+js_is_weak_set (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  wrapper->value = typedarray;
+  JSValue global = JS_GetGlobalObject(env->context);
+  JSValue constructor = JS_GetPropertyStr(env->context, global, "WeakSet");
 
-  *result = wrapper;
+  *result = JS_IsInstanceOf(env->context, value->value, constructor);
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  JS_FreeValue(env->context, constructor);
+  JS_FreeValue(env->context, global);
 
   return 0;
 }
 
 int
-js_coerce_to_boolean (js_env_t *env, js_value_t *value, js_value_t **result) {
+js_is_weak_ref (js_env_t *env, js_value_t *value, bool *result) {
   // Allow continuing even with a pending exception
 
-  JSValue boolean = JS_ToBoolean(env->context, value->value);
-
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
-
-  wrapper->value = boolean;
+  JSValue global = JS_GetGlobalObject(env->context);
+  JSValue constructor = JS_GetPropertyStr(env->context, global, "WeakRef");
 
-  *result = wrapper;
+  *result = JS_IsInstanceOf(env->context, value->value, constructor);
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  JS_FreeValue(env->context, constructor);
+  JS_FreeValue(env->context, global);
 
   return 0;
 }
 
 int
-js_coerce_to_number (js_env_t *env, js_value_t *value, js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
-
-  JSValue number = JS_ToNumber(env->context, value->value);
-
-  if (JS_IsException(number)) return js__error(env);
-
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+js_is_arraybuffer (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  wrapper->value = number;
+  JSValue global = JS_GetGlobalObject(env->context);
+  JSValue constructor = JS_GetPropertyStr(env->context, global, "ArrayBuffer");
 
-  *result = wrapper;
+  *result = JS_IsInstanceOf(env->context, value->value, constructor);
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  JS_FreeValue(env->context, constructor);
+  JS_FreeValue(env->context, global);
 
   return 0;
 }
 
 int
-js_coerce_to_string (js_env_t *env, js_value_t *value, js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
+js_is_detached_arraybuffer (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  JSValue string = JS_ToString(env->context, value->value);
+  size_t len;
 
-  if (JS_IsException(string)) return js__error(env);
+  *result = JS_GetArrayBuffer(env->context, &len, value->value) == NULL;
+
+  return 0;
+}
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+int
+js_is_sharedarraybuffer (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  wrapper->value = string;
+  JSValue global = JS_GetGlobalObject(env->context);
+  JSValue constructor = JS_GetPropertyStr(env->context, global, "SharedArrayBuffer");
 
-  *result = wrapper;
+  *result = JS_IsInstanceOf(env->context, value->value, constructor);
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  JS_FreeValue(env->context, constructor);
+  JS_FreeValue(env->context, global);
 
   return 0;
 }
 
 int
-js_coerce_to_object (js_env_t *env, js_value_t *value, js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
-
-  JSValue object = JS_ToObject(env->context, value->value);
-
-  if (JS_IsException(object)) return js__error(env);
-
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+js_is_typedarray (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  wrapper->value = object;
+  for (size_t i = 0; i < js_typedarray_classes_len; i++) {
+    if (js__is_intrinsic_class(&env->typedarrays[i], value->value)) {
+      *result = true;
 
-  *result = wrapper;
+      return 0;
+    }
+  }
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  *result = false;
 
   return 0;
 }
 
 int
-js_typeof (js_env_t *env, js_value_t *value, js_value_type_t *result) {
+js_is_int8array (js_env_t *env, js_value_t *value, bool *result) {
   // Allow continuing even with a pending exception
 
-  if (JS_IsNumber(value->value)) {
-    *result = js_number;
-  } else if (JS_IsBigInt(env->context, value->value)) {
-    *result = js_bigint;
-  } else if (JS_IsString(value->value)) {
-    *result = js_string;
-  } else if (JS_IsFunction(env->context, value->value)) {
-    *result = js_function;
-  } else if (JS_IsObject(value->value)) {
-    *result = JS_GetOpaque(value->value, js_external_class_id) != NULL
-                ? js_external
-                : js_object;
-  } else if (JS_IsBool(value->value)) {
-    *result = js_boolean;
-  } else if (JS_IsUndefined(value->value)) {
-    *result = js_undefined;
-  } else if (JS_IsSymbol(value->value)) {
-    *result = js_symbol;
-  } else if (JS_IsNull(value->value)) {
-    *result = js_null;
-  }
+  *result = js__is_intrinsic_class(js__get_typedarray_class(env, js_int8array), value->value);
 
   return 0;
 }
 
 int
-js_instanceof (js_env_t *env, js_value_t *object, js_value_t *constructor, bool *result) {
-  if (JS_HasException(env->context)) return js__error(env);
-
-  int success = JS_IsInstanceOf(env->context, object->value, constructor->value);
-
-  if (success < 0) return js__error(env);
+js_is_uint8array (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-  *result = success;
+  *result = js__is_intrinsic_class(js__get_typedarray_class(env, js_uint8array), value->value);
 
   return 0;
 }
 
 int
-js_is_undefined (js_env_t *env, js_value_t *value, bool *result) {
+js_is_uint8clampedarray (js_env_t *env, js_value_t *value, bool *result) {
   // Allow continuing even with a pending exception
 
-  *result = JS_IsUndefined(value->value);
+  *result = js__is_intrinsic_class(js__get_typedarray_class(env, js_uint8clampedarray), value->value);
 
   return 0;
 }
 
 int
-js_is_null (js_env_t *env, js_value_t *value, bool *result) {
+js_is_int16array (js_env_t *env, js_value_t *value, bool *result) {
   // Allow continuing even with a pending exception
 
-  *result = JS_IsNull(value->value);
+  *result = js__is_intrinsic_class(js__get_typedarray_class(env, js_int16_array), value->value);
 
   return 0;
 }
 
 int
-js_is_boolean (js_env_t *env, js_value_t *value, bool *result) {
+js_is_uint16array (js_env_t *env, js_value_t *value, bool *result) {
   // Allow continuing even with a pending exception
 
-  *result = JS_IsBool(value->value);
+  *result = js__is_intrinsic_class(js__get_typedarray_class(env, js_uint16array), value->value);
 
   return 0;
 }
 
 int
-js_is_number (js_env_t *env, js_value_t *value, bool *result) {
+js_is_int32array (js_env_t *env, js_value_t *value, bool *result) {
   // Allow continuing even with a pending exception
 
-  *result = JS_IsNumber(value->value);
+  *result = js__is_intrinsic_class(js__get_typedarray_class(env, js_int32array), value->value);
 
   return 0;
 }
 
 int
-js_is_int32 (js_env_t *env, js_value_t *value, bool *result) {
+js_is_uint32array (js_env_t *env, js_value_t *value, bool *result) {
   // Allow continuing even with a pending exception
 
-  if (JS_IsNumber(value->value)) {
-    double number;
+  *result = js__is_intrinsic_class(js__get_typedarray_class(env, js_uint32array), value->value);
 
-    JS_ToFloat64(env->context, &number, value->value);
+  return 0;
+}
 
-    double integral;
+int
+js_is_float32array (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-    *result = modf(number, &integral) == 0.0 && integral >= INT32_MIN && integral <= INT32_MAX;
-  } else {
-    *result = false;
-  }
+  *result = js__is_intrinsic_class(js__get_typedarray_class(env, js_float32array), value->value);
 
   return 0;
 }
 
 int
-js_is_uint32 (js_env_t *env, js_value_t *value, bool *result) {
+js_is_float64array (js_env_t *env, js_value_t *value, bool *result) {
   // Allow continuing even with a pending exception
 
-  if (JS_IsNumber(value->value)) {
-    double number;
+  *result = js__is_intrinsic_class(js__get_typedarray_class(env, js_float64array), value->value);
 
-    JS_ToFloat64(env->context, &number, value->value);
+  return 0;
+}
 
-    double integral;
+int
+js_is_bigint64array (js_env_t *env, js_value_t *value, bool *result) {
+  // Allow continuing even with a pending exception
 
-    *result = modf(number, &integral) == 0.0 && integral >= 0.0 && integral <= UINT32_MAX;
-  } else {
-    *result = false;
-  }
+  *result = js__is_intrinsic_class(js__get_typedarray_class(env, js_bigint64array), value->value);
 
   return 0;
 }
 
 int
-js_is_string (js_env_t *env, js_value_t *value, bool *result) {
+js_is_biguint64array (js_env_t *env, js_value_t *value, bool *result) {
   // Allow continuing even with a pending exception
 
-  *result = JS_IsString(value->value);
+  *result = js__is_intrinsic_class(js__get_typedarray_class(env, js_biguint64array), value->value);
 
   return 0;
 }
 
 int
-js_is_symbol (js_env_t *env, js_value_t *value, bool *result) {
+js_is_dataview (js_env_t *env, js_value_t *value, bool *result) {
   // Allow continuing even with a pending exception
 
-  *result = JS_IsSymbol(value->value);
+  *result = js__is_intrinsic_class(&env->dataview, value->value);
 
   return 0;
 }
 
 int
-js_is_object (js_env_t *env, js_value_t *value, bool *result) {
+js_is_module_namespace (js_env_t *env, js_value_t *value, bool *result) {
   // Allow continuing even with a pending exception
 
-  *result = JS_IsObject(value->value);
+  *result = false;
 
   return 0;
 }
 
 int
-js_is_function (js_env_t *env, js_value_t *value, bool *result) {
+js_strict_equals (js_env_t *env, js_value_t *a, js_value_t *b, bool *result) {
   // Allow continuing even with a pending exception
 
-  *result = JS_IsFunction(env->context, value->value);
+  *result = JS_StrictEq(env->context, a->value, b->value);
 
   return 0;
 }
 
 int
-js_is_async_function (js_env_t *env, js_value_t *value, bool *result) {
+js_get_global (js_env_t *env, js_value_t **result) {
   // Allow continuing even with a pending exception
 
-  *result = false;
+  *result = js__attach_to_handle_scope(env, env->scope, JS_GetGlobalObject(env->context));
 
   return 0;
 }
 
 int
-js_is_generator_function (js_env_t *env, js_value_t *value, bool *result) {
+js_get_undefined (js_env_t *env, js_value_t **result) {
   // Allow continuing even with a pending exception
 
-  *result = false;
+  *result = js__attach_to_handle_scope(env, env->scope, JS_UNDEFINED);
 
   return 0;
 }
 
 int
-js_is_generator (js_env_t *env, js_value_t *value, bool *result) {
+js_get_null (js_env_t *env, js_value_t **result) {
   // Allow continuing even with a pending exception
 
-  *result = false;
+  *result = js__attach_to_handle_scope(env, env->scope, JS_NULL);
 
   return 0;
 }
 
 int
-js_is_arguments (js_env_t *env, js_value_t *value, bool *result) {
+js_get_boolean (js_env_t *env, bool value, js_value_t **result) {
   // Allow continuing even with a pending exception
 
-  *result = false;
+  *result = js__attach_to_handle_scope(env, env->scope, value ? JS_TRUE : JS_FALSE);
 
   return 0;
 }
 
 int
-js_is_array (js_env_t *env, js_value_t *value, bool *result) {
+js_get_value_bool (js_env_t *env, js_value_t *value, bool *result) {
   // Allow continuing even with a pending exception
 
-  *result = JS_IsArray(env->context, value->value);
+  *result = JS_ToBool(env->context, value->value);
 
   return 0;
 }
 
 int
-js_is_external (js_env_t *env, js_value_t *value, bool *result) {
+js_get_value_int32 (js_env_t *env, js_value_t *value, int32_t *result) {
   // Allow continuing even with a pending exception
 
-  *result = JS_IsObject(value->value) && JS_GetOpaque(value->value, js_external_class_id) != NULL;
+  JS_ToInt32(env->context, result, value->value);
 
   return 0;
 }
 
 int
-js_is_wrapped (js_env_t *env, js_value_t *value, bool *result) {
+js_get_value_uint32 (js_env_t *env, js_value_t *value, uint32_t *result) {
   // Allow continuing even with a pending exception
 
-  JSAtom atom = JS_NewAtom(env->context, "__native_external");
-
-  *result = JS_IsObject(value->value) && JS_HasProperty(env->context, value->value, atom) == 1;
-
-  JS_FreeAtom(env->context, atom);
+  JS_ToUint32(env->context, result, value->value);
 
   return 0;
 }
 
 int
-js_is_delegate (js_env_t *env, js_value_t *value, bool *result) {
+js_get_value_int64 (js_env_t *env, js_value_t *value, int64_t *result) {
   // Allow continuing even with a pending exception
 
-  *result = JS_IsObject(value->value) && JS_GetOpaque(value->value, js_delegate_class_id) != NULL;
+  JS_ToInt64(env->context, result, value->value);
 
   return 0;
 }
 
 int
-js_is_bigint (js_env_t *env, js_value_t *value, bool *result) {
+js_get_value_double (js_env_t *env, js_value_t *value, double *result) {
   // Allow continuing even with a pending exception
 
-  *result = JS_IsBigInt(env->context, value->value);
+  JS_ToFloat64(env->context, result, value->value);
 
   return 0;
 }
 
 int
-js_is_date (js_env_t *env, js_value_t *value, bool *result) {
+js_get_value_bigint_int64 (js_env_t *env, js_value_t *value, int64_t *result, bool *lossless) {
   // Allow continuing even with a pending exception
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "Date");
-
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+  JS_ToBigInt64(env->context, result, value->value);
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+  if (lossless) *lossless = true;
 
   return 0;
 }
 
 int
-js_is_regexp (js_env_t *env, js_value_t *value, bool *result) {
+js_get_value_bigint_uint64 (js_env_t *env, js_value_t *value, uint64_t *result, bool *lossless) {
   // Allow continuing even with a pending exception
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "RegExp");
-
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+  JS_ToBigInt64(env->context, (int64_t *) result, value->value);
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+  if (lossless) *lossless = true;
 
   return 0;
 }
 
-int
-js_is_error (js_env_t *env, js_value_t *value, bool *result) {
-  // Allow continuing even with a pending exception
+static inline const js_string_header_t *
+js__get_string_header (js_env_t *env, JSValueConst value) {
+  if (!env->string_headers || JS_VALUE_GET_TAG(value) != JS_TAG_STRING) return NULL;
 
-  *result = JS_IsError(env->context, value->value);
+  return (const js_string_header_t *) JS_VALUE_GET_PTR(value);
+}
 
-  return 0;
+static inline size_t
+js__get_string_utf8_length (const js_string_header_t *header) {
+  if (!header->is_wide_char) {
+    return utf8_length_from_latin1((const latin1_t *) &header[1], header->len);
+  }
+
+  const uint16_t *chars = (const uint16_t *) &header[1];
+
+  size_t len = 0;
+
+  for (uint32_t i = 0, n = header->len; i < n; i++) {
+    uint16_t c = chars[i];
+
+    if (c < 0x80) len += 1;
+    else if (c < 0x800) len += 2;
+    else if (c >= 0xd800 && c < 0xdc00 && i + 1 < n && chars[i + 1] >= 0xdc00 && chars[i + 1] < 0xe000) {
+      len += 4;
+      i++;
+    } else len += 3;
+  }
+
+  return len;
 }
 
-int
-js_is_promise (js_env_t *env, js_value_t *value, bool *result) {
-  // Allow continuing even with a pending exception
+// Encode UTF-16 as UTF-8 the same way as `JS_ToCStringLen()`, which encodes
+// lone surrogates as if they were regular code points. Encoding stops at the
+// last character that fits in full.
+static inline size_t
+js__write_string_utf8 (const js_string_header_t *header, utf8_t *str, size_t len) {
+  size_t written = 0;
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "Promise");
+  if (!header->is_wide_char) {
+    const latin1_t *chars = (const latin1_t *) &header[1];
 
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+    for (uint32_t i = 0, n = header->len; i < n; i++) {
+      latin1_t c = chars[i];
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+      if (c < 0x80) {
+        if (written + 1 > len) break;
 
-  return 0;
+        str[written++] = c;
+      } else {
+        if (written + 2 > len) break;
+
+        str[written++] = 0xc0 | (c >> 6);
+        str[written++] = 0x80 | (c & 0x3f);
+      }
+    }
+
+    return written;
+  }
+
+  const uint16_t *chars = (const uint16_t *) &header[1];
+
+  for (uint32_t i = 0, n = header->len; i < n; i++) {
+    uint32_t c = chars[i];
+
+    if (c < 0x80) {
+      if (written + 1 > len) break;
+
+      str[written++] = c;
+    } else if (c < 0x800) {
+      if (written + 2 > len) break;
+
+      str[written++] = 0xc0 | (c >> 6);
+      str[written++] = 0x80 | (c & 0x3f);
+    } else if (c >= 0xd800 && c < 0xdc00 && i + 1 < n && chars[i + 1] >= 0xdc00 && chars[i + 1] < 0xe000) {
+      if (written + 4 > len) break;
+
+      c = 0x10000 + ((c - 0xd800) << 10) + (chars[++i] - 0xdc00);
+
+      str[written++] = 0xf0 | (c >> 18);
+      str[written++] = 0x80 | ((c >> 12) & 0x3f);
+      str[written++] = 0x80 | ((c >> 6) & 0x3f);
+      str[written++] = 0x80 | (c & 0x3f);
+    } else {
+      if (written + 3 > len) break;
+
+      str[written++] = 0xe0 | (c >> 12);
+      str[written++] = 0x80 | ((c >> 6) & 0x3f);
+      str[written++] = 0x80 | (c & 0x3f);
+    }
+  }
+
+  return written;
 }
 
-int
-js_is_proxy (js_env_t *env, js_value_t *value, bool *result) {
-  // Allow continuing even with a pending exception
+static bool
+js__verify_string_header (JSContext *context) {
+  // A Latin-1 string and a UTF-16 string with a surrogate pair, which between
+  // them cover both character widths and every UTF-8 sequence length.
+  static const char *samples[] = {"qjs caf\xc3\xa9", "\xce\xbb \xe2\x86\x92 \xf0\x9f\x98\x80"};
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "Proxy");
+  bool verified = true;
 
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+  for (size_t i = 0; i < sizeof(samples) / sizeof(samples[0]) && verified; i++) {
+    JSValue value = JS_NewString(context, samples[i]);
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+    size_t len;
+    const char *expected = JS_ToCStringLen(context, &len, value);
 
-  return 0;
+    const js_string_header_t *header = (const js_string_header_t *) JS_VALUE_GET_PTR(value);
+
+    utf8_t str[32];
+
+    verified = (
+      expected != NULL &&
+      header != NULL &&
+      header->is_wide_char == (i == 1) &&
+      js__get_string_utf8_length(header) == len &&
+      js__write_string_utf8(header, str, sizeof(str)) == len &&
+      memcmp(str, expected, len) == 0
+    );
+
+    JS_FreeCString(context, expected);
+    JS_FreeValue(context, value);
+  }
+
+  return verified;
 }
 
 int
-js_is_map (js_env_t *env, js_value_t *value, bool *result) {
+js_get_value_string_utf8 (js_env_t *env, js_value_t *value, utf8_t *str, size_t len, size_t *result) {
   // Allow continuing even with a pending exception
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "Map");
+  const js_string_header_t *header = js__get_string_header(env, value->value);
 
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+  if (header) {
+    if (str == NULL) {
+      *result = js__get_string_utf8_length(header);
+    } else if (len != 0) {
+      size_t written = js__write_string_utf8(header, str, len);
+
+      if (written < len) str[written] = '\0';
+
+      if (result) *result = written;
+    } else if (result) *result = 0;
+
+    return 0;
+  }
+
+  size_t cstr_len;
+  const char *cstr = JS_ToCStringLen(env->context, &cstr_len, value->value);
+
+  if (str == NULL) {
+    *result = cstr_len;
+  } else if (len != 0) {
+    size_t written = cstr_len < len ? cstr_len : len;
+
+    memcpy(str, cstr, written);
+
+    if (written < len) str[written] = '\0';
+
+    if (result) *result = written;
+  } else if (result) *result = 0;
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+  JS_FreeCString(env->context, cstr);
 
   return 0;
 }
 
 int
-js_is_map_iterator (js_env_t *env, js_value_t *value, bool *result) {
+js_get_value_string_utf16le (js_env_t *env, js_value_t *value, utf16_t *str, size_t len, size_t *result) {
   // Allow continuing even with a pending exception
 
-  *result = false;
+  const js_string_header_t *header = js__get_string_header(env, value->value);
 
-  return 0;
-}
+  if (header == NULL && JS_IsString(value->value)) {
+    size_t cstr_len;
+    const char *cstr = JS_ToCStringLen(env->context, &cstr_len, value->value);
 
-int
-js_is_set (js_env_t *env, js_value_t *value, bool *result) {
-  // Allow continuing even with a pending exception
+    size_t utf16_len = utf16_length_from_utf8((utf8_t *) cstr, cstr_len);
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "Set");
+    if (str == NULL) {
+      *result = utf16_len;
+    } else if (len != 0) {
+      size_t written = utf16_len < len ? utf16_len : len;
 
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+      if (utf16_len <= len) {
+        utf8_convert_to_utf16le((utf8_t *) cstr, cstr_len, str);
+      } else {
+        utf16_t *chars = malloc(utf16_len * sizeof(utf16_t));
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+        utf8_convert_to_utf16le((utf8_t *) cstr, cstr_len, chars);
 
-  return 0;
-}
+        memcpy(str, chars, written * sizeof(utf16_t));
 
-int
-js_is_set_iterator (js_env_t *env, js_value_t *value, bool *result) {
-  // Allow continuing even with a pending exception
+        free(chars);
+      }
 
-  *result = false;
+      if (written < len) str[written] = L'\0';
 
-  return 0;
-}
+      if (result) *result = written;
+    } else if (result) *result = 0;
 
-int
-js_is_weak_map (js_env_t *env, js_value_t *value, bool *result) {
-  // Allow continuing even with a pending exception
+    JS_FreeCString(env->context, cstr);
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "WeakMap");
+    return 0;
+  }
 
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+  if (header == NULL) {
+    JSValue string = JS_ToString(env->context, value->value);
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+    if (JS_IsException(string)) {
+      JS_FreeValue(env->context, JS_GetException(env->context));
 
-  return 0;
-}
+      string = JS_NewString(env->context, "");
+    }
 
-int
-js_is_weak_set (js_env_t *env, js_value_t *value, bool *result) {
-  // Allow continuing even with a pending exception
+    int err = js_get_value_string_utf16le(env, (js_value_t *) &string, str, len, result);
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "WeakSet");
+    JS_FreeValue(env->context, string);
 
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+    return err;
+  }
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+  size_t utf16_len = header->len;
 
-  return 0;
-}
+  if (str == NULL) {
+    *result = utf16_len;
+  } else if (len != 0) {
+    size_t written = utf16_len < len ? utf16_len : len;
 
-int
-js_is_weak_ref (js_env_t *env, js_value_t *value, bool *result) {
-  // Allow continuing even with a pending exception
+    if (header->is_wide_char) {
+      memcpy(str, &header[1], written * sizeof(utf16_t));
+    } else {
+      const latin1_t *chars = (const latin1_t *) &header[1];
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "WeakRef");
+      for (size_t i = 0; i < written; i++) str[i] = chars[i];
+    }
 
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+    if (written < len) str[written] = L'\0';
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+    if (result) *result = written;
+  } else if (result) *result = 0;
 
   return 0;
 }
 
 int
-js_is_arraybuffer (js_env_t *env, js_value_t *value, bool *result) {
+js_get_value_string_view (js_env_t *env, js_value_t *value, js_string_encoding_t *encoding, const void **str, size_t *len) {
   // Allow continuing even with a pending exception
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "ArrayBuffer");
+  const js_string_header_t *header = js__get_string_header(env, value->value);
 
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+  if (header == NULL && JS_IsString(value->value)) {
+    js_throw_error(env, NULL, "String views are not supported by this build of QuickJS");
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+    return js__error(env);
+  }
 
-  return 0;
-}
+  if (header == NULL) {
+    js_throw_type_error(env, NULL, "Value is not a string");
 
-int
-js_is_detached_arraybuffer (js_env_t *env, js_value_t *value, bool *result) {
-  // Allow continuing even with a pending exception
+    return js__error(env);
+  }
 
-  size_t len;
+  if (encoding) {
+    *encoding = header->is_wide_char ? js_string_encoding_utf16le : js_string_encoding_latin1;
+  }
 
-  *result = JS_GetArrayBuffer(env->context, &len, value->value) == NULL;
+  if (str) *str = &header[1];
+
+  if (len) *len = header->len;
 
   return 0;
 }
 
 int
-js_is_sharedarraybuffer (js_env_t *env, js_value_t *value, bool *result) {
+js_get_value_external (js_env_t *env, js_value_t *value, void **result) {
   // Allow continuing even with a pending exception
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "SharedArrayBuffer");
-
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+  js_finalizer_t *finalizer = (js_finalizer_t *) JS_GetOpaque(value->value, js_external_class_id);
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+  *result = finalizer->data;
 
   return 0;
 }
 
 int
-js_is_typedarray (js_env_t *env, js_value_t *value, bool *result) {
+js_get_value_date (js_env_t *env, js_value_t *value, double *result) {
   // Allow continuing even with a pending exception
 
-  JSValue global = JS_GetGlobalObject(env->context);
-
-#define V(class) \
-  { \
-    JSValue constructor = JS_GetPropertyStr(env->context, global, class); \
-\
-    if (JS_IsInstanceOf(env->context, value->value, constructor)) { \
-      *result = true; \
-\
-      JS_FreeValue(env->context, constructor); \
-\
-      goto done; \
-    } \
-\
-    JS_FreeValue(env->context, constructor); \
-  }
-
-  V("Int8Array");
-  V("Uint8Array");
-  V("Uint8ClampedArray");
-  V("Int16Array");
-  V("Uint16Array");
-  V("Int32Array");
-  V("Uint32Array");
-  V("Float32Array");
-  V("Float64Array");
-  V("BigInt64Array");
-  V("BigUint64Array");
-
-#undef V
-
-  *result = false;
-
-done:
-  JS_FreeValue(env->context, global);
+  JS_ToFloat64(env->context, result, value->value);
 
   return 0;
 }
 
 int
-js_is_int8array (js_env_t *env, js_value_t *value, bool *result) {
+js_get_array_length (js_env_t *env, js_value_t *value, uint32_t *result) {
   // Allow continuing even with a pending exception
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "Int8Array");
+  JSValue length = JS_GetPropertyStr(env->context, value->value, "length");
 
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+  JS_ToUint32(env->context, result, length);
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+  JS_FreeValue(env->context, length);
 
   return 0;
 }
 
 int
-js_is_uint8array (js_env_t *env, js_value_t *value, bool *result) {
+js_get_prototype (js_env_t *env, js_value_t *object, js_value_t **result) {
   // Allow continuing even with a pending exception
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "Uint8Array");
-
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
-
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+  *result = js__attach_to_handle_scope(env, env->scope, JS_GetPrototype(env->context, object->value));
 
   return 0;
 }
 
 int
-js_is_uint8clampedarray (js_env_t *env, js_value_t *value, bool *result) {
-  // Allow continuing even with a pending exception
+js_get_property_names (js_env_t *env, js_value_t *object, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "Uint8ClampedArray");
+  int err;
 
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+  JSPropertyEnum *properties;
+  uint32_t len;
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+  js__enter(env);
 
-  return 0;
-}
+  err = JS_GetOwnPropertyNames(env->context, &properties, &len, object->value, JS_GPN_ENUM_ONLY | JS_GPN_STRING_MASK);
 
-int
-js_is_int16array (js_env_t *env, js_value_t *value, bool *result) {
-  // Allow continuing even with a pending exception
+  if (env->depth == 1) js__on_run_microtasks(env);
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "Int16Array");
+  js__exit(env);
 
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+  if (err < 0) {
+    if (env->depth == 0) {
+      JSValue error = JS_GetException(env->context);
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+      js__on_uncaught_exception(env->context, error);
+    }
 
-  return 0;
-}
+    return js__error(env);
+  }
 
-int
-js_is_uint16array (js_env_t *env, js_value_t *value, bool *result) {
-  // Allow continuing even with a pending exception
+  JSValue array = JS_NewArray(env->context);
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "Uint16Array");
+  for (uint32_t i = 0; i < len; i++) {
+    err = JS_SetPropertyUint32(env->context, array, i, JS_AtomToValue(env->context, properties[i].atom));
+    if (err < 0) break;
+  }
 
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+  for (uint32_t i = 0; i < len; i++) {
+    JS_FreeAtom(env->context, properties[i].atom);
+  }
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+  js_free(env->context, properties);
+
+  if (err < 0) {
+    JS_FreeValue(env->context, array);
+
+    return js__error(env);
+  }
+
+  if (result == NULL) JS_FreeValue(env->context, array);
+  else {
+    *result = js__attach_to_handle_scope(env, env->scope, array);
+  }
 
   return 0;
 }
 
 int
-js_is_int32array (js_env_t *env, js_value_t *value, bool *result) {
-  // Allow continuing even with a pending exception
-
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "Int32Array");
+js_create_property_iterator (js_env_t *env, js_value_t *object, js_property_iterator_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+  int err;
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+  JSPropertyEnum *properties;
+  uint32_t len;
 
-  return 0;
-}
+  js__enter(env);
 
-int
-js_is_uint32array (js_env_t *env, js_value_t *value, bool *result) {
-  // Allow continuing even with a pending exception
+  err = JS_GetOwnPropertyNames(env->context, &properties, &len, object->value, JS_GPN_ENUM_ONLY | JS_GPN_STRING_MASK);
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "Uint32Array");
+  if (env->depth == 1) js__on_run_microtasks(env);
 
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+  js__exit(env);
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+  if (err < 0) {
+    if (env->depth == 0) {
+      JSValue error = JS_GetException(env->context);
 
-  return 0;
-}
+      js__on_uncaught_exception(env->context, error);
+    }
 
-int
-js_is_float32array (js_env_t *env, js_value_t *value, bool *result) {
-  // Allow continuing even with a pending exception
+    return js__error(env);
+  }
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "Float32Array");
+  js_property_iterator_t *iterator = malloc(sizeof(js_property_iterator_t));
 
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+  iterator->properties = properties;
+  iterator->len = len;
+  iterator->index = 0;
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+  *result = iterator;
 
   return 0;
 }
 
 int
-js_is_float64array (js_env_t *env, js_value_t *value, bool *result) {
+js_get_next_property (js_env_t *env, js_property_iterator_t *iterator, js_value_t **result) {
   // Allow continuing even with a pending exception
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "Float64Array");
+  if (iterator->index == iterator->len) {
+    *result = NULL;
 
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+    return 0;
+  }
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+  JSAtom atom = iterator->properties[iterator->index++].atom;
+
+  *result = js__attach_to_handle_scope(env, env->scope, JS_AtomToString(env->context, atom));
 
   return 0;
 }
 
 int
-js_is_bigint64array (js_env_t *env, js_value_t *value, bool *result) {
+js_destroy_property_iterator (js_env_t *env, js_property_iterator_t *iterator) {
   // Allow continuing even with a pending exception
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "BigInt64Array");
+  for (uint32_t i = 0; i < iterator->len; i++) {
+    JS_FreeAtom(env->context, iterator->properties[i].atom);
+  }
 
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+  js_free(env->context, iterator->properties);
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+  free(iterator);
 
   return 0;
 }
 
 int
-js_is_biguint64array (js_env_t *env, js_value_t *value, bool *result) {
-  // Allow continuing even with a pending exception
+js_get_property (js_env_t *env, js_value_t *object, js_value_t *key, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "BigUint64Array");
+  JSAtom atom = JS_ValueToAtom(env->context, key->value);
 
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+  js__enter(env);
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+  JSValue value = JS_GetProperty(env->context, object->value, atom);
 
-  return 0;
-}
+  JS_FreeAtom(env->context, atom);
 
-int
-js_is_dataview (js_env_t *env, js_value_t *value, bool *result) {
-  // Allow continuing even with a pending exception
+  if (env->depth == 1) js__on_run_microtasks(env);
 
-  JSValue global = JS_GetGlobalObject(env->context);
-  JSValue constructor = JS_GetPropertyStr(env->context, global, "DataView");
+  js__exit(env);
 
-  *result = JS_IsInstanceOf(env->context, value->value, constructor);
+  if (JS_IsException(value)) {
+    if (env->depth == 0) {
+      JSValue error = JS_GetException(env->context);
 
-  JS_FreeValue(env->context, constructor);
-  JS_FreeValue(env->context, global);
+      js__on_uncaught_exception(env->context, error);
+    }
+
+    return js__error(env);
+  }
+
+  if (result == NULL) JS_FreeValue(env->context, value);
+  else {
+    *result = js__attach_to_handle_scope(env, env->scope, value);
+  }
 
   return 0;
 }
 
 int
-js_is_module_namespace (js_env_t *env, js_value_t *value, bool *result) {
-  // Allow continuing even with a pending exception
+js_has_property (js_env_t *env, js_value_t *object, js_value_t *key, bool *result) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  *result = false;
+  JSAtom atom = JS_ValueToAtom(env->context, key->value);
 
-  return 0;
-}
+  js__enter(env);
 
-int
-js_strict_equals (js_env_t *env, js_value_t *a, js_value_t *b, bool *result) {
-  // Allow continuing even with a pending exception
+  int success = JS_HasProperty(env->context, object->value, atom);
 
-  *result = JS_StrictEq(env->context, a->value, b->value);
+  JS_FreeAtom(env->context, atom);
 
-  return 0;
-}
+  if (env->depth == 1) js__on_run_microtasks(env);
 
-int
-js_get_global (js_env_t *env, js_value_t **result) {
-  // Allow continuing even with a pending exception
+  js__exit(env);
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  if (success < 0) {
+    if (env->depth == 0) {
+      JSValue error = JS_GetException(env->context);
 
-  wrapper->value = JS_GetGlobalObject(env->context);
+      js__on_uncaught_exception(env->context, error);
+    }
 
-  *result = wrapper;
+    return js__error(env);
+  }
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  if (result) *result = success == 1;
 
   return 0;
 }
 
 int
-js_get_undefined (js_env_t *env, js_value_t **result) {
-  // Allow continuing even with a pending exception
-
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+js_set_property (js_env_t *env, js_value_t *object, js_value_t *key, js_value_t *value) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  wrapper->value = JS_UNDEFINED;
+  JSAtom atom = JS_ValueToAtom(env->context, key->value);
 
-  *result = wrapper;
+  js__enter(env);
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  int success = JS_SetProperty(env->context, object->value, atom, JS_DupValue(env->context, value->value));
 
-  return 0;
-}
+  JS_FreeAtom(env->context, atom);
 
-int
-js_get_null (js_env_t *env, js_value_t **result) {
-  // Allow continuing even with a pending exception
+  if (env->depth == 1) js__on_run_microtasks(env);
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  js__exit(env);
 
-  wrapper->value = JS_NULL;
+  if (success < 0) {
+    if (env->depth == 0) {
+      JSValue error = JS_GetException(env->context);
 
-  *result = wrapper;
+      js__on_uncaught_exception(env->context, error);
+    }
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+    return js__error(env);
+  }
 
   return 0;
 }
 
 int
-js_get_boolean (js_env_t *env, bool value, js_value_t **result) {
-  // Allow continuing even with a pending exception
+js_delete_property (js_env_t *env, js_value_t *object, js_value_t *key, bool *result) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+  JSAtom atom = JS_ValueToAtom(env->context, key->value);
 
-  wrapper->value = value ? JS_TRUE : JS_FALSE;
+  js__enter(env);
 
-  *result = wrapper;
+  int success = JS_DeleteProperty(env->context, object->value, atom, 0);
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  JS_FreeAtom(env->context, atom);
 
-  return 0;
-}
+  if (env->depth == 1) js__on_run_microtasks(env);
 
-int
-js_get_value_bool (js_env_t *env, js_value_t *value, bool *result) {
-  // Allow continuing even with a pending exception
+  js__exit(env);
 
-  *result = JS_ToBool(env->context, value->value);
+  if (success < 0) {
+    if (env->depth == 0) {
+      JSValue error = JS_GetException(env->context);
 
-  return 0;
-}
+      js__on_uncaught_exception(env->context, error);
+    }
 
-int
-js_get_value_int32 (js_env_t *env, js_value_t *value, int32_t *result) {
-  // Allow continuing even with a pending exception
+    return js__error(env);
+  }
 
-  JS_ToInt32(env->context, result, value->value);
+  if (result) *result = success == 1;
 
   return 0;
 }
 
 int
-js_get_value_uint32 (js_env_t *env, js_value_t *value, uint32_t *result) {
-  // Allow continuing even with a pending exception
+js_get_named_property (js_env_t *env, js_value_t *object, const char *name, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  JS_ToUint32(env->context, result, value->value);
+  js__enter(env);
 
-  return 0;
-}
+  JSValue value = JS_GetPropertyStr(env->context, object->value, name);
 
-int
-js_get_value_int64 (js_env_t *env, js_value_t *value, int64_t *result) {
-  // Allow continuing even with a pending exception
+  if (env->depth == 1) js__on_run_microtasks(env);
 
-  JS_ToInt64(env->context, result, value->value);
+  js__exit(env);
 
-  return 0;
-}
+  if (JS_IsException(value)) {
+    if (env->depth == 0) {
+      JSValue error = JS_GetException(env->context);
 
-int
-js_get_value_double (js_env_t *env, js_value_t *value, double *result) {
-  // Allow continuing even with a pending exception
+      js__on_uncaught_exception(env->context, error);
+    }
 
-  JS_ToFloat64(env->context, result, value->value);
+    return js__error(env);
+  }
+
+  if (result == NULL) JS_FreeValue(env->context, value);
+  else {
+    *result = js__attach_to_handle_scope(env, env->scope, value);
+  }
 
   return 0;
 }
 
 int
-js_get_value_bigint_int64 (js_env_t *env, js_value_t *value, int64_t *result, bool *lossless) {
-  // Allow continuing even with a pending exception
+js_has_named_property (js_env_t *env, js_value_t *object, const char *name, bool *result) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  JS_ToBigInt64(env->context, result, value->value);
+  JSAtom atom = JS_NewAtom(env->context, name);
 
-  if (lossless) *lossless = true;
+  js__enter(env);
 
-  return 0;
-}
+  int success = JS_HasProperty(env->context, object->value, atom);
 
-int
-js_get_value_bigint_uint64 (js_env_t *env, js_value_t *value, uint64_t *result, bool *lossless) {
-  // Allow continuing even with a pending exception
+  JS_FreeAtom(env->context, atom);
 
-  JS_ToBigInt64(env->context, (int64_t *) result, value->value);
+  if (env->depth == 1) js__on_run_microtasks(env);
 
-  if (lossless) *lossless = true;
+  js__exit(env);
+
+  if (success < 0) {
+    if (env->depth == 0) {
+      JSValue error = JS_GetException(env->context);
+
+      js__on_uncaught_exception(env->context, error);
+    }
+
+    return js__error(env);
+  }
+
+  if (result) *result = success == 1;
 
   return 0;
 }
 
 int
-js_get_value_string_utf8 (js_env_t *env, js_value_t *value, utf8_t *str, size_t len, size_t *result) {
-  // Allow continuing even with a pending exception
+js_set_named_property (js_env_t *env, js_value_t *object, const char *name, js_value_t *value) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  size_t cstr_len;
-  const char *cstr = JS_ToCStringLen(env->context, &cstr_len, value->value);
+  js__enter(env);
 
-  if (str == NULL) {
-    *result = cstr_len;
-  } else if (len != 0) {
-    size_t written = cstr_len < len ? cstr_len : len;
+  int success = JS_SetPropertyStr(env->context, object->value, name, JS_DupValue(env->context, value->value));
 
-    memcpy(str, cstr, written);
+  if (env->depth == 1) js__on_run_microtasks(env);
 
-    if (written < len) str[written] = '\0';
+  js__exit(env);
 
-    if (result) *result = written;
-  } else if (result) *result = 0;
+  if (success < 0) {
+    if (env->depth == 0) {
+      JSValue error = JS_GetException(env->context);
 
-  JS_FreeCString(env->context, cstr);
+      js__on_uncaught_exception(env->context, error);
+    }
+
+    return js__error(env);
+  }
 
   return 0;
 }
 
+static inline js_key_t **
+js__get_key_bucket (js_env_t *env, const char *name, size_t len) {
+  return &env->keys[js__hash(0xcbf29ce484222325, name, len) & 63];
+}
+
 int
-js_get_value_string_utf16le (js_env_t *env, js_value_t *value, utf16_t *str, size_t len, size_t *result) {
-  // Allow continuing even with a pending exception
+js_create_key (js_env_t *env, const char *name, size_t len, js_key_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  size_t cstr_len;
-  const char *cstr = JS_ToCStringLen(env->context, &cstr_len, value->value);
+  if (len == (size_t) -1) len = strlen(name);
 
-  size_t utf16_len = utf16_length_from_utf8((utf8_t *) cstr, cstr_len);
+  js_key_t **bucket = js__get_key_bucket(env, name, len);
 
-  if (str == NULL) {
-    *result = utf16_len;
-  } else if (len != 0) {
-    size_t written = utf16_len < len ? utf16_len : len;
+  js_key_t *key = *bucket;
 
-    utf8_convert_to_utf16le((utf8_t *) cstr, cstr_len, str);
+  while (key && (key->len != len || memcmp(key->name, name, len) != 0)) {
+    key = key->next;
+  }
 
-    if (written < len) str[written] = L'\0';
+  if (key == NULL) {
+    JSAtom atom = JS_NewAtomLen(env->context, name, len);
 
-    if (result) *result = written;
-  } else if (result) *result = 0;
+    if (atom == JS_ATOM_NULL) return js__error(env);
 
-  JS_FreeCString(env->context, cstr);
+    key = malloc(sizeof(js_key_t));
 
-  return 0;
-}
+    key->atom = atom;
+    key->name = strndup(name, len);
+    key->len = len;
+    key->references = 0;
+    key->next = *bucket;
 
-int
-js_get_value_external (js_env_t *env, js_value_t *value, void **result) {
-  // Allow continuing even with a pending exception
+    *bucket = key;
+  }
 
-  js_finalizer_t *finalizer = (js_finalizer_t *) JS_GetOpaque(value->value, js_external_class_id);
+  key->references++;
 
-  *result = finalizer->data;
+  *result = key;
 
   return 0;
 }
 
 int
-js_get_value_date (js_env_t *env, js_value_t *value, double *result) {
+js_delete_key (js_env_t *env, js_key_t *key) {
   // Allow continuing even with a pending exception
 
-  JS_ToFloat64(env->context, result, value->value);
+  if (--key->references > 0) return 0;
 
-  return 0;
-}
+  js_key_t **next = js__get_key_bucket(env, key->name, key->len);
 
-int
-js_get_array_length (js_env_t *env, js_value_t *value, uint32_t *result) {
-  // Allow continuing even with a pending exception
+  while (*next != key) next = &(*next)->next;
 
-  JSValue length = JS_GetPropertyStr(env->context, value->value, "length");
+  *next = key->next;
 
-  JS_ToUint32(env->context, result, length);
+  JS_FreeAtom(env->context, key->atom);
 
-  JS_FreeValue(env->context, length);
+  free(key->name);
+  free(key);
 
   return 0;
 }
 
 int
-js_get_prototype (js_env_t *env, js_value_t *object, js_value_t **result) {
-  // Allow continuing even with a pending exception
+js_get_properties (js_env_t *env, js_value_t *object, js_key_t *const keys[], size_t len, js_value_t *result[]) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  int err = 0;
+
+  js__enter(env);
+
+  for (size_t i = 0; i < len; i++) {
+    JSValue value = JS_GetProperty(env->context, object->value, keys[i]->atom);
+
+    if (JS_IsException(value)) {
+      err = -1;
+
+      break;
+    }
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+    result[i] = js__attach_to_handle_scope(env, env->scope, value);
+  }
+
+  if (env->depth == 1) js__on_run_microtasks(env);
+
+  js__exit(env);
 
-  wrapper->value = JS_GetPrototype(env->context, object->value);
+  if (err < 0) {
+    if (env->depth == 0) {
+      JSValue error = JS_GetException(env->context);
 
-  *result = wrapper;
+      js__on_uncaught_exception(env->context, error);
+    }
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+    return js__error(env);
+  }
 
   return 0;
 }
 
 int
-js_get_property_names (js_env_t *env, js_value_t *object, js_value_t **result) {
+js_set_properties (js_env_t *env, js_value_t *object, js_key_t *const keys[], js_value_t *const values[], size_t len) {
   if (JS_HasException(env->context)) return js__error(env);
 
-  int err;
+  int err = 0;
 
-  JSPropertyEnum *properties;
-  uint32_t len;
+  js__enter(env);
 
-  env->depth++;
+  for (size_t i = 0; i < len; i++) {
+    err = JS_SetProperty(env->context, object->value, keys[i]->atom, JS_DupValue(env->context, values[i]->value));
 
-  err = JS_GetOwnPropertyNames(env->context, &properties, &len, object->value, JS_GPN_ENUM_ONLY | JS_GPN_STRING_MASK);
+    if (err < 0) break;
+  }
 
   if (env->depth == 1) js__on_run_microtasks(env);
 
-  env->depth--;
+  js__exit(env);
 
   if (err < 0) {
     if (env->depth == 0) {
@@ -3962,51 +7738,51 @@ js_get_property_names (js_env_t *env, js_value_t *object, js_value_t **result) {
     return js__error(env);
   }
 
-  JSValue array = JS_NewArray(env->context);
+  return 0;
+}
 
-  for (uint32_t i = 0; i < len; i++) {
-    err = JS_SetPropertyUint32(env->context, object->value, i, JS_AtomToValue(env->context, properties[i].atom));
-    if (err < 0) goto err;
-  }
+int
+js_delete_named_property (js_env_t *env, js_value_t *object, const char *name, bool *result) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  if (result == NULL) JS_FreeValue(env->context, array);
-  else {
-    js_value_t *wrapper = malloc(sizeof(js_value_t));
+  JSAtom atom = JS_NewAtom(env->context, name);
 
-    wrapper->value = array;
+  js__enter(env);
 
-    *result = wrapper;
+  int success = JS_DeleteProperty(env->context, object->value, atom, 0);
 
-    js__attach_to_handle_scope(env, env->scope, wrapper);
-  }
+  JS_FreeAtom(env->context, atom);
 
-  return 0;
+  if (env->depth == 1) js__on_run_microtasks(env);
 
-err:
-  for (uint32_t i = 0; i < len; i++) {
-    JS_FreeAtom(env->context, properties[i].atom);
+  js__exit(env);
+
+  if (success < 0) {
+    if (env->depth == 0) {
+      JSValue error = JS_GetException(env->context);
+
+      js__on_uncaught_exception(env->context, error);
+    }
+
+    return js__error(env);
   }
 
-  free(properties);
+  if (result) *result = success == 1;
 
-  return js__error(env);
+  return 0;
 }
 
 int
-js_get_property (js_env_t *env, js_value_t *object, js_value_t *key, js_value_t **result) {
+js_get_element (js_env_t *env, js_value_t *object, uint32_t index, js_value_t **result) {
   if (JS_HasException(env->context)) return js__error(env);
 
-  JSAtom atom = JS_ValueToAtom(env->context, key->value);
-
-  env->depth++;
+  js__enter(env);
 
-  JSValue value = JS_GetProperty(env->context, object->value, atom);
-
-  JS_FreeAtom(env->context, atom);
+  JSValue value = JS_GetPropertyUint32(env->context, object->value, index);
 
   if (env->depth == 1) js__on_run_microtasks(env);
 
-  env->depth--;
+  js__exit(env);
 
   if (JS_IsException(value)) {
     if (env->depth == 0) {
@@ -4020,25 +7796,19 @@ js_get_property (js_env_t *env, js_value_t *object, js_value_t *key, js_value_t
 
   if (result == NULL) JS_FreeValue(env->context, value);
   else {
-    js_value_t *wrapper = malloc(sizeof(js_value_t));
-
-    wrapper->value = value;
-
-    *result = wrapper;
-
-    js__attach_to_handle_scope(env, env->scope, wrapper);
+    *result = js__attach_to_handle_scope(env, env->scope, value);
   }
 
   return 0;
 }
 
 int
-js_has_property (js_env_t *env, js_value_t *object, js_value_t *key, bool *result) {
+js_has_element (js_env_t *env, js_value_t *object, uint32_t index, bool *result) {
   if (JS_HasException(env->context)) return js__error(env);
 
-  JSAtom atom = JS_ValueToAtom(env->context, key->value);
+  JSAtom atom = JS_NewAtomUInt32(env->context, index);
 
-  env->depth++;
+  js__enter(env);
 
   int success = JS_HasProperty(env->context, object->value, atom);
 
@@ -4046,7 +7816,7 @@ js_has_property (js_env_t *env, js_value_t *object, js_value_t *key, bool *resul
 
   if (env->depth == 1) js__on_run_microtasks(env);
 
-  env->depth--;
+  js__exit(env);
 
   if (success < 0) {
     if (env->depth == 0) {
@@ -4064,20 +7834,16 @@ js_has_property (js_env_t *env, js_value_t *object, js_value_t *key, bool *resul
 }
 
 int
-js_set_property (js_env_t *env, js_value_t *object, js_value_t *key, js_value_t *value) {
+js_set_element (js_env_t *env, js_value_t *object, uint32_t index, js_value_t *value) {
   if (JS_HasException(env->context)) return js__error(env);
 
-  JSAtom atom = JS_ValueToAtom(env->context, key->value);
-
-  env->depth++;
-
-  int success = JS_SetProperty(env->context, object->value, atom, JS_DupValue(env->context, value->value));
+  js__enter(env);
 
-  JS_FreeAtom(env->context, atom);
+  int success = JS_SetPropertyUint32(env->context, object->value, index, JS_DupValue(env->context, value->value));
 
   if (env->depth == 1) js__on_run_microtasks(env);
 
-  env->depth--;
+  js__exit(env);
 
   if (success < 0) {
     if (env->depth == 0) {
@@ -4092,23 +7858,48 @@ js_set_property (js_env_t *env, js_value_t *object, js_value_t *key, js_value_t
   return 0;
 }
 
+static inline bool
+js__get_array_copy_range (js_env_t *env, JSValueConst array, size_t len, size_t offset, uint32_t *result) {
+  uint32_t length;
+
+  JSValue value = JS_GetPropertyStr(env->context, array, "length");
+
+  int err = JS_ToUint32(env->context, &length, value);
+
+  JS_FreeValue(env->context, value);
+
+  if (err < 0) return false;
+
+  if (offset >= length) *result = 0;
+  else *result = length - offset < len ? length - offset : len;
+
+  return true;
+}
+
 int
-js_delete_property (js_env_t *env, js_value_t *object, js_value_t *key, bool *result) {
+js_copy_array_elements (js_env_t *env, js_value_t *array, js_value_t **elements, size_t len, size_t offset, uint32_t *result) {
   if (JS_HasException(env->context)) return js__error(env);
 
-  JSAtom atom = JS_ValueToAtom(env->context, key->value);
+  int err = 0;
 
-  env->depth++;
+  uint32_t copied = 0;
 
-  int success = JS_DeleteProperty(env->context, object->value, atom, 0);
+  js__enter(env);
 
-  JS_FreeAtom(env->context, atom);
+  if (!js__get_array_copy_range(env, array->value, len, offset, &copied)) err = -1;
+
+  for (uint32_t i = 0; err == 0 && i < copied; i++) {
+    JSValue value = JS_GetPropertyUint32(env->context, array->value, offset + i);
+
+    if (JS_IsException(value)) err = -1;
+    else elements[i] = js__attach_to_handle_scope(env, env->scope, value);
+  }
 
   if (env->depth == 1) js__on_run_microtasks(env);
 
-  env->depth--;
+  js__exit(env);
 
-  if (success < 0) {
+  if (err < 0) {
     if (env->depth == 0) {
       JSValue error = JS_GetException(env->context);
 
@@ -4118,24 +7909,53 @@ js_delete_property (js_env_t *env, js_value_t *object, js_value_t *key, bool *re
     return js__error(env);
   }
 
-  if (result) *result = success == 1;
+  if (result) *result = copied;
 
   return 0;
 }
 
 int
-js_get_named_property (js_env_t *env, js_value_t *object, const char *name, js_value_t **result) {
+js_copy_array_doubles (js_env_t *env, js_value_t *array, double *elements, size_t len, size_t offset, uint32_t *result) {
   if (JS_HasException(env->context)) return js__error(env);
 
-  env->depth++;
+  int err = 0;
 
-  JSValue value = JS_GetPropertyStr(env->context, object->value, name);
+  uint32_t copied = 0;
+
+  js__enter(env);
+
+  if (!js__get_array_copy_range(env, array->value, len, offset, &copied)) err = -1;
+
+  for (uint32_t i = 0; err == 0 && i < copied; i++) {
+    JSValue value = JS_GetPropertyUint32(env->context, array->value, offset + i);
+
+    if (JS_IsException(value)) {
+      err = -1;
+
+      break;
+    }
+
+    switch (JS_VALUE_GET_TAG(value)) {
+    case JS_TAG_INT:
+      elements[i] = JS_VALUE_GET_INT(value);
+      break;
+
+    case JS_TAG_FLOAT64:
+      elements[i] = JS_VALUE_GET_FLOAT64(value);
+      break;
+
+    default:
+      err = JS_ToFloat64(env->context, &elements[i], value);
+    }
+
+    JS_FreeValue(env->context, value);
+  }
 
   if (env->depth == 1) js__on_run_microtasks(env);
 
-  env->depth--;
+  js__exit(env);
 
-  if (JS_IsException(value)) {
+  if (err < 0) {
     if (env->depth == 0) {
       JSValue error = JS_GetException(env->context);
 
@@ -4145,35 +7965,26 @@ js_get_named_property (js_env_t *env, js_value_t *object, const char *name, js_v
     return js__error(env);
   }
 
-  if (result == NULL) JS_FreeValue(env->context, value);
-  else {
-    js_value_t *wrapper = malloc(sizeof(js_value_t));
-
-    wrapper->value = value;
-
-    *result = wrapper;
-
-    js__attach_to_handle_scope(env, env->scope, wrapper);
-  }
+  if (result) *result = copied;
 
   return 0;
 }
 
 int
-js_has_named_property (js_env_t *env, js_value_t *object, const char *name, bool *result) {
+js_delete_element (js_env_t *env, js_value_t *object, uint32_t index, bool *result) {
   if (JS_HasException(env->context)) return js__error(env);
 
-  JSAtom atom = JS_NewAtom(env->context, name);
+  JSAtom atom = JS_NewAtomUInt32(env->context, index);
 
-  env->depth++;
+  js__enter(env);
 
-  int success = JS_HasProperty(env->context, object->value, atom);
+  int success = JS_DeleteProperty(env->context, object->value, atom, 0);
 
   JS_FreeAtom(env->context, atom);
 
   if (env->depth == 1) js__on_run_microtasks(env);
 
-  env->depth--;
+  js__exit(env);
 
   if (success < 0) {
     if (env->depth == 0) {
@@ -4191,115 +8002,199 @@ js_has_named_property (js_env_t *env, js_value_t *object, const char *name, bool
 }
 
 int
-js_set_named_property (js_env_t *env, js_value_t *object, const char *name, js_value_t *value) {
-  if (JS_HasException(env->context)) return js__error(env);
-
-  env->depth++;
+js_get_callback_info (js_env_t *env, const js_callback_info_t *info, size_t *argc, js_value_t *argv[], js_value_t **receiver, void **data) {
+  // Allow continuing even with a pending exception
 
-  int success = JS_SetPropertyStr(env->context, object->value, name, JS_DupValue(env->context, value->value));
+  // The arguments, receiver, and new target are owned by the engine for the
+  // duration of the call, which outlives the handle scope opened for the
+  // callback. Hand out wrappers that point straight into the call frame
+  // rather than duplicating each value into the scope.
 
-  if (env->depth == 1) js__on_run_microtasks(env);
+  if (argv) {
+    size_t i = 0, n = info->argc < *argc ? info->argc : *argc;
 
-  env->depth--;
+    for (; i < n; i++) {
+      argv[i] = (js_value_t *) &info->argv[i];
+    }
 
-  if (success < 0) {
-    if (env->depth == 0) {
-      JSValue error = JS_GetException(env->context);
+    n = *argc;
 
-      js__on_uncaught_exception(env->context, error);
+    for (; i < n; i++) {
+      argv[i] = (js_value_t *) &env->undefined;
     }
+  }
 
-    return js__error(env);
+  if (argc) {
+    *argc = info->argc;
+  }
+
+  if (receiver) {
+    *receiver = (js_value_t *) &info->receiver;
+  }
+
+  if (data) {
+    *data = info->callback->data;
   }
 
   return 0;
 }
 
 int
-js_delete_named_property (js_env_t *env, js_value_t *object, const char *name, bool *result) {
-  if (JS_HasException(env->context)) return js__error(env);
+js_get_new_target (js_env_t *env, const js_callback_info_t *info, js_value_t **result) {
+  // Allow continuing even with a pending exception
 
-  JSAtom atom = JS_NewAtom(env->context, name);
+  *result = (js_value_t *) &info->new_target;
 
-  env->depth++;
+  return 0;
+}
 
-  int success = JS_DeleteProperty(env->context, object->value, atom, 0);
+int
+js_get_arraybuffer_info (js_env_t *env, js_value_t *arraybuffer, void **pdata, size_t *plen) {
+  // Allow continuing even with a pending exception
 
-  JS_FreeAtom(env->context, atom);
+  size_t len;
 
-  if (env->depth == 1) js__on_run_microtasks(env);
+  uint8_t *data = JS_GetArrayBuffer(env->context, &len, arraybuffer->value);
 
-  env->depth--;
+  if (pdata) {
+    *pdata = data;
+  }
 
-  if (success < 0) {
-    if (env->depth == 0) {
-      JSValue error = JS_GetException(env->context);
+  if (plen) {
+    *plen = len;
+  }
 
-      js__on_uncaught_exception(env->context, error);
-    }
+  return 0;
+}
 
-    return js__error(env);
+int
+js_get_sharedarraybuffer_info (js_env_t *env, js_value_t *sharedarraybuffer, void **pdata, size_t *plen) {
+  // Allow continuing even with a pending exception
+
+  size_t len;
+
+  uint8_t *data = JS_GetArrayBuffer(env->context, &len, sharedarraybuffer->value);
+
+  if (pdata) {
+    *pdata = data;
   }
 
-  if (result) *result = success == 1;
+  if (plen) {
+    *plen = len;
+  }
 
   return 0;
 }
 
 int
-js_get_element (js_env_t *env, js_value_t *object, uint32_t index, js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
-
-  env->depth++;
-
-  JSValue value = JS_GetPropertyUint32(env->context, object->value, index);
+js_get_typedarray_info (js_env_t *env, js_value_t *typedarray, js_typedarray_type_t *ptype, void **pdata, size_t *plen, js_value_t **parraybuffer, size_t *poffset) {
+  // Allow continuing even with a pending exception
 
-  if (env->depth == 1) js__on_run_microtasks(env);
+  size_t offset, byte_len, bytes_per_element;
 
-  env->depth--;
+  JSValue arraybuffer = JS_GetTypedArrayBuffer(env->context, typedarray->value, &offset, &byte_len, &bytes_per_element);
 
-  if (JS_IsException(value)) {
-    if (env->depth == 0) {
-      JSValue error = JS_GetException(env->context);
+  if (ptype) {
+    for (size_t i = 0; i < js_typedarray_classes_len; i++) {
+      if (js__is_intrinsic_class(&env->typedarrays[i], typedarray->value)) {
+        *ptype = js_typedarray_classes[i].type;
 
-      js__on_uncaught_exception(env->context, error);
+        break;
+      }
     }
-
-    return js__error(env);
   }
 
-  if (result == NULL) JS_FreeValue(env->context, value);
-  else {
-    js_value_t *wrapper = malloc(sizeof(js_value_t));
+  if (pdata) {
+    size_t size;
+
+    *pdata = JS_GetArrayBuffer(env->context, &size, arraybuffer) + offset;
+  }
 
-    wrapper->value = value;
+  if (plen) {
+    *plen = byte_len / bytes_per_element;
+  }
 
-    *result = wrapper;
+  if (parraybuffer) {
+    *parraybuffer = js__attach_to_handle_scope(env, env->scope, JS_DupValue(env->context, arraybuffer));
+  }
 
-    js__attach_to_handle_scope(env, env->scope, wrapper);
+  if (poffset) {
+    *poffset = offset;
   }
 
+  JS_FreeValue(env->context, arraybuffer);
+
   return 0;
 }
 
 int
-js_has_element (js_env_t *env, js_value_t *object, uint32_t index, bool *result) {
-  if (JS_HasException(env->context)) return js__error(env);
+js_get_dataview_info (js_env_t *env, js_value_t *dataview, void **pdata, size_t *plen, js_value_t **parraybuffer, size_t *poffset) {
+  // Allow continuing even with a pending exception
 
-  JSAtom atom = JS_NewAtomUInt32(env->context, index);
+  size_t offset;
 
-  env->depth++;
+  JSValue arraybuffer;
 
-  int success = JS_HasProperty(env->context, object->value, atom);
+  if (pdata || poffset) {
+    JSValue value = JS_GetPropertyStr(env->context, dataview->value, "byteOffset");
 
-  JS_FreeAtom(env->context, atom);
+    JS_ToInt64(env->context, (int64_t *) &offset, value);
 
-  if (env->depth == 1) js__on_run_microtasks(env);
+    JS_FreeValue(env->context, value);
+  }
+
+  if (pdata || parraybuffer) {
+    arraybuffer = JS_GetPropertyStr(env->context, dataview->value, "buffer");
+  }
 
-  env->depth--;
+  if (pdata) {
+    size_t size;
 
-  if (success < 0) {
-    if (env->depth == 0) {
+    *pdata = JS_GetArrayBuffer(env->context, &size, arraybuffer) + offset;
+  }
+
+  if (plen) {
+    JSValue value = JS_GetPropertyStr(env->context, dataview->value, "byteLength");
+
+    JS_ToInt64(env->context, (int64_t *) plen, value);
+
+    JS_FreeValue(env->context, value);
+  }
+
+  if (parraybuffer) {
+    *parraybuffer = js__attach_to_handle_scope(env, env->scope, JS_DupValue(env->context, arraybuffer));
+  }
+
+  if (poffset) {
+    *poffset = offset;
+  }
+
+  if (pdata || parraybuffer) {
+    JS_FreeValue(env->context, arraybuffer);
+  }
+
+  return 0;
+}
+
+static inline int
+js__call (js_env_t *env, JSValueConst receiver, JSValueConst function, size_t argc, JSValueConst *argv, bool construct, bool checkpoint, js_value_t **result) {
+  js__enter(env);
+
+  JSValue value;
+
+  if (construct) {
+    value = JS_CallConstructor(env->context, function, argc, argv);
+  } else {
+    value = JS_Call(env->context, function, receiver, argc, argv);
+  }
+
+  if (checkpoint) js__run_microtasks(env);
+  else if (env->depth == 1) js__on_run_microtasks(env);
+
+  js__exit(env);
+
+  if (JS_IsException(value)) {
+    if (checkpoint || env->depth == 0) {
       JSValue error = JS_GetException(env->context);
 
       js__on_uncaught_exception(env->context, error);
@@ -4308,493 +8203,649 @@ js_has_element (js_env_t *env, js_value_t *object, uint32_t index, bool *result)
     return js__error(env);
   }
 
-  if (result) *result = success == 1;
+  if (result == NULL) JS_FreeValue(env->context, value);
+  else {
+    *result = js__attach_to_handle_scope(env, env->scope, value);
+  }
+
+  return 0;
+}
+
+static inline int
+js__call_with_handles (js_env_t *env, JSValueConst receiver, JSValueConst function, size_t argc, js_value_t *const argv[], bool construct, bool checkpoint, js_value_t **result) {
+  // Unwrap the arguments into a stack allocated vector unless there are too
+  // many of them, which is rare.
+  JSValue stack[8];
+
+  JSValue *args = argc <= sizeof(stack) / sizeof(JSValue) ? stack : malloc(argc * sizeof(JSValue));
+
+  for (size_t i = 0; i < argc; i++) {
+    args[i] = argv[i]->value;
+  }
+
+  int err = js__call(env, receiver, function, argc, args, construct, checkpoint, result);
+
+  if (args != stack) free(args);
+
+  return err;
+}
+
+int
+js_call_function (js_env_t *env, js_value_t *recv, js_value_t *function, size_t argc, js_value_t *const argv[], js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  return js__call_with_handles(env, recv->value, function->value, argc, argv, false, false, result);
+}
 
-  return 0;
+int
+js_call_function_with_values (js_env_t *env, js_value_t *recv, js_value_t *function, size_t argc, js_value_t *argv, js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  return js__call(env, recv->value, function->value, argc, (JSValueConst *) argv, false, false, result);
 }
 
 int
-js_set_element (js_env_t *env, js_value_t *object, uint32_t index, js_value_t *value) {
+js_call_function_with_checkpoint (js_env_t *env, js_value_t *receiver, js_value_t *function, size_t argc, js_value_t *const argv[], js_value_t **result) {
   if (JS_HasException(env->context)) return js__error(env);
 
-  env->depth++;
+  return js__call_with_handles(env, receiver->value, function->value, argc, argv, false, true, result);
+}
 
-  int success = JS_SetPropertyUint32(env->context, object->value, index, JS_DupValue(env->context, value->value));
+int
+js_new_instance (js_env_t *env, js_value_t *constructor, size_t argc, js_value_t *const argv[], js_value_t **result) {
+  if (JS_HasException(env->context)) return js__error(env);
 
-  if (env->depth == 1) js__on_run_microtasks(env);
+  return js__call_with_handles(env, JS_UNDEFINED, constructor->value, argc, argv, true, false, result);
+}
+
+static void
+js__init_threadsafe_queue (js_threadsafe_queue_t *queue, size_t limit) {
+  int err;
 
-  env->depth--;
+  size_t capacity = 1;
 
-  if (success < 0) {
-    if (env->depth == 0) {
-      JSValue error = JS_GetException(env->context);
+  while (capacity < (limit ? limit : js_threadsafe_queue_capacity)) capacity <<= 1;
 
-      js__on_uncaught_exception(env->context, error);
-    }
+  queue->slots = malloc(capacity * sizeof(js_threadsafe_queue_slot_t));
+  queue->mask = capacity - 1;
 
-    return js__error(env);
+  for (size_t i = 0; i < capacity; i++) {
+    atomic_init(&queue->slots[i].sequence, i);
   }
 
-  return 0;
-}
-
-int
-js_delete_element (js_env_t *env, js_value_t *object, uint32_t index, bool *result) {
-  if (JS_HasException(env->context)) return js__error(env);
+  atomic_init(&queue->head, 0);
+  queue->tail = 0;
 
-  JSAtom atom = JS_NewAtomUInt32(env->context, index);
+  queue->limit = limit;
+  atomic_init(&queue->len, 0);
 
-  env->depth++;
+  queue->overflow = NULL;
+  queue->overflow_tail = &queue->overflow;
+  atomic_init(&queue->overflowing, false);
 
-  int success = JS_DeleteProperty(env->context, object->value, atom, 0);
+  queue->pending = NULL;
 
-  JS_FreeAtom(env->context, atom);
+  atomic_init(&queue->closed, false);
+  atomic_init(&queue->aborted, false);
 
-  if (env->depth == 1) js__on_run_microtasks(env);
+  atomic_init(&queue->waiting, 0);
 
-  env->depth--;
+  err = uv_mutex_init(&queue->lock);
+  assert(err == 0);
 
-  if (success < 0) {
-    if (env->depth == 0) {
-      JSValue error = JS_GetException(env->context);
+  err = uv_cond_init(&queue->available);
+  assert(err == 0);
 
-      js__on_uncaught_exception(env->context, error);
-    }
+  err = uv_cond_init(&queue->drained);
+  assert(err == 0);
+}
 
-    return js__error(env);
+static void
+js__destroy_threadsafe_queue (js_threadsafe_queue_t *queue) {
+  // Producers woken up by closing the queue, and the thread that closed it,
+  // may still be on their way out of the lock. Wait for the last of them to
+  // leave before tearing it down.
+  uv_mutex_lock(&queue->lock);
+
+  while (atomic_load(&queue->waiting) > 0) {
+    uv_cond_wait(&queue->drained, &queue->lock);
   }
 
-  if (result) *result = success == 1;
+  uv_mutex_unlock(&queue->lock);
 
-  return 0;
-}
+  js_threadsafe_queue_node_t *lists[2] = {queue->pending, queue->overflow};
 
-int
-js_get_callback_info (js_env_t *env, const js_callback_info_t *info, size_t *argc, js_value_t *argv[], js_value_t **receiver, void **data) {
-  // Allow continuing even with a pending exception
+  for (size_t i = 0; i < 2; i++) {
+    js_threadsafe_queue_node_t *next = lists[i];
+    js_threadsafe_queue_node_t *prev = NULL;
 
-  if (argv) {
-    size_t i = 0, n = info->argc < *argc ? info->argc : *argc;
+    while (next) {
+      prev = next;
+      next = next->next;
 
-    for (; i < n; i++) {
-      js_value_t *wrapper = malloc(sizeof(js_value_t));
+      free(prev);
+    }
+  }
+
+  uv_cond_destroy(&queue->drained);
+  uv_cond_destroy(&queue->available);
+  uv_mutex_destroy(&queue->lock);
 
-      wrapper->value = JS_DupValue(env->context, info->argv[i]);
+  free(queue->slots);
+}
 
-      argv[i] = wrapper;
+static inline bool
+js__push_threadsafe_queue_slot (js_threadsafe_queue_t *queue, void *data) {
+  size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
 
-      js__attach_to_handle_scope(env, env->scope, wrapper);
-    }
+  for (;;) {
+    js_threadsafe_queue_slot_t *slot = &queue->slots[head & queue->mask];
 
-    n = *argc;
+    size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
 
-    if (i < n) {
-      js_value_t *wrapper = malloc(sizeof(js_value_t));
+    intptr_t diff = (intptr_t) sequence - (intptr_t) head;
 
-      wrapper->value = JS_UNDEFINED;
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&queue->head, &head, head + 1, memory_order_relaxed, memory_order_relaxed)) {
+        slot->data = data;
 
-      js__attach_to_handle_scope(env, env->scope, wrapper);
+        atomic_store_explicit(&slot->sequence, head + 1, memory_order_release);
 
-      for (; i < n; i++) {
-        argv[i] = wrapper;
+        return true;
       }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      head = atomic_load_explicit(&queue->head, memory_order_relaxed);
     }
   }
+}
 
-  if (argc) {
-    *argc = info->argc;
-  }
+static inline bool
+js__pop_threadsafe_queue_slot (js_threadsafe_queue_t *queue, void **result) {
+  js_threadsafe_queue_slot_t *slot = &queue->slots[queue->tail & queue->mask];
 
-  if (receiver) {
-    js_value_t *wrapper = malloc(sizeof(js_value_t));
+  size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
 
-    wrapper->value = JS_DupValue(env->context, info->receiver);
+  if (sequence != queue->tail + 1) return false;
 
-    *receiver = wrapper;
+  *result = slot->data;
 
-    js__attach_to_handle_scope(env, env->scope, wrapper);
-  }
+  atomic_store_explicit(&slot->sequence, queue->tail + queue->mask + 1, memory_order_release);
 
-  if (data) {
-    *data = info->callback->data;
-  }
+  queue->tail++;
 
-  return 0;
+  return true;
 }
 
-int
-js_get_new_target (js_env_t *env, const js_callback_info_t *info, js_value_t **result) {
-  // Allow continuing even with a pending exception
+static inline bool
+js__try_push_threadsafe_queue (js_threadsafe_queue_t *queue, void *data) {
+  if (queue->limit) {
+    if (atomic_fetch_add(&queue->len, 1) >= queue->limit) {
+      atomic_fetch_sub(&queue->len, 1);
+
+      return false;
+    }
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
+    // The ring is at least as large as the limit, so claiming a place in the
+    // queue guarantees a free slot.
+    bool success = js__push_threadsafe_queue_slot(queue, data);
+    assert(success);
 
-  wrapper->value = JS_DupValue(env->context, info->new_target);
+    return true;
+  }
 
-  *result = wrapper;
+  if (!atomic_load(&queue->overflowing) && js__push_threadsafe_queue_slot(queue, data)) {
+    return true;
+  }
 
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  js_threadsafe_queue_node_t *node = malloc(sizeof(js_threadsafe_queue_node_t));
 
-  return 0;
-}
+  node->data = data;
+  node->next = NULL;
 
-int
-js_get_arraybuffer_info (js_env_t *env, js_value_t *arraybuffer, void **pdata, size_t *plen) {
-  // Allow continuing even with a pending exception
+  uv_mutex_lock(&queue->lock);
 
-  size_t len;
+  *queue->overflow_tail = node;
 
-  uint8_t *data = JS_GetArrayBuffer(env->context, &len, arraybuffer->value);
+  queue->overflow_tail = &node->next;
 
-  if (pdata) {
-    *pdata = data;
-  }
+  atomic_store(&queue->overflowing, true);
 
-  if (plen) {
-    *plen = len;
-  }
+  uv_mutex_unlock(&queue->lock);
 
-  return 0;
+  return true;
 }
 
-int
-js_get_sharedarraybuffer_info (js_env_t *env, js_value_t *sharedarraybuffer, void **pdata, size_t *plen) {
-  // Allow continuing even with a pending exception
+static bool
+js__push_threadsafe_queue (js_threadsafe_queue_t *queue, void *data, js_threadsafe_function_call_mode_t mode) {
+  if (atomic_load(&queue->closed)) return false;
 
-  size_t len;
+  if (js__try_push_threadsafe_queue(queue, data)) return true;
 
-  uint8_t *data = JS_GetArrayBuffer(env->context, &len, sharedarraybuffer->value);
+  if (mode == js_threadsafe_function_nonblocking) return false;
 
-  if (pdata) {
-    *pdata = data;
-  }
+  uv_mutex_lock(&queue->lock);
 
-  if (plen) {
-    *plen = len;
-  }
+  atomic_fetch_add(&queue->waiting, 1);
 
-  return 0;
-}
+  bool success;
 
-int
-js_get_typedarray_info (js_env_t *env, js_value_t *typedarray, js_typedarray_type_t *ptype, void **pdata, size_t *plen, js_value_t **parraybuffer, size_t *poffset) {
-  // Allow continuing even with a pending exception
+  for (;;) {
+    if (atomic_load(&queue->closed)) {
+      success = false;
+      break;
+    }
 
-  size_t offset, byte_len, bytes_per_element;
+    if (js__try_push_threadsafe_queue(queue, data)) {
+      success = true;
+      break;
+    }
 
-  JSValue arraybuffer = JS_GetTypedArrayBuffer(env->context, typedarray->value, &offset, &byte_len, &bytes_per_element);
+    uv_cond_wait(&queue->available, &queue->lock);
+  }
 
-  if (ptype) {
-    JSValue global = JS_GetGlobalObject(env->context);
-
-#define V(class, type) \
-  { \
-    JSValue constructor = JS_GetPropertyStr(env->context, global, class); \
-\
-    if (JS_IsInstanceOf(env->context, typedarray->value, constructor)) { \
-      *ptype = type; \
-\
-      JS_FreeValue(env->context, constructor); \
-\
-      goto done; \
-    } \
-\
-    JS_FreeValue(env->context, constructor); \
-  }
-
-    V("Int8Array", js_int8array);
-    V("Uint8Array", js_uint8array);
-    V("Uint8ClampedArray", js_uint8clampedarray);
-    V("Int16Array", js_int16_array);
-    V("Uint16Array", js_uint16array);
-    V("Int32Array", js_int32array);
-    V("Uint32Array", js_uint32array);
-    V("Float32Array", js_float32array);
-    V("Float64Array", js_float64array);
-    V("BigInt64Array", js_bigint64array);
-    V("BigUint64Array", js_biguint64array);
-#undef V
-
-  done:
-    JS_FreeValue(env->context, global);
+  if (atomic_fetch_sub(&queue->waiting, 1) == 1) {
+    uv_cond_signal(&queue->drained);
   }
 
-  if (pdata) {
-    size_t size;
+  uv_mutex_unlock(&queue->lock);
 
-    *pdata = JS_GetArrayBuffer(env->context, &size, arraybuffer) + offset;
-  }
+  return success;
+}
 
-  if (plen) {
-    *plen = byte_len / bytes_per_element;
-  }
+static bool
+js__pop_threadsafe_queue (js_threadsafe_queue_t *queue, void **result) {
+  if (queue->pending == NULL) {
+    if (js__pop_threadsafe_queue_slot(queue, result)) {
+      if (queue->limit) atomic_fetch_sub(&queue->len, 1);
 
-  if (parraybuffer) {
-    js_value_t *wrapper = malloc(sizeof(js_value_t));
+      return true;
+    }
 
-    wrapper->value = JS_DupValue(env->context, arraybuffer);
+    if (!atomic_load(&queue->overflowing)) return false;
 
-    *parraybuffer = wrapper;
+    uv_mutex_lock(&queue->lock);
 
-    js__attach_to_handle_scope(env, env->scope, wrapper);
-  }
+    queue->pending = queue->overflow;
 
-  if (poffset) {
-    *poffset = offset;
-  }
+    queue->overflow = NULL;
+    queue->overflow_tail = &queue->overflow;
 
-  JS_FreeValue(env->context, arraybuffer);
+    atomic_store(&queue->overflowing, false);
 
-  return 0;
-}
+    uv_mutex_unlock(&queue->lock);
 
-int
-js_get_dataview_info (js_env_t *env, js_value_t *dataview, void **pdata, size_t *plen, js_value_t **parraybuffer, size_t *poffset) {
-  // Allow continuing even with a pending exception
+    if (queue->pending == NULL) return false;
+  }
 
-  size_t offset;
+  js_threadsafe_queue_node_t *node = queue->pending;
 
-  JSValue arraybuffer;
+  queue->pending = node->next;
 
-  if (pdata || poffset) {
-    JSValue value = JS_GetPropertyStr(env->context, dataview->value, "byteOffset");
+  *result = node->data;
 
-    JS_ToInt64(env->context, (int64_t *) &offset, value);
+  free(node);
 
-    JS_FreeValue(env->context, value);
-  }
+  return true;
+}
 
-  if (pdata || parraybuffer) {
-    arraybuffer = JS_GetPropertyStr(env->context, dataview->value, "buffer");
-  }
+static void
+js__wake_threadsafe_queue (js_threadsafe_queue_t *queue) {
+  if (atomic_load(&queue->waiting) == 0) return;
 
-  if (pdata) {
-    size_t size;
+  uv_mutex_lock(&queue->lock);
 
-    *pdata = JS_GetArrayBuffer(env->context, &size, arraybuffer) + offset;
-  }
+  uv_cond_broadcast(&queue->available);
 
-  if (plen) {
-    JSValue value = JS_GetPropertyStr(env->context, dataview->value, "byteLength");
+  uv_mutex_unlock(&queue->lock);
+}
 
-    JS_ToInt64(env->context, (int64_t *) plen, value);
+static inline void
+js__signal_threadsafe_function (js_threadsafe_function_t *function) {
+  int err;
 
-    JS_FreeValue(env->context, value);
+  if (atomic_exchange(&function->state, js_threadsafe_function_pending) == js_threadsafe_function_idle) {
+    err = uv_async_send(&function->async);
+    assert(err == 0);
   }
+}
 
-  if (parraybuffer) {
-    js_value_t *wrapper = malloc(sizeof(js_value_t));
+static void
+js__finalize_threadsafe_function (js_threadsafe_function_t *function) {
+  int err;
 
-    wrapper->value = JS_DupValue(env->context, arraybuffer);
+  js_env_t *env = function->env;
 
-    *parraybuffer = wrapper;
+  if (function->prev) function->prev->next = function->next;
+  else env->threadsafe_functions = function->next;
 
-    js__attach_to_handle_scope(env, env->scope, wrapper);
-  }
+  if (function->next) function->next->prev = function->prev;
 
-  if (poffset) {
-    *poffset = offset;
-  }
+  if (function->finalize_cb) {
+    js_handle_scope_t *scope;
+    err = js_open_handle_scope(env, &scope);
+    assert(err == 0);
 
-  if (pdata || parraybuffer) {
-    JS_FreeValue(env->context, arraybuffer);
+    function->finalize_cb(env, function->context, function->finalize_hint);
+
+    err = js_close_handle_scope(env, scope);
+    assert(err == 0);
   }
 
-  return 0;
-}
+  JS_FreeValue(env->context, function->function);
 
-int
-js_call_function (js_env_t *env, js_value_t *recv, js_value_t *function, size_t argc, js_value_t *const argv[], js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
+  function->finalized = true;
+}
 
-  JSValue *args = malloc(argc * sizeof(JSValue));
+static void
+js__on_threadsafe_function_close (uv_handle_t *handle) {
+  js_threadsafe_function_t *function = (js_threadsafe_function_t *) handle->data;
 
-  for (size_t i = 0; i < argc; i++) {
-    args[i] = argv[i]->value;
-  }
+  js_env_t *env = function->env;
 
-  env->depth++;
+  // Functions closed during teardown were finalized while the env was still
+  // intact, and keep the env alive until their handle is closed.
+  bool teardown = function->finalized;
 
-  JSValue value = JS_Call(env->context, function->value, recv->value, argc, args);
+  if (!teardown) js__finalize_threadsafe_function(function);
 
-  free(args);
+  js__destroy_threadsafe_queue(&function->queue);
 
-  if (env->depth == 1) js__on_run_microtasks(env);
+  free(function);
 
-  env->depth--;
+  if (teardown && --env->active_handles == 0) free(env);
+}
 
-  if (JS_IsException(value)) {
-    if (env->depth == 0) {
-      JSValue error = JS_GetException(env->context);
+static inline void
+js__call_threadsafe_function (js_threadsafe_function_t *function, void *data) {
+  int err;
 
-      js__on_uncaught_exception(env->context, error);
-    }
+  js_env_t *env = function->env;
 
-    return js__error(env);
-  }
+  js_handle_scope_t *scope;
+  err = js_open_handle_scope(env, &scope);
+  assert(err == 0);
 
-  if (result == NULL) JS_FreeValue(env->context, value);
-  else {
-    js_value_t *wrapper = malloc(sizeof(js_value_t));
+  js_value_t *callback = JS_IsUndefined(function->function) ? NULL : &(js_value_t) {function->function};
 
-    wrapper->value = value;
+  if (function->cb) {
+    function->cb(env, callback, function->context, data);
+  } else if (callback) {
+    js_call_function(env, &(js_value_t) {JS_UNDEFINED}, callback, 0, NULL, NULL);
+  }
 
-    *result = wrapper;
+  if (JS_HasException(env->context)) {
+    JSValue error = JS_GetException(env->context);
 
-    js__attach_to_handle_scope(env, env->scope, wrapper);
+    js__on_uncaught_exception(env->context, error);
   }
 
-  return 0;
+  err = js_close_handle_scope(env, scope);
+  assert(err == 0);
 }
 
-int
-js_call_function_with_checkpoint (js_env_t *env, js_value_t *receiver, js_value_t *function, size_t argc, js_value_t *const argv[], js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
+static void
+js__on_threadsafe_function_async (uv_async_t *handle) {
+  int err;
 
-  JSValue *args = malloc(argc * sizeof(JSValue));
+  js_threadsafe_function_t *function = (js_threadsafe_function_t *) handle->data;
 
-  for (size_t i = 0; i < argc; i++) {
-    args[i] = argv[i]->value;
-  }
+  js_threadsafe_queue_t *queue = &function->queue;
 
-  env->depth++;
+  atomic_store(&function->state, js_threadsafe_function_running);
 
-  JSValue value = JS_Call(env->context, function->value, receiver->value, argc, args);
+  size_t len = 0;
 
-  free(args);
+  void *data;
 
-  js__on_run_microtasks(env);
+  while (len < js_threadsafe_function_batch_len && !atomic_load(&queue->aborted) && js__pop_threadsafe_queue(queue, &data)) {
+    js__call_threadsafe_function(function, data);
 
-  env->depth--;
+    len++;
+  }
 
-  if (JS_IsException(value)) {
-    JSValue error = JS_GetException(env->context);
+  if (len) js__wake_threadsafe_queue(queue);
 
-    js__on_uncaught_exception(env->context, error);
+  if (atomic_load(&queue->closed) && (atomic_load(&queue->aborted) || len < js_threadsafe_function_batch_len)) {
+    uv_close((uv_handle_t *) handle, js__on_threadsafe_function_close);
 
-    return js__error(env);
+    return;
   }
 
-  if (result == NULL) JS_FreeValue(env->context, value);
-  else {
-    js_value_t *wrapper = malloc(sizeof(js_value_t));
+  int expected = js_threadsafe_function_running;
+
+  // Stay scheduled if the batch was cut short or if more calls were queued
+  // while draining.
+  if (len == js_threadsafe_function_batch_len || !atomic_compare_exchange_strong(&function->state, &expected, js_threadsafe_function_idle)) {
+    atomic_store(&function->state, js_threadsafe_function_pending);
+
+    err = uv_async_send(handle);
+    assert(err == 0);
+  }
+}
+
+static void
+js__close_threadsafe_function (js_threadsafe_function_t *function, bool abort) {
+  // As soon as the queue is marked as closed the loop may close the function,
+  // but it won't free it until it has taken the lock. Doing all of the work
+  // under the lock therefore makes releasing it the last thing we touch.
+  uv_mutex_lock(&function->queue.lock);
 
-    wrapper->value = value;
+  if (abort) atomic_store(&function->queue.aborted, true);
 
-    *result = wrapper;
+  if (!atomic_exchange(&function->queue.closed, true)) {
+    uv_cond_broadcast(&function->queue.available);
 
-    js__attach_to_handle_scope(env, env->scope, wrapper);
+    js__signal_threadsafe_function(function);
   }
 
-  return 0;
+  uv_mutex_unlock(&function->queue.lock);
 }
 
-int
-js_new_instance (js_env_t *env, js_value_t *constructor, size_t argc, js_value_t *const argv[], js_value_t **result) {
-  if (JS_HasException(env->context)) return js__error(env);
+static void
+js__close_threadsafe_functions (js_env_t *env) {
+  // Functions that are still open, such as unreferenced ones that never got
+  // released, are aborted and finalized while the env is still intact. Their
+  // handles are closed in the background.
+  while (env->threadsafe_functions) {
+    js_threadsafe_function_t *function = env->threadsafe_functions;
 
-  JSValue *args = malloc(argc * sizeof(JSValue));
+    js__close_threadsafe_function(function, true);
 
-  for (size_t i = 0; i < argc; i++) {
-    args[i] = argv[i]->value;
-  }
+    js__finalize_threadsafe_function(function);
 
-  env->depth++;
+    if (!uv_is_closing((uv_handle_t *) &function->async)) {
+      uv_close((uv_handle_t *) &function->async, js__on_threadsafe_function_close);
+    }
 
-  JSValue value = JS_CallConstructor(env->context, constructor->value, argc, args);
+    env->active_handles++;
+  }
+}
 
-  free(args);
+int
+js_create_threadsafe_function (js_env_t *env, js_value_t *function, size_t queue_limit, size_t initial_thread_count, js_finalize_cb finalize_cb, void *finalize_hint, void *context, js_threadsafe_function_cb cb, js_threadsafe_function_t **result) {
+  // Allow continuing even with a pending exception
 
-  env->depth--;
+  int err;
 
-  if (JS_IsException(value)) {
-    if (env->depth == 0) {
-      JSValue error = JS_GetException(env->context);
+  js_threadsafe_function_t *threadsafe_function = malloc(sizeof(js_threadsafe_function_t));
 
-      js__on_uncaught_exception(env->context, error);
-    }
+  threadsafe_function->function = function ? JS_DupValue(env->context, function->value) : JS_UNDEFINED;
+  threadsafe_function->env = env;
+  threadsafe_function->context = context;
+  threadsafe_function->finalize_cb = finalize_cb;
+  threadsafe_function->finalize_hint = finalize_hint;
+  threadsafe_function->cb = cb;
+  threadsafe_function->finalized = false;
+  threadsafe_function->prev = NULL;
+  threadsafe_function->next = env->threadsafe_functions;
 
-    return js__error(env);
-  }
+  if (env->threadsafe_functions) env->threadsafe_functions->prev = threadsafe_function;
 
-  if (result == NULL) JS_FreeValue(env->context, value);
-  else {
-    js_value_t *wrapper = malloc(sizeof(js_value_t));
+  env->threadsafe_functions = threadsafe_function;
 
-    wrapper->value = value;
+  atomic_init(&threadsafe_function->state, js_threadsafe_function_idle);
+  atomic_init(&threadsafe_function->thread_count, initial_thread_count);
 
-    *result = wrapper;
+  js__init_threadsafe_queue(&threadsafe_function->queue, queue_limit);
 
-    js__attach_to_handle_scope(env, env->scope, wrapper);
-  }
+  err = uv_async_init(env->loop, &threadsafe_function->async, js__on_threadsafe_function_async);
+  assert(err == 0);
 
-  return 0;
-}
+  threadsafe_function->async.data = (void *) threadsafe_function;
 
-int
-js_create_threadsafe_function (js_env_t *env, js_value_t *function, size_t queue_limit, size_t initial_thread_count, js_finalize_cb finalize_cb, void *finalize_hint, void *context, js_threadsafe_function_cb cb, js_threadsafe_function_t **result) {
-  js_throw_error(env, NULL, "Unsupported operation");
+  *result = threadsafe_function;
 
-  return js__error(env);
+  return 0;
 }
 
 int
 js_get_threadsafe_function_context (js_threadsafe_function_t *function, void **result) {
-  return -1;
+  *result = function->context;
+
+  return 0;
 }
 
 int
 js_call_threadsafe_function (js_threadsafe_function_t *function, void *data, js_threadsafe_function_call_mode_t mode) {
-  return -1;
+  if (!js__push_threadsafe_queue(&function->queue, data, mode)) return -1;
+
+  js__signal_threadsafe_function(function);
+
+  return 0;
 }
 
 int
 js_acquire_threadsafe_function (js_threadsafe_function_t *function) {
-  return -1;
+  if (atomic_load(&function->queue.closed)) return -1;
+
+  atomic_fetch_add(&function->thread_count, 1);
+
+  return 0;
 }
 
 int
 js_release_threadsafe_function (js_threadsafe_function_t *function, js_threadsafe_function_release_mode_t mode) {
-  return -1;
+  if (atomic_load(&function->queue.closed)) return -1;
+
+  int remaining = atomic_fetch_sub(&function->thread_count, 1) - 1;
+
+  if (remaining <= 0 || mode == js_threadsafe_function_abort) {
+    js__close_threadsafe_function(function, mode == js_threadsafe_function_abort);
+  }
+
+  return 0;
 }
 
 int
 js_ref_threadsafe_function (js_env_t *env, js_threadsafe_function_t *function) {
-  js_throw_error(env, NULL, "Unsupported operation");
+  // Allow continuing even with a pending exception
 
-  return js__error(env);
+  uv_ref((uv_handle_t *) &function->async);
+
+  return 0;
 }
 
 int
 js_unref_threadsafe_function (js_env_t *env, js_threadsafe_function_t *function) {
-  js_throw_error(env, NULL, "Unsupported operation");
+  // Allow continuing even with a pending exception
 
-  return js__error(env);
+  uv_unref((uv_handle_t *) &function->async);
+
+  return 0;
 }
 
 int
 js_add_teardown_callback (js_env_t *env, js_teardown_cb callback, void *data) {
-  js_throw_error(env, NULL, "Unsupported operation");
+  // Allow continuing even with a pending exception
 
-  return js__error(env);
+  js_teardown_task_t *task = malloc(sizeof(js_teardown_task_t));
+
+  task->deferred = false;
+  task->callback = callback;
+  task->deferred_callback = NULL;
+  task->data = data;
+  task->next = env->teardown.tasks;
+
+  env->teardown.tasks = task;
+
+  return 0;
 }
 
 int
 js_remove_teardown_callback (js_env_t *env, js_teardown_cb callback, void *data) {
-  js_throw_error(env, NULL, "Unsupported operation");
+  // Allow continuing even with a pending exception
 
-  return js__error(env);
+  js_teardown_task_t **next = &env->teardown.tasks;
+
+  while (*next) {
+    js_teardown_task_t *task = *next;
+
+    if (!task->deferred && task->callback == callback && task->data == data) {
+      *next = task->next;
+
+      free(task);
+
+      break;
+    }
+
+    next = &task->next;
+  }
+
+  return 0;
 }
 
 int
 js_add_deferred_teardown_callback (js_env_t *env, js_deferred_teardown_cb callback, void *data, js_deferred_teardown_t **result) {
-  js_throw_error(env, NULL, "Unsupported operation");
+  // Allow continuing even with a pending exception
 
-  return js__error(env);
+  js_teardown_task_t *task = malloc(sizeof(js_teardown_task_t));
+
+  task->deferred = true;
+  task->callback = NULL;
+  task->deferred_callback = callback;
+  task->data = data;
+  task->handle.env = env;
+  task->handle.task = task;
+  task->next = env->teardown.tasks;
+
+  env->teardown.tasks = task;
+
+  if (result) *result = &task->handle;
+
+  return 0;
 }
 
 int
 js_finish_deferred_teardown_callback (js_deferred_teardown_t *handle) {
-  return -1;
+  js_env_t *env = handle->env;
+
+  js_teardown_task_t *task = handle->task;
+
+  // Finishing a deferred teardown before the env is destroyed simply removes
+  // it from the registry.
+  if (!env->teardown.destroying) {
+    js_teardown_task_t **next = &env->teardown.tasks;
+
+    while (*next && *next != task) next = &(*next)->next;
+
+    if (*next == NULL) return -1;
+
+    *next = task->next;
+
+    free(task);
+
+    return 0;
+  }
+
+  free(task);
+
+  if (env->teardown.pending == 0) return -1;
+
+  if (--env->teardown.pending == 0 && !env->teardown.running) js__destroy_env(env);
+
+  return 0;
 }
 int
 js_throw (js_env_t *env, js_value_t *error) {
@@ -5057,13 +9108,7 @@ js_get_and_clear_last_exception (js_env_t *env, js_value_t **result) {
 
   if (JS_IsUninitialized(error)) return js_get_undefined(env, result);
 
-  js_value_t *wrapper = malloc(sizeof(js_value_t));
-
-  wrapper->value = error;
-
-  *result = wrapper;
-
-  js__attach_to_handle_scope(env, env->scope, wrapper);
+  *result = js__attach_to_handle_scope(env, env->scope, error);
 
   return 0;
 }
@@ -5092,11 +9137,327 @@ js_terminate_execution (js_env_t *env) {
   return 0;
 }
 
+int
+js_get_runtime_statistics (js_env_t *env, js_runtime_statistics_t *result) {
+  // Allow continuing even with a pending exception
+
+  JSMemoryUsage usage;
+
+  JS_ComputeMemoryUsage(env->runtime, &usage);
+
+  result->malloc_size = usage.malloc_size;
+  result->malloc_limit = usage.malloc_limit;
+  result->malloc_count = usage.malloc_count;
+  result->memory_used_size = usage.memory_used_size;
+  result->memory_used_count = usage.memory_used_count;
+  result->atom_count = usage.atom_count;
+  result->atom_size = usage.atom_size;
+  result->string_count = usage.str_count;
+  result->string_size = usage.str_size;
+  result->object_count = usage.obj_count;
+  result->object_size = usage.obj_size;
+  result->property_count = usage.prop_count;
+  result->property_size = usage.prop_size;
+  result->shape_count = usage.shape_count;
+  result->shape_size = usage.shape_size;
+  result->function_count = usage.js_func_count;
+  result->function_size = usage.js_func_size;
+  result->bytecode_size = usage.js_func_code_size;
+  result->native_function_count = usage.c_func_count;
+  result->array_count = usage.array_count;
+  result->fast_array_count = usage.fast_array_count;
+  result->fast_array_elements = usage.fast_array_elements;
+  result->binary_object_count = usage.binary_object_count;
+  result->binary_object_size = usage.binary_object_size;
+
+  result->allocations = env->heap->allocations;
+
+  result->external_memory = env->external_memory;
+  result->mapped_memory = env->mapped_memory;
+
+  result->handle_scope_depth = env->handles.depth;
+  result->peak_handle_scope_depth = env->handles.peak_depth;
+  result->handles = env->handles.len;
+  result->peak_handles = env->handles.peak_len;
+
+  result->gc_count = env->gc.count;
+  result->gc_time = env->gc.time;
+
+  result->microtask_drains = env->microtasks.drains;
+  result->microtasks = env->microtasks.jobs;
+
+  js_platform_t *platform = env->platform;
+
+  uv_mutex_lock(&platform->scripts.lock);
+
+  result->script_cache_size = platform->scripts.len;
+  result->script_cache_hits = platform->scripts.hits;
+
+  uv_mutex_unlock(&platform->scripts.lock);
+
+  return 0;
+}
+
+int
+js_set_trace_callback (js_env_t *env, js_trace_cb cb, void *data) {
+  // Allow continuing even with a pending exception
+
+  env->trace.cb = cb;
+  env->trace.data = data;
+
+  return 0;
+}
+
+int
+js_start_profile (js_env_t *env, uint64_t interval) {
+  // Allow continuing even with a pending exception
+
+  int err;
+
+  if (env->profiler) {
+    js_throw_error(env, NULL, "Profiler is already running");
+
+    return js__error(env);
+  }
+
+  js_profiler_t *profiler = malloc(sizeof(js_profiler_t));
+
+  profiler->stopping = false;
+  profiler->interval = (interval ? interval : 1000) * 1000;
+  profiler->start = uv_hrtime();
+
+  atomic_init(&profiler->pending, false);
+
+  profiler->nodes_len = 1;
+  profiler->nodes_capacity = 64;
+  profiler->nodes = malloc(profiler->nodes_capacity * sizeof(js_profile_node_t));
+
+  profiler->nodes[0] = (js_profile_node_t) {
+    .function_name = strdup("(root)"),
+    .url = strdup(""),
+    .line = -1,
+  };
+
+  profiler->samples_len = 0;
+  profiler->samples_capacity = 1024;
+  profiler->samples = malloc(profiler->samples_capacity * sizeof(uint32_t));
+  profiler->timestamps = malloc(profiler->samples_capacity * sizeof(uint64_t));
+
+  err = uv_mutex_init(&profiler->lock);
+  assert(err == 0);
+
+  err = uv_cond_init(&profiler->wake);
+  assert(err == 0);
+
+  err = uv_thread_create(&profiler->thread, js__on_profiler_thread, profiler);
+  assert(err == 0);
+
+  env->profiler = profiler;
+
+  return 0;
+}
+
+static void
+js__write_profile (js_profile_buffer_t *buffer, const char *format, ...) {
+  va_list args;
+
+  while (true) {
+    va_start(args, format);
+    int len = vsnprintf(buffer->data + buffer->len, buffer->capacity - buffer->len, format, args);
+    va_end(args);
+
+    if ((size_t) len < buffer->capacity - buffer->len) {
+      buffer->len += len;
+
+      return;
+    }
+
+    buffer->capacity = buffer->capacity * 2 + len;
+    buffer->data = realloc(buffer->data, buffer->capacity);
+  }
+}
+
+static void
+js__write_profile_string (js_profile_buffer_t *buffer, const char *str) {
+  js__write_profile(buffer, "\"");
+
+  for (const char *c = str; *c; c++) {
+    if (*c == '"' || *c == '\\') js__write_profile(buffer, "\\%c", *c);
+    else if ((unsigned char) *c < 0x20) js__write_profile(buffer, "\\u%04x", *c);
+    else js__write_profile(buffer, "%c", *c);
+  }
+
+  js__write_profile(buffer, "\"");
+}
+
+int
+js_stop_profile (js_env_t *env, char **result, size_t *len) {
+  // Allow continuing even with a pending exception
+
+  js_profiler_t *profiler = env->profiler;
+
+  if (profiler == NULL) {
+    js_throw_error(env, NULL, "Profiler is not running");
+
+    return js__error(env);
+  }
+
+  env->profiler = NULL;
+
+  uint64_t end = uv_hrtime();
+
+  js_profile_buffer_t buffer = {
+    .data = malloc(4096),
+    .len = 0,
+    .capacity = 4096,
+  };
+
+  // Write the profile in the format of the `Profile` type of the Chrome
+  // DevTools protocol, as used by `.cpuprofile` files, with times given in
+  // microseconds.
+  js__write_profile(&buffer, "{\"nodes\":[");
+
+  for (size_t i = 0; i < profiler->nodes_len; i++) {
+    js_profile_node_t *node = &profiler->nodes[i];
+
+    if (i != 0) js__write_profile(&buffer, ",");
+
+    js__write_profile(&buffer, "{\"id\":%zu,\"callFrame\":{\"functionName\":", i + 1);
+    js__write_profile_string(&buffer, node->function_name);
+    js__write_profile(&buffer, ",\"scriptId\":\"0\",\"url\":");
+    js__write_profile_string(&buffer, node->url);
+    js__write_profile(&buffer, ",\"lineNumber\":%d,\"columnNumber\":-1},\"hitCount\":%u,\"children\":[", node->line, node->hits);
+
+    for (uint32_t child = node->child; child; child = profiler->nodes[child].sibling) {
+      js__write_profile(&buffer, child == node->child ? "%u" : ",%u", child + 1);
+    }
+
+    js__write_profile(&buffer, "]}");
+  }
+
+  js__write_profile(&buffer, "],\"startTime\":%" PRIu64 ",\"endTime\":%" PRIu64 ",\"samples\":[", profiler->start / 1000, end / 1000);
+
+  for (size_t i = 0; i < profiler->samples_len; i++) {
+    js__write_profile(&buffer, i == 0 ? "%u" : ",%u", profiler->samples[i] + 1);
+  }
+
+  js__write_profile(&buffer, "],\"timeDeltas\":[");
+
+  uint64_t last = profiler->start;
+
+  for (size_t i = 0; i < profiler->samples_len; i++) {
+    js__write_profile(&buffer, i == 0 ? "%" PRIu64 : ",%" PRIu64, (profiler->timestamps[i] - last) / 1000);
+
+    last = profiler->timestamps[i];
+  }
+
+  js__write_profile(&buffer, "]}");
+
+  js__free_profiler(profiler);
+
+  *result = buffer.data;
+
+  if (len) *len = buffer.len;
+
+  return 0;
+}
+
+int
+js_request_termination (js_env_t *env) {
+  // Allow continuing even with a pending exception
+
+  atomic_store_explicit(&env->execution.terminate, true, memory_order_release);
+
+  return 0;
+}
+
+int
+js_set_execution_timeout (js_env_t *env, uint64_t timeout) {
+  // Allow continuing even with a pending exception
+
+  env->execution.timeout = timeout * 1000000;
+
+  // When called from within JavaScript, the timeout also applies to the rest
+  // of the current entry.
+  if (env->depth > 0) {
+    env->execution.deadline = timeout ? uv_hrtime() + env->execution.timeout : 0;
+  }
+
+  return 0;
+}
+
+int
+js_set_execution_budget (js_env_t *env, uint64_t budget) {
+  // Allow continuing even with a pending exception
+
+  env->execution.budget = budget;
+
+  if (env->depth > 0) env->execution.remaining = budget;
+
+  return 0;
+}
+
+int
+js_set_microtask_policy (js_env_t *env, js_microtask_policy_t policy) {
+  // Allow continuing even with a pending exception
+
+  env->microtasks.policy = policy;
+
+  return 0;
+}
+
+int
+js_set_microtask_budget (js_env_t *env, size_t budget) {
+  // Allow continuing even with a pending exception
+
+  env->microtasks.budget = budget;
+
+  return 0;
+}
+
+int
+js_perform_microtask_checkpoint (js_env_t *env) {
+  if (JS_HasException(env->context)) return js__error(env);
+
+  if (env->depth > 0) return 0;
+
+  js__enter(env);
+
+  js__run_microtasks(env);
+
+  js__exit(env);
+
+  return 0;
+}
+
+int
+js_set_idle_garbage_collection (js_env_t *env, uint64_t budget, uint64_t interval) {
+  // Allow continuing even with a pending exception
+
+  env->gc.idle_budget = budget;
+  env->gc.idle_interval = interval;
+
+  return 0;
+}
+
+int
+js_set_external_memory_watermarks (js_env_t *env, int64_t low, int64_t high) {
+  // Allow continuing even with a pending exception
+
+  env->gc.low = low;
+  env->gc.high = high > low ? high : low;
+  env->gc.trigger = env->gc.high;
+
+  js__adjust_external_memory(env, 0);
+
+  return 0;
+}
+
 int
 js_adjust_external_memory (js_env_t *env, int64_t change_in_bytes, int64_t *result) {
   // Allow continuing even with a pending exception
 
-  env->external_memory += change_in_bytes;
+  js__adjust_external_memory(env, change_in_bytes);
 
   if (result) *result = env->external_memory;
 
@@ -5108,7 +9469,7 @@ js_request_garbage_collection (js_env_t *env) {
   // Allow continuing even with a pending exception
 
   if (env->platform->options.expose_garbage_collection) {
-    JS_RunGC(env->runtime);
+    js__run_gc(env);
   }
 
   return 0;
@@ -5154,21 +9515,47 @@ js_send_inspector_request (js_env_t *env, js_inspector_t *inspector, js_value_t
 
 int
 js_ffi_create_type_info (js_ffi_type_t type, js_ffi_type_info_t **result) {
-  *result = NULL;
+  js_ffi_type_info_t *type_info = malloc(sizeof(js_ffi_type_info_t));
+
+  type_info->type = type;
+
+  *result = type_info;
 
   return 0;
 }
 
 int
 js_ffi_create_function_info (const js_ffi_type_info_t *return_info, js_ffi_type_info_t *const arg_info[], unsigned int arg_len, js_ffi_function_info_t **result) {
-  *result = NULL;
+  js_ffi_function_info_t *function_info = malloc(sizeof(js_ffi_function_info_t) + arg_len * sizeof(js_ffi_type_t));
+
+  // The function info takes ownership of the type infos.
+  function_info->result = return_info->type;
+  function_info->argc = arg_len;
+
+  free((js_ffi_type_info_t *) return_info);
+
+  for (unsigned int i = 0; i < arg_len; i++) {
+    function_info->argv[i] = arg_info[i]->type;
+
+    free(arg_info[i]);
+  }
+
+  *result = function_info;
 
   return 0;
 }
 
 int
 js_ffi_create_function (const void *function, const js_ffi_function_info_t *type_info, js_ffi_function_t **result) {
-  *result = NULL;
+  js_ffi_function_t *ffi = malloc(sizeof(js_ffi_function_t));
+
+  // The function takes ownership of the function info, and is in turn owned
+  // by the JavaScript function it's passed to.
+  ffi->function = function;
+  ffi->type_info = (js_ffi_function_info_t *) type_info;
+  ffi->fast = js__is_ffi_function_fast(type_info);
+
+  *result = ffi;
 
   return 0;
 }
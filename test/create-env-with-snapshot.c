@@ -0,0 +1,136 @@
+#include <assert.h>
+#include <js.h>
+#include <qjs.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <uv.h>
+
+static int32_t
+run (js_env_t *env, const char *source) {
+  int e;
+
+  js_value_t *script;
+  e = js_create_string_utf8(env, (utf8_t *) source, -1, &script);
+  assert(e == 0);
+
+  js_value_t *result;
+  e = js_run_script(env, NULL, 0, 0, script, &result);
+  assert(e == 0);
+
+  int32_t value;
+  e = js_get_value_int32(env, result, &value);
+  assert(e == 0);
+
+  return value;
+}
+
+int
+main () {
+  int e;
+
+  uv_loop_t *loop = uv_default_loop();
+
+  js_platform_t *platform;
+  e = js_create_platform(loop, NULL, &platform);
+  assert(e == 0);
+
+  uint8_t *snapshot;
+  size_t snapshot_len;
+
+  {
+    js_env_t *env;
+    e = js_create_env(loop, platform, NULL, &env);
+    assert(e == 0);
+
+    js_handle_scope_t *scope;
+    e = js_open_handle_scope(env, &scope);
+    assert(e == 0);
+
+    js_value_t *bindings;
+    e = js_get_bindings(env, &bindings);
+    assert(e == 0);
+
+    js_value_t *value;
+    e = js_create_int32(env, 42, &value);
+    assert(e == 0);
+
+    e = js_set_named_property(env, bindings, "answer", value);
+    assert(e == 0);
+
+    js_value_t *source;
+    e = js_create_string_utf8(env, (utf8_t *) "globalThis.booted = (globalThis.booted || 0) + 1", -1, &source);
+    assert(e == 0);
+
+    js_script_t *script;
+    e = js_create_script(env, "bootstrap.js", -1, 0, source, &script);
+    assert(e == 0);
+
+    e = js_create_snapshot(env, &script, 1, &snapshot, &snapshot_len);
+    assert(e == 0);
+
+    // Creating the snapshot doesn't run the bootstrap scripts.
+    assert(run(env, "globalThis.booted || 0") == 0);
+
+    e = js_delete_script(env, script);
+    assert(e == 0);
+
+    e = js_close_handle_scope(env, scope);
+    assert(e == 0);
+
+    e = js_destroy_env(env);
+    assert(e == 0);
+  }
+
+  {
+    js_env_t *env;
+    e = js_create_env_with_snapshot(loop, platform, snapshot, snapshot_len, NULL, &env);
+    assert(e == 0);
+
+    js_handle_scope_t *scope;
+    e = js_open_handle_scope(env, &scope);
+    assert(e == 0);
+
+    // The bindings are restored and the bootstrap scripts run exactly once.
+    js_value_t *bindings;
+    e = js_get_bindings(env, &bindings);
+    assert(e == 0);
+
+    js_value_t *value;
+    e = js_get_named_property(env, bindings, "answer", &value);
+    assert(e == 0);
+
+    int32_t answer;
+    e = js_get_value_int32(env, value, &answer);
+    assert(e == 0);
+
+    assert(answer == 42);
+
+    assert(run(env, "globalThis.booted") == 1);
+
+    e = js_close_handle_scope(env, scope);
+    assert(e == 0);
+
+    e = js_destroy_env(env);
+    assert(e == 0);
+  }
+
+  {
+    // A corrupted or truncated snapshot is refused.
+    snapshot[0] ^= 0xff;
+
+    js_env_t *env;
+    e = js_create_env_with_snapshot(loop, platform, snapshot, snapshot_len, NULL, &env);
+    assert(e != 0);
+
+    e = js_create_env_with_snapshot(loop, platform, snapshot, 1, NULL, &env);
+    assert(e != 0);
+  }
+
+  free(snapshot);
+
+  e = js_destroy_platform(platform);
+  assert(e == 0);
+
+  e = uv_run(loop, UV_RUN_DEFAULT);
+  assert(e == 0);
+}
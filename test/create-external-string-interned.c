@@ -0,0 +1,85 @@
+#include <assert.h>
+#include <js.h>
+#include <qjs.h>
+#include <stdbool.h>
+#include <string.h>
+#include <uv.h>
+
+static int finalize_called = 0;
+
+static void
+on_finalize (js_env_t *env, void *data, void *finalize_hint) {
+  finalize_called++;
+}
+
+int
+main () {
+  int e;
+
+  uv_loop_t *loop = uv_default_loop();
+
+  js_platform_t *platform;
+  e = js_create_platform(loop, NULL, &platform);
+  assert(e == 0);
+
+  js_env_t *env;
+  e = js_create_env(loop, platform, NULL, &env);
+  assert(e == 0);
+
+  js_handle_scope_t *scope;
+  e = js_open_handle_scope(env, &scope);
+  assert(e == 0);
+
+  utf8_t a[] = "hello world";
+  utf8_t b[] = "hello world";
+
+  js_value_t *first;
+  bool copied = false;
+  e = js_create_external_string_utf8(env, a, sizeof(a) - 1, on_finalize, NULL, &first, &copied);
+  assert(e == 0);
+
+  assert(copied);
+  assert(finalize_called == 1);
+
+  // The caller owned memory is released once the call returns.
+  memset(a, 0, sizeof(a));
+
+  js_value_t *second;
+  e = js_create_external_string_utf8(env, b, sizeof(b) - 1, on_finalize, NULL, &second, &copied);
+  assert(e == 0);
+
+  assert(finalize_called == 2);
+
+  bool equals;
+  e = js_strict_equals(env, first, second, &equals);
+  assert(e == 0);
+
+  assert(equals);
+
+  // Both strings share the interned copy of the characters.
+  const void *first_str, *second_str;
+  size_t len;
+
+  e = js_get_value_string_view(env, first, NULL, &first_str, &len);
+  assert(e == 0);
+
+  assert(len == 11);
+  assert(memcmp(first_str, "hello world", len) == 0);
+
+  e = js_get_value_string_view(env, second, NULL, &second_str, NULL);
+  assert(e == 0);
+
+  assert(first_str == second_str);
+
+  e = js_close_handle_scope(env, scope);
+  assert(e == 0);
+
+  e = js_destroy_env(env);
+  assert(e == 0);
+
+  e = js_destroy_platform(platform);
+  assert(e == 0);
+
+  e = uv_run(loop, UV_RUN_DEFAULT);
+  assert(e == 0);
+}
@@ -0,0 +1,147 @@
+#include <assert.h>
+#include <js.h>
+#include <qjs.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <uv.h>
+
+static const char *path = "create-mapped-arraybuffer.bin";
+
+static void
+write_file (const char *data) {
+  FILE *file = fopen(path, "wb");
+  assert(file);
+
+  size_t len = strlen(data);
+  assert(fwrite(data, 1, len, file) == len);
+
+  assert(fclose(file) == 0);
+}
+
+static void
+read_file (char *data, size_t len) {
+  FILE *file = fopen(path, "rb");
+  assert(file);
+
+  assert(fread(data, 1, len, file) == len);
+
+  assert(fclose(file) == 0);
+}
+
+static void
+map (js_env_t *env, size_t offset, size_t len, int flags, void **data, size_t *data_len) {
+  int e;
+
+  js_value_t *arraybuffer;
+  e = js_create_mapped_arraybuffer(env, path, offset, len, flags, js_mapping_advice_normal, &arraybuffer);
+  assert(e == 0);
+
+  e = js_get_arraybuffer_info(env, arraybuffer, data, data_len);
+  assert(e == 0);
+}
+
+static void
+map_out_of_range (js_env_t *env, size_t offset, size_t len) {
+  int e;
+
+  js_value_t *arraybuffer;
+  e = js_create_mapped_arraybuffer(env, path, offset, len, js_mapping_readonly, js_mapping_advice_normal, &arraybuffer);
+  assert(e != 0);
+
+  js_value_t *error;
+  e = js_get_and_clear_last_exception(env, &error);
+  assert(e == 0);
+}
+
+int
+main () {
+  int e;
+
+  write_file("hello world");
+
+  uv_loop_t *loop = uv_default_loop();
+
+  js_platform_options_t options = {
+    .expose_garbage_collection = true,
+  };
+
+  js_platform_t *platform;
+  e = js_create_platform(loop, &options, &platform);
+  assert(e == 0);
+
+  js_env_t *env;
+  e = js_create_env(loop, platform, NULL, &env);
+  assert(e == 0);
+
+  js_handle_scope_t *scope;
+  e = js_open_handle_scope(env, &scope);
+  assert(e == 0);
+
+  void *data;
+  size_t len;
+
+  // A length of 0 maps the remainder of the file.
+  map(env, 0, 0, js_mapping_readonly, &data, &len);
+
+  assert(len == 11);
+  assert(memcmp(data, "hello world", len) == 0);
+
+  // Offsets need not be aligned to the mapping granularity.
+  map(env, 6, 5, js_mapping_readonly, &data, &len);
+
+  assert(len == 5);
+  assert(memcmp(data, "world", len) == 0);
+
+  // Private mappings copy on write, leaving the file untouched.
+  map(env, 0, 5, js_mapping_private, &data, &len);
+
+  memcpy(data, "HELLO", 5);
+
+  char contents[11];
+  read_file(contents, 11);
+
+  assert(memcmp(contents, "hello world", 11) == 0);
+
+  // Shared mappings carry writes through to the file.
+  map(env, 6, 5, 0, &data, &len);
+
+  memcpy(data, "WORLD", 5);
+
+  read_file(contents, 11);
+
+  assert(memcmp(contents, "hello WORLD", 11) == 0);
+
+  map_out_of_range(env, 12, 0);
+  map_out_of_range(env, 6, 6);
+  map_out_of_range(env, 0, 12);
+
+  js_runtime_statistics_t statistics = {.version = 0};
+  e = js_get_runtime_statistics(env, &statistics);
+  assert(e == 0);
+
+  // Unaligned mappings also count the bytes preceding the offset.
+  assert(statistics.mapped_memory == 11 + 11 + 5 + 11);
+
+  e = js_close_handle_scope(env, scope);
+  assert(e == 0);
+
+  e = js_request_garbage_collection(env);
+  assert(e == 0);
+
+  e = js_get_runtime_statistics(env, &statistics);
+  assert(e == 0);
+
+  assert(statistics.mapped_memory == 0);
+
+  e = js_destroy_env(env);
+  assert(e == 0);
+
+  e = js_destroy_platform(platform);
+  assert(e == 0);
+
+  e = uv_run(loop, UV_RUN_DEFAULT);
+  assert(e == 0);
+
+  assert(remove(path) == 0);
+}
@@ -0,0 +1,84 @@
+#include <assert.h>
+#include <js.h>
+#include <qjs.h>
+#include <string.h>
+#include <uv.h>
+
+int
+main () {
+  int e;
+
+  uv_loop_t *loop = uv_default_loop();
+
+  js_platform_t *platform;
+  e = js_create_platform(loop, NULL, &platform);
+  assert(e == 0);
+
+  js_env_t *env;
+  e = js_create_env(loop, platform, NULL, &env);
+  assert(e == 0);
+
+  js_handle_scope_t *scope;
+  e = js_open_handle_scope(env, &scope);
+  assert(e == 0);
+
+  js_value_t *script;
+  e = js_create_string_utf8(env, (utf8_t *) "const o = { a: 1, b: 2 }; Object.defineProperty(o, 'c', { value: 3 }); o[Symbol('d')] = 4; o", -1, &script);
+  assert(e == 0);
+
+  js_value_t *object;
+  e = js_run_script(env, NULL, 0, 0, script, &object);
+  assert(e == 0);
+
+  js_property_iterator_t *iterator;
+  e = js_create_property_iterator(env, object, &iterator);
+  assert(e == 0);
+
+  // Keys added after the iterator was created aren't visited.
+  js_value_t *property;
+  e = js_create_int32(env, 5, &property);
+  assert(e == 0);
+
+  e = js_set_named_property(env, object, "e", property);
+  assert(e == 0);
+
+  const char *expected[] = {"a", "b"};
+
+  for (size_t i = 0; i < 2; i++) {
+    js_value_t *name;
+    e = js_get_next_property(env, iterator, &name);
+    assert(e == 0);
+
+    assert(name != NULL);
+
+    utf8_t value[8];
+    e = js_get_value_string_utf8(env, name, value, sizeof(value), NULL);
+    assert(e == 0);
+
+    assert(strcmp((char *) value, expected[i]) == 0);
+  }
+
+  // The iterator stays exhausted once all keys have been visited.
+  for (size_t i = 0; i < 2; i++) {
+    js_value_t *name;
+    e = js_get_next_property(env, iterator, &name);
+    assert(e == 0);
+
+    assert(name == NULL);
+  }
+
+  e = js_destroy_property_iterator(env, iterator);
+  assert(e == 0);
+
+  e = js_close_handle_scope(env, scope);
+  assert(e == 0);
+
+  e = js_destroy_env(env);
+  assert(e == 0);
+
+  e = js_destroy_platform(platform);
+  assert(e == 0);
+
+  e = uv_run(loop, UV_RUN_DEFAULT);
+  assert(e == 0);
+}
@@ -0,0 +1,113 @@
+#include <assert.h>
+#include <js.h>
+#include <qjs.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <uv.h>
+
+int
+main () {
+  int e;
+
+  uv_loop_t *loop = uv_default_loop();
+
+  js_platform_t *platform;
+  e = js_create_platform(loop, NULL, &platform);
+  assert(e == 0);
+
+  js_env_t *env;
+  e = js_create_env(loop, platform, NULL, &env);
+  assert(e == 0);
+
+  js_handle_scope_t *scope;
+  e = js_open_handle_scope(env, &scope);
+  assert(e == 0);
+
+  js_value_t *source;
+  e = js_create_string_utf8(env, (utf8_t *) "globalThis.count = (globalThis.count || 0) + 1", -1, &source);
+  assert(e == 0);
+
+  js_script_t *script;
+  e = js_create_script(env, "test.js", -1, 0, source, &script);
+  assert(e == 0);
+
+  // Compiling doesn't run the script, but it may then be run repeatedly.
+  for (int32_t i = 1; i <= 3; i++) {
+    js_value_t *result;
+    e = js_run_compiled_script(env, script, &result);
+    assert(e == 0);
+
+    int32_t value;
+    e = js_get_value_int32(env, result, &value);
+    assert(e == 0);
+
+    assert(value == i);
+  }
+
+  uint8_t *cache;
+  size_t cache_len;
+  e = js_create_script_cache(env, script, &cache, &cache_len);
+  assert(e == 0);
+
+  assert(cache_len > 0);
+
+  e = js_delete_script(env, script);
+  assert(e == 0);
+
+  // A cache for the same file and source is accepted.
+  bool rejected = true;
+  e = js_create_script_with_cache(env, "test.js", -1, 0, source, cache, cache_len, &rejected, &script);
+  assert(e == 0);
+
+  assert(!rejected);
+
+  js_value_t *result;
+  e = js_run_compiled_script(env, script, &result);
+  assert(e == 0);
+
+  int32_t value;
+  e = js_get_value_int32(env, result, &value);
+  assert(e == 0);
+
+  assert(value == 4);
+
+  e = js_delete_script(env, script);
+  assert(e == 0);
+
+  // A cache for a different source is rejected and the source compiled
+  // instead.
+  js_value_t *other;
+  e = js_create_string_utf8(env, (utf8_t *) "globalThis.count * 10", -1, &other);
+  assert(e == 0);
+
+  e = js_create_script_with_cache(env, "test.js", -1, 0, other, cache, cache_len, &rejected, &script);
+  assert(e == 0);
+
+  assert(rejected);
+
+  e = js_run_compiled_script(env, script, &result);
+  assert(e == 0);
+
+  e = js_get_value_int32(env, result, &value);
+  assert(e == 0);
+
+  assert(value == 40);
+
+  e = js_delete_script(env, script);
+  assert(e == 0);
+
+  free(cache);
+
+  e = js_close_handle_scope(env, scope);
+  assert(e == 0);
+
+  e = js_destroy_env(env);
+  assert(e == 0);
+
+  e = js_destroy_platform(platform);
+  assert(e == 0);
+
+  e = uv_run(loop, UV_RUN_DEFAULT);
+  assert(e == 0);
+}
@@ -0,0 +1,96 @@
+#include <assert.h>
+#include <js.h>
+#include <stdbool.h>
+#include <string.h>
+#include <uv.h>
+
+int
+main () {
+  int e;
+
+  uv_loop_t *loop = uv_default_loop();
+
+  js_platform_t *platform;
+  e = js_create_platform(loop, NULL, &platform);
+  assert(e == 0);
+
+  js_env_t *env;
+  e = js_create_env(loop, platform, NULL, &env);
+  assert(e == 0);
+
+  js_handle_scope_t *scope;
+  e = js_open_handle_scope(env, &scope);
+  assert(e == 0);
+
+  js_value_t *script;
+  e = js_create_string_utf8(env, (utf8_t *) "const o = { a: 1, b: 2 }; Object.defineProperty(o, 'c', { value: 3 }); o[Symbol('d')] = 4; o", -1, &script);
+  assert(e == 0);
+
+  js_value_t *object;
+  e = js_run_script(env, NULL, 0, 0, script, &object);
+  assert(e == 0);
+
+  js_value_t *names;
+  e = js_get_property_names(env, object, &names);
+  assert(e == 0);
+
+  bool is_array;
+  e = js_is_array(env, names, &is_array);
+  assert(e == 0);
+
+  assert(is_array);
+
+  // Only the enumerable string keys are included.
+  uint32_t len;
+  e = js_get_array_length(env, names, &len);
+  assert(e == 0);
+
+  assert(len == 2);
+
+  const char *expected[] = {"a", "b"};
+
+  for (uint32_t i = 0; i < len; i++) {
+    js_value_t *name;
+    e = js_get_element(env, names, i, &name);
+    assert(e == 0);
+
+    utf8_t value[8];
+    e = js_get_value_string_utf8(env, name, value, sizeof(value), NULL);
+    assert(e == 0);
+
+    assert(strcmp((char *) value, expected[i]) == 0);
+  }
+
+  // The names must not be written to the object itself.
+  js_value_t *element;
+  e = js_get_element(env, object, 0, &element);
+  assert(e == 0);
+
+  bool is_undefined;
+  e = js_is_undefined(env, element, &is_undefined);
+  assert(e == 0);
+
+  assert(is_undefined);
+
+  js_value_t *property;
+  e = js_get_named_property(env, object, "a", &property);
+  assert(e == 0);
+
+  int32_t value;
+  e = js_get_value_int32(env, property, &value);
+  assert(e == 0);
+
+  assert(value == 1);
+
+  e = js_close_handle_scope(env, scope);
+  assert(e == 0);
+
+  e = js_destroy_env(env);
+  assert(e == 0);
+
+  e = js_destroy_platform(platform);
+  assert(e == 0);
+
+  e = uv_run(loop, UV_RUN_DEFAULT);
+  assert(e == 0);
+}
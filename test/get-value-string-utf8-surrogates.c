@@ -0,0 +1,60 @@
+#include <assert.h>
+#include <js.h>
+#include <string.h>
+#include <uv.h>
+
+int
+main () {
+  int e;
+
+  uv_loop_t *loop = uv_default_loop();
+
+  js_platform_t *platform;
+  e = js_create_platform(loop, NULL, &platform);
+  assert(e == 0);
+
+  js_env_t *env;
+  e = js_create_env(loop, platform, NULL, &env);
+  assert(e == 0);
+
+  js_handle_scope_t *scope;
+  e = js_open_handle_scope(env, &scope);
+  assert(e == 0);
+
+  // A surrogate pair followed by a lone high and a lone low surrogate.
+  utf16_t input[] = {'a', 0xd83d, 0xde00, 0xd800, 'b', 0xdc00};
+
+  js_value_t *string;
+  e = js_create_string_utf16le(env, input, 6, &string);
+  assert(e == 0);
+
+  // The pair is combined into a single code point while the lone surrogates
+  // are encoded as if they were regular code points.
+  const utf8_t expected[] = {'a', 0xf0, 0x9f, 0x98, 0x80, 0xed, 0xa0, 0x80, 'b', 0xed, 0xb0, 0x80};
+
+  size_t len;
+  e = js_get_value_string_utf8(env, string, NULL, 0, &len);
+  assert(e == 0);
+
+  assert(len == sizeof(expected));
+
+  utf8_t value[16];
+  e = js_get_value_string_utf8(env, string, value, sizeof(value), &len);
+  assert(e == 0);
+
+  assert(len == sizeof(expected));
+  assert(memcmp(value, expected, len) == 0);
+  assert(value[len] == '\0');
+
+  e = js_close_handle_scope(env, scope);
+  assert(e == 0);
+
+  e = js_destroy_env(env);
+  assert(e == 0);
+
+  e = js_destroy_platform(platform);
+  assert(e == 0);
+
+  e = uv_run(loop, UV_RUN_DEFAULT);
+  assert(e == 0);
+}
@@ -0,0 +1,74 @@
+#include <assert.h>
+#include <js.h>
+#include <string.h>
+#include <uv.h>
+
+int
+main () {
+  int e;
+
+  uv_loop_t *loop = uv_default_loop();
+
+  js_platform_t *platform;
+  e = js_create_platform(loop, NULL, &platform);
+  assert(e == 0);
+
+  js_env_t *env;
+  e = js_create_env(loop, platform, NULL, &env);
+  assert(e == 0);
+
+  js_handle_scope_t *scope;
+  e = js_open_handle_scope(env, &scope);
+  assert(e == 0);
+
+  // "a", U+00E9, U+2192 and U+1F600, which encode as 1, 2, 3 and 4 bytes.
+  utf16_t input[] = {'a', 0xe9, 0x2192, 0xd83d, 0xde00};
+
+  js_value_t *string;
+  e = js_create_string_utf16le(env, input, 5, &string);
+  assert(e == 0);
+
+  const utf8_t expected[] = {'a', 0xc3, 0xa9, 0xe2, 0x86, 0x92, 0xf0, 0x9f, 0x98, 0x80};
+
+  // Encoding stops at the last character that fits in full, and the result
+  // is terminated if there's room left.
+  struct {
+    size_t len;
+    size_t written;
+  } cases[] = {
+    {1, 1},
+    {2, 1},
+    {3, 3},
+    {5, 3},
+    {6, 6},
+    {9, 6},
+    {10, 10},
+  };
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    utf8_t value[16];
+    memset(value, 0xff, sizeof(value));
+
+    size_t len;
+    e = js_get_value_string_utf8(env, string, value, cases[i].len, &len);
+    assert(e == 0);
+
+    assert(len == cases[i].written);
+    assert(memcmp(value, expected, len) == 0);
+
+    if (len < cases[i].len) assert(value[len] == '\0');
+    else assert(value[len] == 0xff);
+  }
+
+  e = js_close_handle_scope(env, scope);
+  assert(e == 0);
+
+  e = js_destroy_env(env);
+  assert(e == 0);
+
+  e = js_destroy_platform(platform);
+  assert(e == 0);
+
+  e = uv_run(loop, UV_RUN_DEFAULT);
+  assert(e == 0);
+}
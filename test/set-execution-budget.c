@@ -0,0 +1,85 @@
+#include <assert.h>
+#include <js.h>
+#include <qjs.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <uv.h>
+
+static int
+run (js_env_t *env, const char *source, js_value_t **result) {
+  int e;
+
+  js_value_t *script;
+  e = js_create_string_utf8(env, (utf8_t *) source, -1, &script);
+  assert(e == 0);
+
+  return js_run_script(env, NULL, 0, 0, script, result);
+}
+
+int
+main () {
+  int e;
+
+  uv_loop_t *loop = uv_default_loop();
+
+  js_platform_t *platform;
+  e = js_create_platform(loop, NULL, &platform);
+  assert(e == 0);
+
+  js_env_t *env;
+  e = js_create_env(loop, platform, NULL, &env);
+  assert(e == 0);
+
+  js_handle_scope_t *scope;
+  e = js_open_handle_scope(env, &scope);
+  assert(e == 0);
+
+  e = js_set_execution_budget(env, 1000000);
+  assert(e == 0);
+
+  js_value_t *result;
+
+  // The loop is terminated once it has used up the budget, and the
+  // termination can't be caught from within.
+  e = run(env, "try { for (;;) {} } catch {}", &result);
+  assert(e != 0);
+
+  js_value_t *error;
+  e = js_get_and_clear_last_exception(env, &error);
+  assert(e == 0);
+
+  // The budget applies afresh to the next entry, which runs normally.
+  e = run(env, "1 + 2", &result);
+  assert(e == 0);
+
+  int32_t value;
+  e = js_get_value_int32(env, result, &value);
+  assert(e == 0);
+
+  assert(value == 3);
+
+  // Every entry gets its own budget.
+  e = run(env, "for (;;) {}", &result);
+  assert(e != 0);
+
+  e = js_get_and_clear_last_exception(env, &error);
+  assert(e == 0);
+
+  e = js_set_execution_budget(env, 0);
+  assert(e == 0);
+
+  e = run(env, "let i = 0; while (i < 1e7) i++; i", &result);
+  assert(e == 0);
+
+  e = js_close_handle_scope(env, scope);
+  assert(e == 0);
+
+  e = js_destroy_env(env);
+  assert(e == 0);
+
+  e = js_destroy_platform(platform);
+  assert(e == 0);
+
+  e = uv_run(loop, UV_RUN_DEFAULT);
+  assert(e == 0);
+}
@@ -0,0 +1,72 @@
+#include <assert.h>
+#include <js.h>
+#include <qjs.h>
+#include <stdint.h>
+#include <uv.h>
+
+static int32_t
+run (js_env_t *env, const char *source) {
+  int e;
+
+  js_value_t *script;
+  e = js_create_string_utf8(env, (utf8_t *) source, -1, &script);
+  assert(e == 0);
+
+  js_value_t *result;
+  e = js_run_script(env, NULL, 0, 0, script, &result);
+  assert(e == 0);
+
+  int32_t value;
+  e = js_get_value_int32(env, result, &value);
+  assert(e == 0);
+
+  return value;
+}
+
+int
+main () {
+  int e;
+
+  uv_loop_t *loop = uv_default_loop();
+
+  js_platform_t *platform;
+  e = js_create_platform(loop, NULL, &platform);
+  assert(e == 0);
+
+  js_env_t *env;
+  e = js_create_env(loop, platform, NULL, &env);
+  assert(e == 0);
+
+  js_handle_scope_t *scope;
+  e = js_open_handle_scope(env, &scope);
+  assert(e == 0);
+
+  e = js_set_microtask_policy(env, js_microtask_policy_explicit);
+  assert(e == 0);
+
+  run(env, "globalThis.count = 0; Promise.resolve().then(() => count++); 0");
+
+  // Neither returning from the script nor turning the loop drains the queue.
+  assert(run(env, "count") == 0);
+
+  uv_run(loop, UV_RUN_NOWAIT);
+
+  assert(run(env, "count") == 0);
+
+  e = js_perform_microtask_checkpoint(env);
+  assert(e == 0);
+
+  assert(run(env, "count") == 1);
+
+  e = js_close_handle_scope(env, scope);
+  assert(e == 0);
+
+  e = js_destroy_env(env);
+  assert(e == 0);
+
+  e = js_destroy_platform(platform);
+  assert(e == 0);
+
+  e = uv_run(loop, UV_RUN_DEFAULT);
+  assert(e == 0);
+}
@@ -0,0 +1,98 @@
+#include <assert.h>
+#include <js.h>
+#include <qjs.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <uv.h>
+
+static uint64_t
+churn (uv_loop_t *loop, js_platform_t *platform) {
+  int e;
+
+  js_env_t *env;
+  e = js_create_env(loop, platform, NULL, &env);
+  assert(e == 0);
+
+  js_handle_scope_t *scope;
+  e = js_open_handle_scope(env, &scope);
+  assert(e == 0);
+
+  js_runtime_statistics_t statistics = {.version = 0};
+  e = js_get_runtime_statistics(env, &statistics);
+  assert(e == 0);
+
+  // Nothing of the previous env must be visible to the next one.
+  js_value_t *script;
+  e = js_create_string_utf8(env, (utf8_t *) "const leaked = typeof globalThis.state !== 'undefined'; globalThis.state = { list: [1, 2, 3] }; leaked", -1, &script);
+  assert(e == 0);
+
+  js_value_t *result;
+  e = js_run_script(env, NULL, 0, 0, script, &result);
+  assert(e == 0);
+
+  bool leaked;
+  e = js_get_value_bool(env, result, &leaked);
+  assert(e == 0);
+
+  assert(!leaked);
+
+  e = js_close_handle_scope(env, scope);
+  assert(e == 0);
+
+  e = js_destroy_env(env);
+  assert(e == 0);
+
+  e = uv_run(loop, UV_RUN_DEFAULT);
+  assert(e == 0);
+
+  return statistics.allocations;
+}
+
+int
+main () {
+  int e;
+
+  uv_loop_t *loop = uv_default_loop();
+
+  js_platform_t *platform;
+  e = js_create_platform(loop, NULL, &platform);
+  assert(e == 0);
+
+  // Without a pool every env starts out on a fresh heap, whose allocation
+  // count only covers the setup of the env.
+  uint64_t fresh = churn(loop, platform);
+
+  assert(churn(loop, platform) == fresh);
+
+  e = js_set_platform_runtime_pool_limit(platform, 2);
+  assert(e == 0);
+
+  // The first env destroyed once the pool is enabled hands its runtime over
+  // to the next one, whose heap then also counts the allocations of the
+  // previous env.
+  churn(loop, platform);
+
+  uint64_t previous = churn(loop, platform);
+
+  assert(previous > fresh);
+
+  for (int i = 0; i < 16; i++) {
+    uint64_t allocations = churn(loop, platform);
+
+    assert(allocations > previous);
+
+    previous = allocations;
+  }
+
+  // Disabling the pool releases the pooled runtimes.
+  e = js_set_platform_runtime_pool_limit(platform, 0);
+  assert(e == 0);
+
+  assert(churn(loop, platform) == fresh);
+
+  e = js_destroy_platform(platform);
+  assert(e == 0);
+
+  e = uv_run(loop, UV_RUN_DEFAULT);
+  assert(e == 0);
+}
@@ -0,0 +1,113 @@
+#include <assert.h>
+#include <js.h>
+#include <qjs.h>
+#include <stdint.h>
+#include <uv.h>
+
+static js_platform_t *platform;
+static js_env_t *env;
+
+static void
+compile (const char *file) {
+  int e;
+
+  js_value_t *source;
+  e = js_create_string_utf8(env, (utf8_t *) "1 + 2", -1, &source);
+  assert(e == 0);
+
+  js_script_t *script;
+  e = js_create_script(env, file, -1, 0, source, &script);
+  assert(e == 0);
+
+  e = js_delete_script(env, script);
+  assert(e == 0);
+}
+
+static js_runtime_statistics_t
+statistics (void) {
+  int e;
+
+  js_runtime_statistics_t result = {.version = 0};
+  e = js_get_runtime_statistics(env, &result);
+  assert(e == 0);
+
+  return result;
+}
+
+int
+main () {
+  int e;
+
+  uv_loop_t *loop = uv_default_loop();
+
+  e = js_create_platform(loop, NULL, &platform);
+  assert(e == 0);
+
+  e = js_create_env(loop, platform, NULL, &env);
+  assert(e == 0);
+
+  js_handle_scope_t *scope;
+  e = js_open_handle_scope(env, &scope);
+  assert(e == 0);
+
+  // The cache is disabled by default.
+  compile("a.js");
+
+  assert(statistics().script_cache_size == 0);
+
+  e = js_set_platform_script_cache_limit(platform, 1024 * 1024);
+  assert(e == 0);
+
+  compile("a.js");
+
+  // The scripts only differ by file name, so their entries are of the same
+  // size. Make room for exactly two of them.
+  size_t len = statistics().script_cache_size;
+
+  assert(len > 0);
+
+  e = js_set_platform_script_cache_limit(platform, len * 2);
+  assert(e == 0);
+
+  compile("b.js");
+
+  assert(statistics().script_cache_size == len * 2);
+
+  uint64_t hits = statistics().script_cache_hits;
+
+  // Using a.js makes b.js the least recently used entry...
+  compile("a.js");
+
+  assert(statistics().script_cache_hits == hits + 1);
+
+  // ...which is evicted to make room for c.js.
+  compile("c.js");
+
+  assert(statistics().script_cache_size == len * 2);
+
+  compile("a.js");
+
+  assert(statistics().script_cache_hits == hits + 2);
+
+  compile("b.js");
+
+  assert(statistics().script_cache_hits == hits + 2);
+
+  // Lowering the limit trims the cache right away.
+  e = js_set_platform_script_cache_limit(platform, 0);
+  assert(e == 0);
+
+  assert(statistics().script_cache_size == 0);
+
+  e = js_close_handle_scope(env, scope);
+  assert(e == 0);
+
+  e = js_destroy_env(env);
+  assert(e == 0);
+
+  e = js_destroy_platform(platform);
+  assert(e == 0);
+
+  e = uv_run(loop, UV_RUN_DEFAULT);
+  assert(e == 0);
+}